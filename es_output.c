@@ -0,0 +1,624 @@
+/*
+
+	es_output.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "es_output.h"
+
+
+
+#if defined(__linux__) && defined(SPLICE_F_NONBLOCK)
+#define HAVE_VMSPLICE
+
+// Size to grow pipes to, as each spliced slice takes up a whole pipe buffer
+#define ES_OUTPUT_PIPE_SIZE			(1024*1024)
+
+
+// Can we splice into this file descriptor?
+static int can_splice( int fd )
+{
+	struct stat st;
+	
+	if (fstat( fd, &st ) < 0 || !S_ISFIFO( st.st_mode ))
+		return 0;
+	
+	// Best effort - the default size still works, just in smaller steps
+	fcntl( fd, F_SETPIPE_SZ, ES_OUTPUT_PIPE_SIZE );
+	
+	return 1;
+}
+
+
+// Splice a run of slices into the pipe
+// returns 0 on success, -1 on failure, or 1 if splicing is not supported
+static int splice_slices( es_output_t* output, struct iovec *iov, int count )
+{
+	while (count > 0) {
+		ssize_t spliced = vmsplice( output->fd, iov, count, 0 );
+		if (spliced < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EINVAL || errno == ENOSYS || errno == EPERM) return 1;
+			return -1;
+		}
+		
+		// Skip past the slices that were spliced
+		while (count > 0 && (size_t)spliced >= iov->iov_len) {
+			spliced -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (unsigned char*)iov->iov_base + spliced;
+			iov->iov_len -= spliced;
+		}
+	}
+	
+	return 0;
+}
+#endif
+
+
+// Write a run of slices out
+// returns 0 on success or -1 on failure
+static int write_slices( es_output_t* output, struct iovec *iov, int count )
+{
+	while (count > 0) {
+		ssize_t written = writev( output->fd, iov, count );
+		if (written < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		
+		// Skip past the slices that were written
+		while (count > 0 && (size_t)written >= iov->iov_len) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (unsigned char*)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	
+	return 0;
+}
+
+
+// Send the data in a staging buffer that hasn't been written yet
+// returns 0 on success or -1 on failure
+static int submit_stage( es_output_t* output, int index )
+{
+	size_t done = output->stage_done[index];
+	long long offset = output->stage_offset[index];
+	
+	if (offset != -1) offset += done;
+	if (uring_write( output->uring, output->fd, output->stage[index] + done,
+	                 output->stage_len[index] - done, offset, index ))
+		return -1;
+	if (uring_submit( output->uring ))
+		return -1;
+	output->stage_pending[index] = 1;
+	
+	return 0;
+}
+
+
+// Wait for a write to finish, sending the rest of it after a short write
+// returns 0 on success or -1 on failure
+static int reap_stage( es_output_t* output )
+{
+	unsigned long long index;
+	int result;
+	
+	if (uring_complete( output->uring, 1, &index, &result ) < 0)
+		return -1;
+	output->stage_pending[index] = 0;
+	
+	if (result == -EINTR || result == -EAGAIN) {
+		return submit_stage( output, index );
+	} else if (result < 0) {
+		// Report it on the next flush
+		output->uring_error = -result;
+		return 0;
+	}
+	
+	output->stage_done[index] += result;
+	if (output->stage_done[index] < output->stage_len[index])
+		return submit_stage( output, index );
+	
+	return 0;
+}
+
+
+// Wait until a staging buffer is free to use again
+// returns 0 on success or -1 on failure
+static int wait_stage( es_output_t* output, int index )
+{
+	while (output->stage_pending[index]) {
+		if (reap_stage( output )) return -1;
+	}
+	
+	return 0;
+}
+
+
+// Start writing a full staging buffer
+// returns 0 on success or -1 on failure
+static int send_stage( es_output_t* output, int index )
+{
+	int i;
+
+	// Only one write can be in flight to something without offsets
+	if (output->write_offset == -1) {
+		for (i=0; i<ES_OUTPUT_URING_DEPTH; i++)
+			if (wait_stage( output, i )) return -1;
+	}
+	
+	output->stage_done[index] = 0;
+	output->stage_offset[index] = output->write_offset;
+	if (output->write_offset != -1)
+		output->write_offset += output->stage_len[index];
+	
+	output->stage_next = (index + 1) % ES_OUTPUT_URING_DEPTH;
+	return submit_stage( output, index );
+}
+
+
+// Copy the queued slices into staging buffers and start writing them
+// returns 0 on success or -1 on failure
+static int uring_slices( es_output_t* output, struct iovec *iov, int count )
+{
+	int index = output->stage_next;
+	size_t fill = 0;
+	
+	if (wait_stage( output, index )) return -1;
+	
+	while (count > 0) {
+		size_t len = iov->iov_len;
+		if (len > output->batch_size - fill)
+			len = output->batch_size - fill;
+		memcpy( output->stage[index] + fill, iov->iov_base, len );
+		fill += len;
+		
+		iov->iov_base = (unsigned char*)iov->iov_base + len;
+		iov->iov_len -= len;
+		if (iov->iov_len == 0) {
+			iov++;
+			count--;
+		}
+		
+		if (fill == output->batch_size || count == 0) {
+			output->stage_len[index] = fill;
+			if (send_stage( output, index )) return -1;
+			index = output->stage_next;
+			fill = 0;
+			if (count > 0 && wait_stage( output, index )) return -1;
+		}
+	}
+	
+	return 0;
+}
+
+
+// Switch to using io_uring to write the output
+// returns 1 on success, or 0 if it is not available
+static int start_uring( es_output_t* output )
+{
+	struct stat st;
+	int i;
+	
+	output->uring = uring_open( ES_OUTPUT_URING_DEPTH*2 );
+	if (output->uring == NULL) return 0;
+	
+	for (i=0; i<ES_OUTPUT_URING_DEPTH; i++) {
+		output->stage[i] = malloc( output->batch_size );
+		if (output->stage[i] == NULL) goto fail;
+	}
+	
+	// Carry on from wherever the file is now, in case it was opened by the shell
+	output->write_offset = -1;
+	if (fstat( output->fd, &st ) == 0 && S_ISREG( st.st_mode ) &&
+	    !(fcntl( output->fd, F_GETFL ) & O_APPEND))
+		output->write_offset = lseek( output->fd, 0, SEEK_CUR );
+	
+	return 1;
+
+fail:
+	for (i=0; i<ES_OUTPUT_URING_DEPTH; i++) {
+		free( output->stage[i] );
+		output->stage[i] = NULL;
+	}
+	uring_close( output->uring );
+	output->uring = NULL;
+	return 0;
+}
+
+
+// Wait for all writes and release the ring
+// returns 0 on success or -1 on failure
+static int stop_uring( es_output_t* output )
+{
+	int result = 0;
+	int i;
+	
+	for (i=0; i<ES_OUTPUT_URING_DEPTH; i++) {
+		if (wait_stage( output, i )) result = -1;
+	}
+	for (i=0; i<ES_OUTPUT_URING_DEPTH; i++)
+		free( output->stage[i] );
+	uring_close( output->uring );
+	
+	// Leave the file position after the data written
+	if (output->write_offset != -1)
+		lseek( output->fd, output->write_offset, SEEK_SET );
+	
+	if (output->uring_error) {
+		errno = output->uring_error;
+		result = -1;
+	}
+	
+	return result;
+}
+
+
+// Write out the blocks passed over, until an empty one arrives
+static void* writer_thread( void* arg )
+{
+	es_output_t *output = arg;
+	es_output_block_t *block = NULL;
+	
+	while ((block = spsc_ring_pop_wait( output->full ))->len) {
+		struct iovec iov;
+		
+		iov.iov_base = block->buf;
+		iov.iov_len = block->len;
+		if (!output->thread_error && write_slices( output, &iov, 1 ))
+			__atomic_store_n( &output->thread_error, errno, __ATOMIC_RELEASE );
+		
+		spsc_ring_push( output->empty, block );
+	}
+	
+	return NULL;
+}
+
+
+// Copy the queued slices into blocks for the writer thread
+static void thread_slices( es_output_t* output, struct iovec *iov, int count )
+{
+	es_output_block_t *block = NULL;
+	
+	while (count > 0) {
+		size_t len = iov->iov_len;
+		
+		if (block == NULL) {
+			block = spsc_ring_pop_wait( output->empty );
+			block->len = 0;
+		}
+		
+		if (len > output->batch_size - block->len)
+			len = output->batch_size - block->len;
+		memcpy( block->buf + block->len, iov->iov_base, len );
+		block->len += len;
+		
+		iov->iov_base = (unsigned char*)iov->iov_base + len;
+		iov->iov_len -= len;
+		if (iov->iov_len == 0) {
+			iov++;
+			count--;
+		}
+		
+		if (block->len == output->batch_size || count == 0) {
+			spsc_ring_push_wait( output->full, block );
+			block = NULL;
+		}
+	}
+}
+
+
+// Start a thread to do the writing
+// returns 1 on success, or 0 if it could not be started
+static int start_thread( es_output_t* output )
+{
+	sigset_t all, old;
+	int i;
+	
+	output->full = spsc_ring_new( ES_OUTPUT_THREAD_DEPTH );
+	output->empty = spsc_ring_new( ES_OUTPUT_THREAD_DEPTH );
+	if (output->full == NULL || output->empty == NULL) goto fail;
+	
+	for (i=0; i<ES_OUTPUT_THREAD_DEPTH; i++) {
+		output->blocks[i].buf = malloc( output->batch_size );
+		if (output->blocks[i].buf == NULL) goto fail;
+		spsc_ring_push( output->empty, &output->blocks[i] );
+	}
+	
+	// Signals are left for the main thread to handle
+	sigfillset( &all );
+	pthread_sigmask( SIG_SETMASK, &all, &old );
+	i = pthread_create( &output->writer, NULL, writer_thread, output );
+	pthread_sigmask( SIG_SETMASK, &old, NULL );
+	if (i) goto fail;
+	
+	output->threaded = 1;
+	return 1;
+
+fail:
+	for (i=0; i<ES_OUTPUT_THREAD_DEPTH; i++) {
+		free( output->blocks[i].buf );
+		output->blocks[i].buf = NULL;
+	}
+	if (output->full) spsc_ring_free( output->full );
+	if (output->empty) spsc_ring_free( output->empty );
+	output->full = output->empty = NULL;
+	return 0;
+}
+
+
+// Wait for the writer thread to write everything and finish
+// returns 0 on success or -1 on failure
+static int stop_thread( es_output_t* output )
+{
+	es_output_block_t *block = spsc_ring_pop_wait( output->empty );
+	int i;
+	
+	block->len = 0;
+	spsc_ring_push_wait( output->full, block );
+	pthread_join( output->writer, NULL );
+	
+	for (i=0; i<ES_OUTPUT_THREAD_DEPTH; i++)
+		free( output->blocks[i].buf );
+	spsc_ring_free( output->full );
+	spsc_ring_free( output->empty );
+	
+	if (output->thread_error) {
+		errno = output->thread_error;
+		return -1;
+	}
+	
+	return 0;
+}
+
+
+// Expand %pid and %sid in the output filename template
+void es_output_expand_template( const char* tmpl, int pid, int stream_id, char* buf, size_t buf_len )
+{
+	size_t len = 0;
+	
+	while (*tmpl && len+1 < buf_len) {
+		if (strncmp( tmpl, "%pid", 4 ) == 0) {
+			len += snprintf( buf+len, buf_len-len, "%d", pid );
+			tmpl += 4;
+		} else if (strncmp( tmpl, "%sid", 4 ) == 0) {
+			len += snprintf( buf+len, buf_len-len, "%x", stream_id );
+			tmpl += 4;
+		} else if (strncmp( tmpl, "%%", 2 ) == 0) {
+			buf[len++] = '%';
+			tmpl += 2;
+		} else {
+			buf[len++] = *tmpl++;
+		}
+	}
+	
+	if (len >= buf_len) len = buf_len-1;
+	buf[len] = '\0';
+}
+
+
+es_output_t* es_output_open( const char* path, size_t batch_size, int flags )
+{
+	int fd = -1;
+
+	if (strncmp( path, "-", 1 ) == 0) {
+		// Use STDOUT
+		fd = STDOUT_FILENO;
+	} else {
+		fd = open( path, O_WRONLY|O_CREAT|O_TRUNC, 0666 );
+		if (fd < 0) return NULL;
+	}
+
+	return es_output_fdopen( fd, batch_size, flags );
+}
+
+
+es_output_t* es_output_open_at( const char* path, unsigned long long offset, size_t batch_size, int flags )
+{
+	int fd = open( path, O_WRONLY|O_CREAT, 0666 );
+	if (fd < 0) return NULL;
+	
+	if (ftruncate( fd, offset ) || lseek( fd, offset, SEEK_SET ) == (off_t)-1) {
+		int err = errno;
+		close( fd );
+		errno = err;
+		return NULL;
+	}
+
+	return es_output_fdopen( fd, batch_size, flags );
+}
+
+
+es_output_t* es_output_fdopen( int fd, size_t batch_size, int flags )
+{
+	es_output_t *output = NULL;
+
+	output = malloc( sizeof(es_output_t) );
+	if (output==NULL) {
+		if (fd != STDOUT_FILENO) close(fd);
+		return NULL;
+	}
+	bzero( output, sizeof(es_output_t) );
+	
+	output->fd = fd;
+#ifdef HAVE_VMSPLICE
+	output->splice = (flags & ES_OUTPUT_SPLICE) && can_splice( fd );
+#else
+	output->splice = 0;
+#endif
+	output->slice_count = 0;
+	output->pending = 0;
+	output->batch_size = batch_size ? batch_size : ES_OUTPUT_BATCH_SIZE;
+	output->copy_len = 0;
+	
+	// Splicing into a pipe already avoids the copy
+	if ((flags & ES_OUTPUT_THREAD) && !output->splice)
+		start_thread( output );
+	else if ((flags & ES_OUTPUT_URING) && !output->splice)
+		start_uring( output );
+
+	return output;
+}
+
+
+int es_output_write( es_output_t* output, const unsigned char* ptr, size_t len )
+{
+	struct iovec *last = NULL;
+
+	if (len == 0) return 0;
+	if (output->slice_count)
+		last = &output->slices[output->slice_count-1];
+
+	// Extend the last slice if this carries straight on from it
+	if (last && (unsigned char*)last->iov_base + last->iov_len == ptr) {
+		last->iov_len += len;
+	} else {
+		if (output->slice_count == ES_OUTPUT_MAX_SLICES) {
+			if (es_output_flush( output )) return -1;
+		}
+		output->slices[output->slice_count].iov_base = (void*)ptr;
+		output->slices[output->slice_count].iov_len = len;
+		output->slice_count++;
+	}
+	output->pending += len;
+
+	if (output->pending >= output->batch_size)
+		return es_output_flush( output );
+
+	return 0;
+}
+
+
+int es_output_write_copy( es_output_t* output, const unsigned char* ptr, size_t len )
+{
+	// Too big to copy?
+	if (len > ES_OUTPUT_COPY_SIZE) {
+		if (es_output_write( output, ptr, len )) return -1;
+		return es_output_flush( output );
+	}
+
+	if (output->copy_len + len > ES_OUTPUT_COPY_SIZE) {
+		if (es_output_flush( output )) return -1;
+	}
+	
+	memcpy( output->copy_buf + output->copy_len, ptr, len );
+	output->copy_len += len;
+	
+	return es_output_write( output, output->copy_buf + output->copy_len - len, len );
+}
+
+
+int es_output_flush( es_output_t* output )
+{
+	struct iovec *iov = output->slices;
+	int count = output->slice_count;
+
+#ifdef HAVE_VMSPLICE
+	while (output->splice && count > 0) {
+		const unsigned char *copy_end = output->copy_buf + ES_OUTPUT_COPY_SIZE;
+		int run = 0;
+		int result;
+		
+		// The copy buffer gets re-used, so its slices are written normally,
+		// in between runs of slices that are spliced
+		while (run < count && ((unsigned char*)iov[run].iov_base < output->copy_buf ||
+		                       (unsigned char*)iov[run].iov_base >= copy_end))
+			run++;
+		
+		if (run == 0) {
+			result = write_slices( output, iov, 1 );
+			run = 1;
+		} else {
+			result = splice_slices( output, iov, run );
+			if (result == 1) {
+				// Not supported here, so stop trying
+				output->splice = 0;
+				break;
+			}
+		}
+		if (result) return -1;
+		
+		iov += run;
+		count -= run;
+	}
+#endif
+
+	if (output->threaded) {
+		int error = __atomic_load_n( &output->thread_error, __ATOMIC_ACQUIRE );
+		if (error) {
+			errno = error;
+			return -1;
+		}
+		thread_slices( output, iov, count );
+	} else if (output->uring) {
+		if (output->uring_error) {
+			errno = output->uring_error;
+			return -1;
+		}
+		if (uring_slices( output, iov, count ))
+			return -1;
+	} else if (write_slices( output, iov, count )) {
+		return -1;
+	}
+
+	output->slice_count = 0;
+	output->pending = 0;
+	output->copy_len = 0;
+
+	return 0;
+}
+
+
+int es_output_close( es_output_t* output )
+{
+	int result = es_output_flush( output );
+	
+	if (output->uring && stop_uring( output ))
+		result = -1;
+	if (output->threaded && stop_thread( output ))
+		result = -1;
+	if (close( output->fd ) < 0)
+		result = -1;
+	free( output );
+	
+	return result;
+}
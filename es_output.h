@@ -0,0 +1,149 @@
+/*
+
+	es_output.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _ES_OUTPUT_H
+#define _ES_OUTPUT_H
+
+#include <stddef.h>
+#include <sys/uio.h>
+#include <pthread.h>
+
+#include "uring.h"
+#include "spsc_ring.h"
+
+
+// Default number of bytes to collect before writing them out
+#define ES_OUTPUT_BATCH_SIZE		65536
+
+// Maximum number of slices in a single writev() call
+#define ES_OUTPUT_MAX_SLICES		1024
+
+// Space for small pieces of data that have to be copied
+#define ES_OUTPUT_COPY_SIZE			4096
+
+// Number of batches that can be in flight when using io_uring
+#define ES_OUTPUT_URING_DEPTH		4
+
+// Number of batches queued for the writer thread
+#define ES_OUTPUT_THREAD_DEPTH		8
+
+// Flags for es_output_open()
+#define ES_OUTPUT_SPLICE			0x01	// vmsplice() into pipes
+#define ES_OUTPUT_URING				0x02	// Use io_uring, if available
+#define ES_OUTPUT_THREAD			0x04	// Write on a separate thread
+
+
+// A batch passed to and from the writer thread
+typedef struct es_output_block_s {
+	unsigned char* buf;
+	size_t len;										// 0 tells the thread to finish
+} es_output_block_t;
+
+
+/*
+	Coalescing Elementary Stream writer
+
+	Slices of ES data are queued by reference, without copying, and
+	written out together with writev() once batch_size bytes have
+	been queued. Queued data must stay valid until es_output_flush().
+
+	If asked for and the output is a pipe, slices are spliced into
+	it with vmsplice() instead, so that the pipe refers to the caller's pages
+	rather than a copy. Those pages must then never be changed again,
+	even after the flush.
+
+	With io_uring, a flush copies the slices into one of a few staging
+	buffers and the write carries on in the background. Writes to a
+	regular file are placed at explicit offsets; anything else only
+	has one write in flight at a time, to keep the data in order.
+
+	With a writer thread, a flush copies the slices into blocks that
+	are passed to that thread through a lock-free ring, and come back
+	through another once written.
+*/
+typedef struct es_output_s {
+
+	int fd;
+	int splice;					// Output is a pipe that we vmsplice() into
+	
+	struct iovec slices[ES_OUTPUT_MAX_SLICES];
+	int slice_count;
+	size_t pending;				// Bytes queued but not yet written
+	size_t batch_size;
+	
+	unsigned char copy_buf[ES_OUTPUT_COPY_SIZE];
+	size_t copy_len;
+	
+	uring_t* uring;
+	unsigned char* stage[ES_OUTPUT_URING_DEPTH];
+	size_t stage_len[ES_OUTPUT_URING_DEPTH];
+	size_t stage_done[ES_OUTPUT_URING_DEPTH];		// Bytes written so far
+	long long stage_offset[ES_OUTPUT_URING_DEPTH];
+	int stage_pending[ES_OUTPUT_URING_DEPTH];		// Write in flight from this buffer
+	int stage_next;
+	long long write_offset;							// Offset of the next write, or -1
+	int uring_error;								// errno of a failed write
+	
+	pthread_t writer;
+	int threaded;
+	es_output_block_t blocks[ES_OUTPUT_THREAD_DEPTH];
+	spsc_ring_t* full;								// Blocks waiting to be written
+	spsc_ring_t* empty;								// Blocks that can be filled
+	int thread_error;								// errno of a failed write
+
+} es_output_t;
+
+
+// Open a file for writing, or STDOUT if path is "-"
+// With ES_OUTPUT_SPLICE, vmsplice() will be used if the file is a pipe
+es_output_t* es_output_open( const char* path, size_t batch_size, int flags );
+
+// Open a file to carry on writing at offset, cutting off anything
+// after it
+es_output_t* es_output_open_at( const char* path, unsigned long long offset, size_t batch_size, int flags );
+
+// Expand %pid (decimal) and %sid (hexadecimal) in an output filename template
+void es_output_expand_template( const char* tmpl, int pid, int stream_id, char* buf, size_t buf_len );
+
+// Write to a file descriptor that is already open, closing it afterwards
+es_output_t* es_output_fdopen( int fd, size_t batch_size, int flags );
+
+// Queue a slice of data, which must stay valid until the next flush
+// returns 0 on success or -1 on failure
+int es_output_write( es_output_t* output, const unsigned char* ptr, size_t len );
+
+// Queue a copy of a small piece of data
+// returns 0 on success or -1 on failure
+int es_output_write_copy( es_output_t* output, const unsigned char* ptr, size_t len );
+
+// Write out everything that has been queued
+// returns 0 on success or -1 on failure
+int es_output_flush( es_output_t* output );
+
+// Flush and close
+// returns 0 on success or -1 on failure
+int es_output_close( es_output_t* output );
+
+
+
+#endif
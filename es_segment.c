@@ -0,0 +1,345 @@
+/*
+
+	es_segment.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "es_segment.h"
+
+
+// Allowance for rounding, when comparing times added up frame by frame
+#define ES_SEGMENT_EPSILON		1e-6
+
+
+
+// Expand %seq in a template, then %pid and %sid
+static void expand_path( es_segment_t* segment, unsigned long seq, char* buf, size_t buf_len )
+{
+	char tmpl[FILENAME_MAX];
+	const char *in = segment->template;
+	size_t len = 0, seq_len = strlen( ES_SEGMENT_SEQ );
+
+	while (*in && len+1 < sizeof(tmpl)) {
+		if (strncmp( in, ES_SEGMENT_SEQ, seq_len ) == 0) {
+			len += snprintf( tmpl+len, sizeof(tmpl)-len, "%0*lu", ES_SEGMENT_SEQ_DIGITS, seq );
+			in += seq_len;
+		} else if (strncmp( in, "%%", 2 ) == 0) {
+			// Left for es_output_expand_template()
+			tmpl[len++] = *in++;
+			if (len+1 < sizeof(tmpl)) tmpl[len++] = *in++;
+		} else {
+			tmpl[len++] = *in++;
+		}
+	}
+	if (len >= sizeof(tmpl)) len = sizeof(tmpl)-1;
+	tmpl[len] = '\0';
+
+	es_output_expand_template( tmpl, segment->pid, segment->stream_id, buf, buf_len );
+}
+
+
+// Open the file for a segment
+// returns 0 on success or -1 on failure
+static int open_segment( es_segment_t* segment, unsigned long seq, es_output_t** output, char** path )
+{
+	char filename[FILENAME_MAX];
+
+	expand_path( segment, seq, filename, sizeof(filename) );
+	*path = strdup( filename );
+	if (*path==NULL) return -1;
+
+	*output = es_output_open( filename, segment->batch_size, segment->flags );
+	if (*output==NULL) {
+		free( *path );
+		*path = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+// Name of a segment as it is listed in the playlist
+static const char* segment_uri( es_segment_t* segment, const char* path )
+{
+	const char *slash = strrchr( segment->playlist_path, '/' );
+	size_t dir_len = slash ? slash - segment->playlist_path + 1 : 0;
+
+	if (strncmp( path, segment->playlist_path, dir_len ) == 0 &&
+	    strchr( path + dir_len, '/' ) == NULL)
+		return path + dir_len;
+
+	return path;
+}
+
+
+// Write the playlist to one side and rename it into place, so that
+// anything reading it never sees half of it
+// returns 0 on success or -1 on failure
+static int write_playlist( es_segment_t* segment, int ended )
+{
+	char tmp_path[FILENAME_MAX];
+	unsigned long first = 0, i;
+	FILE *file = NULL;
+	int target, err;
+
+	if (segment->window && segment->entry_count > segment->window)
+		first = segment->entry_count - segment->window;
+
+	// Every segment, rounded to the nearest second, must fit in this
+	target = (int)(segment->target_duration + 0.5);
+
+	snprintf( tmp_path, sizeof(tmp_path), "%s.tmp", segment->playlist_path );
+	file = fopen( tmp_path, "w" );
+	if (file==NULL) return -1;
+
+	fprintf( file, "#EXTM3U\n" );
+	fprintf( file, "#EXT-X-VERSION:3\n" );
+	fprintf( file, "#EXT-X-TARGETDURATION:%d\n", target );
+	fprintf( file, "#EXT-X-MEDIA-SEQUENCE:%lu\n", first );
+	for (i=first; i<segment->entry_count; i++) {
+		es_segment_entry_t *entry = &segment->entries[ segment->window ? i % segment->window : i ];
+		fprintf( file, "#EXTINF:%.3f,\n%s\n", entry->duration, entry->uri );
+	}
+	if (ended) fprintf( file, "#EXT-X-ENDLIST\n" );
+
+	if (ferror( file ) | fclose( file ) || rename( tmp_path, segment->playlist_path )) {
+		err = errno;
+		unlink( tmp_path );
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+// Add the segment that has just been finished to the playlist
+// returns 0 on success or -1 on failure
+static int list_segment( es_segment_t* segment, int ended )
+{
+	es_segment_entry_t *entry = NULL;
+
+	if (segment->playlist_path==NULL) return 0;
+
+	// Make room for it
+	if (segment->window) {
+		entry = &segment->entries[ segment->entry_count % segment->window ];
+		free( entry->uri );
+	} else {
+		if (segment->entry_count == segment->entries_size) {
+			unsigned long size = segment->entries_size ? segment->entries_size*2 : 64;
+			es_segment_entry_t *entries = realloc( segment->entries, size * sizeof(es_segment_entry_t) );
+			if (entries==NULL) return -1;
+			segment->entries = entries;
+			segment->entries_size = size;
+		}
+		entry = &segment->entries[ segment->entry_count ];
+	}
+
+	entry->uri = strdup( segment_uri( segment, segment->path ) );
+	if (entry->uri==NULL) return -1;
+	entry->duration = segment->seconds;
+	segment->entry_count++;
+
+	if (segment->seconds > segment->target_duration)
+		segment->target_duration = segment->seconds;
+
+	return write_playlist( segment, ended );
+}
+
+
+// Finish the current segment and carry on in the next one, which is
+// already open, then open the one after that
+// returns 0 on success or -1 on failure
+static int next_segment( es_segment_t* segment )
+{
+	if (es_output_close( segment->output )) {
+		segment->output = NULL;
+		return -1;
+	}
+	segment->output = NULL;
+	if (list_segment( segment, 0 )) return -1;
+
+	segment->elapsed += segment->seconds;
+	segment->seconds = 0;
+	segment->bytes = 0;
+	segment->frames = 0;
+	segment->seq++;
+
+	free( segment->path );
+	segment->output = segment->next;
+	segment->path = segment->next_path;
+	segment->next = NULL;
+	segment->next_path = NULL;
+
+	return open_segment( segment, segment->seq + 1, &segment->next, &segment->next_path );
+}
+
+
+es_segment_t* es_segment_open( const char* tmpl, int pid, int stream_id,
+                               double duration, unsigned long long max_bytes,
+                               const char* playlist, unsigned long window,
+                               size_t batch_size, int flags )
+{
+	es_segment_t *segment = NULL;
+	char playlist_path[FILENAME_MAX];
+
+	// Every segment needs a name of its own
+	if (strstr( tmpl, ES_SEGMENT_SEQ ) == NULL) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	segment = calloc( 1, sizeof(es_segment_t) );
+	if (segment==NULL) return NULL;
+
+	segment->template = strdup( tmpl );
+	if (segment->template==NULL) goto fail;
+	segment->pid = pid;
+	segment->stream_id = stream_id;
+	segment->batch_size = batch_size;
+	segment->flags = flags;
+	segment->duration = duration;
+	segment->max_bytes = max_bytes;
+	segment->next_cut = duration;
+
+	if (playlist) {
+		es_output_expand_template( playlist, pid, stream_id, playlist_path, sizeof(playlist_path) );
+		segment->playlist_path = strdup( playlist_path );
+		if (segment->playlist_path==NULL) goto fail;
+
+		segment->window = window;
+		segment->entries_size = window;
+		if (window) {
+			segment->entries = calloc( window, sizeof(es_segment_entry_t) );
+			if (segment->entries==NULL) goto fail;
+		}
+	}
+
+	if (open_segment( segment, 0, &segment->output, &segment->path ) ||
+	    open_segment( segment, 1, &segment->next, &segment->next_path ))
+		goto fail;
+
+	return segment;
+
+fail:
+	{
+		int err = errno;
+		if (segment->output) {
+			es_output_close( segment->output );
+			unlink( segment->path );
+		}
+		free( segment->path );
+		free( segment->entries );
+		free( segment->playlist_path );
+		free( segment->template );
+		free( segment );
+		errno = err;
+	}
+	return NULL;
+}
+
+
+int es_segment_frame( es_segment_t* segment, size_t len, unsigned int samples, unsigned int samplerate )
+{
+	double now = segment->elapsed + segment->seconds;
+	int cut = 0;
+
+	// Never leave a segment empty
+	if (segment->frames) {
+		if (segment->duration && now + ES_SEGMENT_EPSILON >= segment->next_cut) {
+			cut = 1;
+			while (segment->next_cut <= now + ES_SEGMENT_EPSILON)
+				segment->next_cut += segment->duration;
+		}
+		if (segment->max_bytes && segment->bytes + len > segment->max_bytes)
+			cut = 1;
+	}
+	if (cut && next_segment( segment )) return -1;
+
+	segment->frames++;
+	segment->bytes += len;
+	if (samplerate) segment->seconds += (double)samples / samplerate;
+
+	return 0;
+}
+
+
+int es_segment_write( es_segment_t* segment, const unsigned char* ptr, size_t len )
+{
+	return es_output_write( segment->output, ptr, len );
+}
+
+
+int es_segment_write_copy( es_segment_t* segment, const unsigned char* ptr, size_t len )
+{
+	return es_output_write_copy( segment->output, ptr, len );
+}
+
+
+int es_segment_flush( es_segment_t* segment )
+{
+	return es_output_flush( segment->output );
+}
+
+
+int es_segment_close( es_segment_t* segment )
+{
+	unsigned long i;
+	int result = 0;
+
+	// The last segment is only kept if anything went in it
+	if (segment->output) {
+		if (es_output_close( segment->output )) result = -1;
+		if (segment->frames == 0) {
+			unlink( segment->path );
+		} else if (result == 0 && list_segment( segment, 1 )) {
+			result = -1;
+		}
+	}
+	if (segment->next) {
+		es_output_close( segment->next );
+		unlink( segment->next_path );
+	}
+
+	// A stream with nothing in it still gets a playlist, listing nothing
+	if (result == 0 && segment->playlist_path && segment->frames == 0 &&
+	    write_playlist( segment, 1 ))
+		result = -1;
+
+	for (i=0; i<segment->entry_count && i<segment->entries_size; i++)
+		free( segment->entries[i].uri );
+	free( segment->entries );
+	free( segment->path );
+	free( segment->next_path );
+	free( segment->playlist_path );
+	free( segment->template );
+	free( segment );
+
+	return result;
+}
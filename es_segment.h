@@ -0,0 +1,130 @@
+/*
+
+	es_segment.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _ES_SEGMENT_H
+#define _ES_SEGMENT_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "es_output.h"
+
+
+// Replaced with the segment number in the output filename template
+#define ES_SEGMENT_SEQ			"%seq"
+
+// Digits that segment numbers are padded to, so the files sort in order
+#define ES_SEGMENT_SEQ_DIGITS	6
+
+
+// A finished segment, as listed in the playlist
+typedef struct es_segment_entry_s {
+	char* uri;					// Relative to the playlist, if it is in the same directory
+	double duration;			// Seconds
+} es_segment_entry_t;
+
+
+/*
+	Segmented Elementary Stream output
+
+	A stream is written to a series of files, named from a template
+	containing %seq. A new file is started before the frame that would
+	take the current one past its duration or size, so every file is
+	whole frames. Durations are counted in audio samples, and each cut
+	is made at the first frame boundary after a multiple of the duration
+	from the start, so the cuts don't drift however long it runs.
+
+	The next file is always opened in advance, so a cut only has to
+	close the finished file and carry on in the open one.
+
+	An M3U8 playlist of the finished segments can be kept up to date,
+	replaced atomically after each one. With a window, it lists just
+	the most recent segments, as a live playlist.
+*/
+typedef struct es_segment_s {
+
+	char* template;				// Filename template
+	int pid;					// Filled in for %pid and %sid
+	int stream_id;
+	char* playlist_path;		// Or NULL
+	size_t batch_size;
+	int flags;					// ES_OUTPUT_* flags for each file
+
+	double duration;			// Seconds per segment, or 0
+	unsigned long long max_bytes;	// Largest segment, or 0
+	double next_cut;			// Time of the next cut for the duration
+
+	es_output_t* output;		// Segment being written
+	char* path;
+	es_output_t* next;			// Opened in advance, for the segment after
+	char* next_path;
+	unsigned long seq;			// Number of the segment being written
+
+	unsigned long long bytes;	// Written to this segment
+	unsigned long frames;		// Frames in this segment
+	double seconds;				// Of audio in this segment
+	double elapsed;				// Of audio in the segments before it
+
+	es_segment_entry_t* entries;	// Ring of finished segments for the playlist
+	unsigned long entry_count;		// Finished segments, since the start
+	unsigned long window;			// Size of the ring, or 0 to list them all
+	unsigned long entries_size;		// Space allocated in the ring
+	double target_duration;			// Longest segment listed so far
+
+} es_segment_t;
+
+
+// Start writing segments, from a template containing %seq and
+// optionally %pid and %sid, which the playlist path can contain too.
+// A duration or max_bytes of 0 means not to split on that.
+// returns NULL on failure, with errno set
+es_segment_t* es_segment_open( const char* tmpl, int pid, int stream_id,
+                               double duration, unsigned long long max_bytes,
+                               const char* playlist, unsigned long window,
+                               size_t batch_size, int flags );
+
+// A frame of len bytes, and samples long at samplerate, is about to be
+// written: start a new segment first, if this one is long enough
+// returns 0 on success or -1 on failure
+int es_segment_frame( es_segment_t* segment, size_t len, unsigned int samples, unsigned int samplerate );
+
+// Queue data for the current segment, as es_output_write()
+// returns 0 on success or -1 on failure
+int es_segment_write( es_segment_t* segment, const unsigned char* ptr, size_t len );
+
+// Queue a copy of some data for the current segment, as es_output_write_copy()
+// returns 0 on success or -1 on failure
+int es_segment_write_copy( es_segment_t* segment, const unsigned char* ptr, size_t len );
+
+// Write out everything queued for the current segment
+// returns 0 on success or -1 on failure
+int es_segment_flush( es_segment_t* segment );
+
+// Finish the last segment, and the playlist; the file opened in
+// advance is removed
+// returns 0 on success or -1 on failure
+int es_segment_close( es_segment_t* segment );
+
+
+
+#endif
@@ -0,0 +1,1640 @@
+/* 
+
+	libts2mpa.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+	
+	Copyright notice:
+	
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+	
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+	
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+    
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include "ts2mpa.h"
+#include "mpa_header.h"
+
+
+
+// Read a cheap clock for timing each stage
+static inline unsigned long long cycles()
+{
+#ifdef HAVE_RDTSC
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+
+
+// Pass a message to the application, if it wants them
+static void message( ts2mpa_t *ts2mpa, int level, const char *fmt, ... )
+{
+	char text[256];
+	va_list args;
+
+	if (ts2mpa->message==NULL) return;
+
+	va_start( args, fmt );
+	vsnprintf( text, sizeof(text), fmt, args );
+	va_end( args );
+
+	ts2mpa->message( ts2mpa, level, text );
+}
+
+
+// Stop everything, because of a failure
+static void fail( ts2mpa_t *ts2mpa, int err )
+{
+	if (ts2mpa->error == 0)
+		ts2mpa->error = err ? err : EIO;
+}
+
+
+// Check to see if a PES header looks like a valid MPEG Audio one
+static int validate_pes_header( ts2mpa_t *ts2mpa, int pid, const unsigned char* buf_ptr, int buf_len )
+{
+	unsigned char stream_id = 0x00;
+
+	// Enough of it in this packet for the fixed part of the header?
+	if (buf_len < 9) {
+		message( ts2mpa, TS2MPA_INFO, "PES header cut short (pid: %d).", pid);
+		return 0;
+	}
+
+	// Does it have the right magic?
+	if( PES_PACKET_SYNC_BYTE1(buf_ptr) != 0x00 ||
+	    PES_PACKET_SYNC_BYTE2(buf_ptr) != 0x00 ||
+	    PES_PACKET_SYNC_BYTE3(buf_ptr) != 0x01 )
+	{
+		message( ts2mpa, TS2MPA_INFO, "Invalid PES header (pid: %d).", pid);
+		return 0;
+	}
+	
+	// Is it MPEG Audio?
+	stream_id = PES_PACKET_STREAM_ID(buf_ptr);
+	if (stream_id < 0xC0 || stream_id > 0xDF) {
+		message( ts2mpa, TS2MPA_INFO, "Ignoring non-mpegaudio stream (pid: %d, stream id: 0x%x).", pid, stream_id);
+		return 0;
+	}
+
+	// Check PES Extension header 
+	if( PES_PACKET_SYNC_CODE(buf_ptr) != 0x2 )
+	{
+		message( ts2mpa, TS2MPA_INFO, "Invalid sync code PES extension header (pid: %d, stream id: 0x%x).", pid, stream_id);
+		return 0;
+	}
+
+	// Reject scrambled packets
+	if( PES_PACKET_SCRAMBLED(buf_ptr) )
+	{
+		message( ts2mpa, TS2MPA_INFO, "PES payload is scrambled (pid: %d, stream id: 0x%x).", pid, stream_id);
+		return 0;
+	}
+
+	// The rest of the header has to be in this packet, and in the PES packet
+	if( 9+PES_PACKET_HEAD_LEN(buf_ptr) > buf_len ||
+	    (PES_PACKET_LEN(buf_ptr) && PES_PACKET_LEN(buf_ptr) < 3+PES_PACKET_HEAD_LEN(buf_ptr)) )
+	{
+		message( ts2mpa, TS2MPA_INFO, "Invalid PES header length (pid: %d, stream id: 0x%x).", pid, stream_id);
+		return 0;
+	}
+
+	// It is valid
+	return 1;
+}
+
+
+// Start extracting from a Transport Stream PID
+static ts2mpa_pid_t* add_pid( ts2mpa_t *ts2mpa, int pid )
+{
+	ts2mpa_pid_t *ts_pid = malloc( sizeof(ts2mpa_pid_t) );
+	if (ts_pid==NULL) {
+		message( ts2mpa, TS2MPA_ERROR, "Failed to allocate memory for ts2mpa_pid_t" );
+		fail( ts2mpa, ENOMEM );
+		return NULL;
+	}
+	bzero( ts_pid, sizeof(ts2mpa_pid_t) );
+	
+	ts_pid->pid = pid;
+	ts_pid->continuity_count = -1;
+	ts_pid->streams = NULL;
+	ts_pid->current = NULL;
+
+	ts2mpa->pids[pid] = ts_pid;
+
+	return ts_pid;
+}
+
+
+// Should packets on a PID be looked at, going by what we know so far?
+static int pid_wanted( ts2mpa_t *ts2mpa, int pid )
+{
+	if (ts2mpa->pid != -1) return (pid == ts2mpa->pid);
+	
+	// Only the PID of the first stream, once it has been found, and
+	// the program map, in case the audio moves to another PID
+	if (!ts2mpa->demux_all && ts2mpa->stream_list)
+		return (pid == ts2mpa->stream_list->pid || ts2mpa->pid_types[pid] == TS2MPA_PID_PSI);
+	if (ts2mpa->pids[pid]) return 1;
+	
+	switch (ts2mpa->pid_types[pid]) {
+		case TS2MPA_PID_PSI:
+		case TS2MPA_PID_AUDIO:
+			return 1;
+		case TS2MPA_PID_OTHER:
+			return 0;
+		default:
+			// Everything gets probed until there is a program map
+			return (ts2mpa->pat_version == -1 && pid != 0x1FFF);
+	}
+}
+
+
+static void update_pid_map( ts2mpa_t *ts2mpa, int pid )
+{
+	if (pid_wanted( ts2mpa, pid )) {
+		if (!TS_PID_MAP_TEST( ts2mpa->pid_map, pid )) ts2mpa->pid_map_grown = 1;
+		TS_PID_MAP_SET( ts2mpa->pid_map, pid );
+	} else
+		TS_PID_MAP_CLEAR( ts2mpa->pid_map, pid );
+}
+
+
+static void update_pid_maps( ts2mpa_t *ts2mpa )
+{
+	int pid;
+	
+	for (pid=0; pid<TS_PID_COUNT; pid++)
+		update_pid_map( ts2mpa, pid );
+}
+
+
+// Start extracting a new elementary stream
+static ts2mpa_stream_t* add_stream( ts2mpa_t *ts2mpa, ts2mpa_pid_t *ts_pid, int stream_id )
+{
+	ts2mpa_stream_t *stream = malloc( sizeof(ts2mpa_stream_t) );
+	if (stream==NULL) {
+		message( ts2mpa, TS2MPA_ERROR, "Failed to allocate memory for ts2mpa_stream_t" );
+		fail( ts2mpa, ENOMEM );
+		return NULL;
+	}
+	bzero( stream, sizeof(ts2mpa_stream_t) );
+	
+	stream->user = NULL;
+	stream->pid = ts_pid->pid;
+	stream->pes_stream_id = stream_id;
+	stream->synced = 0;
+	stream->never_synced = 1;
+	stream->pes_remaining = 0;
+	stream->total_bytes = 0;
+	stream->pts = -1;
+	
+	// Give the application a chance to set up its output
+	if (ts2mpa->new_stream && ts2mpa->new_stream( ts2mpa, stream )) {
+		fail( ts2mpa, errno );
+		free( stream );
+		return NULL;
+	}
+	
+	// Add to the end of the list for this PID
+	if (ts_pid->streams) {
+		ts2mpa_stream_t *last = ts_pid->streams;
+		while (last->next) last = last->next;
+		last->next = stream;
+	} else {
+		ts_pid->streams = stream;
+	}
+	ts2mpa->stream_count++;
+	
+	stream->list_next = ts2mpa->stream_list;
+	ts2mpa->stream_list = stream;
+	
+	// Only want packets from this PID, and the program map, from now on
+	if (!ts2mpa->demux_all) update_pid_maps( ts2mpa );
+	
+	return stream;
+}
+
+
+// Find the stream for a PES stream ID on a PID, adding it if we want it
+static ts2mpa_stream_t* find_stream( ts2mpa_t *ts2mpa, ts2mpa_pid_t *ts_pid, int stream_id, unsigned int pes_total_len )
+{
+	ts2mpa_stream_t *stream = NULL;
+	
+	for (stream = ts_pid->streams; stream; stream = stream->next) {
+		if (stream->pes_stream_id == stream_id) return stream;
+		
+		// Moved here from another PID, and yet to see which stream it is
+		if (stream->pes_stream_id == -1 &&
+		    (ts2mpa->pes_stream_id == -1 || ts2mpa->pes_stream_id == stream_id)) {
+			stream->pes_stream_id = stream_id;
+			return stream;
+		}
+	}
+	
+	// Is it one we have been asked for?
+	if ((ts2mpa->pes_stream_id == -1 || ts2mpa->pes_stream_id == stream_id) &&
+	    (ts2mpa->demux_all || ts2mpa->stream_count == 0))
+	{
+		message( ts2mpa, TS2MPA_INFO, "Found valid PES audio packet (offset: 0x%llx, pid: %d, stream id: 0x%x, length: %u)",
+		         ts2mpa->packet_offset, ts_pid->pid, stream_id, pes_total_len);
+		return add_stream( ts2mpa, ts_pid, stream_id );
+	}
+	
+	message( ts2mpa, TS2MPA_INFO, "Ignoring additional audio stream ID 0x%x (pid: %d).",
+	         stream_id, ts_pid->pid);
+	return NULL;
+}
+
+
+// Count Elementary Stream data as passed on
+static void count_es( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, size_t es_len )
+{
+	ts2mpa_pid_t *ts_pid = ts2mpa->pids[stream->pid];
+	
+	stream->total_bytes += es_len;
+	ts2mpa->total_bytes += es_len;
+	ts_pid->counters.bytes += es_len;
+	ts2mpa->counters.bytes += es_len;
+}
+
+
+// Pass Elementary Stream data for a stream to the application
+static void write_es( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, const unsigned char *es_ptr, size_t es_len )
+{
+	unsigned long long start = cycles();
+	
+	if (ts2mpa->es_data( ts2mpa, stream, es_ptr, es_len )) {
+		fail( ts2mpa, errno );
+		return;
+	}
+	ts2mpa->output_cycles += cycles() - start;
+	
+	count_es( ts2mpa, stream, es_len );
+}
+
+
+// Copy the held slices of the frame in progress, before the
+// memory that they point into goes away
+static void copy_held( ts2mpa_stream_t *stream )
+{
+	int i;
+	
+	for (i=0; i<stream->held_count; i++) {
+		memcpy( stream->frame_buf + stream->frame_copied, stream->held[i].ptr, stream->held[i].len );
+		stream->frame_copied += stream->held[i].len;
+	}
+	stream->held_count = 0;
+}
+
+
+// Hold on to part of the frame in progress: by reference if it is in
+// the buffer being fed in, otherwise by copying it. Without an es_data
+// callback, only its length is kept.
+static void hold_frame( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, const unsigned char *ptr, size_t len, int transient )
+{
+	if (len == 0) return;
+	
+	if (ts2mpa->es_data == NULL) {
+		// Nowhere for it to go
+	} else if (transient || stream->held_count == TS2MPA_HELD_SLICES ||
+	    (ptr >= ts2mpa->pending && ptr < ts2mpa->pending + sizeof(ts2mpa->pending)))
+	{
+		copy_held( stream );
+		memcpy( stream->frame_buf + stream->frame_copied, ptr, len );
+		stream->frame_copied += len;
+	} else if (stream->held_count &&
+	           stream->held[stream->held_count-1].ptr + stream->held[stream->held_count-1].len == ptr) {
+		// Carries straight on from the last slice
+		stream->held[stream->held_count-1].len += len;
+	} else {
+		stream->held[stream->held_count].ptr = ptr;
+		stream->held[stream->held_count].len = len;
+		stream->held_count++;
+	}
+	stream->frame_len += len;
+}
+
+
+// Throw away the frame in progress
+static void drop_frame( ts2mpa_stream_t *stream )
+{
+	stream->confirming = 0;
+	stream->frame_left = 0;
+	stream->frame_header_len = 0;
+	stream->frame_len = 0;
+	stream->frame_copied = 0;
+	stream->held_count = 0;
+}
+
+
+// Pass the first len bytes held to the application
+static void pass_held( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, size_t len )
+{
+	size_t take;
+	int i, kept = 0;
+	
+	take = len < stream->frame_copied ? len : stream->frame_copied;
+	if (take)
+		write_es( ts2mpa, stream, stream->frame_buf, take );
+	memmove( stream->frame_buf, stream->frame_buf + take, stream->frame_copied - take );
+	stream->frame_copied -= take;
+	len -= take;
+	
+	// Keep whatever comes after them
+	for (i=0; i<stream->held_count && !ts2mpa->error; i++) {
+		take = len < stream->held[i].len ? len : stream->held[i].len;
+		if (take)
+			write_es( ts2mpa, stream, stream->held[i].ptr, take );
+		len -= take;
+		if (take < stream->held[i].len) {
+			stream->held[kept].ptr = stream->held[i].ptr + take;
+			stream->held[kept].len = stream->held[i].len - take;
+			kept++;
+		}
+	}
+	stream->held_count = kept;
+}
+
+
+// Pass on a whole frame, from the first len bytes held
+static void write_frame( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, size_t len )
+{
+	ts2mpa_pid_t *ts_pid = ts2mpa->pids[stream->pid];
+	
+	if (ts2mpa->frame_start && ts2mpa->frame_start( ts2mpa, stream, len )) {
+		fail( ts2mpa, errno );
+		return;
+	}
+	
+	// Without anywhere to pass it to, nothing was held
+	if (ts2mpa->es_data) pass_held( ts2mpa, stream, len );
+	else count_es( ts2mpa, stream, len );
+	stream->frame_len -= len;
+	
+	ts_pid->counters.frames++;
+	ts2mpa->counters.frames++;
+}
+
+
+// A valid MPEG Audio header has been found, that output starts with.
+// One found by hunting could be a false one, so its frame is only
+// passed on once the header after it has been checked too.
+static void gain_sync( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, const unsigned char *header, int confirm )
+{
+	ts2mpa_pid_t *ts_pid = ts2mpa->pids[stream->pid];
+	
+	mpa_header_parse( header, &stream->mpah );
+	stream->format = MPA_HEADER_FORMAT( header );
+	
+	// Looks good, we have gained sync.
+	if (ts2mpa->frame_header)
+		ts2mpa->frame_header( ts2mpa, stream, &stream->mpah );
+
+	drop_frame( stream );
+	stream->synced = 1;
+	stream->never_synced = 0;
+	stream->confirming = confirm;
+	stream->predicted = 0;
+	stream->carry_len = 0;
+	
+	ts_pid->counters.sync_gains++;
+	ts2mpa->counters.sync_gains++;
+}
+
+
+// Could a frame of the stream start with this header?
+static int frame_follows( ts2mpa_stream_t *stream, const unsigned char *header )
+{
+	unsigned int framesize = mpa_header_framesize( header );
+	
+	return framesize && framesize <= TS2MPA_MAX_FRAME &&
+	       MPA_HEADER_FORMAT( header ) == stream->format;
+}
+
+
+// There wasn't a header where the next frame should have started
+static void lose_frame_sync( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream )
+{
+	ts2mpa_pid_t *ts_pid = ts2mpa->pids[stream->pid];
+	size_t len = sizeof(stream->frame_header);
+	
+	// Sync found by hunting wasn't real after all
+	if (!stream->confirming) {
+		message( ts2mpa, TS2MPA_WARNING, "Warning, lost MPEG audio frame sync at 0x%llx (pid: %d).",
+		         ts2mpa->packet_offset, stream->pid );
+	}
+	if (ts2mpa->sync_lost)
+		ts2mpa->sync_lost( ts2mpa, stream, stream->confirming );
+	ts_pid->counters.sync_losses++;
+	ts2mpa->counters.sync_losses++;
+	stream->synced = 0;
+	
+	// Hunt from where the header should have been, which could be a
+	// stream that has changed format
+	memcpy( stream->carry, stream->frame_header, len );
+	stream->carry_len = len;
+	ts_pid->counters.hunt_skipped += stream->frame_len;
+	ts2mpa->counters.hunt_skipped += stream->frame_len;
+	drop_frame( stream );
+}
+
+
+// Add ES data to the frame in progress on a synced stream,
+// passing each frame on once it is whole
+// returns the number of bytes used, which is less than es_len if sync was lost
+static size_t add_frame_data( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream,
+                              const unsigned char *es_ptr, size_t es_len, int transient )
+{
+	size_t used = 0, len;
+	
+	while (used < es_len && !ts2mpa->error) {
+		
+		if (stream->frame_left == 0) {
+			// Enough of the header to know how long the frame is
+			len = sizeof(stream->frame_header) - stream->frame_header_len;
+			if (len > es_len - used) len = es_len - used;
+			memcpy( stream->frame_header + stream->frame_header_len, es_ptr + used, len );
+			hold_frame( ts2mpa, stream, es_ptr + used, len, transient );
+			stream->frame_header_len += len;
+			used += len;
+			if (stream->frame_header_len < sizeof(stream->frame_header)) break;
+			
+			if (!frame_follows( stream, stream->frame_header )) {
+				lose_frame_sync( ts2mpa, stream );
+				break;
+			}
+			
+			// The frame before this header was real
+			if (stream->confirming && stream->frame_len > sizeof(stream->frame_header)) {
+				write_frame( ts2mpa, stream, stream->frame_len - sizeof(stream->frame_header) );
+				stream->confirming = 0;
+			}
+			stream->frame_header_len = 0;
+			stream->frame_left = mpa_header_framesize( stream->frame_header ) - sizeof(stream->frame_header);
+		}
+		
+		len = stream->frame_left < es_len - used ? stream->frame_left : es_len - used;
+		hold_frame( ts2mpa, stream, es_ptr + used, len, transient );
+		stream->frame_left -= len;
+		used += len;
+		
+		if (stream->frame_left == 0 && !stream->confirming)
+			write_frame( ts2mpa, stream, stream->frame_len );
+	}
+	
+	return used;
+}
+
+
+// Keep the bytes at the end of the ES data that could be the
+// start of a header split across two packets
+static void carry_es( ts2mpa_stream_t *stream, const unsigned char *es_ptr, size_t es_len )
+{
+	size_t keep = sizeof(stream->carry);
+	
+	if (es_len >= keep) {
+		memcpy( stream->carry, es_ptr+es_len-keep, keep );
+		stream->carry_len = keep;
+	} else {
+		size_t old = stream->carry_len + es_len > keep ? keep - es_len : stream->carry_len;
+		memmove( stream->carry, stream->carry+stream->carry_len-old, old );
+		memcpy( stream->carry+old, es_ptr, es_len );
+		stream->carry_len = old + es_len;
+	}
+}
+
+
+// Look for a header starting in the bytes carried from the last packet
+static void hunt_carried_header( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, const unsigned char *es_ptr, size_t es_len )
+{
+	unsigned char join[sizeof(stream->carry)*2];
+	size_t join_len = stream->carry_len;
+	size_t i;
+	
+	memcpy( join, stream->carry, stream->carry_len );
+	for (i=0; i<es_len && i<sizeof(stream->carry); i++)
+		join[join_len++] = es_ptr[i];
+	
+	for (i=0; i<stream->carry_len && i+4<=join_len; i++) {
+		if (mpa_header_framesize(join+i)) {
+			size_t len = stream->carry_len - i;
+			gain_sync( ts2mpa, stream, join+i, 1 );
+			
+			// These bytes were counted as skipped, but are written after all
+			ts2mpa->pids[stream->pid]->counters.hunt_skipped -= len;
+			ts2mpa->counters.hunt_skipped -= len;
+			
+			// These bytes are only on the stack
+			add_frame_data( ts2mpa, stream, join+i, len, 1 );
+			return;
+		}
+	}
+}
+
+
+// Find the frames in some ES data, and pass them on
+static void extract_es( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, const unsigned char *es_ptr, size_t es_len )
+{
+	ts2mpa_pid_t *ts_pid = ts2mpa->pids[stream->pid];
+	size_t offset;
+	
+	while (es_len > 0 && !ts2mpa->error) {
+		
+		if (stream->synced) {
+			offset = add_frame_data( ts2mpa, stream, es_ptr, es_len, 0 );
+			es_ptr += offset;
+			es_len -= offset;
+			continue;
+		}
+		
+		// Skip the rest of a damaged frame, to where the next one should be
+		if (stream->predicted) {
+			offset = stream->resume_skip < es_len ? stream->resume_skip : es_len;
+			stream->resume_skip -= offset;
+			es_ptr += offset;
+			es_len -= offset;
+			ts_pid->counters.hunt_skipped += offset;
+			ts2mpa->counters.hunt_skipped += offset;
+			if (es_len == 0) break;
+			
+			// One header check says whether it is there,
+			// otherwise hunt for it from here
+			stream->predicted = 0;
+			if (es_len >= 4 && frame_follows( stream, es_ptr )) {
+				gain_sync( ts2mpa, stream, es_ptr, 0 );
+				ts_pid->counters.sync_predicted++;
+				ts2mpa->counters.sync_predicted++;
+				continue;
+			}
+		}
+		
+		// Did a header start in the end of the last packet?
+		if (stream->carry_len) {
+			hunt_carried_header( ts2mpa, stream, es_ptr, es_len );
+			if (stream->synced) continue;
+		}
+		
+		// Scan through Elementary Stream (ES) 
+		// and try and find MPEG audio stream header
+		offset = mpa_header_find( es_ptr, es_len );
+		if (offset < es_len) {
+			// Valid header
+			gain_sync( ts2mpa, stream, es_ptr+offset, 1 );
+		} else {
+			// Keep the last few bytes, in case a header starts there
+			carry_es( stream, es_ptr, es_len );
+		}
+		
+		// Skip bytes
+		es_ptr += offset;
+		es_len -= offset;
+		ts_pid->counters.hunt_skipped += offset;
+		ts2mpa->counters.hunt_skipped += offset;
+	}
+}
+
+
+// Extract the PES payload and pass it on to the application
+static void extract_pes_payload( ts2mpa_t *ts2mpa, ts2mpa_pid_t *ts_pid, const unsigned char *pes_ptr, size_t pes_len, int start_of_pes )
+{
+	ts2mpa_stream_t *stream=NULL;
+	const unsigned char* es_ptr=NULL;
+	size_t es_len=0;
+	
+	
+	// Start of a PES header?
+	if ( start_of_pes ) {
+		unsigned int pes_total_len;
+		size_t pes_header_len;
+		unsigned char stream_id;
+		long long pts;
+	
+		// Payload is no longer part of the previous PES packet
+		ts_pid->current = NULL;
+	
+		// Check that it has a valid header, before reading any of it
+		if (!validate_pes_header( ts2mpa, ts_pid->pid, pes_ptr, pes_len )) return;
+		pes_total_len = PES_PACKET_LEN(pes_ptr);
+		pes_header_len = PES_PACKET_HEAD_LEN(pes_ptr);
+		stream_id = PES_PACKET_STREAM_ID(pes_ptr);
+		
+		// Stream IDs in range 0xC0-0xDF are MPEG audio
+		stream = find_stream( ts2mpa, ts_pid, stream_id, pes_total_len );
+		if (stream==NULL) return;
+		ts_pid->current = stream;
+	
+		// Store the length of the PES packet payload; the length
+		// counts the three bytes up to the header length, and the header
+		stream->pes_remaining = pes_total_len - (3+pes_header_len);
+		stream->pes_length = stream->pes_remaining;
+		stream->pes_head_len = 9+pes_header_len;
+		
+		// Note when it is to be presented
+		pts = ts2mpa_pes_pts( pes_ptr, pes_len );
+		if (pts >= 0) {
+			stream->pts = pts;
+			if (ts2mpa->pes_pts) ts2mpa->pes_pts( ts2mpa, stream );
+		}
+	
+		// Keep pointer to ES data in this packet
+		es_ptr = pes_ptr+(9+pes_header_len);
+		es_len = pes_len-(9+pes_header_len);
+	
+
+	} else if (ts_pid->current) {
+	
+		// Only output data once we have seen a PES header
+		stream = ts_pid->current;
+		es_ptr = pes_ptr;
+		es_len = pes_len;
+	
+		// Are we are the end of the PES packet?
+		if (es_len>stream->pes_remaining) {
+			es_len=stream->pes_remaining;
+		}
+		
+	}
+
+	
+	// Got some data to write out?
+	if (es_ptr) {
+		
+		// Subtract the amount remaining in current PES packet
+		stream->pes_remaining -= es_len;
+	
+		extract_es( ts2mpa, stream, es_ptr, es_len );
+	}
+
+}
+
+
+// Packets on a PID have been lost or damaged, and so has the frame in
+// progress on each of its streams. The next frame should start the
+// rest of that frame, plus however many whole frames fit in the lost
+// bytes, further on. Padding can only put it a byte (a four byte slot
+// in Layer I) per frame later, which the hunt from there finds straight
+// away.
+// lost is the number of ES bytes missing, or -1 if it isn't known
+// returns 1 if any of the streams were synced
+static int unsync_pid( ts2mpa_t *ts2mpa, ts2mpa_pid_t *ts_pid, long lost )
+{
+	ts2mpa_stream_t *stream = NULL;
+	int was_synced = 0;
+	
+	for (stream = ts_pid->streams; stream; stream = stream->next) {
+		unsigned long step = stream->mpah.framesize -
+		                     stream->mpah.padding * (stream->mpah.layer == 1 ? 4 : 1);
+		unsigned long next = stream->resume_skip;
+		
+		if (stream->synced) {
+			was_synced = 1;
+			ts_pid->counters.sync_losses++;
+			ts2mpa->counters.sync_losses++;
+			if (ts2mpa->sync_lost)
+				ts2mpa->sync_lost( ts2mpa, stream, stream->confirming );
+			if (stream->frame_len) {
+				ts_pid->counters.frames_dropped++;
+				ts2mpa->counters.frames_dropped++;
+			}
+			
+			// Bytes left of the frame in progress, which may only
+			// have had some of its header so far
+			if (stream->frame_left) next = stream->frame_left;
+			else if (stream->frame_header_len) next = step - stream->frame_header_len;
+			else next = 0;
+			stream->predicted = 1;
+		}
+		
+		if (stream->predicted && lost >= 0) {
+			if ((unsigned long)lost <= next)
+				stream->resume_skip = next - lost;
+			else
+				stream->resume_skip = (step - (lost - next) % step) % step;
+		} else {
+			stream->predicted = 0;
+		}
+		
+		stream->synced = 0;
+		stream->carry_len = 0;
+		drop_frame( stream );
+	}
+	
+	return was_synced;
+}
+
+
+// Work out how many ES bytes were in the packets missing from a PID,
+// and how much is left of the PES packet that carries on after them
+static long lost_es_bytes( ts2mpa_pid_t *ts_pid, int missing )
+{
+	ts2mpa_stream_t *stream = ts_pid->current;
+	long lost = missing * (TS_PACKET_SIZE-4);		// Most likely whole payloads
+	long packets, after;
+	
+	if (stream == NULL) return lost;
+	if (lost <= stream->pes_remaining) {
+		stream->pes_remaining -= lost;
+		return lost;
+	}
+	
+	// The end of the PES packet, then the start of another like it
+	packets = (stream->pes_remaining + TS_PACKET_SIZE-5) / (TS_PACKET_SIZE-4);
+	after = (missing - packets) * (TS_PACKET_SIZE-4) - stream->pes_head_len;
+	if (after < 0) after = 0;
+	lost = stream->pes_remaining + after;
+	stream->pes_remaining = stream->pes_length > after ? stream->pes_length - after : 0;
+	
+	return lost;
+}
+
+
+// returns 1 if the packet repeats the one before, and so should be dropped
+static int ts_continuity_check( ts2mpa_t *ts2mpa, ts2mpa_pid_t *ts_pid, int ts_cc ) 
+{
+	long lost = -1;
+	
+	// A packet may be sent twice, with the same continuity count
+	if (ts_pid->continuity_count != -1 &&
+	    ts_cc == ((ts_pid->continuity_count + 15) & 0xF))
+		return 1;
+	
+	if (ts_pid->continuity_count != ts_cc) {
+	
+		// The first packet has nothing to follow on from
+		if (ts_pid->continuity_count != -1) {
+			ts_pid->counters.cc_errors++;
+			ts2mpa->counters.cc_errors++;
+			lost = lost_es_bytes( ts_pid, (ts_cc - ts_pid->continuity_count) & 0xF );
+		}
+	
+		// Only display an error after we gain sync
+		if (unsync_pid( ts2mpa, ts_pid, lost )) {
+			message( ts2mpa, TS2MPA_WARNING, "Warning, TS continuity error at 0x%llx",
+			         ts2mpa->packet_offset);
+		}
+		ts_pid->continuity_count = ts_cc;
+	}
+
+	ts_pid->continuity_count++;
+	if (ts_pid->continuity_count==16)
+		ts_pid->continuity_count=0;
+	
+	return 0;
+}
+
+
+static ts2mpa_psi_t* find_psi( ts2mpa_t *ts2mpa, int pid )
+{
+	ts2mpa_psi_t *psi = NULL;
+	
+	for (psi = ts2mpa->psi_list; psi; psi = psi->next) {
+		if (psi->pid == pid) break;
+	}
+	
+	return psi;
+}
+
+
+// Work out what a PID carries again, from the PAT and every PMT
+static void retype_pid( ts2mpa_t *ts2mpa, int pid )
+{
+	ts2mpa_program_t *program = NULL;
+	int type = TS2MPA_PID_UNKNOWN;
+	int i;
+	
+	if (find_psi( ts2mpa, pid )) {
+		type = TS2MPA_PID_PSI;
+	} else {
+		for (program = ts2mpa->programs; program; program = program->next) {
+			for (i=0; i<program->es_count; i++) {
+				if (program->es_pids[i] != pid) continue;
+				if (program->es_types[i] == TS_PSI_STREAM_MPEG1_AUDIO ||
+				    program->es_types[i] == TS_PSI_STREAM_MPEG2_AUDIO)
+					type = TS2MPA_PID_AUDIO;
+				else if (type == TS2MPA_PID_UNKNOWN)
+					type = TS2MPA_PID_OTHER;
+			}
+		}
+	}
+	
+	ts2mpa->pid_types[pid] = type;
+	update_pid_map( ts2mpa, pid );
+}
+
+
+// Start collecting sections on a PID
+// returns NULL if memory ran out
+static ts2mpa_psi_t* add_psi( ts2mpa_t *ts2mpa, int pid )
+{
+	ts2mpa_psi_t *psi = find_psi( ts2mpa, pid );
+	if (psi) return psi;
+	
+	psi = malloc( sizeof(ts2mpa_psi_t) );
+	if (psi==NULL) {
+		message( ts2mpa, TS2MPA_ERROR, "Failed to allocate memory for ts2mpa_psi_t" );
+		fail( ts2mpa, ENOMEM );
+		return NULL;
+	}
+	
+	psi->ts2mpa = ts2mpa;
+	psi->pid = pid;
+	ts_psi_init( &psi->section );
+	psi->next = ts2mpa->psi_list;
+	ts2mpa->psi_list = psi;
+	
+	retype_pid( ts2mpa, pid );
+	return psi;
+}
+
+
+// Stop collecting sections on a PMT PID, if no program uses it any more
+static void remove_psi( ts2mpa_t *ts2mpa, int pid )
+{
+	ts2mpa_psi_t **prev = &ts2mpa->psi_list;
+	ts2mpa_program_t *program = NULL;
+	
+	for (program = ts2mpa->programs; program; program = program->next) {
+		if (program->pmt_pid == pid) return;
+	}
+	
+	while (*prev && (*prev)->pid != pid)
+		prev = &(*prev)->next;
+	if (*prev) {
+		ts2mpa_psi_t *psi = *prev;
+		*prev = psi->next;
+		free( psi );
+	}
+	
+	retype_pid( ts2mpa, pid );
+}
+
+
+// Forget the streams that a program's PMT listed
+static void forget_program_streams( ts2mpa_t *ts2mpa, ts2mpa_program_t *program )
+{
+	int count = program->es_count;
+	int i;
+	
+	program->es_count = 0;
+	program->version = -1;
+	for (i=0; i<count; i++)
+		retype_pid( ts2mpa, program->es_pids[i] );
+}
+
+
+// A program listed in a PAT section
+static void add_program( ts2mpa_t *ts2mpa, int program_number, int pmt_pid )
+{
+	ts2mpa_program_t *program = NULL;
+	int old_pid;
+	
+	for (program = ts2mpa->programs; program; program = program->next) {
+		if (program->program_number == program_number) break;
+	}
+	
+	if (program==NULL) {
+		program = malloc( sizeof(ts2mpa_program_t) );
+		if (program==NULL) {
+			message( ts2mpa, TS2MPA_ERROR, "Failed to allocate memory for ts2mpa_program_t" );
+			fail( ts2mpa, ENOMEM );
+			return;
+		}
+		program->program_number = program_number;
+		program->pmt_pid = pmt_pid;
+		program->version = -1;
+		program->es_count = 0;
+		program->next = ts2mpa->programs;
+		ts2mpa->programs = program;
+	} else if (program->pmt_pid != pmt_pid) {
+		// Moved to another PID, so the PMT has to be found again
+		old_pid = program->pmt_pid;
+		program->pmt_pid = pmt_pid;
+		forget_program_streams( ts2mpa, program );
+		remove_psi( ts2mpa, old_pid );
+	}
+	
+	program->in_pat = 1;
+	add_psi( ts2mpa, pmt_pid );
+}
+
+
+// Every section of a new PAT version has been seen
+static void apply_pat( ts2mpa_t *ts2mpa )
+{
+	ts2mpa_program_t **prev = &ts2mpa->programs;
+	int first = (ts2mpa->pat_version == -1);
+	int count = 0;
+	
+	ts2mpa->pat_version = ts2mpa->pat_next_version;
+	
+	// Drop the programs that have gone
+	while (*prev) {
+		ts2mpa_program_t *program = *prev;
+		if (program->in_pat) {
+			prev = &program->next;
+			count++;
+			continue;
+		}
+		*prev = program->next;
+		forget_program_streams( ts2mpa, program );
+		remove_psi( ts2mpa, program->pmt_pid );
+		free( program );
+	}
+	
+	// Stop probing PIDs that no PMT will mention
+	if (first) update_pid_maps( ts2mpa );
+	
+	message( ts2mpa, TS2MPA_INFO, "Found PAT version %d, with %d program%s.",
+	         ts2mpa->pat_version, count, count==1 ? "" : "s" );
+}
+
+
+static void handle_pat( ts2mpa_t *ts2mpa, const unsigned char *section, size_t len )
+{
+	const unsigned char *entry = section + TS_PSI_HEADER_SIZE;
+	const unsigned char *end = section + len - TS_PSI_CRC_SIZE;
+	ts2mpa_program_t *program = NULL;
+	int number = PSI_SECTION_NUMBER(section);
+	int last = PSI_LAST_SECTION_NUMBER(section);
+	int i;
+	
+	if (number > last) return;
+	
+	// Start collecting a new version
+	if (PSI_VERSION(section) != ts2mpa->pat_next_version) {
+		ts2mpa->pat_next_version = PSI_VERSION(section);
+		memset( ts2mpa->pat_sections, 0, sizeof(ts2mpa->pat_sections) );
+		for (program = ts2mpa->programs; program; program = program->next)
+			program->in_pat = 0;
+	}
+	
+	// Already got this section of it?
+	if (TS_PID_MAP_TEST( ts2mpa->pat_sections, number )) return;
+	TS_PID_MAP_SET( ts2mpa->pat_sections, number );
+	
+	for (; entry + 4 <= end; entry += 4) {
+		int pid = PAT_PID(entry);
+		
+		// Program 0 is the network PID, not a PMT
+		if (PAT_PROGRAM_NUMBER(entry) == 0 || pid == TS_PSI_PAT_PID || pid == 0x1FFF)
+			continue;
+		add_program( ts2mpa, PAT_PROGRAM_NUMBER(entry), pid );
+	}
+	
+	for (i=0; i<=last; i++) {
+		if (!TS_PID_MAP_TEST( ts2mpa->pat_sections, i )) return;
+	}
+	if (ts2mpa->pat_next_version != ts2mpa->pat_version)
+		apply_pat( ts2mpa );
+}
+
+
+// Without demux_all, follow the stream being extracted when a new
+// version of its program's PMT no longer has audio on its PID, to
+// the first PID that the program now has audio on
+static void follow_audio( ts2mpa_t *ts2mpa, ts2mpa_program_t *program, const uint16_t *old_pids, int old_count )
+{
+	ts2mpa_stream_t *stream = ts2mpa->stream_list;
+	ts2mpa_pid_t *from = NULL, *to = NULL;
+	int i, pid = -1;
+	
+	if (ts2mpa->demux_all || ts2mpa->pid != -1 || stream==NULL) return;
+	if (ts2mpa->pid_types[stream->pid] == TS2MPA_PID_AUDIO) return;
+	
+	// Was it in this program?
+	for (i=0; i<old_count; i++) {
+		if (old_pids[i] == stream->pid) break;
+	}
+	if (i == old_count) return;
+	
+	for (i=0; i<program->es_count && pid == -1; i++) {
+		if (ts2mpa->pid_types[program->es_pids[i]] == TS2MPA_PID_AUDIO)
+			pid = program->es_pids[i];
+	}
+	if (pid == -1) return;
+	
+	to = ts2mpa->pids[pid];
+	if (to == NULL) to = add_pid( ts2mpa, pid );
+	if (to == NULL) return;
+	
+	message( ts2mpa, TS2MPA_INFO, "Audio has moved from PID %d to PID %d, following it.",
+	         stream->pid, pid );
+	
+	// Nothing more will come on the old PID, so the frame in progress
+	// can't be finished
+	from = ts2mpa->pids[stream->pid];
+	unsync_pid( ts2mpa, from, -1 );
+	from->streams = NULL;
+	from->current = NULL;
+	
+	stream->pid = pid;
+	stream->pes_stream_id = -1;
+	stream->pes_remaining = 0;
+	stream->next = to->streams;
+	to->streams = stream;
+	
+	update_pid_maps( ts2mpa );
+}
+
+
+static void handle_pmt( ts2mpa_t *ts2mpa, int pid, const unsigned char *section, size_t len )
+{
+	ts2mpa_program_t *program = NULL;
+	const unsigned char *entry = NULL;
+	const unsigned char *end = section + len - TS_PSI_CRC_SIZE;
+	uint16_t old_pids[TS_PSI_MAX_ES];
+	char audio[128] = "";
+	int old_count, info_len, i;
+	
+	for (program = ts2mpa->programs; program; program = program->next) {
+		if (program->pmt_pid == pid && program->program_number == PSI_TABLE_ID_EXT(section)) break;
+	}
+	if (program==NULL || program->version == PSI_VERSION(section)) return;
+	
+	info_len = PMT_PROGRAM_INFO_LEN(section);
+	if (12 + info_len > len - TS_PSI_CRC_SIZE) return;
+	
+	// Replace the streams listed before
+	old_count = program->es_count;
+	memcpy( old_pids, program->es_pids, old_count * sizeof(uint16_t) );
+	program->es_count = 0;
+	for (entry = section + 12 + info_len; entry + 5 <= end; entry += 5 + PMT_ES_INFO_LEN(entry)) {
+		if (program->es_count == TS_PSI_MAX_ES) break;
+		program->es_pids[program->es_count] = PMT_ES_PID(entry);
+		program->es_types[program->es_count] = PMT_ES_STREAM_TYPE(entry);
+		program->es_count++;
+	}
+	program->version = PSI_VERSION(section);
+	
+	for (i=0; i<old_count; i++)
+		retype_pid( ts2mpa, old_pids[i] );
+	for (i=0; i<program->es_count; i++) {
+		size_t used = strlen( audio );
+		retype_pid( ts2mpa, program->es_pids[i] );
+		if (ts2mpa->pid_types[program->es_pids[i]] == TS2MPA_PID_AUDIO && used < sizeof(audio))
+			snprintf( audio+used, sizeof(audio)-used, "%s%d", used ? ", " : "", program->es_pids[i] );
+	}
+	
+	message( ts2mpa, TS2MPA_INFO, "Program %d (PMT version %d) has MPEG audio on PIDs: %s",
+	         program->program_number, program->version, audio[0] ? audio : "none" );
+	
+	follow_audio( ts2mpa, program, old_pids, old_count );
+}
+
+
+// A complete section, with a good CRC, from a PAT or PMT PID
+static void handle_section( void *user, const unsigned char *section, size_t len )
+{
+	ts2mpa_psi_t *psi = user;
+	
+	// Ignore tables that aren't in force yet
+	if (!PSI_CURRENT_NEXT(section)) return;
+	
+	if (psi->pid == TS_PSI_PAT_PID && PSI_TABLE_ID(section) == TS_PSI_TABLE_PAT)
+		handle_pat( psi->ts2mpa, section, len );
+	else if (PSI_TABLE_ID(section) == TS_PSI_TABLE_PMT)
+		handle_pmt( psi->ts2mpa, psi->pid, section, len );
+}
+
+
+// Collect the sections in a packet on a PAT or PMT PID
+static void process_psi_packet( ts2mpa_t *ts2mpa, int pid, const unsigned char *buf,
+                                const unsigned char *payload, size_t len )
+{
+	ts2mpa_psi_t *psi = find_psi( ts2mpa, pid );
+	int bad;
+	
+	if (psi==NULL) return;
+	
+	// Bad sections are thrown away, so there is no need to count these
+	if (TS_PACKET_TRANS_ERROR(buf) || TS_PACKET_SCRAMBLING(buf)) {
+		ts_psi_init( &psi->section );
+		return;
+	}
+	
+	bad = ts_psi_collect( &psi->section, payload, len, TS_PACKET_PAYLOAD_START(buf),
+	                      TS_PACKET_CONT_COUNT(buf), handle_section, psi );
+	if (bad) {
+		ts2mpa->psi_crc_errors += bad;
+		message( ts2mpa, TS2MPA_WARNING, "Warning, PSI section with a bad CRC on PID %d at 0x%llx",
+		         pid, ts2mpa->packet_offset );
+	}
+}
+
+
+// Might this be a PID that we want to extract audio from?
+static int is_candidate_pid( ts2mpa_t *ts2mpa, int pid )
+{
+	if (ts2mpa->pid != -1) return (pid == ts2mpa->pid);
+	if (ts2mpa->pid_types[pid] == TS2MPA_PID_PSI) return 0;
+	if (ts2mpa->demux_all) return TS_PID_MAP_TEST( ts2mpa->pid_map, pid );
+	
+	// Otherwise we only want the first one
+	return (ts2mpa->stream_count == 0);
+}
+
+
+// Process a single TS packet, that starts with a sync byte
+static void process_ts_packet( ts2mpa_t *ts2mpa, const unsigned char *buf )
+{
+	int pid = TS_PACKET_PID(buf);
+	ts2mpa_pid_t *ts_pid = ts2mpa->pids[pid];
+	const unsigned char* pes_ptr=NULL;
+	size_t pes_len;
+
+	ts2mpa->total_packets++;
+	ts2mpa->counters.packets++;
+	if (ts_pid) ts_pid->counters.packets++;
+
+	// Check packet validity
+	if (ts_pid || is_candidate_pid( ts2mpa, pid )) {
+    // Scrambled?
+    if ( TS_PACKET_SCRAMBLING(buf) ) {
+      message( ts2mpa, TS2MPA_WARNING, "Warning, PID %d is scrambled.", pid);
+      ts2mpa->counters.scrambled++;
+      if (ts_pid) ts_pid->counters.scrambled++;
+      return;
+    }	
+	
+    // Transport error?
+	  if ( TS_PACKET_TRANS_ERROR(buf) ) {
+      message( ts2mpa, TS2MPA_WARNING, "Warning, transport error at 0x%llx", ts2mpa->packet_offset);
+      ts2mpa->counters.trans_errors++;
+      if (ts_pid) {
+        ts_pid->counters.trans_errors++;
+        // The gap it leaves is counted by the continuity check
+        unsync_pid( ts2mpa, ts_pid, 0 );
+      }
+	    return;
+    }
+	}
+
+	// Location of and size of PES payload
+	pes_ptr = &buf[4];
+	pes_len = TS_PACKET_SIZE - 4;
+
+	// Check for adaptation field?
+	if (TS_PACKET_ADAPTATION(buf)==0x1) {
+		// Payload only, no adaptation field
+	} else if (TS_PACKET_ADAPTATION(buf)==0x2) {
+		// Adaptation field only, no payload
+		return;
+	} else if (TS_PACKET_ADAPTATION(buf)==0x3) {
+		// Adaptation field AND payload, which has to fit in the packet
+		if (TS_PACKET_ADAPT_LEN(buf) > TS_PACKET_SIZE-5) {
+			message( ts2mpa, TS2MPA_WARNING, "Warning, invalid adaptation field length at 0x%llx", ts2mpa->packet_offset);
+			return;
+		}
+		pes_ptr += (TS_PACKET_ADAPT_LEN(buf) + 1);
+		pes_len -= (TS_PACKET_ADAPT_LEN(buf) + 1);
+	}
+
+	// Check we know about the payload
+	if (pid == 0x1FFF) {
+		// Ignore NULL package
+		return;
+	}
+	
+	// Part of the program map?
+	if (ts2mpa->pid_types[pid] == TS2MPA_PID_PSI) {
+		if (TS_PID_MAP_TEST( ts2mpa->pid_map, pid ))
+			process_psi_packet( ts2mpa, pid, buf, pes_ptr, pes_len );
+		return;
+	}
+	
+	// Not a PID we are extracting from yet?
+	if (ts_pid == NULL && TS_PACKET_PAYLOAD_START(buf) && is_candidate_pid( ts2mpa, pid )) {
+
+		// Does this one look good ?
+		if (validate_pes_header( ts2mpa, pid, pes_ptr, pes_len )) {
+			// Looks good, use this one
+			ts_pid = add_pid( ts2mpa, pid );
+		} else if (ts2mpa->demux_all && pes_len >= 4 &&
+		           PES_PACKET_SYNC_BYTE1(pes_ptr) == 0x00 &&
+		           PES_PACKET_SYNC_BYTE2(pes_ptr) == 0x00 &&
+		           PES_PACKET_SYNC_BYTE3(pes_ptr) == 0x01 &&
+		           (PES_PACKET_STREAM_ID(pes_ptr) < 0xC0 || PES_PACKET_STREAM_ID(pes_ptr) > 0xDF))
+		{
+			// Don't keep checking PIDs carrying video or data
+			TS_PID_MAP_CLEAR( ts2mpa->pid_map, pid );
+		}
+	}
+
+	// Process the packet, if it is a PID we are interested in		
+	if (ts_pid) {
+	
+		// Continuity check, which drops a repeated packet
+		if (ts_continuity_check( ts2mpa, ts_pid, TS_PACKET_CONT_COUNT(buf) ))
+			return;
+	
+		// Extract PES payload and pass it on
+		extract_pes_payload( ts2mpa, ts_pid, pes_ptr, pes_len, TS_PACKET_PAYLOAD_START(buf) );
+	}
+}
+
+
+// Packets start with sync bytes again at offset
+static void regain_ts_sync( ts2mpa_t *ts2mpa, unsigned long long offset )
+{
+	int pid;
+
+	ts2mpa->resyncing = 0;
+	ts2mpa->total_skipped += ts2mpa->resync_skipped;
+	message( ts2mpa, TS2MPA_WARNING, "Regained Transport Stream syncronisation at 0x%llx (skipped %lu bytes).",
+	         offset, ts2mpa->resync_skipped);
+	
+	// Data has been lost, so every stream has to find its feet again
+	for (pid=0; pid<TS_PID_COUNT; pid++) {
+		if (ts2mpa->pids[pid]==NULL) continue;
+		unsync_pid( ts2mpa, ts2mpa->pids[pid], -1 );
+		ts2mpa->pids[pid]->current = NULL;
+	}
+}
+
+
+// Walk through the packets in a buffer, which starts at offset in the stream
+// returns the number of bytes used; anything left over is less than a
+// packet, or less than the run of packets needed to regain sync
+static size_t process_buffer( ts2mpa_t *ts2mpa, const unsigned char *buf, size_t len, unsigned long long offset )
+{
+	unsigned int wanted[TS_SCAN_BATCH];
+	unsigned long long start, scanned;
+	size_t used = 0;
+	size_t count, valid, found, skip, i;
+
+	while ( !ts2mpa->error ) {
+	
+		// Skip forward to where packets start with sync bytes again
+		if (ts2mpa->resyncing) {
+			if (len-used < TS_RESYNC_PACKETS*TS_PACKET_SIZE) break;
+		
+			skip = ts_scan_sync( buf+used, len-used, TS_RESYNC_PACKETS );
+			if (skip < len-used) {
+				used += skip;
+				ts2mpa->resync_skipped += skip;
+				regain_ts_sync( ts2mpa, offset+used );
+				continue;
+			}
+
+			// Skip everything that could not be the start of a run of packets
+			skip = len-used - (TS_RESYNC_PACKETS-1)*TS_PACKET_SIZE;
+			used += skip;
+			ts2mpa->resync_skipped += skip;
+			break;
+		}
+
+		if (len-used < TS_PACKET_SIZE) break;
+
+		// Walk through the packets in place, a batch at a time,
+		// only stopping at the ones on PIDs that we care about
+		count = (len-used) / TS_PACKET_SIZE;
+		start = cycles();
+		found = ts_scan_packets( buf+used, count, ts2mpa->pid_map, wanted, &valid );
+		scanned = cycles();
+		ts2mpa->scan_cycles += scanned - start;
+
+		ts2mpa->pid_map_grown = 0;
+		for (i=0; i<found && !ts2mpa->error; i++) {
+			ts2mpa->packet_offset = offset + used + wanted[i]*TS_PACKET_SIZE;
+			process_ts_packet( ts2mpa, buf + used + wanted[i]*TS_PACKET_SIZE );
+			
+			// The rest of the batch has to be scanned again, for
+			// packets on a PID that the program map has just added
+			if (ts2mpa->pid_map_grown) {
+				count = valid = wanted[i]+1;
+				found = i+1;
+			}
+		}
+		if (found) ts2mpa->demux_cycles += cycles() - scanned;
+		ts2mpa->total_packets += valid - found;
+		used += valid*TS_PACKET_SIZE;
+
+		// Stopped because of a bad sync byte?
+		if (valid < count && valid < TS_SCAN_BATCH) {
+			message( ts2mpa, TS2MPA_WARNING, "Lost Transport Stream syncronisation (offset: 0x%llx).",
+			         offset+used);
+			ts2mpa->resyncing = 1;
+			ts2mpa->resync_skipped = 0;
+			ts2mpa->ts_sync_losses++;
+		}
+	}
+
+	return used;
+}
+
+
+// Decide which PIDs to look at, before we start
+static void init_pid_map( ts2mpa_t *ts2mpa )
+{
+	if (ts2mpa->pid != -1) {
+		memset( ts2mpa->pid_map, 0, sizeof(ts2mpa->pid_map) );
+		TS_PID_MAP_SET( ts2mpa->pid_map, ts2mpa->pid );
+	} else {
+		memset( ts2mpa->pid_map, 0xFF, sizeof(ts2mpa->pid_map) );
+		TS_PID_MAP_CLEAR( ts2mpa->pid_map, 0x1FFF );
+		
+		// Look out for the program map, to find the audio PIDs from
+		add_psi( ts2mpa, TS_PSI_PAT_PID );
+	}
+}
+
+
+ts2mpa_t* ts2mpa_new( void )
+{
+	ts2mpa_t *ts2mpa = malloc( sizeof(ts2mpa_t) );
+	if (ts2mpa==NULL) return NULL;
+
+	// Zero the memory
+	bzero( ts2mpa, sizeof(ts2mpa_t) );
+
+	// Initialise defaults
+	ts2mpa->pid = -1;
+	ts2mpa->pes_stream_id = -1;
+	ts2mpa->demux_all = 0;
+	ts2mpa->user = NULL;
+	ts2mpa->new_stream = NULL;
+	ts2mpa->es_data = NULL;
+	ts2mpa->frame_start = NULL;
+	ts2mpa->sync_lost = NULL;
+	ts2mpa->frame_header = NULL;
+	ts2mpa->message = NULL;
+	ts2mpa->pes_pts = NULL;
+	ts2mpa->stream_count = 0;
+	ts2mpa->stream_list = NULL;
+	ts2mpa->total_bytes = 0;
+	ts2mpa->total_packets = 0;
+	ts2mpa->total_skipped = 0;
+	ts2mpa->offset = 0;
+	ts2mpa->packet_offset = 0;
+	ts2mpa->started = 0;
+	ts2mpa->resyncing = 0;
+	ts2mpa->error = 0;
+	ts2mpa->pending_len = 0;
+	ts2mpa->psi_list = NULL;
+	ts2mpa->programs = NULL;
+	ts2mpa->pat_version = -1;
+	ts2mpa->pat_next_version = -1;
+
+	return ts2mpa;
+}
+
+
+// Apply the options, the first time that we are used
+static void ts2mpa_start( ts2mpa_t *ts2mpa )
+{
+	if (ts2mpa->started) return;
+
+	init_pid_map( ts2mpa );
+	ts2mpa->started = 1;
+}
+
+
+ts2mpa_stream_t* ts2mpa_add_stream( ts2mpa_t* ts2mpa, int pid, int stream_id )
+{
+	ts2mpa_pid_t *ts_pid = NULL;
+	ts2mpa_stream_t *stream = NULL;
+
+	ts2mpa_start( ts2mpa );
+
+	ts_pid = ts2mpa->pids[pid];
+	if (ts_pid==NULL) ts_pid = add_pid( ts2mpa, pid );
+	if (ts_pid==NULL) return NULL;
+
+	for (stream = ts_pid->streams; stream; stream = stream->next) {
+		if (stream->pes_stream_id == stream_id) return stream;
+	}
+
+	return add_stream( ts2mpa, ts_pid, stream_id );
+}
+
+
+int ts2mpa_feed( ts2mpa_t* ts2mpa, const unsigned char* buf, size_t len )
+{
+	ts2mpa_stream_t *stream = NULL;
+	size_t used, need, take;
+
+	ts2mpa_start( ts2mpa );
+
+	while (len > 0 && !ts2mpa->error) {
+
+		if (ts2mpa->pending_len) {
+			// Top up what was left over last time, until there is enough
+			// for a whole packet, or a run of them when looking for sync
+			need = ts2mpa->resyncing ? sizeof(ts2mpa->pending) : TS_PACKET_SIZE;
+			take = need - ts2mpa->pending_len;
+			if (take > len) take = len;
+
+			memcpy( ts2mpa->pending + ts2mpa->pending_len, buf, take );
+			ts2mpa->pending_len += take;
+			ts2mpa->offset += take;
+			buf += take;
+			len -= take;
+			if (ts2mpa->pending_len < need) break;
+
+			used = process_buffer( ts2mpa, ts2mpa->pending, ts2mpa->pending_len,
+			                       ts2mpa->offset - ts2mpa->pending_len );
+			memmove( ts2mpa->pending, ts2mpa->pending + used, ts2mpa->pending_len - used );
+			ts2mpa->pending_len -= used;
+
+		} else {
+			// Use the packets in place
+			used = process_buffer( ts2mpa, buf, len, ts2mpa->offset );
+			ts2mpa->offset += used;
+			buf += used;
+			len -= used;
+
+			// Keep the rest until there is more
+			if (len > 0 && !ts2mpa->error) {
+				memcpy( ts2mpa->pending, buf, len );
+				ts2mpa->pending_len = len;
+				ts2mpa->offset += len;
+				len = 0;
+			}
+		}
+	}
+	
+	// The buffer is only valid until we return
+	for (stream = ts2mpa->stream_list; stream; stream = stream->list_next)
+		copy_held( stream );
+
+	return ts2mpa->error ? -1 : 0;
+}
+
+
+int ts2mpa_finish( ts2mpa_t* ts2mpa )
+{
+	const unsigned char *buf = ts2mpa->pending;
+	size_t len = ts2mpa->pending_len;
+	unsigned long long offset = ts2mpa->offset - len;
+	ts2mpa_stream_t *stream = NULL;
+	size_t used, count;
+
+	// Only the last few packets are left to regain sync with
+	while (ts2mpa->resyncing && !ts2mpa->error) {
+		count = len / TS_PACKET_SIZE;
+		used = count ? ts_scan_sync( buf, len, count ) : len;
+		ts2mpa->resync_skipped += used;
+
+		if (used >= len) {
+			ts2mpa->resyncing = 0;
+			ts2mpa->total_skipped += ts2mpa->resync_skipped;
+			message( ts2mpa, TS2MPA_WARNING, "Failed to regain Transport Stream syncronisation (skipped %lu bytes).",
+			         ts2mpa->resync_skipped);
+			break;
+		}
+
+		regain_ts_sync( ts2mpa, offset+used );
+		used += process_buffer( ts2mpa, buf+used, len-used, offset+used );
+		buf += used;
+		len -= used;
+		offset += used;
+	}
+
+	// Anything else is less than a whole packet
+	ts2mpa->pending_len = 0;
+	
+	// Nor are frames cut off by the end
+	for (stream = ts2mpa->stream_list; stream; stream = stream->list_next)
+		drop_frame( stream );
+
+	return ts2mpa->error ? -1 : 0;
+}
+
+
+long long ts2mpa_pes_pts( const unsigned char* pes, size_t len )
+{
+	// Fixed header, then the PTS in the first five bytes of the rest
+	if (len < 14 || PES_PACKET_SYNC_BYTE1(pes) != 0x00 || PES_PACKET_SYNC_BYTE2(pes) != 0x00 ||
+	    PES_PACKET_SYNC_BYTE3(pes) != 0x01 || PES_PACKET_SYNC_CODE(pes) != 0x2 ||
+	    PES_PACKET_HEAD_LEN(pes) < 5 || !(PES_PACKET_PTS_DTS(pes) & 0x2))
+		return -1;
+
+	return PES_PACKET_PTS(pes);
+}
+
+
+long long ts2mpa_pts_unwrap( long long pts, long long near )
+{
+	long long diff = (pts - near) & (TS2MPA_PTS_WRAP-1);
+	
+	// Within half a wrap either side
+	if (diff >= TS2MPA_PTS_WRAP/2) diff -= TS2MPA_PTS_WRAP;
+	
+	return near + diff;
+}
+
+
+// Write a set of counters as JSON members
+static void write_counters( FILE *file, const ts2mpa_counters_t *c )
+{
+	fprintf( file, "\"packets\": %lu, \"cc_errors\": %lu, \"trans_errors\": %lu, \"scrambled\": %lu, "
+	         "\"sync_losses\": %lu, \"sync_gains\": %lu, \"sync_predicted\": %lu, \"hunt_skipped\": %lu, "
+	         "\"frames\": %lu, \"frames_dropped\": %lu, \"bytes\": %lu",
+	         c->packets, c->cc_errors, c->trans_errors, c->scrambled,
+	         c->sync_losses, c->sync_gains, c->sync_predicted, c->hunt_skipped,
+	         c->frames, c->frames_dropped, c->bytes );
+}
+
+
+int ts2mpa_write_stats( ts2mpa_t* ts2mpa, FILE* file )
+{
+	unsigned long packets = ts2mpa->total_packets ? ts2mpa->total_packets : 1;
+	unsigned long long demux = ts2mpa->demux_cycles;
+	int pid, first = 1;
+	
+	// Output is timed within the demux stage
+	demux = demux > ts2mpa->output_cycles ? demux - ts2mpa->output_cycles : 0;
+	
+	fprintf( file, "{\n  \"offset\": %llu, \"packets_seen\": %lu, \"packets_filtered\": %lu,\n  ",
+	         ts2mpa->offset, ts2mpa->total_packets, ts2mpa->total_packets - ts2mpa->counters.packets );
+	write_counters( file, &ts2mpa->counters );
+	fprintf( file, ",\n  \"ts_sync_losses\": %lu, \"ts_skipped\": %lu, \"psi_crc_errors\": %lu,\n",
+	         ts2mpa->ts_sync_losses, ts2mpa->total_skipped, ts2mpa->psi_crc_errors );
+	fprintf( file, "  \"cycles\": { \"scan\": %llu, \"demux\": %llu, \"output\": %llu },\n",
+	         ts2mpa->scan_cycles, demux, ts2mpa->output_cycles );
+	fprintf( file, "  \"cycles_per_packet\": { \"scan\": %.1f, \"demux\": %.1f, \"output\": %.1f },\n",
+	         (double)ts2mpa->scan_cycles / packets, (double)demux / packets,
+	         (double)ts2mpa->output_cycles / packets );
+	fprintf( file, "  \"pids\": [" );
+	
+	for (pid=0; pid<TS_PID_COUNT; pid++) {
+		ts2mpa_pid_t *ts_pid = ts2mpa->pids[pid];
+		ts2mpa_stream_t *stream = NULL;
+		if (ts_pid==NULL || ts_pid->streams==NULL) continue;
+		
+		fprintf( file, "%s\n    { \"pid\": %d, ", first ? "" : ",", pid );
+		write_counters( file, &ts_pid->counters );
+		fprintf( file, ",\n      \"streams\": [" );
+		for (stream = ts_pid->streams; stream; stream = stream->next) {
+			fprintf( file, "%s { \"stream_id\": %d, \"synced\": %d, \"bytes\": %lu }",
+			         stream==ts_pid->streams ? "" : ",",
+			         stream->pes_stream_id, stream->synced, stream->total_bytes );
+		}
+		fprintf( file, " ] }" );
+		first = 0;
+	}
+	
+	fprintf( file, "%s]\n}\n", first ? "" : "\n  " );
+	
+	return ferror( file ) ? -1 : 0;
+}
+
+
+void ts2mpa_free( ts2mpa_t* ts2mpa )
+{
+	int pid;
+	
+	for (pid=0; pid<TS_PID_COUNT; pid++) {
+		ts2mpa_pid_t *ts_pid = ts2mpa->pids[pid];
+		if (ts_pid==NULL) continue;
+		
+		while (ts_pid->streams) {
+			ts2mpa_stream_t *stream = ts_pid->streams;
+			ts_pid->streams = stream->next;
+			free( stream );
+		}
+		free( ts_pid );
+	}
+	
+	while (ts2mpa->psi_list) {
+		ts2mpa_psi_t *psi = ts2mpa->psi_list;
+		ts2mpa->psi_list = psi->next;
+		free( psi );
+	}
+	while (ts2mpa->programs) {
+		ts2mpa_program_t *program = ts2mpa->programs;
+		ts2mpa->programs = program->next;
+		free( program );
+	}
+	
+	free( ts2mpa );
+}
+
@@ -27,10 +27,22 @@
  
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "mpa_header.h"
 
 
+#ifndef MPA_TABLE_GEN
+const unsigned short mpa_header_framesizes[MPA_HEADER_TABLE_SIZE] = {
+#include "mpa_table.h"
+};
+#endif
+
+
 #define MPA_MODE_STEREO		0
 #define MPA_MODE_JOINT		1
 #define MPA_MODE_DUAL		2
@@ -100,12 +112,18 @@ static void parse_header(mpa_header_t *mh, unsigned int header)
 	else
 		mh->channels = 2;
 
-	if (mh->version == 1)
+	// Only Layer III has half as many samples at the lower samplerates
+	if (mh->layer == 1)
+		mh->samples = 384;
+	else if (mh->version == 1 || mh->layer == 2)
 		mh->samples = 1152;
 	else
 		mh->samples = 576;
 
-	if(mh->samplerate)
+	// Layer I is made of four byte slots, and is padded by a whole slot
+	if (mh->samplerate && mh->layer == 1)
+		mh->framesize = (12 * mh->bitrate * 1000 / mh->samplerate + mh->padding) * 4;
+	else if (mh->samplerate)
 		mh->framesize = (mh->samples * mh->bitrate * 1000 / mh->samplerate) / 8 + mh->padding;
 }
 
@@ -139,35 +157,44 @@ void mpa_header_debug( mpa_header_t *mh )
 	fprintf(stderr, "  framesize=%d\n", mh->framesize);
 }
 
+const char* mpa_header_version_name( const mpa_header_t *mh )
+{
+	if (mh->version==1)			return "MPEG-1";
+	else if (mh->version==2)	return "MPEG-2";
+	else if (mh->version==3)	return "MPEG-2.5";
+	else 						return "MPEG-??";
+}
+
+const char* mpa_header_mode_name( const mpa_header_t *mh )
+{
+	if (mh->mode==MPA_MODE_STEREO)		return "Stereo";
+	else if (mh->mode==MPA_MODE_JOINT)	return "Joint Stereo";
+	else if (mh->mode==MPA_MODE_DUAL)	return "Dual";
+	else if (mh->mode==MPA_MODE_MONO)	return "Mono";
+	else								return "";
+}
+
 // concise informational string
 void mpa_header_print( mpa_header_t *mh )
 {
-	if (mh->version==1)			fprintf(stderr, "MPEG-1 ");
-	else if (mh->version==2)	fprintf(stderr, "MPEG-2 ");
-	else if (mh->version==3)	fprintf(stderr, "MPEG-2.5 ");
-	else 						fprintf(stderr, "MPEG-?? ");
-
+	fprintf(stderr, "%s ", mpa_header_version_name( mh ));
 	fprintf(stderr, "layer %d, ", mh->layer);
 	fprintf(stderr, "%d kbps, ", mh->bitrate);
 	fprintf(stderr, "%d Hz, ", mh->samplerate);
-	
-	if (mh->mode==MPA_MODE_STEREO)		fprintf(stderr, "Stereo");
-	else if (mh->mode==MPA_MODE_JOINT)	fprintf(stderr, "Joint Stereo");
-	else if (mh->mode==MPA_MODE_DUAL)	fprintf(stderr, "Dual");
-	else if (mh->mode==MPA_MODE_MONO)	fprintf(stderr, "Mono");
-
-	fprintf(stderr, "\n");
+	fprintf(stderr, "%s\n", mpa_header_mode_name( mh ));
 }
 
 
+#ifndef MPA_TABLE_GEN
+
 // Parse mpeg audio header
 // returns 1 if valid, or 0 if invalid
 int mpa_header_parse( const unsigned char* buf, mpa_header_t *mh)
 {
 	unsigned long head;
 		
-	/* Quick check */
-	if (buf[0] != 0xFF)
+	/* check for syncword, version, layer, bitrate and samplerate */
+	if (mpa_header_framesize( buf ) == 0)
 		return 0;
 
 	/* Put the first four bytes into an integer */
@@ -180,6 +207,61 @@ int mpa_header_parse( const unsigned char* buf, mpa_header_t *mh)
 	/* fill out the header struct */
 	parse_header(mh, head);
 
+	return 1;
+}
+
+
+// Search for the first valid header in a buffer
+// returns its offset, or len if there isn't a whole header in the buffer
+size_t mpa_header_find( const unsigned char* buf, size_t len )
+{
+	size_t pos = 0;
+	
+	if (len < 4) return len;
+
+#ifdef __SSE2__
+	{
+		const __m128i ff = _mm_set1_epi8( (char)0xFF );
+		const __m128i e0 = _mm_set1_epi8( (char)0xE0 );
+		
+		/* Look for 0xFF followed by 0xE0 masked bytes, 16 bytes at a time */
+		while (pos+20 <= len) {
+			__m128i b0 = _mm_loadu_si128( (const __m128i*)(buf+pos) );
+			__m128i b1 = _mm_loadu_si128( (const __m128i*)(buf+pos+1) );
+			unsigned int mask = _mm_movemask_epi8( _mm_and_si128(
+				_mm_cmpeq_epi8( b0, ff ),
+				_mm_cmpeq_epi8( _mm_and_si128( b1, e0 ), e0 ) ) );
+			
+			/* Only the candidates need the table lookup */
+			while (mask) {
+				size_t offset = pos + __builtin_ctz( mask );
+				if (mpa_header_framesize( buf+offset )) return offset;
+				mask &= mask-1;
+			}
+			pos += 16;
+		}
+	}
+#endif
+
+	/* Let memchr() find the candidates in whatever is left */
+	while (pos+4 <= len) {
+		const unsigned char* ptr = memchr( buf+pos, 0xFF, len-3-pos );
+		if (ptr==NULL) break;
+		
+		pos = ptr - buf;
+		if (mpa_header_framesize( ptr )) return pos;
+		pos++;
+	}
+	
+	return len;
+}
+
+#else
+
+// Check a header the long way
+// returns 1 if valid, or 0 if invalid
+static int check_header( mpa_header_t *mh )
+{
 	/* check for syncword */
 	if ((mh->syncword & 0x0ffe) != 0x0ffe)
 		return 0;
@@ -204,3 +286,42 @@ int mpa_header_parse( const unsigned char* buf, mpa_header_t *mh)
 }
 
 
+// Write out the frame size table, to be included by mpa_header.c
+int main()
+{
+	unsigned int key;
+	
+	printf("/* Generated by mpa_table_gen - do not edit */\n");
+	
+	for (key=0; key<MPA_HEADER_TABLE_SIZE; key++) {
+		unsigned char buf[4];
+		mpa_header_t mh;
+		unsigned long head;
+		
+		/* Build a header with these bits set */
+		buf[0] = 0xFF;
+		buf[1] = 0xE0 | ((key >> 6) & 0x1E);
+		buf[2] = (key << 1) & 0xFE;
+		buf[3] = 0x00;
+		
+		head = ((unsigned int)buf[0] << 24) | 
+			   ((unsigned int)buf[1] << 16) |
+			   ((unsigned int)buf[2] << 8)  |
+			   ((unsigned int)buf[3]);
+		
+		if (MPA_HEADER_KEY(buf) != key) {
+			fprintf(stderr, "mpa_table_gen: header key mismatch for 0x%x\n", key);
+			return 1;
+		}
+		
+		mh.framesize = 0;
+		parse_header(&mh, head);
+		
+		printf("%4u,%s", check_header(&mh) ? mh.framesize : 0,
+		       (key % 16 == 15) ? "\n" : " ");
+	}
+	
+	return 0;
+}
+
+#endif
@@ -20,6 +20,7 @@
 #ifndef _MPA_HEADER_H
 #define _MPA_HEADER_H
 
+#include <stddef.h>
 
 
 typedef struct {
@@ -49,8 +50,43 @@ typedef struct {
 int mpa_header_parse( const unsigned char* buf, mpa_header_t *mh);
 
 void mpa_header_print( mpa_header_t *mh );
+
+// Names of the version ("MPEG-1") and channel mode ("Joint Stereo"),
+// as printed by mpa_header_print()
+const char* mpa_header_version_name( const mpa_header_t *mh );
+const char* mpa_header_mode_name( const mpa_header_t *mh );
 void mpa_header_debug( mpa_header_t *mh );
 
 
 
+/*
+	Frame size for every combination of the version, layer, bitrate,
+	samplerate and padding bits of a header, or 0 if it is invalid.
+	Generated at build time by mpa_table_gen.
+*/
+#define MPA_HEADER_TABLE_SIZE		2048
+#define MPA_HEADER_KEY(b)			((((b)[1] & 0x1E) << 6) | ((b)[2] >> 1))
+
+extern const unsigned short mpa_header_framesizes[MPA_HEADER_TABLE_SIZE];
+
+// The version, layer and samplerate bits, which are the same for every
+// frame of a stream
+#define MPA_HEADER_FORMAT(b)		((((b)[1] & 0x1E) << 8) | ((b)[2] & 0x0C))
+
+// Quickly check for a valid header, without parsing it
+// returns the frame size if valid, or 0 if invalid
+static inline unsigned int mpa_header_framesize( const unsigned char* buf )
+{
+	if (buf[0] != 0xFF || (buf[1] & 0xE0) != 0xE0)
+		return 0;
+	
+	return mpa_header_framesizes[ MPA_HEADER_KEY(buf) ];
+}
+
+// Search for the first valid header in a buffer
+// returns its offset, or len if there isn't a whole header in the buffer
+size_t mpa_header_find( const unsigned char* buf, size_t len );
+
+
+
 #endif
@@ -0,0 +1,129 @@
+/* Generated by mpa_table_gen - do not edit */
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,   52,   53,   48,   49,   72,   73,    0,    0,
+ 104,  105,   96,   97,  144,  145,    0,    0,  156,  157,  144,  145,  216,  217,    0,    0,
+ 208,  209,  192,  193,  288,  289,    0,    0,  261,  262,  240,  241,  360,  361,    0,    0,
+ 313,  314,  288,  289,  432,  433,    0,    0,  365,  366,  336,  337,  504,  505,    0,    0,
+ 417,  418,  384,  385,  576,  577,    0,    0,  522,  523,  480,  481,  720,  721,    0,    0,
+ 626,  627,  576,  577,  864,  865,    0,    0,  731,  732,  672,  673, 1008, 1009,    0,    0,
+ 835,  836,  768,  769, 1152, 1153,    0,    0,  940,  941,  864,  865, 1296, 1297,    0,    0,
+1044, 1045,  960,  961, 1440, 1441,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,  104,  105,   96,   97,  144,  145,    0,    0,
+ 208,  209,  192,  193,  288,  289,    0,    0,  313,  314,  288,  289,  432,  433,    0,    0,
+ 417,  418,  384,  385,  576,  577,    0,    0,  522,  523,  480,  481,  720,  721,    0,    0,
+ 626,  627,  576,  577,  864,  865,    0,    0,  731,  732,  672,  673, 1008, 1009,    0,    0,
+ 835,  836,  768,  769, 1152, 1153,    0,    0, 1044, 1045,  960,  961, 1440, 1441,    0,    0,
+1253, 1254, 1152, 1153, 1728, 1729,    0,    0, 1462, 1463, 1344, 1345, 2016, 2017,    0,    0,
+1671, 1672, 1536, 1537, 2304, 2305,    0,    0, 1880, 1881, 1728, 1729, 2592, 2593,    0,    0,
+2089, 2090, 1920, 1921, 2880, 2881,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,  136,  140,  128,  132,  192,  196,    0,    0,
+ 208,  212,  192,  196,  288,  292,    0,    0,  240,  244,  224,  228,  336,  340,    0,    0,
+ 276,  280,  256,  260,  384,  388,    0,    0,  348,  352,  320,  324,  480,  484,    0,    0,
+ 416,  420,  384,  388,  576,  580,    0,    0,  484,  488,  448,  452,  672,  676,    0,    0,
+ 556,  560,  512,  516,  768,  772,    0,    0,  624,  628,  576,  580,  864,  868,    0,    0,
+ 696,  700,  640,  644,  960,  964,    0,    0,  764,  768,  704,  708, 1056, 1060,    0,    0,
+ 832,  836,  768,  772, 1152, 1156,    0,    0,  972,  976,  896,  900, 1344, 1348,    0,    0,
+1112, 1116, 1024, 1028, 1536, 1540,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,   52,   53,   48,   49,   72,   73,    0,    0,
+ 104,  105,   96,   97,  144,  145,    0,    0,  156,  157,  144,  145,  216,  217,    0,    0,
+ 208,  209,  192,  193,  288,  289,    0,    0,  261,  262,  240,  241,  360,  361,    0,    0,
+ 313,  314,  288,  289,  432,  433,    0,    0,  365,  366,  336,  337,  504,  505,    0,    0,
+ 417,  418,  384,  385,  576,  577,    0,    0,  522,  523,  480,  481,  720,  721,    0,    0,
+ 626,  627,  576,  577,  864,  865,    0,    0,  731,  732,  672,  673, 1008, 1009,    0,    0,
+ 835,  836,  768,  769, 1152, 1153,    0,    0,  940,  941,  864,  865, 1296, 1297,    0,    0,
+1044, 1045,  960,  961, 1440, 1441,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,  104,  105,   96,   97,  144,  145,    0,    0,
+ 208,  209,  192,  193,  288,  289,    0,    0,  313,  314,  288,  289,  432,  433,    0,    0,
+ 417,  418,  384,  385,  576,  577,    0,    0,  522,  523,  480,  481,  720,  721,    0,    0,
+ 626,  627,  576,  577,  864,  865,    0,    0,  731,  732,  672,  673, 1008, 1009,    0,    0,
+ 835,  836,  768,  769, 1152, 1153,    0,    0, 1044, 1045,  960,  961, 1440, 1441,    0,    0,
+1253, 1254, 1152, 1153, 1728, 1729,    0,    0, 1462, 1463, 1344, 1345, 2016, 2017,    0,    0,
+1671, 1672, 1536, 1537, 2304, 2305,    0,    0, 1880, 1881, 1728, 1729, 2592, 2593,    0,    0,
+2089, 2090, 1920, 1921, 2880, 2881,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,  136,  140,  128,  132,  192,  196,    0,    0,
+ 208,  212,  192,  196,  288,  292,    0,    0,  240,  244,  224,  228,  336,  340,    0,    0,
+ 276,  280,  256,  260,  384,  388,    0,    0,  348,  352,  320,  324,  480,  484,    0,    0,
+ 416,  420,  384,  388,  576,  580,    0,    0,  484,  488,  448,  452,  672,  676,    0,    0,
+ 556,  560,  512,  516,  768,  772,    0,    0,  624,  628,  576,  580,  864,  868,    0,    0,
+ 696,  700,  640,  644,  960,  964,    0,    0,  764,  768,  704,  708, 1056, 1060,    0,    0,
+ 832,  836,  768,  772, 1152, 1156,    0,    0,  972,  976,  896,  900, 1344, 1348,    0,    0,
+1112, 1116, 1024, 1028, 1536, 1540,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,   26,   27,   24,   25,   36,   37,    0,    0,
+  52,   53,   48,   49,   72,   73,    0,    0,   78,   79,   72,   73,  108,  109,    0,    0,
+ 104,  105,   96,   97,  144,  145,    0,    0,  130,  131,  120,  121,  180,  181,    0,    0,
+ 156,  157,  144,  145,  216,  217,    0,    0,  182,  183,  168,  169,  252,  253,    0,    0,
+ 208,  209,  192,  193,  288,  289,    0,    0,  261,  262,  240,  241,  360,  361,    0,    0,
+ 313,  314,  288,  289,  432,  433,    0,    0,  365,  366,  336,  337,  504,  505,    0,    0,
+ 417,  418,  384,  385,  576,  577,    0,    0,  470,  471,  432,  433,  648,  649,    0,    0,
+ 522,  523,  480,  481,  720,  721,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,   52,   53,   48,   49,   72,   73,    0,    0,
+ 104,  105,   96,   97,  144,  145,    0,    0,  156,  157,  144,  145,  216,  217,    0,    0,
+ 208,  209,  192,  193,  288,  289,    0,    0,  261,  262,  240,  241,  360,  361,    0,    0,
+ 313,  314,  288,  289,  432,  433,    0,    0,  365,  366,  336,  337,  504,  505,    0,    0,
+ 417,  418,  384,  385,  576,  577,    0,    0,  522,  523,  480,  481,  720,  721,    0,    0,
+ 626,  627,  576,  577,  864,  865,    0,    0,  731,  732,  672,  673, 1008, 1009,    0,    0,
+ 835,  836,  768,  769, 1152, 1153,    0,    0,  940,  941,  864,  865, 1296, 1297,    0,    0,
+1044, 1045,  960,  961, 1440, 1441,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,   68,   72,   64,   68,   96,  100,    0,    0,
+ 104,  108,   96,  100,  144,  148,    0,    0,  120,  124,  112,  116,  168,  172,    0,    0,
+ 136,  140,  128,  132,  192,  196,    0,    0,  172,  176,  160,  164,  240,  244,    0,    0,
+ 208,  212,  192,  196,  288,  292,    0,    0,  240,  244,  224,  228,  336,  340,    0,    0,
+ 276,  280,  256,  260,  384,  388,    0,    0,  312,  316,  288,  292,  432,  436,    0,    0,
+ 348,  352,  320,  324,  480,  484,    0,    0,  380,  384,  352,  356,  528,  532,    0,    0,
+ 416,  420,  384,  388,  576,  580,    0,    0,  484,  488,  448,  452,  672,  676,    0,    0,
+ 556,  560,  512,  516,  768,  772,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,  104,  105,   96,   97,  144,  145,    0,    0,
+ 130,  131,  120,  121,  180,  181,    0,    0,  156,  157,  144,  145,  216,  217,    0,    0,
+ 182,  183,  168,  169,  252,  253,    0,    0,  208,  209,  192,  193,  288,  289,    0,    0,
+ 261,  262,  240,  241,  360,  361,    0,    0,  313,  314,  288,  289,  432,  433,    0,    0,
+ 365,  366,  336,  337,  504,  505,    0,    0,  417,  418,  384,  385,  576,  577,    0,    0,
+ 522,  523,  480,  481,  720,  721,    0,    0,  626,  627,  576,  577,  864,  865,    0,    0,
+ 731,  732,  672,  673, 1008, 1009,    0,    0,  835,  836,  768,  769, 1152, 1153,    0,    0,
+1044, 1045,  960,  961, 1440, 1441,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,  104,  105,   96,   97,  144,  145,    0,    0,
+ 156,  157,  144,  145,  216,  217,    0,    0,  182,  183,  168,  169,  252,  253,    0,    0,
+ 208,  209,  192,  193,  288,  289,    0,    0,  261,  262,  240,  241,  360,  361,    0,    0,
+ 313,  314,  288,  289,  432,  433,    0,    0,  365,  366,  336,  337,  504,  505,    0,    0,
+ 417,  418,  384,  385,  576,  577,    0,    0,  522,  523,  480,  481,  720,  721,    0,    0,
+ 626,  627,  576,  577,  864,  865,    0,    0,  731,  732,  672,  673, 1008, 1009,    0,    0,
+ 835,  836,  768,  769, 1152, 1153,    0,    0, 1044, 1045,  960,  961, 1440, 1441,    0,    0,
+1253, 1254, 1152, 1153, 1728, 1729,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
+   0,    0,    0,    0,    0,    0,    0,    0,   32,   36,   32,   36,   48,   52,    0,    0,
+  68,   72,   64,   68,   96,  100,    0,    0,  104,  108,   96,  100,  144,  148,    0,    0,
+ 136,  140,  128,  132,  192,  196,    0,    0,  172,  176,  160,  164,  240,  244,    0,    0,
+ 208,  212,  192,  196,  288,  292,    0,    0,  240,  244,  224,  228,  336,  340,    0,    0,
+ 276,  280,  256,  260,  384,  388,    0,    0,  312,  316,  288,  292,  432,  436,    0,    0,
+ 348,  352,  320,  324,  480,  484,    0,    0,  380,  384,  352,  356,  528,  532,    0,    0,
+ 416,  420,  384,  388,  576,  580,    0,    0,  452,  456,  416,  420,  624,  628,    0,    0,
+ 484,  488,  448,  452,  672,  676,    0,    0,    0,    0,    0,    0,    0,    0,    0,    0,
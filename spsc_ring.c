@@ -0,0 +1,153 @@
+/*
+
+	spsc_ring.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "spsc_ring.h"
+
+
+// Number of times to look again before going to sleep
+#define SPSC_RING_SPIN		64
+
+
+// Sleep while *addr still holds value
+static void futex_wait( unsigned int* addr, unsigned int value )
+{
+	syscall( __NR_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0 );
+}
+
+// Wake anything asleep on addr
+static void futex_wake( unsigned int* addr )
+{
+	syscall( __NR_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0 );
+}
+
+
+spsc_ring_t* spsc_ring_new( unsigned int size )
+{
+	spsc_ring_t *ring = NULL;
+	unsigned int capacity = 1;
+	
+	while (capacity < size) capacity <<= 1;
+	
+	if (posix_memalign( (void**)&ring, 64, sizeof(spsc_ring_t) )) return NULL;
+	bzero( ring, sizeof(spsc_ring_t) );
+	
+	ring->slots = calloc( capacity, sizeof(void*) );
+	if (ring->slots==NULL) {
+		free( ring );
+		return NULL;
+	}
+	ring->mask = capacity-1;
+	
+	return ring;
+}
+
+
+int spsc_ring_push( spsc_ring_t* ring, void* item )
+{
+	unsigned int head = __atomic_load_n( &ring->head, __ATOMIC_RELAXED );
+	unsigned int tail = __atomic_load_n( &ring->tail, __ATOMIC_ACQUIRE );
+	
+	if (head - tail > ring->mask) return -1;
+	
+	ring->slots[head & ring->mask] = item;
+	__atomic_store_n( &ring->head, head+1, __ATOMIC_SEQ_CST );
+	
+	// The consumer may have gone to sleep waiting for this
+	if (__atomic_load_n( &ring->waiting, __ATOMIC_SEQ_CST ))
+		futex_wake( &ring->head );
+	
+	return 0;
+}
+
+
+void* spsc_ring_pop( spsc_ring_t* ring )
+{
+	unsigned int tail = __atomic_load_n( &ring->tail, __ATOMIC_RELAXED );
+	unsigned int head = __atomic_load_n( &ring->head, __ATOMIC_ACQUIRE );
+	void *item = NULL;
+	
+	if (head == tail) return NULL;
+	
+	item = ring->slots[tail & ring->mask];
+	__atomic_store_n( &ring->tail, tail+1, __ATOMIC_SEQ_CST );
+	
+	// The producer may have gone to sleep waiting for space
+	if (__atomic_load_n( &ring->waiting, __ATOMIC_SEQ_CST ))
+		futex_wake( &ring->tail );
+	
+	return item;
+}
+
+
+void spsc_ring_push_wait( spsc_ring_t* ring, void* item )
+{
+	int spin = 0;
+	
+	while (spsc_ring_push( ring, item )) {
+		unsigned int tail = __atomic_load_n( &ring->tail, __ATOMIC_SEQ_CST );
+		
+		if (spin++ < SPSC_RING_SPIN) continue;
+		
+		// Announce that we are going to sleep, then check again,
+		// so that a pop in between can't be missed
+		__atomic_store_n( &ring->waiting, 1, __ATOMIC_SEQ_CST );
+		if (__atomic_load_n( &ring->head, __ATOMIC_SEQ_CST ) - tail > ring->mask)
+			futex_wait( &ring->tail, tail );
+		__atomic_store_n( &ring->waiting, 0, __ATOMIC_SEQ_CST );
+	}
+}
+
+
+void* spsc_ring_pop_wait( spsc_ring_t* ring )
+{
+	void *item = NULL;
+	int spin = 0;
+	
+	while ((item = spsc_ring_pop( ring )) == NULL) {
+		unsigned int head = __atomic_load_n( &ring->head, __ATOMIC_SEQ_CST );
+		
+		if (spin++ < SPSC_RING_SPIN) continue;
+		
+		__atomic_store_n( &ring->waiting, 1, __ATOMIC_SEQ_CST );
+		if (head == __atomic_load_n( &ring->tail, __ATOMIC_SEQ_CST ))
+			futex_wait( &ring->head, head );
+		__atomic_store_n( &ring->waiting, 0, __ATOMIC_SEQ_CST );
+	}
+	
+	return item;
+}
+
+
+void spsc_ring_free( spsc_ring_t* ring )
+{
+	free( ring->slots );
+	free( ring );
+}
@@ -0,0 +1,70 @@
+/*
+
+	spsc_ring.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _SPSC_RING_H
+#define _SPSC_RING_H
+
+
+/*
+	Bounded single-producer, single-consumer ring of pointers
+
+	One thread pushes and one other thread pops, with no locks.
+	The indexes are free-running, and the capacity is a power of two.
+	The _wait() versions sleep on a futex while the ring is full or
+	empty, and are woken by the other side.
+*/
+typedef struct spsc_ring_s {
+
+	void** slots;
+	unsigned int mask;
+	
+	// Kept on separate cache lines, as each is written by a different thread
+	unsigned int head __attribute__((aligned(64)));		// Next slot to push into
+	unsigned int tail __attribute__((aligned(64)));		// Next slot to pop from
+	int waiting __attribute__((aligned(64)));			// A thread is asleep on head or tail
+
+} spsc_ring_t;
+
+
+// Create a ring that can hold at least size items
+spsc_ring_t* spsc_ring_new( unsigned int size );
+
+// Add an item to the ring
+// returns 0 on success, or -1 if it is full
+int spsc_ring_push( spsc_ring_t* ring, void* item );
+
+// Take the oldest item from the ring
+// returns NULL if it is empty
+void* spsc_ring_pop( spsc_ring_t* ring );
+
+// Add an item, waiting for space if the ring is full
+void spsc_ring_push_wait( spsc_ring_t* ring, void* item );
+
+// Take the oldest item, waiting for one if the ring is empty
+void* spsc_ring_pop_wait( spsc_ring_t* ring );
+
+void spsc_ring_free( spsc_ring_t* ring );
+
+
+
+#endif
@@ -29,304 +29,738 @@
 #include <unistd.h>
 #include <string.h>
 #include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 
 #include "ts2mpa.h"
+#include "ts_input.h"
+#include "ts_index.h"
+#include "ts_checkpoint.h"
+#include "ts_report.h"
+#include "ts_batch.h"
+#include "es_output.h"
+#include "es_segment.h"
 #include "mpa_header.h"
 
 int Quiet = 0;
 int Interrupted = 0;
+int DumpMetrics = 0;
 
 
+// Most input passed to ts2mpa_feed() in one go, so that an
+// interruption is noticed quickly even on a memory mapped file
+#define TS2MPA_FEED_SIZE		(16*TS_SCAN_BATCH*TS_PACKET_SIZE)
 
-// Check to see if a PES header looks like a valid MPEG Audio one
-static int validate_pes_header( int pid, unsigned char* buf_ptr, int buf_len )
-{
-	unsigned char stream_id = 0x00;
+// Start of a file read to find the first PTS of each stream, when
+// there is no index to seek with
+#define TS2MPA_TIME_PROBE		(4*1024*1024)
 
-	// Does it have the right magic?
-	if( PES_PACKET_SYNC_BYTE1(buf_ptr) != 0x00 ||
-	    PES_PACKET_SYNC_BYTE2(buf_ptr) != 0x00 ||
-	    PES_PACKET_SYNC_BYTE3(buf_ptr) != 0x01 )
-	{
-		if (!Quiet) fprintf(stderr, "ts2mpa: Invalid PES header (pid: %d).\n", pid);
-		return 0;
-	}
+// Seconds between checkpoints, while the input keeps coming
+#define TS2MPA_CHECKPOINT_INTERVAL	10
+
+
+// Extraction of one input, with libts2mpa doing the work
+typedef struct ts2mpa_cli_s {
 	
-	// Is it MPEG Audio?
-	stream_id = PES_PACKET_STREAM_ID(buf_ptr);
-	if (stream_id < 0xC0 || stream_id > 0xDF) {
-		if (!Quiet) fprintf(stderr, "ts2mpa: Ignoring non-mpegaudio stream (pid: %d, stream id: 0x%x).\n", pid, stream_id);
-		return 0;
+	ts2mpa_t* ts2mpa;
+
+	char* input_path;
+	ts_input_t* input;
+	char* output_path;			// As given, which is a template with -a
+	es_output_t* output;
+	char* output_template;
+	size_t batch_size;
+	int output_flags;			// ES_OUTPUT_* flags for each output
+	int input_flags;			// TS_INPUT_* flags
+	int jobs;					// Threads to extract with in parallel
+	int temp_outputs;			// Write each stream to a temporary file
+	unsigned long long end_offset;	// Stop at this offset, or 0 for the end of the input
+	char* metrics_path;			// Write metrics as JSON here, or NULL
+	int metrics_interval;		// Seconds between writing metrics, or 0
+	time_t metrics_written;
+	unsigned long udp_lost;			// RTP datagrams lost, that have been reported
+	
+	ts_index_t* index;				// Index being written, instead of extracting
+	char* report_path;				// Report on the input here, instead of extracting, or NULL
+	ts_report_t* report;
+	long long start_time;			// Time into the recording to extract from (in PTS ticks)
+	long long end_time;				// Time to stop extracting at, or -1
+	long long* pts_origin;			// First PTS of each PID, or -1, with a time range
+	long long* elapsed;				// Time into the recording of each PID, or -1
+	long long first_origin;			// For PIDs that weren't seen before seeking, or -1
+	unsigned long time_skipped;		// ES bytes outside the time range
+	int time_done;					// Every stream is past the end time
+	
+	double segment_duration;		// Split the output into segments this long (seconds), or 0
+	unsigned long long segment_bytes;	// or this big, or 0
+	char* playlist_path;			// Keep a playlist of the segments here, or NULL
+	unsigned long playlist_window;	// Only list this many of the latest segments, or 0
+	
+	char* checkpoint_path;			// Keep a checkpoint here, or NULL
+	ts_checkpoint_t* checkpoint;	// To carry on from, or NULL
+	time_t checkpoint_written;
+	unsigned long long checkpoint_offset;	// Of the last checkpoint written
+	int warming_up;					// Getting back to a checkpoint, without writing anything
+
+	const unsigned char* feed_buf;	// Input being fed in, that output may point into
+	size_t feed_len;
+	
+	ts_batch_t* batch;				// Many inputs to extract, instead of one, or NULL
+	int batch_threads;				// Threads to extract them on
+	char* batch_list;				// File listing more of them ('-' for stdin), or NULL
+
+} ts2mpa_cli_t;
+
+
+
+// Open an unnamed temporary file to write a stream to
+static es_output_t* open_temp_output( ts2mpa_cli_t *cli )
+{
+	const char *dir = getenv("TMPDIR");
+	char path[FILENAME_MAX];
+	es_output_t *output = NULL;
+	int fd = -1;
+	
+	snprintf( path, sizeof(path), "%s/ts2mpa-XXXXXX", dir ? dir : "/tmp" );
+	fd = mkstemp( path );
+	if (fd >= 0) {
+		unlink( path );
+		output = es_output_fdopen( fd, cli->batch_size, 0 );
+	}
+	if (output==NULL) {
+		perror("ts2mpa: Failed to create temporary file");
+		exit(-2);
 	}
+	
+	return output;
+}
 
-	// Check PES Extension header 
-	if( PES_PACKET_SYNC_CODE(buf_ptr) != 0x2 )
-	{
-		if (!Quiet) fprintf(stderr, "ts2mpa: Invalid sync code PES extension header (pid: %d, stream id: 0x%x).\n", pid, stream_id);
+
+// Callback for a new stream: choose where it is written to
+static int cli_new_stream( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream )
+{
+	ts2mpa_cli_t *cli = ts2mpa->user;
+	es_output_t *output = NULL;
+	
+	if (cli->report) {
+		// Only reported on, not written out
+		stream->user = ts_report_add_stream( cli->report, stream->pid, stream->pes_stream_id );
+		if (stream->user==NULL) {
+			perror("Failed to allocate memory for ts_report_stream_t");
+			exit(-3);
+		}
+		return 0;
+	} else if (cli->warming_up) {
+		// Outputs are opened once the checkpoint has been got back to
+		output = NULL;
+	} else if (cli->temp_outputs) {
+		// Stitched into the real output afterwards
+		output = open_temp_output( cli );
+	} else if (cli->segment_duration || cli->segment_bytes) {
+		es_segment_t *segment = es_segment_open( cli->output_template, stream->pid, stream->pes_stream_id,
+		                                         cli->segment_duration, cli->segment_bytes,
+		                                         cli->playlist_path, cli->playlist_window,
+		                                         cli->batch_size, cli->output_flags );
+		if (segment==NULL) {
+			perror("ts2mpa: Failed to open output segment");
+			exit(-2);
+		}
+		if (!Quiet) fprintf(stderr, "ts2mpa: Writing pid %d, stream id 0x%x to segments starting with %s\n", stream->pid, stream->pes_stream_id, segment->path);
+		stream->user = segment;
 		return 0;
+	} else if (ts2mpa->demux_all) {
+		char filename[FILENAME_MAX];
+		
+		// Each stream gets its own output file
+		es_output_expand_template( cli->output_template, stream->pid, stream->pes_stream_id, filename, sizeof(filename) );
+		output = es_output_open( filename, cli->batch_size, cli->output_flags );
+		if (output==NULL) {
+			perror("ts2mpa: Failed to open output file");
+			exit(-2);
+		}
+		if (output->splice) cli->input->no_reuse = 1;
+		if (!Quiet) fprintf(stderr, "ts2mpa: Writing pid %d, stream id 0x%x to %s\n", stream->pid, stream->pes_stream_id, filename);
+	} else {
+		output = cli->output;
 	}
+	
+	stream->user = output;
+	return 0;
+}
 
-	// Reject scrambled packets
-	if( PES_PACKET_SCRAMBLED(buf_ptr) )
-	{
-		if (!Quiet) fprintf(stderr, "ts2mpa: PES payload is scrambled (pid: %d, stream id: 0x%x).\n", pid, stream_id);
+
+// Is a stream outside the time range asked for, at the moment?
+static int outside_time_range( ts2mpa_cli_t *cli, ts2mpa_stream_t *stream )
+{
+	long long elapsed;
+	
+	if (cli->elapsed == NULL) return 0;
+	
+	elapsed = cli->elapsed[stream->pid];
+	return elapsed == -1 || elapsed < cli->start_time ||
+	       (cli->end_time != -1 && elapsed >= cli->end_time);
+}
+
+
+// Callback for ES data: queue it up, to be written out in batches
+static int cli_es_data( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, const unsigned char *data, size_t len )
+{
+	ts2mpa_cli_t *cli = ts2mpa->user;
+	int in_feed, result;
+	
+	// Already written before the checkpoint
+	if (cli->warming_up) return 0;
+	
+	if (outside_time_range( cli, stream )) {
+		// Not written, so not counted as written either
+		stream->total_bytes -= len;
+		ts2mpa->total_bytes -= len;
+		ts2mpa->pids[stream->pid]->counters.bytes -= len;
+		ts2mpa->counters.bytes -= len;
+		cli->time_skipped += len;
 		return 0;
 	}
+	
+	// Data from anywhere but the input buffer is gone once we return
+	in_feed = data >= cli->feed_buf && data+len <= cli->feed_buf+cli->feed_len;
+	if (cli->segment_duration || cli->segment_bytes) {
+		if (in_feed) result = es_segment_write( stream->user, data, len );
+		else result = es_segment_write_copy( stream->user, data, len );
+	} else {
+		if (in_feed) result = es_output_write( stream->user, data, len );
+		else result = es_output_write_copy( stream->user, data, len );
+	}
+	
+	if (result) {
+		perror("Error: failed to write stream out");
+		exit(-2);
+	}
 
-	// It is valid
-	return 1;
+	return 0;
 }
 
 
-// Extract the PES payload and send it to the output file
-static void extract_pes_payload( ts2mpa_t *ts2mpa, unsigned char *pes_ptr, size_t pes_len, int start_of_pes ) 
+// Callback for the start of each frame, when splitting the output
+// into segments: start a new segment first, if it is time to
+static int cli_frame_start( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, size_t len )
 {
-	unsigned char* es_ptr=NULL;
-	size_t es_len=0;
+	ts2mpa_cli_t *cli = ts2mpa->user;
 	
+	if (outside_time_range( cli, stream )) return 0;
 	
-	// Start of a PES header?
-	if ( start_of_pes ) {
-		unsigned int pes_total_len = PES_PACKET_LEN(pes_ptr);
-		size_t pes_header_len = PES_PACKET_HEAD_LEN(pes_ptr);
-		unsigned char stream_id = PES_PACKET_STREAM_ID(pes_ptr);
+	if (es_segment_frame( stream->user, len, stream->mpah.samples, stream->mpah.samplerate )) {
+		perror("ts2mpa: Failed to start the next output segment");
+		exit(-2);
+	}
 	
-		// Check that it has a valid header
-		if (!validate_pes_header( ts2mpa->pid, pes_ptr, pes_len )) return;
-		
-		// Stream IDs in range 0xC0-0xDF are MPEG audio
-		if( stream_id != ts2mpa->pes_stream_id )
-		{	
-			if (ts2mpa->pes_stream_id == -1) {
-				// keep the first stream we see
-				ts2mpa->pes_stream_id = stream_id;	
-				if (!Quiet)
-					fprintf(stderr, "ts2mpa: Found valid PES audio packet (offset: 0x%lx, pid: %d, stream id: 0x%x, length: %u)\n",
-									((unsigned long)ts2mpa->total_packets-1)*TS_PACKET_SIZE, ts2mpa->pid, stream_id, pes_total_len);
-			} else {
-				if (!Quiet)
-					fprintf(stderr, "ts2mpa: Ignoring additional audio stream ID 0x%x (pid: %d).\n",
-							stream_id, ts2mpa->pid);
-				return;
-			}
+	return 0;
+}
+
+
+// Callback for the start of each frame, when reporting on the streams
+static int cli_report_frame( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, size_t len )
+{
+	ts_report_frame( stream->user, &stream->mpah, len, ts2mpa->packet_offset );
+	return 0;
+}
+
+
+// Callback for a PES packet with a PTS: index it, report it, or keep
+// track of how far into the recording its stream has got
+static void cli_pes_pts( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream )
+{
+	ts2mpa_cli_t *cli = ts2mpa->user;
+	ts2mpa_stream_t *other = NULL;
+	long long origin, near;
+	int pid = stream->pid;
+	
+	if (cli->report) {
+		ts_report_pts( stream->user, stream->pts );
+		return;
+	}
+	if (cli->index) {
+		if (ts_index_add( cli->index, pid, stream->pes_stream_id, stream->pts, ts2mpa->packet_offset )) {
+			perror("ts2mpa: Failed to write index");
+			exit(-2);
 		}
+		return;
+	}
+	if (cli->elapsed == NULL) return;
 	
-		// Store the length of the PES packet payload
-		ts2mpa->pes_remaining = pes_total_len - (2+pes_header_len);
+	// Time is counted from the first PTS on each PID
+	if (cli->pts_origin[pid] == -1)
+		cli->pts_origin[pid] = cli->first_origin != -1 ? cli->first_origin : stream->pts;
+	origin = cli->pts_origin[pid];
 	
-		// Keep pointer to ES data in this packet
-		es_ptr = pes_ptr+(9+pes_header_len);
-		es_len = pes_len-(9+pes_header_len);
+	// Unwrap it near the last one, or near where we seeked to
+	near = origin + (cli->elapsed[pid] != -1 ? cli->elapsed[pid] : cli->start_time);
+	cli->elapsed[pid] = ts2mpa_pts_unwrap( stream->pts, near ) - origin;
+	
+	// Nothing more to extract, once every stream is past the end
+	if (cli->end_time != -1 && cli->elapsed[pid] >= cli->end_time) {
+		cli->time_done = 1;
+		for (other = ts2mpa->stream_list; other; other = other->list_next) {
+			if (cli->elapsed[other->pid] < cli->end_time) cli->time_done = 0;
+		}
+	}
+}
+
+
+// Callback for a stream gaining sync
+static void cli_frame_header( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, const mpa_header_t *mpah )
+{
+	ts2mpa_cli_t *cli = ts2mpa->user;
 	
+	if (cli->report && !stream->never_synced)
+		ts_report_event( stream->user, TS_REPORT_REGAINED, ts2mpa->packet_offset );
+	if (Quiet) return;
+
+	if (stream->never_synced) {
+		fprintf(stderr, "ts2mpa: ");
+		mpa_header_print( (mpa_header_t*)mpah );
+		fprintf(stderr, "ts2mpa: MPEG Audio Framesize: %d bytes\n", mpah->framesize);
+	} else {
+		fprintf(stderr, "ts2mpa: Regained sync at 0x%llx\n", ts2mpa->packet_offset);
+	}
+}
+
+
+// Callback for a stream losing sync, when reporting on the streams
+static void cli_sync_lost( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, int unconfirmed )
+{
+	ts_report_event( stream->user, unconfirmed ? TS_REPORT_UNCONFIRMED : TS_REPORT_LOST,
+	                 ts2mpa->packet_offset );
+}
+
+
+static void cli_message( ts2mpa_t *ts2mpa, int level, const char *text )
+{
+	if (!Quiet || level == TS2MPA_ERROR)
+		fprintf(stderr, "ts2mpa: %s\n", text);
+}
+
+
+// libts2mpa gave up, which only happens if it ran out of memory
+static void extract_failed( ts2mpa_t *ts2mpa )
+{
+	errno = ts2mpa->error;
+	perror("ts2mpa: Failed to extract audio");
+	exit(ts2mpa->error == ENOMEM ? -3 : -2);
+}
+
 
-	} else if (ts2mpa->pes_stream_id) {
+// Write out all the data queued for every stream
+static void flush_outputs( ts2mpa_cli_t *cli )
+{
+	ts2mpa_stream_t *stream = NULL;
 	
-		// Only output data once we have seen a PES header
-		es_ptr = pes_ptr;
-		es_len = pes_len;
+	// Streams that are only reported on have no outputs
+	if (cli->report) return;
 	
-		// Are we are the end of the PES packet?
-		if (es_len>ts2mpa->pes_remaining) {
-			es_len=ts2mpa->pes_remaining;
-		}
+	for (stream = cli->ts2mpa->stream_list; stream; stream = stream->list_next) {
+		int result;
 		
+		if (stream->user==NULL) continue;
+		if (cli->segment_duration || cli->segment_bytes)
+			result = es_segment_flush( stream->user );
+		else
+			result = es_output_flush( stream->user );
+		if (result) {
+			perror("Error: failed to write stream out");
+			exit(-2);
+		}
 	}
+}
+
 
+/*
+	Marks of the state of every stream at a point in the input, for
+	joining up parallel chunks and for checkpoints
+*/
+
+// Put stream marks in a fixed order
+static int compare_marks( const void *a, const void *b )
+{
+	const ts2mpa_mark_t *ma = a, *mb = b;
 	
-	// Got some data to write out?
-	if (es_ptr) {
-		
-		// Subtract the amount remaining in current PES packet
-		ts2mpa->pes_remaining -= es_len;
+	if (ma->pid != mb->pid) return ma->pid - mb->pid;
+	return ma->pes_stream_id - mb->pes_stream_id;
+}
+
+
+// Record the state of every stream
+// returns the number of marks
+static int mark_streams( ts2mpa_t *ts2mpa, ts2mpa_mark_t **marks, uint32_t *watch_map )
+{
+	ts2mpa_stream_t *stream = NULL;
+	int count = 0;
+	int pid;
 	
-		// Scan through Elementary Stream (ES) 
-		// and try and find MPEG audio stream header
-		while (!ts2mpa->synced && es_len>=4) {
+	*marks = calloc( ts2mpa->stream_count+1, sizeof(ts2mpa_mark_t) );
+	if (*marks==NULL) {
+		perror("Failed to allocate memory for ts2mpa_mark_t");
+		exit(-3);
+	}
+	
+	for (stream = ts2mpa->stream_list; stream; stream = stream->list_next) {
+		ts2mpa_pid_t *ts_pid = ts2mpa->pids[stream->pid];
+		ts2mpa_mark_t *mark = &(*marks)[count++];
 		
-			// Valid header?
-			if (mpa_header_parse(es_ptr, &ts2mpa->mpah)) {
-
-				// Looks good, we have gained sync.
-				if (!Quiet) {
-				  if (ts2mpa->never_synced) {
-            fprintf(stderr, "ts2mpa: ");
-            mpa_header_print( &ts2mpa->mpah );
-            fprintf(stderr, "ts2mpa: MPEG Audio Framesize: %d bytes\n", ts2mpa->mpah.framesize);
-          } else {
-            fprintf(stderr, "ts2mpa: Regained sync at 0x%lx\n", ((unsigned long)ts2mpa->total_packets-1)*TS_PACKET_SIZE);
-          }
-				}
-				ts2mpa->synced = 1;
-				ts2mpa->never_synced = 0;
+		mark->pid = stream->pid;
+		mark->pes_stream_id = stream->pes_stream_id;
+		mark->continuity_count = ts_pid->continuity_count;
+		mark->current_stream_id = ts_pid->current ? ts_pid->current->pes_stream_id : -1;
+		mark->synced = stream->synced;
+		mark->pes_remaining = stream->pes_remaining;
+		mark->carry_len = stream->carry_len;
+		memcpy( mark->carry, stream->carry, stream->carry_len );
+		mark->frame_left = stream->frame_left;
+		mark->frame_header_len = stream->frame_header_len;
+		memcpy( mark->frame_header, stream->frame_header, stream->frame_header_len );
+		mark->frame_len = stream->frame_len;
+		mark->confirming = stream->confirming;
+		mark->predicted = stream->predicted;
+		mark->resume_skip = stream->resume_skip;
+		mark->total_bytes = stream->total_bytes;
+		mark->counters = ts_pid->counters;
+	}
+	qsort( *marks, count, sizeof(ts2mpa_mark_t), compare_marks );
+	
+	// PIDs that might still have streams found on them
+	for (pid=0; pid<TS_PID_COUNT; pid++) {
+		if (ts2mpa->pids[pid] || TS_PID_MAP_TEST( ts2mpa->pid_map, pid ))
+			TS_PID_MAP_SET( watch_map, pid );
+		else
+			TS_PID_MAP_CLEAR( watch_map, pid );
+	}
+	
+	return count;
+}
 
-			} else {
-				// Skip byte
-				es_len--;
-				es_ptr++;
-			}
-		}
-		
-		
-		// If stream is synced then write the data out
-		if (ts2mpa->synced && es_len > 0) {
-			int written = 0;
-			
-			// Write out the data
-			written = fwrite( es_ptr, es_len, 1, ts2mpa->output );
-			if (written<=0) {
-				perror("Error: failed to write stream out");
-				exit(-2);
-			}
-			ts2mpa->total_bytes += written;
-		}
+
+// Has ts2mpa stopped cleanly between two packets at offset?
+static int stopped_at( ts2mpa_t *ts2mpa, unsigned long long offset )
+{
+	return ts2mpa->offset == offset && ts2mpa->pending_len == 0 && !ts2mpa->resyncing;
+}
+
+
+// Is the state of the streams the same as in some marks?
+static int marks_match( ts2mpa_t *ts2mpa, const ts2mpa_mark_t *with, int with_count, const uint32_t *with_watch_map )
+{
+	uint32_t watch_map[TS_PID_MAP_WORDS];
+	ts2mpa_mark_t *marks = NULL;
+	int count, i;
+	int matches = 1;
+	
+	count = mark_streams( ts2mpa, &marks, watch_map );
+	if (count != with_count) matches = 0;
+	for (i=0; i<count && matches; i++) {
+		const ts2mpa_mark_t *a = &marks[i], *b = &with[i];
+		if (a->pid != b->pid || a->pes_stream_id != b->pes_stream_id ||
+		    a->continuity_count != b->continuity_count ||
+		    a->current_stream_id != b->current_stream_id ||
+		    a->synced != b->synced || a->pes_remaining != b->pes_remaining ||
+		    a->carry_len != b->carry_len || memcmp( a->carry, b->carry, a->carry_len ) ||
+		    a->frame_left != b->frame_left || a->frame_len != b->frame_len ||
+		    a->confirming != b->confirming ||
+		    a->frame_header_len != b->frame_header_len ||
+		    memcmp( a->frame_header, b->frame_header, a->frame_header_len ) ||
+		    a->predicted != b->predicted || (a->predicted && a->resume_skip != b->resume_skip))
+			matches = 0;
 	}
+	
+	// Could a stream turn up in one but not the other?
+	if (ts2mpa->demux_all && memcmp( watch_map, with_watch_map, sizeof(watch_map) ))
+		matches = 0;
+	
+	free( marks );
+	return matches;
+}
 
+
+// Write the metrics out, replacing the file atomically so that
+// anything watching it never sees half of it
+static void write_metrics( ts2mpa_cli_t *cli )
+{
+	char tmp_path[FILENAME_MAX];
+	FILE *file = NULL;
+	
+	cli->metrics_written = time( NULL );
+	
+	if (strcmp( cli->metrics_path, "-" ) == 0) {
+		ts2mpa_write_stats( cli->ts2mpa, stderr );
+		return;
+	}
+	
+	snprintf( tmp_path, sizeof(tmp_path), "%s.tmp", cli->metrics_path );
+	file = fopen( tmp_path, "w" );
+	if (file==NULL) {
+		perror("ts2mpa: Failed to open metrics file");
+		return;
+	}
+	if (ts2mpa_write_stats( cli->ts2mpa, file ) | fclose( file ) ||
+	    rename( tmp_path, cli->metrics_path ))
+	{
+		perror("ts2mpa: Failed to write metrics file");
+		unlink( tmp_path );
+	}
 }
 
 
+// Write the report on the input, replacing the file atomically
+// returns 0 on success, or -1 on failure
+static int write_report( ts2mpa_cli_t *cli )
+{
+	char tmp_path[FILENAME_MAX];
+	FILE *file = NULL;
+	int err;
+	
+	if (strcmp( cli->report_path, "-" ) == 0) {
+		if (ts_report_write( cli->report, cli->ts2mpa, cli->input_path, stdout ) | fflush( stdout ))
+			return -1;
+		return 0;
+	}
+	
+	snprintf( tmp_path, sizeof(tmp_path), "%s.tmp", cli->report_path );
+	file = fopen( tmp_path, "w" );
+	if (file==NULL) return -1;
+	if (ts_report_write( cli->report, cli->ts2mpa, cli->input_path, file ) | fclose( file ) ||
+	    rename( tmp_path, cli->report_path ))
+	{
+		err = errno;
+		unlink( tmp_path );
+		errno = err;
+		return -1;
+	}
+	
+	return 0;
+}
+
 
-static void ts_continuity_check( ts2mpa_t *ts2mpa, int ts_cc ) 
+// Warn about datagrams lost from a udp:// or rtp:// input since last time
+static void report_udp_losses( ts2mpa_cli_t *cli )
 {
-	if (ts2mpa->continuity_count != ts_cc) {
+	udp_input_t *udp = cli->input->udp;
 	
-		// Only display an error after we gain sync
-		if (ts2mpa->synced) {
-			if (!Quiet) {
-			  fprintf(stderr, "ts2mpa: Warning, TS continuity error at 0x%lx\n",
-			    ((unsigned long)ts2mpa->total_packets-1)*TS_PACKET_SIZE);
-			}
-			ts2mpa->synced=0;
-		}
-		ts2mpa->continuity_count = ts_cc;
+	if (udp->lost != cli->udp_lost) {
+		if (!Quiet) fprintf(stderr, "ts2mpa: Warning, RTP sequence gap: %lu datagram(s) lost\n", udp->lost - cli->udp_lost);
+		cli->udp_lost = udp->lost;
 	}
+}
+
 
-	ts2mpa->continuity_count++;
-	if (ts2mpa->continuity_count==16)
-		ts2mpa->continuity_count=0;
+// Write a checkpoint, once everything before it has been written out.
+// It can only be taken between two packets, so is left until next
+// time if the input stopped part way through one.
+static void save_checkpoint( ts2mpa_cli_t *cli )
+{
+	ts2mpa_t *ts2mpa = cli->ts2mpa;
+	ts_checkpoint_t checkpoint;
+	
+	cli->checkpoint_written = time( NULL );
+	if (!stopped_at( ts2mpa, ts2mpa->offset ) || ts2mpa->offset == cli->checkpoint_offset)
+		return;
+	
+	flush_outputs( cli );
+	
+	bzero( &checkpoint, sizeof(checkpoint) );
+	checkpoint.input_path = cli->input_path;
+	checkpoint.output_path = cli->output_path;
+	checkpoint.pid = ts2mpa->pid;
+	checkpoint.pes_stream_id = ts2mpa->pes_stream_id;
+	checkpoint.demux_all = ts2mpa->demux_all;
+	checkpoint.offset = ts2mpa->offset;
+	checkpoint.total_packets = ts2mpa->total_packets;
+	checkpoint.total_bytes = ts2mpa->total_bytes;
+	checkpoint.total_skipped = ts2mpa->total_skipped;
+	checkpoint.ts_sync_losses = ts2mpa->ts_sync_losses;
+	checkpoint.counters = ts2mpa->counters;
+	checkpoint.mark_count = mark_streams( ts2mpa, &checkpoint.marks, checkpoint.watch_map );
+	
+	if (ts_checkpoint_write( cli->checkpoint_path, &checkpoint ))
+		perror("ts2mpa: Failed to write checkpoint");
+	else
+		cli->checkpoint_offset = ts2mpa->offset;
+	
+	free( checkpoint.marks );
 }
 
 
+// Write the metrics if asked for them with SIGUSR1, or if it is time to
+static void check_metrics( ts2mpa_cli_t *cli )
+{
+	if (cli->metrics_path && (DumpMetrics || (cli->metrics_interval &&
+	    time( NULL ) - cli->metrics_written >= cli->metrics_interval)))
+	{
+		DumpMetrics = 0;
+		write_metrics( cli );
+	}
+}
 
-static void process_ts_packets( ts2mpa_t *ts2mpa )
+
+// Feed the input into libts2mpa, up to the end of the chunk or input
+static void extract_input( ts2mpa_cli_t *cli )
 {
-	unsigned char buf[TS_PACKET_SIZE];
-	unsigned char* pes_ptr=NULL;
-	size_t pes_len;
-	size_t count;
+	ts2mpa_t *ts2mpa = cli->ts2mpa;
+	unsigned char* buf=NULL;
+	size_t avail;
 
-	while ( !Interrupted ) {
-		
-		count = fread(buf, TS_PACKET_SIZE, 1, ts2mpa->input);
-		if (count==0) break;
-		ts2mpa->total_packets++;
+	while ( !Interrupted && !cli->time_done ) {
+	
+		// Only feed in what comes before the end of a chunk
+		if (cli->end_offset && cli->input->offset >= cli->end_offset) return;
 		
-		// Check the sync-byte
-		if (TS_PACKET_SYNC_BYTE(buf) != 0x47) {
-			fprintf(stderr,"ts2mpa: Lost Transport Stream syncronisation - aborting (offset: 0x%lx).\n",
-			  ((unsigned long)ts2mpa->total_packets-1)*TS_PACKET_SIZE);
-			// FIXME: try and re-gain synchronisation
+		// Get the next block of packets from the input buffer
+		avail = ts_input_peek( cli->input, &buf, TS_PACKET_SIZE );
+		if (cli->input->udp) report_udp_losses( cli );
+		if (avail == 0) {
+			// A network input has gone quiet, or a file being followed
+			// hasn't grown, but neither has ended; a good time for a
+			// checkpoint, with everything there is written out
+			if ((cli->input->udp || cli->input->follow) && !cli->input->eof) {
+				if (cli->checkpoint_path && !cli->warming_up) save_checkpoint( cli );
+				check_metrics( cli );
+				continue;
+			}
 			break;
 		}
+		if (cli->end_offset && avail > cli->end_offset - cli->input->offset)
+			avail = cli->end_offset - cli->input->offset;
+		if (avail > TS2MPA_FEED_SIZE) avail = TS2MPA_FEED_SIZE;
 
-		// Check packet validity
-		if (TS_PACKET_PID(buf) == ts2mpa->pid || ts2mpa->pid == -1) {
-      // Scrambled?
-      if ( TS_PACKET_SCRAMBLING(buf) ) {
-        if (!Quiet) fprintf(stderr, "ts2mpa: Warning, PID %d is scrambled.\n", TS_PACKET_PID(buf));
-        continue;
-      }	
+		cli->feed_buf = buf;
+		cli->feed_len = avail;
+		if (ts2mpa_feed( ts2mpa, buf, avail )) extract_failed( ts2mpa );
+		ts_input_consume( cli->input, avail );
 		
-      // Transport error?
-		  if ( TS_PACKET_TRANS_ERROR(buf) ) {
-        if (!Quiet) fprintf(stderr, "ts2mpa: Warning, transport error at 0x%lx\n", ((unsigned long)ts2mpa->total_packets-1)*TS_PACKET_SIZE);
-        ts2mpa->synced = 0;
-		    continue;
-      }
- 		}
-
-		// Location of and size of PES payload
-		pes_ptr = &buf[4];
-		pes_len = TS_PACKET_SIZE - 4;
-
-		// Check for adaptation field?
-		if (TS_PACKET_ADAPTATION(buf)==0x1) {
-			// Payload only, no adaptation field
-		} else if (TS_PACKET_ADAPTATION(buf)==0x2) {
-			// Adaptation field only, no payload
-			continue;
-		} else if (TS_PACKET_ADAPTATION(buf)==0x3) {
-			// Adaptation field AND payload
-			pes_ptr += (TS_PACKET_ADAPT_LEN(buf) + 1);
-			pes_len -= (TS_PACKET_ADAPT_LEN(buf) + 1);
-		}
-
-		// Check we know about the payload
-		if (TS_PACKET_PID(buf) == 0x1FFF) {
-			// Ignore NULL package
-			continue;
-		}
-		
-		// No chosen PID yet?
-		if (ts2mpa->pid == -1 && TS_PACKET_PAYLOAD_START(buf)) {
-
-			// Does this one look good ?
-			if (TS_PACKET_PAYLOAD_START(buf) && 
-			    validate_pes_header( TS_PACKET_PID(buf), pes_ptr, pes_len ))
-			{
-				// Looks good, use this one
-				ts2mpa->pid = TS_PACKET_PID(buf);
-			}
-		}
-
-		// Process the packet, if it is the PID we are interested in		
-		if (TS_PACKET_PID(buf) == ts2mpa->pid) {
+		// Queued output points into the input buffer, so must be
+		// written out before the buffer is re-used
+		if (!cli->input->map)
+			flush_outputs( cli );
 		
-			// Continuity check
-			ts_continuity_check( ts2mpa, TS_PACKET_CONT_COUNT(buf) );
+		check_metrics( cli );
 		
-			// Extract PES payload and write it to output
-			extract_pes_payload( ts2mpa, pes_ptr, pes_len, TS_PACKET_PAYLOAD_START(buf) );
-		}
-
+		if (cli->checkpoint_path && !cli->warming_up &&
+		    time( NULL ) - cli->checkpoint_written >= TS2MPA_CHECKPOINT_INTERVAL)
+			save_checkpoint( cli );
 	}
 
-	
+	// Before what is left over is dealt with, which can't be carried on from
+	if (cli->checkpoint_path && !cli->warming_up) save_checkpoint( cli );
+
+	if (!Interrupted && ts2mpa_finish( ts2mpa )) extract_failed( ts2mpa );
 }
 
-static ts2mpa_t * init_ts2mpa_t()
+
+static ts2mpa_cli_t * init_ts2mpa_cli_t()
 {
-	ts2mpa_t *ts2mpa = malloc( sizeof(ts2mpa_t) );
-	if (ts2mpa==NULL) {
-		perror("Failed to allocate memory for ts2mpa_t");
+	ts2mpa_cli_t *cli = malloc( sizeof(ts2mpa_cli_t) );
+	if (cli==NULL) {
+		perror("Failed to allocate memory for ts2mpa_cli_t");
 		exit(-3);
 	}
 	
 	// Zero the memory
-	bzero( ts2mpa, sizeof(ts2mpa_t) );
+	bzero( cli, sizeof(ts2mpa_cli_t) );
+
+	cli->ts2mpa = ts2mpa_new();
+	if (cli->ts2mpa==NULL) {
+		perror("Failed to allocate memory for ts2mpa_t");
+		exit(-3);
+	}
+	cli->ts2mpa->user = cli;
+	cli->ts2mpa->new_stream = cli_new_stream;
+	cli->ts2mpa->es_data = cli_es_data;
+	cli->ts2mpa->frame_header = cli_frame_header;
+	cli->ts2mpa->message = cli_message;
+	cli->ts2mpa->pes_pts = cli_pes_pts;
 	
 	// Initialise defaults
-	ts2mpa->input = NULL;
-	ts2mpa->output = NULL;
-	ts2mpa->pid = -1;
-	ts2mpa->synced = 0;
-	ts2mpa->never_synced = 1;
-	ts2mpa->continuity_count = -1;
-	ts2mpa->pes_stream_id = -1;
-	ts2mpa->pes_remaining = 0;
-	ts2mpa->total_bytes = 0;
-	ts2mpa->total_packets = 0;
+	cli->input = NULL;
+	cli->output_path = NULL;
+	cli->output = NULL;
+	cli->output_template = NULL;
+	cli->batch_size = ES_OUTPUT_BATCH_SIZE;
+	cli->output_flags = 0;
+	cli->input_flags = 0;
+	cli->jobs = 1;
+	cli->temp_outputs = 0;
+	cli->end_offset = 0;
+	cli->metrics_path = NULL;
+	cli->metrics_interval = 0;
+	cli->metrics_written = 0;
+	cli->udp_lost = 0;
+	cli->index = NULL;
+	cli->report_path = NULL;
+	cli->report = NULL;
+	cli->start_time = 0;
+	cli->end_time = -1;
+	cli->pts_origin = NULL;
+	cli->elapsed = NULL;
+	cli->first_origin = -1;
+	cli->time_skipped = 0;
+	cli->time_done = 0;
+	cli->segment_duration = 0;
+	cli->segment_bytes = 0;
+	cli->playlist_path = NULL;
+	cli->playlist_window = 0;
+	cli->checkpoint_path = NULL;
+	cli->checkpoint = NULL;
+	cli->checkpoint_written = 0;
+	cli->checkpoint_offset = 0;
+	cli->warming_up = 0;
+	cli->feed_buf = NULL;
+	cli->feed_len = 0;
+	cli->batch = NULL;
+	cli->batch_threads = 0;
+	cli->batch_list = NULL;
 
-	return ts2mpa;
+	return cli;
 }
 
 
 static void usage()
 {
 	fprintf( stderr, "Usage: ts2mpa [options] <infile> <outfile>\n" );
+	fprintf( stderr, "       ts2mpa -B <threads> [options] <infile>... <outfile>\n" );
+	fprintf( stderr, "    <infile> is a file (which can be compressed with gzip or zstd), - for stdin,\n" );
+	fprintf( stderr, "    or udp://[[source@]address]:port or rtp://[[source@]address]:port to\n" );
+	fprintf( stderr, "    receive a (multicast) stream.\n" );
 	fprintf( stderr, "    -h             Help - this message.\n" );
 	fprintf( stderr, "    -q             Quiet - don't print messages to stderr.\n" );
 	fprintf( stderr, "    -p <pid>       Choose a specific transport stream PID.\n" );
 	fprintf( stderr, "    -s <streamid>  Choose a specific PES stream ID.\n" );
+	fprintf( stderr, "    -b <bytes>     Size of batches written to the output (default %d).\n", ES_OUTPUT_BATCH_SIZE );
+	fprintf( stderr, "    -z             Use vmsplice() when writing to a pipe.\n" );
+	fprintf( stderr, "    -u             Use io_uring for reading and writing.\n" );
+	fprintf( stderr, "    -t             Read and write on separate threads.\n" );
+	fprintf( stderr, "    -j <jobs>      Extract a file in parallel chunks, on this many threads.\n" );
+	fprintf( stderr, "    -a             Extract all audio streams, to separate files.\n" );
+	fprintf( stderr, "                   <outfile> is a template containing %%pid and/or %%sid.\n" );
+	fprintf( stderr, "    -M <file>      Write metrics as JSON at exit and on SIGUSR1 ('-' for stderr).\n" );
+	fprintf( stderr, "    -i <secs>      Also write the metrics every few seconds.\n" );
+	fprintf( stderr, "    -I             Write a seek index of <infile> to <infile>%s, instead of extracting.\n", TS_INDEX_SUFFIX );
+	fprintf( stderr, "    -r <file>      Report on the audio streams in <infile> as JSON, instead of\n" );
+	fprintf( stderr, "                   extracting ('-' for stdout).\n" );
+	fprintf( stderr, "    -S <time>      Start this far into the recording ([[hh:]mm:]ss[.s]).\n" );
+	fprintf( stderr, "    -E <time>      Stop this far into the recording.\n" );
+	fprintf( stderr, "    -T <time>      Split the output into segments this long.\n" );
+	fprintf( stderr, "    -L <bytes>     Split the output into segments no bigger than this (k, M or G).\n" );
+	fprintf( stderr, "                   <outfile> is a template containing %%seq, for the segment number.\n" );
+	fprintf( stderr, "    -P <file>      Keep an M3U8 playlist of the segments.\n" );
+	fprintf( stderr, "    -W <count>     Only list the latest few segments in the playlist.\n" );
+	fprintf( stderr, "    -F <secs>      Follow a file that is still being written, until it\n" );
+	fprintf( stderr, "                   stops growing for this long (0 for ever).\n" );
+	fprintf( stderr, "    -C <file>      Keep a checkpoint, and carry on from it if it is there.\n" );
+	fprintf( stderr, "    -B <threads>   Extract many files, on this many threads. Each <infile> can\n" );
+	fprintf( stderr, "                   be a file, a directory of .ts files, or a glob pattern.\n" );
+	fprintf( stderr, "                   <outfile> is a template containing %%name, for the name of\n" );
+	fprintf( stderr, "                   each file without its extension. -M writes a summary.\n" );
+	fprintf( stderr, "    -l <file>      Also extract the files listed in this ('-' for stdin).\n" );
 	exit(-1);
 }
 
@@ -354,13 +788,185 @@ static int parse_value( char* str )
 }
 
 
-static void parse_cmd_line( ts2mpa_t *ts2mpa, int argc, char** argv )
+// Parse a size in bytes, which can end in k, M or G
+// returns it, or 0 if it isn't valid
+static unsigned long long parse_size( const char* str )
+{
+	unsigned long long size = 0;
+	char *end = NULL;
+	
+	size = strtoull( str, &end, 10 );
+	if (end == str) return 0;
+	switch (*end) {
+		case 'k': case 'K': size <<= 10; end++; break;
+		case 'M': size <<= 20; end++; break;
+		case 'G': size <<= 30; end++; break;
+	}
+	if (*end) return 0;
+	
+	return size;
+}
+
+
+// Parse a time in the form [[hh:]mm:]ss[.s]
+// returns it in PTS ticks, or -1 if it isn't valid
+static long long parse_time( const char* str )
+{
+	double seconds = 0, part;
+	char *end = NULL;
+	
+	while (1) {
+		part = strtod( str, &end );
+		if (end == str || part < 0) return -1;
+		seconds = seconds * 60 + part;
+		if (*end != ':') break;
+		str = end+1;
+	}
+	if (*end) return -1;
+	
+	return (long long)(seconds * TS2MPA_PTS_CLOCK + 0.5);
+}
+
+
+// Read the checkpoint, if there is one, and check that it is for the
+// same extraction
+static void load_checkpoint( ts2mpa_cli_t *cli, char* output_path )
+{
+	ts2mpa_t *ts2mpa = cli->ts2mpa;
+	ts_checkpoint_t *checkpoint = NULL;
+	
+	cli->output_path = output_path;
+	if (strcmp( output_path, "-" ) == 0) {
+		fprintf(stderr, "ts2mpa: -C needs the output to be a file.\n");
+		exit(-1);
+	}
+	
+	checkpoint = ts_checkpoint_read( cli->checkpoint_path );
+	if (checkpoint==NULL) {
+		if (errno == ENOENT) return;
+		perror("ts2mpa: Failed to read checkpoint");
+		exit(-2);
+	}
+	
+	if (strcmp( checkpoint->input_path, cli->input_path ) ||
+	    strcmp( checkpoint->output_path, output_path ) ||
+	    checkpoint->pid != ts2mpa->pid || checkpoint->pes_stream_id != ts2mpa->pes_stream_id ||
+	    checkpoint->demux_all != ts2mpa->demux_all)
+	{
+		fprintf(stderr, "ts2mpa: The checkpoint in %s is for a different extraction; remove it to start again.\n", cli->checkpoint_path);
+		exit(-1);
+	}
+	
+	cli->checkpoint = checkpoint;
+}
+
+
+// Open an output to carry on writing it from a checkpoint, with
+// anything written after the checkpoint cut off
+static es_output_t* reopen_output( ts2mpa_cli_t *cli, const char* path, unsigned long bytes )
+{
+	es_output_t *output = NULL;
+	struct stat st;
+	
+	if (stat( path, &st ) || (unsigned long long)st.st_size < bytes) {
+		fprintf(stderr, "ts2mpa: The output %s is shorter than when the checkpoint was taken; remove %s to start again.\n",
+		        path, cli->checkpoint_path);
+		exit(-1);
+	}
+	
+	output = es_output_open_at( path, bytes, cli->batch_size, cli->output_flags );
+	if (output==NULL) {
+		perror("ts2mpa: Failed to open output file");
+		exit(-2);
+	}
+	
+	return output;
+}
+
+
+// Set up extraction of each of the inputs on the command line, and
+// in the list file, to outputs named from the template after them
+static void parse_batch( ts2mpa_cli_t *cli, int argc, char** argv )
+{
+	ts2mpa_t *ts2mpa = cli->ts2mpa;
+	ts_batch_t *batch = NULL;
+	const char *clash = NULL;
+	char *output_template = NULL;
+	int i;
+	
+	if (argc-optind < (cli->batch_list ? 1 : 2)) {
+		fprintf(stderr, "ts2mpa: missing input and output files.\n");
+		usage();
+	}
+	output_template = argv[argc-1];
+	if (strstr( output_template, TS_BATCH_NAME ) == NULL) {
+		fprintf(stderr, "ts2mpa: output filename must contain %%name when extracting many files.\n");
+		exit(-1);
+	}
+	if (ts2mpa->demux_all &&
+	    strstr( output_template, "%pid" ) == NULL &&
+	    strstr( output_template, "%sid" ) == NULL)
+	{
+		fprintf(stderr, "ts2mpa: output filename must contain %%pid or %%sid when extracting all streams.\n");
+		exit(-1);
+	}
+	
+	batch = ts_batch_new( output_template );
+	if (batch==NULL) {
+		perror("Failed to allocate memory for ts_batch_t");
+		exit(-3);
+	}
+	batch->pid = ts2mpa->pid;
+	batch->pes_stream_id = ts2mpa->pes_stream_id;
+	batch->demux_all = ts2mpa->demux_all;
+	batch->batch_size = cli->batch_size;
+	batch->interrupted = &Interrupted;
+	
+	for (i=optind; i<argc-1; i++) {
+		if (strcmp( argv[i], "-" ) == 0 || udp_input_is_url( argv[i] )) {
+			fprintf(stderr, "ts2mpa: Only files can be extracted with -B: %s\n", argv[i]);
+			exit(-1);
+		}
+		if (ts_batch_add( batch, argv[i] ) < 0) {
+			fprintf(stderr, "ts2mpa: Failed to add %s: %s\n", argv[i], strerror(errno));
+			exit(-2);
+		}
+	}
+	
+	if (cli->batch_list) {
+		FILE *list = stdin;
+		if (strcmp( cli->batch_list, "-" ) != 0) list = fopen( cli->batch_list, "r" );
+		if (list==NULL || ts_batch_add_list( batch, list ) < 0) {
+			perror("ts2mpa: Failed to read list of input files");
+			exit(-2);
+		}
+		if (list != stdin) fclose( list );
+	}
+	
+	if (batch->job_count == 0) {
+		fprintf(stderr, "ts2mpa: No input files to extract.\n");
+		exit(-1);
+	}
+	clash = ts_batch_clash( batch );
+	if (clash) {
+		fprintf(stderr, "ts2mpa: More than one input file is called %s, so their outputs would overwrite each other.\n", clash);
+		exit(-1);
+	}
+	
+	cli->batch = batch;
+}
+
+
+static void parse_cmd_line( ts2mpa_cli_t *cli, int argc, char** argv )
 {
+	ts2mpa_t *ts2mpa = cli->ts2mpa;
+	int make_index = 0;
+	int follow_timeout = 0;
 	int ch;
 
 
 	// Parse the options/switches
-	while ((ch = getopt(argc, argv, "p:s:qh?")) != -1)
+	while ((ch = getopt(argc, argv, "p:s:b:j:M:i:r:S:E:T:L:P:W:F:C:B:l:Izutaqh?")) != -1)
 	switch (ch) {
 		case 'q':
 			Quiet = 1;
@@ -382,41 +988,987 @@ static void parse_cmd_line( ts2mpa_t *ts2mpa, int argc, char** argv )
 			}
 		break;
 
-		case '?':
+		case 'b':
+			cli->batch_size = parse_value( optarg );
+			if ((int)cli->batch_size <= 0) {
+				fprintf(stderr, "ts2mpa: Invalid output batch size: %s\n", optarg);
+				exit(-1);
+			}
+		break;
+
+		case 'j':
+			cli->jobs = parse_value( optarg );
+			if (cli->jobs <= 0) {
+				fprintf(stderr, "ts2mpa: Invalid number of jobs: %s\n", optarg);
+				exit(-1);
+			}
+		break;
+
+		case 'M':
+			cli->metrics_path = optarg;
+		break;
+
+		case 'i':
+			cli->metrics_interval = parse_value( optarg );
+			if (cli->metrics_interval <= 0) {
+				fprintf(stderr, "ts2mpa: Invalid metrics interval: %s\n", optarg);
+				exit(-1);
+			}
+		break;
+
+		case 'I':
+			make_index = 1;
+		break;
+
+		case 'r':
+			cli->report_path = optarg;
+		break;
+
+		case 'S':
+		case 'E':
+			if (parse_time( optarg ) < 0) {
+				fprintf(stderr, "ts2mpa: Invalid time: %s\n", optarg);
+				exit(-1);
+			}
+			if (ch == 'S') cli->start_time = parse_time( optarg );
+			else cli->end_time = parse_time( optarg );
+		break;
+
+		case 'T':
+			if (parse_time( optarg ) <= 0) {
+				fprintf(stderr, "ts2mpa: Invalid segment duration: %s\n", optarg);
+				exit(-1);
+			}
+			cli->segment_duration = (double)parse_time( optarg ) / TS2MPA_PTS_CLOCK;
+		break;
+
+		case 'L':
+			cli->segment_bytes = parse_size( optarg );
+			if (cli->segment_bytes == 0) {
+				fprintf(stderr, "ts2mpa: Invalid segment size: %s\n", optarg);
+				exit(-1);
+			}
+		break;
+
+		case 'P':
+			cli->playlist_path = optarg;
+		break;
+
+		case 'W':
+			if (parse_value( optarg ) <= 0) {
+				fprintf(stderr, "ts2mpa: Invalid playlist window: %s\n", optarg);
+				exit(-1);
+			}
+			cli->playlist_window = parse_value( optarg );
+		break;
+
+		case 'F':
+			if (optarg[0] < '0' || optarg[0] > '9') {
+				fprintf(stderr, "ts2mpa: Invalid follow timeout: %s\n", optarg);
+				exit(-1);
+			}
+			cli->input_flags |= TS_INPUT_FOLLOW;
+			follow_timeout = parse_value( optarg );
+		break;
+
+		case 'C':
+			cli->checkpoint_path = optarg;
+		break;
+
+		case 'B':
+			cli->batch_threads = parse_value( optarg );
+			if (cli->batch_threads <= 0) {
+				fprintf(stderr, "ts2mpa: Invalid number of threads: %s\n", optarg);
+				exit(-1);
+			}
+		break;
+
+		case 'l':
+			cli->batch_list = optarg;
+		break;
+
+		case 'z':
+			cli->output_flags |= ES_OUTPUT_SPLICE;
+		break;
+
+		case 'u':
+			cli->output_flags |= ES_OUTPUT_URING;
+			cli->input_flags |= TS_INPUT_URING;
+		break;
+
+		case 't':
+			cli->output_flags |= ES_OUTPUT_THREAD;
+			cli->input_flags |= TS_INPUT_THREAD;
+		break;
+
+		case 'a':
+			ts2mpa->demux_all = 1;
+		break;
+
+		case '?':
 		case 'h':
 		default:
 			usage();
 	}
 
 
+	if (cli->metrics_interval && cli->metrics_path==NULL) {
+		fprintf(stderr, "ts2mpa: -i needs a metrics file to be given with -M.\n");
+		exit(-1);
+	}
+
+	if ((cli->input_flags & TS_INPUT_URING) && (cli->input_flags & TS_INPUT_THREAD)) {
+		fprintf(stderr, "ts2mpa: -u and -t can't be used together.\n");
+		exit(-1);
+	}
+
+	if (cli->end_time != -1 && cli->end_time <= cli->start_time) {
+		fprintf(stderr, "ts2mpa: The end time must be after the start time.\n");
+		exit(-1);
+	}
+
+	if (cli->playlist_path && !cli->segment_duration && !cli->segment_bytes) {
+		fprintf(stderr, "ts2mpa: -P needs the output to be split into segments with -T or -L.\n");
+		exit(-1);
+	}
+
+	if (cli->playlist_window && cli->playlist_path==NULL) {
+		fprintf(stderr, "ts2mpa: -W needs a playlist to be given with -P.\n");
+		exit(-1);
+	}
+
+	if ((cli->segment_duration || cli->segment_bytes) && (make_index || cli->jobs > 1)) {
+		fprintf(stderr, "ts2mpa: -T and -L can't be used with -I or -j.\n");
+		exit(-1);
+	}
+
+	if (cli->checkpoint_path && (make_index || cli->jobs > 1 || cli->segment_duration || cli->segment_bytes ||
+	                             cli->start_time || cli->end_time != -1 ||
+	                             (cli->input_flags & (TS_INPUT_URING|TS_INPUT_THREAD))))
+	{
+		fprintf(stderr, "ts2mpa: -C can't be used with -I, -j, -S, -E, -T, -L, -t or -u.\n");
+		exit(-1);
+	}
+
+	if ((cli->start_time || cli->end_time != -1) && (make_index || cli->jobs > 1)) {
+		fprintf(stderr, "ts2mpa: -S and -E can't be used with -I or -j.\n");
+		exit(-1);
+	}
+
+	if (cli->report_path && (make_index || cli->jobs > 1 || cli->segment_duration || cli->segment_bytes ||
+	                         cli->start_time || cli->end_time != -1 || cli->checkpoint_path))
+	{
+		fprintf(stderr, "ts2mpa: -r can't be used with -I, -j, -S, -E, -T, -L or -C.\n");
+		exit(-1);
+	}
+
+	if (cli->batch_list && !cli->batch_threads) {
+		fprintf(stderr, "ts2mpa: -l needs batch mode to be turned on with -B.\n");
+		exit(-1);
+	}
+
+	// Extract many inputs, each on their own
+	if (cli->batch_threads) {
+		if (make_index || cli->report_path || cli->jobs > 1 || cli->metrics_interval ||
+		    cli->start_time || cli->end_time != -1 || cli->segment_duration || cli->segment_bytes ||
+		    cli->checkpoint_path || cli->input_flags || cli->output_flags)
+		{
+			fprintf(stderr, "ts2mpa: -B can't be used with -I, -r, -j, -i, -S, -E, -T, -L, -C, -F, -t, -u or -z.\n");
+			exit(-1);
+		}
+		parse_batch( cli, argc, argv );
+		return;
+	}
+
+	// Keep track of time, to extract only part of the recording
+	if (cli->start_time || cli->end_time != -1) {
+		int pid;
+		cli->pts_origin = malloc( TS_PID_COUNT * sizeof(long long) );
+		cli->elapsed = malloc( TS_PID_COUNT * sizeof(long long) );
+		if (cli->pts_origin==NULL || cli->elapsed==NULL) {
+			perror("Failed to allocate memory for times");
+			exit(-3);
+		}
+		for (pid=0; pid<TS_PID_COUNT; pid++) {
+			cli->pts_origin[pid] = -1;
+			cli->elapsed[pid] = -1;
+		}
+	}
+
 	// Open the input file
 	if (argc-optind < 1) {
 		fprintf(stderr, "ts2mpa: missing input and output files.\n");
 		usage();
-	} else if ( strncmp( argv[optind], "-", 1 ) == 0 ) {
-		// Use STDIN
-		ts2mpa->input = stdin;
 	} else {
-		ts2mpa->input = fopen( argv[optind], "rb" );
-		if (ts2mpa->input==NULL) {
+		cli->input_path = argv[optind];
+		if ((cli->checkpoint_path || (cli->input_flags & TS_INPUT_FOLLOW)) &&
+		    (strcmp( cli->input_path, "-" ) == 0 || udp_input_is_url( cli->input_path )))
+		{
+			fprintf(stderr, "ts2mpa: -C and -F need the input to be a file.\n");
+			exit(-1);
+		}
+		cli->input = ts_input_open( argv[optind], cli->input_flags );
+		if (cli->input==NULL && errno == ENOTSUP) {
+			fprintf(stderr, "ts2mpa: The input is compressed, and this ts2mpa was built without support for it (make ZLIB=1 ZSTD=1).\n");
+			exit(-2);
+		} else if (cli->input==NULL) {
 			perror("ts2mpa: Failed to open input file");
 			exit(-2);
 		}
+		if (cli->input->decompress && (make_index || cli->checkpoint_path || (cli->input_flags & TS_INPUT_FOLLOW))) {
+			fprintf(stderr, "ts2mpa: -I, -C and -F can't be used with a compressed input.\n");
+			exit(-1);
+		}
+		cli->input->follow_timeout = follow_timeout;
+		if ((cli->input_flags & TS_INPUT_URING) && cli->input->uring==NULL && !cli->input->decompress) {
+			if (!Quiet) fprintf(stderr, "ts2mpa: io_uring is not available, using normal reads and writes.\n");
+			cli->input_flags &= ~TS_INPUT_URING;
+			cli->output_flags &= ~ES_OUTPUT_URING;
+		}
+	}
+
+	// Index every audio stream, without writing them out
+	if (make_index) {
+		char index_path[FILENAME_MAX];
+		
+		if (strcmp( cli->input_path, "-" ) == 0 || udp_input_is_url( cli->input_path )) {
+			fprintf(stderr, "ts2mpa: Only a file can be indexed.\n");
+			exit(-1);
+		}
+		if (cli->jobs > 1) {
+			fprintf(stderr, "ts2mpa: -I can't be used with -j.\n");
+			exit(-1);
+		}
+		
+		snprintf( index_path, sizeof(index_path), "%s%s", cli->input_path, TS_INDEX_SUFFIX );
+		cli->index = ts_index_create( index_path );
+		if (cli->index==NULL) {
+			perror("ts2mpa: Failed to create index");
+			exit(-2);
+		}
+		ts2mpa->demux_all = 1;
+		ts2mpa->new_stream = NULL;
+		ts2mpa->es_data = NULL;
+		return;
+	}
+
+	// Look at every audio stream, and only count what is in them
+	if (cli->report_path) {
+		cli->report = ts_report_new();
+		if (cli->report==NULL) {
+			perror("Failed to allocate memory for ts_report_t");
+			exit(-3);
+		}
+		ts2mpa->demux_all = 1;
+		ts2mpa->es_data = NULL;
+		ts2mpa->frame_start = cli_report_frame;
+		ts2mpa->sync_lost = cli_sync_lost;
+		return;
 	}
 
+	// Carry on from a checkpoint, if there is one
+	if (cli->checkpoint_path && argc-optind >= 2)
+		load_checkpoint( cli, argv[optind+1] );
+
 	// Open the output file
 	if (argc-optind < 2) {
 		fprintf(stderr, "ts2mpa: missing output file.\n");
 		usage();
-	} else if ( strncmp( argv[optind+1], "-", 1 ) == 0 ) {
-		// Use STDOUT
-		ts2mpa->output = stdout;
+	} else if ( ts2mpa->demux_all || cli->segment_duration || cli->segment_bytes ) {
+		// Files are opened as each stream is found
+		cli->output_template = argv[optind+1];
+		if (ts2mpa->demux_all &&
+		    strstr( cli->output_template, "%pid" ) == NULL &&
+		    strstr( cli->output_template, "%sid" ) == NULL)
+		{
+			fprintf(stderr, "ts2mpa: output filename must contain %%pid or %%sid when extracting all streams.\n");
+			exit(-1);
+		}
+		if (cli->segment_duration || cli->segment_bytes) {
+			if (strstr( cli->output_template, ES_SEGMENT_SEQ ) == NULL) {
+				fprintf(stderr, "ts2mpa: output filename must contain %%seq when splitting into segments.\n");
+				exit(-1);
+			}
+			if (ts2mpa->demux_all && cli->playlist_path &&
+			    strstr( cli->playlist_path, "%pid" ) == NULL &&
+			    strstr( cli->playlist_path, "%sid" ) == NULL)
+			{
+				fprintf(stderr, "ts2mpa: playlist filename must contain %%pid or %%sid when extracting all streams.\n");
+				exit(-1);
+			}
+			ts2mpa->frame_start = cli_frame_start;
+		}
 	} else {
-		ts2mpa->output = fopen( argv[optind+1], "wb" );
-		if (ts2mpa->output==NULL) {
+		// Cut off anything written after the checkpoint, and carry on from there
+		if (cli->checkpoint) {
+			ts_checkpoint_t *checkpoint = cli->checkpoint;
+			cli->output = reopen_output( cli, argv[optind+1], checkpoint->mark_count ? checkpoint->marks[0].total_bytes : 0 );
+		} else {
+			cli->output = es_output_open( argv[optind+1], cli->batch_size, cli->output_flags );
+		}
+		if (cli->output==NULL) {
 			perror("ts2mpa: Failed to open output file");
 			exit(-2);
 		}
+		
+		// Pages spliced into a pipe must not be read into again
+		if (cli->output->splice) cli->input->no_reuse = 1;
+	}
+}
+
+// Write out anything still queued and close the output files
+// returns 0 on success or -1 if any failed
+static int close_outputs( ts2mpa_cli_t *cli )
+{
+	ts2mpa_stream_t *stream = NULL;
+	int result = 0;
+	
+	if (cli->report) return 0;
+	
+	for (stream = cli->ts2mpa->stream_list; stream; stream = stream->list_next) {
+		if (cli->segment_duration || cli->segment_bytes) {
+			if (es_segment_close( stream->user )) result = -1;
+		} else if (stream->user != cli->output && es_output_close( stream->user )) {
+			result = -1;
+		}
+	}
+	
+	if (cli->output && es_output_close( cli->output ))
+		result = -1;
+	
+	return result;
+}
+
+// Write a summary of a batch, replacing the file atomically
+static void write_summary( ts2mpa_cli_t *cli )
+{
+	char tmp_path[FILENAME_MAX];
+	FILE *file = NULL;
+	
+	if (strcmp( cli->metrics_path, "-" ) == 0) {
+		ts_batch_write_summary( cli->batch, stderr );
+		return;
+	}
+	
+	snprintf( tmp_path, sizeof(tmp_path), "%s.tmp", cli->metrics_path );
+	file = fopen( tmp_path, "w" );
+	if (file==NULL) {
+		perror("ts2mpa: Failed to open summary file");
+		return;
+	}
+	if (ts_batch_write_summary( cli->batch, file ) | fclose( file ) ||
+	    rename( tmp_path, cli->metrics_path ))
+	{
+		perror("ts2mpa: Failed to write summary file");
+		unlink( tmp_path );
+	}
+}
+
+
+// Extract each input of a batch
+// returns 0 on success, or -2 if any of them failed
+static int process_batch( ts2mpa_cli_t *cli )
+{
+	ts_batch_t *batch = cli->batch;
+	int failed;
+	
+	batch->quiet = Quiet;
+	if (!Quiet)
+		fprintf(stderr, "ts2mpa: Extracting %d file(s) on %d thread(s).\n",
+		        batch->job_count, cli->batch_threads < batch->job_count ? cli->batch_threads : batch->job_count);
+	
+	failed = ts_batch_run( batch, cli->batch_threads );
+	if (failed < 0) {
+		perror("Failed to start extracting");
+		exit(-3);
+	}
+	
+	if (!Quiet || failed)
+		fprintf(stderr, "ts2mpa: Extracted %d file(s), %d failed, in %.1fs.\n",
+		        batch->job_count - failed, failed, batch->seconds);
+	if (cli->metrics_path) write_summary( cli );
+	
+	ts_batch_free( batch );
+	ts2mpa_free( cli->ts2mpa );
+	free( cli );
+	
+	return failed ? -2 : 0;
+}
+
+/*
+	Parallel extraction of a single file
+
+	The file is split into packet aligned chunks, which are extracted
+	into temporary files by a pool of threads. Each chunk gets its own
+	ts2mpa_t, started a little before the chunk so that it has found
+	sync by the time it gets to the start, where its state is marked.
+
+	The chunks are then joined up in order. The real state where a chunk
+	starts is the state at the end of the chunk before it. If the two
+	match, then everything from there on is the same as a serial run. If
+	they don't, the chunk is extracted again, carrying on from the state
+	before it. Either way the output is byte-for-byte the same.
+*/
+
+// Don't bother splitting chunks smaller than this
+#define TS2MPA_MIN_CHUNK		(16*1024*1024)
+
+// Number of chunks for each thread, to even out the work
+#define TS2MPA_CHUNKS_PER_JOB	4
+
+// Amount to extract before the start of a chunk
+#define TS2MPA_WARMUP			(22310*TS_PACKET_SIZE)
+
+// Step to look for the first stream in, when extracting a single stream
+#define TS2MPA_PROBE_STEP		(1024*1024)
+
+
+// Part of the input that is extracted on its own, by a worker thread.
+// Extraction starts a little before the chunk, so that streams have
+// found sync by the time it gets there.
+typedef struct ts2mpa_chunk_s {
+
+	ts2mpa_cli_t* cli;
+	unsigned long long start;		// Packet aligned offsets in the input
+	unsigned long long end;
+
+	int at_start;					// Stopped exactly at start, and marks taken there
+	ts2mpa_mark_t* marks;
+	int mark_count;
+	uint32_t watch_map[TS_PID_MAP_WORDS];	// PIDs that could still be picked up
+	unsigned long start_packets;
+	unsigned long start_skipped;
+	unsigned long start_sync_losses;
+	ts2mpa_counters_t start_counters;
+
+} ts2mpa_chunk_t;
+
+
+typedef struct ts2mpa_pool_s {
+	ts2mpa_chunk_t* chunks;
+	int chunk_count;
+	int next;
+} ts2mpa_pool_t;
+
+
+// Is the state of a chunk where it starts the same as ts2mpa is in now?
+static int chunk_matches( ts2mpa_t *ts2mpa, ts2mpa_chunk_t *chunk )
+{
+	if (!chunk->at_start || !stopped_at( ts2mpa, chunk->start ))
+		return 0;
+	
+	return marks_match( ts2mpa, chunk->marks, chunk->mark_count, chunk->watch_map );
+}
+
+
+// Extract a chunk into temporary files
+static void extract_chunk( ts2mpa_chunk_t *chunk )
+{
+	ts2mpa_cli_t *cli = chunk->cli;
+	ts2mpa_t *ts2mpa = cli->ts2mpa;
+	
+	// Get going before the start, then mark the state there
+	if (chunk->start > cli->input->offset) {
+		cli->end_offset = chunk->start;
+		extract_input( cli );
+		
+		chunk->at_start = stopped_at( ts2mpa, chunk->start );
+		chunk->mark_count = mark_streams( ts2mpa, &chunk->marks, chunk->watch_map );
+		chunk->start_packets = ts2mpa->total_packets;
+		chunk->start_skipped = ts2mpa->total_skipped;
+		chunk->start_sync_losses = ts2mpa->ts_sync_losses;
+		chunk->start_counters = ts2mpa->counters;
+	}
+	
+	cli->end_offset = chunk->end;
+	extract_input( cli );
+	flush_outputs( cli );
+}
+
+
+static void* pool_thread( void* arg )
+{
+	ts2mpa_pool_t *pool = arg;
+	int i;
+	
+	while ((i = __atomic_fetch_add( &pool->next, 1, __ATOMIC_RELAXED )) < pool->chunk_count) {
+		if (Interrupted) break;
+		extract_chunk( &pool->chunks[i] );
+	}
+	
+	return NULL;
+}
+
+
+// Set up extraction of part of the input
+static ts2mpa_cli_t* new_worker( ts2mpa_cli_t *cli, unsigned long long start )
+{
+	ts2mpa_cli_t *worker = init_ts2mpa_cli_t();
+	
+	worker->ts2mpa->pid = cli->ts2mpa->pid;
+	worker->ts2mpa->pes_stream_id = cli->ts2mpa->pes_stream_id;
+	worker->ts2mpa->demux_all = cli->ts2mpa->demux_all;
+	worker->ts2mpa->offset = start;
+	worker->batch_size = cli->batch_size;
+	worker->temp_outputs = 1;
+	
+	worker->input = ts_input_open( cli->input_path, 0 );
+	if (worker->input==NULL || ts_input_seek( worker->input, start )) {
+		perror("ts2mpa: Failed to open input file");
+		exit(-2);
+	}
+	
+	return worker;
+}
+
+
+// Copy part of a temporary file to an output
+static void copy_range( int in_fd, off_t offset, size_t len, int out_fd )
+{
+	while (len > 0) {
+		ssize_t copied = sendfile( out_fd, in_fd, &offset, len );
+		if (copied < 0 && errno == EINTR) continue;
+		if (copied <= 0) {
+			perror("Error: failed to write stream out");
+			exit(-2);
+		}
+		len -= copied;
+	}
+}
+
+
+// Add the counts made since the start of a chunk
+static void add_counters( ts2mpa_counters_t *to, const ts2mpa_counters_t *now, const ts2mpa_counters_t *start )
+{
+	to->packets += now->packets - start->packets;
+	to->cc_errors += now->cc_errors - start->cc_errors;
+	to->trans_errors += now->trans_errors - start->trans_errors;
+	to->scrambled += now->scrambled - start->scrambled;
+	to->sync_losses += now->sync_losses - start->sync_losses;
+	to->sync_gains += now->sync_gains - start->sync_gains;
+	to->hunt_skipped += now->hunt_skipped - start->hunt_skipped;
+	to->frames += now->frames - start->frames;
+	to->frames_dropped += now->frames_dropped - start->frames_dropped;
+	to->sync_predicted += now->sync_predicted - start->sync_predicted;
+	to->bytes += now->bytes - start->bytes;
+}
+
+
+// Append what a chunk extracted, after its start, to the real output
+static void output_chunk( ts2mpa_cli_t *cli, ts2mpa_chunk_t *chunk )
+{
+	ts2mpa_t *ts2mpa = cli->ts2mpa;
+	ts2mpa_t *worker = chunk->cli->ts2mpa;
+	ts2mpa_stream_t *from = NULL;
+	ts2mpa_counters_t zero;
+	int i;
+	
+	bzero( &zero, sizeof(zero) );
+	for (from = worker->stream_list; from; from = from->list_next) {
+		ts2mpa_stream_t *stream = ts2mpa_add_stream( ts2mpa, from->pid, from->pes_stream_id );
+		es_output_t *from_output = from->user;
+		const ts2mpa_counters_t *start = &zero;
+		unsigned long skip = 0;
+		
+		if (stream==NULL) extract_failed( ts2mpa );
+		for (i=0; i<chunk->mark_count; i++) {
+			if (chunk->marks[i].pid == from->pid &&
+			    chunk->marks[i].pes_stream_id == from->pes_stream_id)
+				skip = chunk->marks[i].total_bytes;
+			if (chunk->marks[i].pid == from->pid)
+				start = &chunk->marks[i].counters;
+		}
+		
+		// Counters are kept per PID, so only merge them once
+		if (from == worker->pids[from->pid]->streams)
+			add_counters( &ts2mpa->pids[from->pid]->counters, &worker->pids[from->pid]->counters, start );
+		
+		if (es_output_flush( stream->user )) {
+			perror("Error: failed to write stream out");
+			exit(-2);
+		}
+		copy_range( from_output->fd, skip, from->total_bytes - skip, ((es_output_t*)stream->user)->fd );
+		stream->total_bytes += from->total_bytes - skip;
+		stream->synced = from->synced;
+		ts2mpa->total_bytes += from->total_bytes - skip;
+	}
+	
+	ts2mpa->total_packets += worker->total_packets - chunk->start_packets;
+	ts2mpa->total_skipped += worker->total_skipped - chunk->start_skipped;
+	ts2mpa->offset = worker->offset;
+	ts2mpa->ts_sync_losses += worker->ts_sync_losses - chunk->start_sync_losses;
+	add_counters( &ts2mpa->counters, &worker->counters, &chunk->start_counters );
+}
+
+
+static void free_chunk( ts2mpa_cli_t *cli, ts2mpa_chunk_t *chunk )
+{
+	ts2mpa_t *worker = chunk->cli->ts2mpa;
+	
+	// All the work done counts, including warming up and re-doing
+	cli->ts2mpa->scan_cycles += worker->scan_cycles;
+	cli->ts2mpa->demux_cycles += worker->demux_cycles;
+	cli->ts2mpa->output_cycles += worker->output_cycles;
+	
+	close_outputs( chunk->cli );
+	if (chunk->cli->input->error) cli->input->error = chunk->cli->input->error;
+	ts_input_close( chunk->cli->input );
+	ts2mpa_free( chunk->cli->ts2mpa );
+	free( chunk->cli );
+	free( chunk->marks );
+}
+
+
+// Extract a seekable file in chunks, on several threads
+// returns 0 if the file can't be split up
+static int process_parallel( ts2mpa_cli_t *cli )
+{
+	ts2mpa_pool_t pool;
+	ts2mpa_chunk_t *chunks = NULL;
+	ts2mpa_cli_t *first = NULL;
+	pthread_t *threads = NULL;
+	unsigned long long size;
+	unsigned char *buf = NULL;
+	sigset_t all, old;
+	int demux_all = cli->ts2mpa->demux_all;
+	int quiet = Quiet;
+	int count, threads_started, redone, last, i;
+	
+	if (cli->input->map == NULL) {
+		if (!Quiet) fprintf(stderr, "ts2mpa: Input can't be split up, so extracting on one thread.\n");
+		return 0;
+	}
+	
+	size = cli->input->map_size;
+	count = cli->jobs * TS2MPA_CHUNKS_PER_JOB;
+	if (count > size / TS2MPA_MIN_CHUNK) count = size / TS2MPA_MIN_CHUNK;
+	if (count < 2) return 0;
+	
+	chunks = calloc( count, sizeof(ts2mpa_chunk_t) );
+	threads = calloc( cli->jobs, sizeof(pthread_t) );
+	if (chunks==NULL || threads==NULL) {
+		perror("Failed to allocate memory for chunks");
+		exit(-3);
+	}
+	
+	// Split where a run of packets starts, after each even division
+	for (i=0; i<count; i++) {
+		unsigned long long start = size / count * i;
+		if (i > 0) {
+			size_t avail;
+			ts_input_seek( cli->input, start );
+			avail = ts_input_peek( cli->input, &buf, TS_RESYNC_PACKETS*TS_PACKET_SIZE );
+			start += ts_scan_sync( buf, avail, TS_RESYNC_PACKETS );
+		}
+		chunks[i].start = start;
+		if (i > 0) chunks[i-1].end = start;
+	}
+	chunks[count-1].end = size;
+	ts_input_seek( cli->input, 0 );
+	
+	// The first chunk is a serial run from the start
+	first = chunks[0].cli = new_worker( cli, 0 );
+	chunks[0].at_start = 1;
+	
+	// When only extracting one stream, find which one it will be,
+	// so that the other chunks don't pick a different one
+	while (!demux_all && first->ts2mpa->stream_count == 0 && !Interrupted &&
+	       first->input->offset < chunks[0].end)
+	{
+		unsigned long long offset = first->input->offset;
+		first->end_offset = offset + TS2MPA_PROBE_STEP;
+		if (first->end_offset > chunks[0].end) first->end_offset = chunks[0].end;
+		extract_input( first );
+		if (first->input->offset == offset) break;
+	}
+	
+	for (i=1; i<count; i++) {
+		unsigned long long warmup = chunks[i].start - chunks[i-1].start;
+		if (warmup > TS2MPA_WARMUP) warmup = TS2MPA_WARMUP;
+		chunks[i].cli = new_worker( cli, chunks[i].start - warmup );
+		if (!demux_all && first->ts2mpa->stream_list) {
+			chunks[i].cli->ts2mpa->pid = first->ts2mpa->stream_list->pid;
+			chunks[i].cli->ts2mpa->pes_stream_id = first->ts2mpa->stream_list->pes_stream_id;
+		}
+	}
+	
+	// The workers keep quiet, as they would repeat each other
+	Quiet = 1;
+	pool.chunks = chunks;
+	pool.chunk_count = count;
+	pool.next = 0;
+	sigfillset( &all );
+	pthread_sigmask( SIG_SETMASK, &all, &old );
+	for (threads_started=0; threads_started<cli->jobs; threads_started++) {
+		if (pthread_create( &threads[threads_started], NULL, pool_thread, &pool )) break;
+	}
+	pthread_sigmask( SIG_SETMASK, &old, NULL );
+	if (threads_started == 0) pool_thread( &pool );
+	for (i=0; i<threads_started; i++)
+		pthread_join( threads[i], NULL );
+	Quiet = quiet;
+	
+	// Join up the chunks, re-doing any that didn't start in the same state
+	redone = 0;
+	for (i=1, last=0; i<count && !Interrupted; i++) {
+		if (chunk_matches( chunks[last].cli->ts2mpa, &chunks[i] )) {
+			output_chunk( cli, &chunks[last] );
+			last = i;
+		} else {
+			first = chunks[last].cli;
+			first->end_offset = chunks[i].end;
+			extract_input( first );
+			flush_outputs( first );
+			redone++;
+		}
+	}
+	output_chunk( cli, &chunks[last] );
+	
+	if (!Quiet)
+		fprintf(stderr, "ts2mpa: Extracted in %d chunks on %d threads (%d re-done on one thread).\n",
+		        count, threads_started ? threads_started : 1, redone);
+	
+	for (i=0; i<count; i++)
+		free_chunk( cli, &chunks[i] );
+	free( chunks );
+	free( threads );
+	
+	return 1;
+}
+
+
+/*
+	Seeking to a time into the recording
+
+	Time is counted on each PID from the first PTS on it. With an index
+	(written by -I) the offset to start from is looked up in it. Without
+	one, the first PTS of each stream is found at the start of the file
+	and the offset is found by bisection.
+*/
+
+// Callback while probing the start of the file for the first PTS
+static void probe_pes_pts( ts2mpa_t *probe, ts2mpa_stream_t *stream )
+{
+	ts2mpa_cli_t *cli = probe->user;
+	
+	if (cli->pts_origin[stream->pid] == -1)
+		cli->pts_origin[stream->pid] = stream->pts;
+}
+
+
+// Find where to start reading by bisecting the file
+// returns the offset
+static unsigned long long bisect_start( ts2mpa_cli_t *cli )
+{
+	ts2mpa_t *ts2mpa = cli->ts2mpa;
+	ts2mpa_t *probe = ts2mpa_new();
+	ts2mpa_stream_t *stream = NULL;
+	unsigned long long offset = 0, found;
+	size_t len = cli->input->map_size;
+	
+	if (probe==NULL) {
+		perror("Failed to allocate memory for ts2mpa_t");
+		exit(-3);
+	}
+	probe->pid = ts2mpa->pid;
+	probe->pes_stream_id = ts2mpa->pes_stream_id;
+	probe->demux_all = ts2mpa->demux_all;
+	probe->pes_pts = probe_pes_pts;
+	probe->user = cli;
+	ts2mpa_feed( probe, cli->input->map, len < TS2MPA_TIME_PROBE ? len : TS2MPA_TIME_PROBE );
+	
+	// Start early enough for every stream
+	for (stream = probe->stream_list; stream; stream = stream->list_next) {
+		if (cli->pts_origin[stream->pid] == -1) continue;
+		found = ts_index_bisect( cli->input->map, len, stream->pid,
+		                         cli->pts_origin[stream->pid], cli->start_time );
+		if (stream == probe->stream_list || found < offset) offset = found;
+		if (cli->first_origin == -1) cli->first_origin = cli->pts_origin[stream->pid];
+	}
+	
+	// Extract the same stream as if reading from the start
+	if (!ts2mpa->demux_all && probe->stream_list) {
+		ts2mpa->pid = probe->stream_list->pid;
+		ts2mpa->pes_stream_id = probe->stream_list->pes_stream_id;
+	}
+	
+	ts2mpa_free( probe );
+	return offset;
+}
+
+
+// Find where to start reading with an index
+// returns 0 on success, or -1 if the index is missing or out of date
+static int index_start( ts2mpa_cli_t *cli, unsigned long long *offset )
+{
+	ts2mpa_t *ts2mpa = cli->ts2mpa;
+	char index_path[FILENAME_MAX];
+	ts_index_t *index = NULL;
+	
+	snprintf( index_path, sizeof(index_path), "%s%s", cli->input_path, TS_INDEX_SUFFIX );
+	index = ts_index_open( index_path );
+	if (index==NULL) return -1;
+	if (index->input_size != cli->input->map_size) {
+		if (!Quiet) fprintf(stderr, "ts2mpa: Index %s is out of date, not using it.\n", index_path);
+		ts_index_close( index, 0 );
+		return -1;
+	}
+	
+	// Extract the same stream as if reading from the start
+	if (!ts2mpa->demux_all && ts2mpa->pid == -1 && index->first.pid != -1 &&
+	    (ts2mpa->pes_stream_id == -1 || ts2mpa->pes_stream_id == index->first.stream_id))
+	{
+		ts2mpa->pid = index->first.pid;
+		ts2mpa->pes_stream_id = index->first.stream_id;
+	}
+	
+	if (ts_index_find( index, ts2mpa->demux_all ? -1 : ts2mpa->pid,
+	                   cli->start_time, offset, cli->pts_origin ))
+	{
+		perror("ts2mpa: Failed to read index");
+		exit(-2);
+	}
+	if (index->first.pid != -1)
+		cli->first_origin = cli->pts_origin[index->first.pid];
+	
+	ts_index_close( index, 0 );
+	return 0;
+}
+
+
+// Seek the input to just before the start time
+static void seek_to_start( ts2mpa_cli_t *cli )
+{
+	unsigned long long offset = 0;
+	const char *how = "the index";
+	
+	if (cli->start_time == 0) return;
+	if (cli->input->map == NULL) {
+		if (!Quiet) fprintf(stderr, "ts2mpa: Input can't be seeked, reading it from the start.\n");
+		return;
+	}
+	
+	if (index_start( cli, &offset )) {
+		offset = bisect_start( cli );
+		how = "bisection";
+	}
+	
+	if (!Quiet) fprintf(stderr, "ts2mpa: Starting at offset %llu, found by %s.\n", offset, how);
+	if (ts_input_seek( cli->input, offset )) {
+		perror("ts2mpa: Failed to seek input");
+		exit(-2);
+	}
+	cli->ts2mpa->offset = offset;
+}
+
+
+// Get back to where the checkpoint was taken. Extraction starts a little
+// before it, without writing anything, and once the streams are in
+// the same state as they were then, carries on writing each output
+// from where it was. If they aren't, it goes back further and tries
+// again, which from the start of the input is bound to work.
+static void resume_from_checkpoint( ts2mpa_cli_t *cli )
+{
+	ts_checkpoint_t *checkpoint = cli->checkpoint;
+	ts2mpa_t *old = cli->ts2mpa, *ts2mpa = NULL;
+	ts2mpa_stream_t *stream = NULL;
+	unsigned long long warmup = TS2MPA_WARMUP, start;
+	struct stat st;
+	int i;
+	
+	if (fstat( cli->input->fd, &st ) == 0 && (unsigned long long)st.st_size < checkpoint->offset) {
+		fprintf(stderr, "ts2mpa: The input is shorter than when the checkpoint was taken; remove %s to start again.\n", cli->checkpoint_path);
+		exit(-1);
+	}
+	
+	while (1) {
+		start = checkpoint->offset > warmup ? checkpoint->offset - warmup : 0;
+		
+		ts2mpa = ts2mpa_new();
+		if (ts2mpa==NULL) {
+			perror("Failed to allocate memory for ts2mpa_t");
+			exit(-3);
+		}
+		ts2mpa->pid = old->pid;
+		ts2mpa->pes_stream_id = old->pes_stream_id;
+		ts2mpa->demux_all = old->demux_all;
+		ts2mpa->offset = start;
+		ts2mpa->user = cli;
+		ts2mpa->new_stream = old->new_stream;
+		ts2mpa->es_data = old->es_data;
+		ts2mpa->pes_pts = old->pes_pts;
+		
+		if (ts_input_seek( cli->input, start )) {
+			perror("ts2mpa: Failed to seek in input file");
+			exit(-2);
+		}
+		cli->ts2mpa = ts2mpa;
+		cli->warming_up = 1;
+		cli->end_offset = checkpoint->offset;
+		if (start < checkpoint->offset) extract_input( cli );
+		if (Interrupted) exit(-1);
+		
+		if (stopped_at( ts2mpa, checkpoint->offset ) &&
+		    marks_match( ts2mpa, checkpoint->marks, checkpoint->mark_count, checkpoint->watch_map ))
+			break;
+		if (start == 0) {
+			fprintf(stderr, "ts2mpa: The input doesn't match the checkpoint; remove %s to start again.\n", cli->checkpoint_path);
+			exit(-1);
+		}
+		
+		ts2mpa_free( ts2mpa );
+		cli->ts2mpa = old;
+		warmup *= 4;
+	}
+	
+	ts2mpa->frame_header = old->frame_header;
+	ts2mpa->message = old->message;
+	ts2mpa_free( old );
+	cli->warming_up = 0;
+	cli->end_offset = 0;
+	cli->checkpoint_offset = checkpoint->offset;
+	
+	// Carry on writing each stream where it was
+	for (stream = ts2mpa->stream_list; stream; stream = stream->list_next) {
+		for (i=0; i<checkpoint->mark_count; i++) {
+			ts2mpa_mark_t *mark = &checkpoint->marks[i];
+			if (mark->pid != stream->pid || mark->pes_stream_id != stream->pes_stream_id) continue;
+			
+			stream->total_bytes = mark->total_bytes;
+			ts2mpa->pids[stream->pid]->counters = mark->counters;
+			
+			if (ts2mpa->demux_all) {
+				char filename[FILENAME_MAX];
+				es_output_expand_template( cli->output_template, stream->pid, stream->pes_stream_id, filename, sizeof(filename) );
+				stream->user = reopen_output( cli, filename, mark->total_bytes );
+			} else {
+				stream->user = cli->output;
+			}
+		}
+	}
+	ts2mpa->total_packets = checkpoint->total_packets;
+	ts2mpa->total_bytes = checkpoint->total_bytes;
+	ts2mpa->total_skipped = checkpoint->total_skipped;
+	ts2mpa->ts_sync_losses = checkpoint->ts_sync_losses;
+	ts2mpa->counters = checkpoint->counters;
+	
+	if (!Quiet) fprintf(stderr, "ts2mpa: Carrying on from the checkpoint at 0x%llx, with %lu bytes already written.\n",
+	                    checkpoint->offset, checkpoint->total_bytes);
+}
+
+
+static void print_stream_totals( ts2mpa_t *ts2mpa )
+{
+	int pid;
+	
+	for (pid=0; pid<TS_PID_COUNT; pid++) {
+		ts2mpa_stream_t *stream = NULL;
+		if (ts2mpa->pids[pid]==NULL) continue;
+		
+		for (stream = ts2mpa->pids[pid]->streams; stream; stream = stream->next) {
+			fprintf(stderr, "ts2mpa:   pid %d, stream id 0x%x: %lu bytes\n",
+			        stream->pid, stream->pes_stream_id, stream->total_bytes);
+		}
 	}
 }
 
@@ -429,13 +1981,20 @@ static void termination_handler(int signum)
 	Interrupted = 1;
 }
 
+static void metrics_handler(int signum)
+{
+	DumpMetrics = 1;
+}
+
 
 int main( int argc, char** argv )
 {
-	ts2mpa_t *ts2mpa = init_ts2mpa_t();
+	ts2mpa_cli_t *cli = init_ts2mpa_cli_t();
+	ts2mpa_t *ts2mpa = cli->ts2mpa;
+	int result = 0;
 
 	// Parse the command-line parameters
-	parse_cmd_line( ts2mpa, argc, argv );
+	parse_cmd_line( cli, argc, argv );
 	
 	// Setup signal handling - so we exit cleanly
 	if (signal (SIGINT, termination_handler) == SIG_IGN)
@@ -444,23 +2003,77 @@ int main( int argc, char** argv )
 		signal (SIGHUP, SIG_IGN);
 	if (signal (SIGTERM, termination_handler) == SIG_IGN)
 		signal (SIGTERM, SIG_IGN);
+	if (cli->metrics_path)
+		signal (SIGUSR1, metrics_handler);
 
 	// Hard work happens here
-	process_ts_packets( ts2mpa );
+	if (cli->batch)
+		return process_batch( cli );
+	if (cli->checkpoint) {
+		resume_from_checkpoint( cli );
+		ts2mpa = cli->ts2mpa;
+	}
+	if (cli->elapsed) seek_to_start( cli );
+	if (cli->jobs < 2 || !process_parallel( cli ))
+		extract_input( cli );
+	
+	if (cli->index) {
+		if (!Quiet) fprintf(stderr, "ts2mpa: Indexed %llu PES packets.\n", cli->index->entries);
+		if (ts_index_close( cli->index, ts2mpa->offset )) {
+			perror("ts2mpa: Failed to write index");
+			return -2;
+		}
+	}
+	
+	if (cli->report) {
+		if (write_report( cli )) {
+			perror("ts2mpa: Failed to write report");
+			return -2;
+		}
+	}
 	
 	// Display statistics
 	if (!Quiet) {
     fprintf(stderr, "ts2mpa: TS packets processed: %lu\n", ts2mpa->total_packets);
     fprintf(stderr, "ts2mpa: Total written: %lu bytes\n", ts2mpa->total_bytes);
+    if (cli->time_skipped)
+      fprintf(stderr, "ts2mpa: Outside the time range: %lu bytes\n", cli->time_skipped);
+    if (ts2mpa->total_skipped)
+      fprintf(stderr, "ts2mpa: Skipped to regain sync: %lu bytes\n", ts2mpa->total_skipped);
+    if (ts2mpa->demux_all) print_stream_totals( ts2mpa );
+    if (cli->input->udp) {
+      udp_input_t *udp = cli->input->udp;
+      fprintf(stderr, "ts2mpa: Datagrams received: %lu\n", udp->datagrams);
+      if (udp->lost) fprintf(stderr, "ts2mpa: RTP datagrams lost: %lu\n", udp->lost);
+      if (udp->late) fprintf(stderr, "ts2mpa: RTP datagrams dropped for arriving late: %lu\n", udp->late);
+      if (udp->truncated) fprintf(stderr, "ts2mpa: Datagrams truncated: %lu\n", udp->truncated);
+      if (udp->invalid) fprintf(stderr, "ts2mpa: Invalid RTP datagrams: %lu\n", udp->invalid);
+    }
 	}
+	if (cli->metrics_path) write_metrics( cli );
 	
-	// Close the input and output files
-	fclose( ts2mpa->input );
-	fclose( ts2mpa->output );
+	// Close the output files, before the input that they may point into
+	if (close_outputs( cli )) {
+		perror("Error: failed to write stream out");
+		return -2;
+	}
 	
-	free(ts2mpa);
+	// What was read before a read failed has been written out, but
+	// the input wasn't read to the end
+	if (cli->input->error) {
+		errno = cli->input->error;
+		perror("Error: failed to read the whole of the input");
+		result = -2;
+	}
+	ts_input_close( cli->input );
 	
-	// Success
-	return 0;
+	ts2mpa_free( ts2mpa );
+	if (cli->checkpoint) ts_checkpoint_free( cli->checkpoint );
+	if (cli->report) ts_report_free( cli->report );
+	free( cli->pts_origin );
+	free( cli->elapsed );
+	free( cli );
+	
+	return result;
 }
 
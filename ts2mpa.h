@@ -24,32 +24,291 @@
 #ifndef _TS2MPA_H
 #define _TS2MPA_H
 
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
 #include "mpa_header.h"
+#include "ts_scan.h"
+#include "ts_psi.h"
 
 
+/*
+	libts2mpa - push-based MPEG Audio extraction from a Transport Stream
 
-typedef struct ts2mpa_s {
-	
-	FILE* input;
-	FILE* output;
+	Create a context with ts2mpa_new(), set the options and callbacks
+	in it, then pass the stream in with ts2mpa_feed(), in pieces of any
+	size. Extracted audio is handed to the es_data callback, a whole
+	MPEG audio frame at a time; a frame damaged by a lost or errored
+	packet is dropped, and extraction picks up at the next one.
+	The library has no global state, never exits and never prints
+	anything itself; messages go to the message callback.
+*/
+
+// The size of MPEG2 TS packets
+#define TS_PACKET_SIZE			188
+
+// Larger than any MPEG audio frame
+#define TS2MPA_MAX_FRAME		4096
+
+// Pieces of a frame that are held on to without copying them
+#define TS2MPA_HELD_SLICES		32
+
+
+/*
+	Counters kept for each PID, and for the whole stream.
+	They are cheap enough to leave on.
+*/
+typedef struct ts2mpa_counters_s {
+	unsigned long packets;			// Packets looked at, rather than filtered out
+	unsigned long cc_errors;		// Continuity errors
+	unsigned long trans_errors;		// Packets with the transport error flag set
+	unsigned long scrambled;		// Scrambled packets
+	unsigned long sync_losses;		// Streams losing MPEG audio sync
+	unsigned long sync_gains;		// Streams finding MPEG audio sync, or finding it again
+	unsigned long hunt_skipped;		// ES bytes skipped while hunting for a frame header
+	unsigned long frames;			// Whole MPEG audio frames passed to the application
+	unsigned long frames_dropped;	// Frames thrown away because they were damaged
+	unsigned long sync_predicted;	// Sync regained where the next frame was expected
+	unsigned long bytes;			// ES data passed to the application
+} ts2mpa_counters_t;
+
+
+// State for each MPEG Audio elementary stream (PES stream ID)
+typedef struct ts2mpa_stream_s {
+
+	void* user;						// For the application to use
 	
 	int pid;
+	int pes_stream_id;				// Or -1 once moved to another PID, until its next PES packet
 	int synced;
 	int never_synced;
-	int continuity_count;
-	int pes_stream_id;
 	int pes_remaining;
+	int pes_length;					// ES bytes in the last PES packet
+	int pes_head_len;				// Bytes before them
 	unsigned long total_bytes;
-	unsigned long total_packets;
+	long long pts;					// Of the last PES packet that had one, or -1
 	
 	mpa_header_t mpah;
 	
+	unsigned char carry[3];			// End of the last packet, while hunting for sync
+	size_t carry_len;
+	
+	unsigned int format;			// MPA_HEADER_FORMAT() of the header sync was found on
+	int confirming;					// Holding the first frame until the next header
+	
+	// The frame in progress, which is only passed on once it is whole
+	// (and confirmed): frame_buf[0..frame_copied) then the held slices
+	unsigned int frame_left;		// Bytes until the next frame header
+	unsigned char frame_header[3];	// Start of a header split across packets
+	size_t frame_header_len;
+	size_t frame_len;				// Bytes of the frame held so far
+	size_t frame_copied;
+	unsigned char frame_buf[TS2MPA_MAX_FRAME];
+	struct {
+		const unsigned char* ptr;	// Into the buffer being fed in
+		size_t len;
+	} held[TS2MPA_HELD_SLICES];
+	int held_count;
+	
+	// After a damaged frame, where the next one should start
+	int predicted;					// Check for a header there, before hunting
+	unsigned long resume_skip;		// ES bytes until then
+	
+	struct ts2mpa_stream_s *next;			// Next stream on the same PID
+	struct ts2mpa_stream_s *list_next;		// Next stream on any PID
+
+} ts2mpa_stream_t;
+
+
+// State for each Transport Stream PID that we are extracting from
+typedef struct ts2mpa_pid_s {
+
+	int pid;
+	int continuity_count;
+	
+	ts2mpa_stream_t* streams;		// Streams found on this PID
+	ts2mpa_stream_t* current;		// Stream of the PES packet in progress
+	
+	ts2mpa_counters_t counters;
+
+} ts2mpa_pid_t;
+
+
+// PSI sections being collected on a PAT or PMT PID
+typedef struct ts2mpa_psi_s {
+
+	struct ts2mpa_s *ts2mpa;		// Context that it belongs to
+	int pid;
+	ts_psi_section_t section;
+	
+	struct ts2mpa_psi_s *next;
+
+} ts2mpa_psi_t;
+
+
+// A program listed in the PAT, and the streams its PMT lists
+typedef struct ts2mpa_program_s {
+
+	int program_number;
+	int pmt_pid;
+	int version;					// Of the PMT, or -1 until it has been seen
+	int in_pat;						// Still listed in the PAT being collected
+	
+	int es_count;
+	uint16_t es_pids[TS_PSI_MAX_ES];
+	unsigned char es_types[TS_PSI_MAX_ES];
+	
+	struct ts2mpa_program_s *next;
+
+} ts2mpa_program_t;
+
+
+// The number of possible Transport Stream PIDs
+#define TS_PID_COUNT			8192
+
+// PTS are 33 bit counts of a 90kHz clock, so wrap every 26.5 hours
+#define TS2MPA_PTS_CLOCK		90000
+#define TS2MPA_PTS_WRAP			(1LL<<33)
+
+// What the program map says each PID carries
+#define TS2MPA_PID_UNKNOWN		0
+#define TS2MPA_PID_PSI			1		// PAT or PMT
+#define TS2MPA_PID_AUDIO		2		// MPEG audio, from its stream type
+#define TS2MPA_PID_OTHER		3		// Any other elementary stream
+
+// Levels of messages passed to the message callback
+#define TS2MPA_INFO				0
+#define TS2MPA_WARNING			1
+#define TS2MPA_ERROR			2
+
+
+typedef struct ts2mpa_s {
+	
+	// Options - set these before the first call to ts2mpa_feed()
+	int pid;					// PID to extract from, or -1 for the first found
+	int pes_stream_id;			// Stream ID to extract, or -1 for the first found
+	int demux_all;				// Extract every audio stream found
+	
+	/*
+		Callbacks - any can be NULL.
+		Those returning int can return non-zero to stop ts2mpa_feed()
+		with an error.
+	*/
+	void* user;
+	
+	// A new stream has been found, and is about to be extracted
+	int (*new_stream)( struct ts2mpa_s* ts2mpa, ts2mpa_stream_t* stream );
+	
+	// Elementary stream data for a stream, in one or more pieces for
+	// each whole frame. It points into the buffer passed to
+	// ts2mpa_feed() when it can, but otherwise into memory that is only
+	// valid until the callback returns. Without it, frames are only
+	// counted, which is quicker as none of them are kept.
+	int (*es_data)( struct ts2mpa_s* ts2mpa, ts2mpa_stream_t* stream,
+	                const unsigned char* data, size_t len );
+	
+	// A whole frame of len bytes is about to be passed to es_data.
+	// Output can be split here, without breaking a frame.
+	int (*frame_start)( struct ts2mpa_s* ts2mpa, ts2mpa_stream_t* stream, size_t len );
+	
+	// A stream has gained sync on this frame header.
+	// stream->never_synced is still set the first time.
+	void (*frame_header)( struct ts2mpa_s* ts2mpa, ts2mpa_stream_t* stream,
+	                      const mpa_header_t* mpah );
+	
+	// A stream has lost sync, in the packet at packet_offset.
+	// unconfirmed is set if it was on a header found by hunting, that
+	// turned out not to be real.
+	void (*sync_lost)( struct ts2mpa_s* ts2mpa, ts2mpa_stream_t* stream, int unconfirmed );
+	
+	// Something worth knowing about, or something going wrong
+	void (*message)( struct ts2mpa_s* ts2mpa, int level, const char* text );
+	
+	// A PES packet with a PTS (now in stream->pts) has started, in the
+	// packet at packet_offset. Called before any frames that start in it.
+	void (*pes_pts)( struct ts2mpa_s* ts2mpa, ts2mpa_stream_t* stream );
+	
+	// Statistics
+	int stream_count;
+	ts2mpa_stream_t* stream_list;
+	unsigned long total_bytes;
+	unsigned long total_packets;
+	unsigned long total_skipped;
+	unsigned long ts_sync_losses;		// Times that the packet boundaries were lost
+	ts2mpa_counters_t counters;			// For every PID
+	
+	// Time spent in each stage, in CPU cycles (or nanoseconds,
+	// where there is no cycle counter)
+	unsigned long long scan_cycles;		// Finding the packets on wanted PIDs
+	unsigned long long demux_cycles;	// Handling those packets, including output
+	unsigned long long output_cycles;	// In the es_data callback
+	
+	// Where we are in the stream
+	unsigned long long offset;			// Position of the next byte to be fed in,
+										// which can be set before the first feed
+	unsigned long long packet_offset;	// Position of the packet being processed
+	int started;
+	int resyncing;						// Looking for the packet boundaries again
+	unsigned long resync_skipped;
+	int error;							// errno of a failure, which stops everything
+	
+	// Packets, or the run of them used to resync, that span two feeds
+	unsigned char pending[TS_RESYNC_PACKETS*TS_PACKET_SIZE];
+	size_t pending_len;
+	
+	ts2mpa_pid_t* pids[TS_PID_COUNT];
+	uint32_t pid_map[TS_PID_MAP_WORDS];		// PIDs that packets are looked at for
+	int pid_map_grown;						// A PID added to it, part way through a batch
+	
+	// Program map, from the PAT and PMTs, when no PID is given.
+	// Until a PAT turns up, every PID is probed for MPEG audio PES
+	// packets instead.
+	unsigned char pid_types[TS_PID_COUNT];	// TS2MPA_PID_* for each PID
+	ts2mpa_psi_t* psi_list;
+	ts2mpa_program_t* programs;
+	int pat_version;						// -1 until a whole PAT has been seen
+	int pat_next_version;					// Version of the PAT being collected
+	uint32_t pat_sections[8];				// Sections of it seen so far
+	unsigned long psi_crc_errors;
+	
 } ts2mpa_t;
 
 
+// Create a new context, with the default options
+// returns NULL if there isn't enough memory
+ts2mpa_t* ts2mpa_new( void );
+
+// Find the stream for a PES stream ID on a PID, starting to extract it
+// if it hasn't been seen yet
+// returns NULL if a callback failed or memory ran out
+ts2mpa_stream_t* ts2mpa_add_stream( ts2mpa_t* ts2mpa, int pid, int stream_id );
+
+// Process the next part of the Transport Stream, which can be any length
+// returns 0 on success, or -1 if a callback failed or memory ran out
+int ts2mpa_feed( ts2mpa_t* ts2mpa, const unsigned char* buf, size_t len );
+
+// Process anything left over at the end of the stream
+// returns 0 on success, or -1 on failure
+int ts2mpa_finish( ts2mpa_t* ts2mpa );
+
+// Get the PTS from a PES header, of at least len bytes
+// returns the PTS, or -1 if it doesn't have one
+long long ts2mpa_pes_pts( const unsigned char* pes, size_t len );
+
+// Undo the wraparound of a 33 bit PTS, by picking the value that it
+// could stand for that is closest to near (the PTS expected, or the
+// last one unwrapped)
+long long ts2mpa_pts_unwrap( long long pts, long long near );
+
+// Write the counters out as a JSON object, with one for each PID
+// that has streams
+// returns 0 on success, or -1 on failure
+int ts2mpa_write_stats( ts2mpa_t* ts2mpa, FILE* file );
+
+void ts2mpa_free( ts2mpa_t* ts2mpa );
+
 
-// The size of MPEG2 TS packets
-#define TS_PACKET_SIZE			188
 
 /*
 	Macros for accessing MPEG-2 TS packet headers
@@ -92,17 +351,17 @@ typedef struct ts2mpa_s {
 #define PES_PACKET_EXTEN(b)			((b[7] & 0x1) >> 0)
 #define PES_PACKET_HEAD_LEN(b)		(b[8])
 
-#define PES_PACKET_PTS(b)		((uint32_t)((b[9] & 0x0E) << 29) | \
-					 (uint32_t)(b[10] << 22) | \
-					 (uint32_t)((b[11] & 0xFE) << 14) | \
-					 (uint32_t)(b[12] << 7) | \
-					 (uint32_t)(b[13] >> 1))
-
-#define PES_PACKET_DTS(b)		((uint32_t)((b[14] & 0x0E) << 29) | \
-					 (uint32_t)(b[15] << 22) | \
-					 (uint32_t)((b[16] & 0xFE) << 14) | \
-					 (uint32_t)(b[17] << 7) | \
-					 (uint32_t)(b[18] >> 1))
+#define PES_PACKET_PTS(b)		((uint64_t)(b[9] & 0x0E) << 29 | \
+					 (uint64_t)(b[10] << 22) | \
+					 (uint64_t)((b[11] & 0xFE) << 14) | \
+					 (uint64_t)(b[12] << 7) | \
+					 (uint64_t)(b[13] >> 1))
+
+#define PES_PACKET_DTS(b)		((uint64_t)(b[14] & 0x0E) << 29 | \
+					 (uint64_t)(b[15] << 22) | \
+					 (uint64_t)((b[16] & 0xFE) << 14) | \
+					 (uint64_t)(b[17] << 7) | \
+					 (uint64_t)(b[18] >> 1))
 
 
 
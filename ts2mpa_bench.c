@@ -0,0 +1,441 @@
+/*
+
+	ts2mpa_bench.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "ts2mpa.h"
+#include "ts_gen.h"
+#include "ts_report.h"
+#include "mpa_header.h"
+
+
+#define STRINGIFY(x)		#x
+#define TOSTRING(x)			STRINGIFY(x)
+
+// Size of the pieces that streams are fed to libts2mpa in
+#define BENCH_FEED_SIZE		(1024*1024)
+
+// Number of headers parsed in each run of the header benchmark
+#define BENCH_PARSE_COUNT	(16*1024*1024)
+
+
+// A multiplex to measure extraction from
+typedef struct bench_stream_s {
+	const char* name;
+	int audio_pids;
+	int other_pids;
+	int layer;
+	int bitrate;
+	int samplerate;
+	int padding;
+	int adaptation;
+	int cc_errors;
+	int trans_errors;
+	int corruption;
+	int length_errors;
+	int duplicates;
+	int psi_interval;
+	int demux_all;
+} bench_stream_t;
+
+static const bench_stream_t bench_streams[] = {
+	// name              audio other layer kbps    hz pad adapt  cc    trans  corrupt len   dup   psi  all
+	{ "feed_radio_mux",     8,   2,  2,  192, 48000, 0,  10,    0,     0,      0,    0,    0,    0,  0 },
+	{ "feed_radio_mux_all", 8,   2,  2,  192, 48000, 0,  10,    0,     0,      0,    0,    0,    0,  1 },
+	{ "feed_tv_mux",        4,  12,  2,  256, 48000, 0,  10,    0,     0,      0,    0,    0,    0,  0 },
+	{ "feed_tv_mux_psi",    4,  12,  2,  256, 48000, 0,  10,    0,     0,      0,    0,    0, 1000,  1 },
+	{ "feed_adaptation",    8,   2,  2,  192, 48000, 0, 100,    0,     0,      0,    0,    0,    0,  1 },
+	{ "feed_single_low",    1,   0,  2,   32, 48000, 0,  10,    0,     0,      0,    0,    0,    0,  0 },
+	{ "feed_errors",        8,   2,  2,  192, 48000, 0,  10, 1000,  5000,   2000,    0,    0,    0,  1 },
+	{ "feed_duplicates",    8,   2,  2,  192, 48000, 0,  10,    0,     0,      0,    0,  200,    0,  1 },
+	{ "feed_bad_lengths",   8,   2,  2,  192, 48000, 0,  10,    0,     0,      0,  500,    0,    0,  1 },
+	{ "feed_padded",        8,   2,  2,  128, 44100, 1,  10,    0,     0,      0,    0,    0,    0,  1 },
+	{ "feed_layer1",        4,   2,  1,  384, 48000, 0,  10,    0,     0,      0,    0,    0,    0,  1 },
+	{ "feed_layer1_padded", 4,   2,  1,  320, 44100, 1,  10,    0,     0,      0,    0,    0,    0,  1 },
+	{ "feed_lsf_layer2",    8,   2,  2,   64, 24000, 0,  10,    0,     0,      0,    0,    0,    0,  1 },
+	{ "feed_lsf_layer3",    8,   2,  3,   64, 22050, 1,  10,    0,     0,      0,    0,    0,    0,  1 },
+	{ "feed_mpeg25_layer2", 8,   2,  2,   32,  8000, 0,  10,    0,     0,      0,    0,    0,    0,  1 },
+	{ NULL }
+};
+
+
+// Largest difference allowed between the duration of the frames
+// extracted, and the duration of their bytes at the bitrate
+#define BENCH_DURATION_ERROR	0.001
+
+
+// Totals from check_durations()
+typedef struct bench_check_s {
+	double seconds;
+	unsigned long long bytes;
+	ts_report_t* report;
+} bench_check_t;
+
+
+static FILE* Results = NULL;
+static int ResultCount = 0;
+
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+// Start a JSON object for a result
+static void begin_result( const char* name )
+{
+	fprintf( Results, "%s\n    { \"name\": \"%s\"", ResultCount ? "," : "", name );
+	ResultCount++;
+}
+
+
+// Generate a stream into memory
+// returns its length
+static size_t make_stream( const bench_stream_t *bs, unsigned char *buf, size_t len )
+{
+	ts_gen_t gen;
+	size_t used = 0, filled;
+
+	ts_gen_init( &gen );
+	gen.audio_pids = bs->audio_pids;
+	gen.other_pids = bs->other_pids;
+	gen.layer = bs->layer;
+	gen.bitrate = bs->bitrate;
+	gen.samplerate = bs->samplerate;
+	gen.padding = bs->padding;
+	gen.adaptation = bs->adaptation;
+	gen.cc_errors = bs->cc_errors;
+	gen.trans_errors = bs->trans_errors;
+	gen.corruption = bs->corruption;
+	gen.length_errors = bs->length_errors;
+	gen.duplicates = bs->duplicates;
+	gen.psi_interval = bs->psi_interval;
+
+	while ((filled = ts_gen_fill( &gen, buf+used, len-used )) > 0)
+		used += filled;
+
+	ts_gen_free( &gen );
+	return used;
+}
+
+
+// Benchmark parsing a mix of valid MPEG audio headers
+static void bench_header_parse( int iterations )
+{
+	unsigned char headers[256][4];
+	unsigned long sum = 0;
+	double best = 0;
+	int count = 0;
+	int i, run;
+
+	// Every layer II bitrate and samplerate, with and without padding
+	for (i=0; i<14*3*2; i++) {
+		headers[count][0] = 0xFF;
+		headers[count][1] = 0xFD;
+		headers[count][2] = ((i/6+1) << 4) | (((i/2)%3) << 2) | ((i%2) << 1);
+		headers[count][3] = 0x04;
+		count++;
+	}
+
+	for (run=0; run<iterations; run++) {
+		double start = now(), elapsed;
+		for (i=0; i<BENCH_PARSE_COUNT; i++) {
+			mpa_header_t mh;
+			if (mpa_header_parse( headers[i % count], &mh )) sum += mh.framesize;
+		}
+		elapsed = now() - start;
+		if (run==0 || elapsed < best) best = elapsed;
+	}
+
+	begin_result( "mpa_header_parse" );
+	fprintf( Results, ", \"ops\": %d, \"seconds\": %.6f, \"ns_per_op\": %.3f, \"checksum\": %lu }",
+	         BENCH_PARSE_COUNT, best, best * 1e9 / BENCH_PARSE_COUNT, sum );
+	fprintf( stderr, "mpa_header_parse:    %8.3f ns/header\n", best * 1e9 / BENCH_PARSE_COUNT );
+}
+
+
+// Benchmark hunting for sync through data with no sync in it
+static void bench_sync_hunt( unsigned char *buf, size_t len, int iterations )
+{
+	double best_mpa = 0, best_ts = 0;
+	size_t found = 0;
+	uint32_t x = 1;
+	size_t i;
+	int run;
+
+	// Random bytes, with the occasional false start
+	for (i=0; i<len; i++) {
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		buf[i] = x >> 24;
+		if (buf[i] == 0x47 && i % 1024) buf[i] = 0x46;
+	}
+
+	for (run=0; run<iterations; run++) {
+		double start = now(), elapsed;
+		size_t pos = 0;
+
+		// Skip over false starts, as the extractor would
+		while (pos < len) {
+			pos += mpa_header_find( buf+pos, len-pos ) + 1;
+			found++;
+		}
+		elapsed = now() - start;
+		if (run==0 || elapsed < best_mpa) best_mpa = elapsed;
+
+		start = now();
+		found += ts_scan_sync( buf, len, TS_RESYNC_PACKETS );
+		elapsed = now() - start;
+		if (run==0 || elapsed < best_ts) best_ts = elapsed;
+	}
+
+	begin_result( "mpa_header_find" );
+	fprintf( Results, ", \"bytes\": %zu, \"seconds\": %.6f, \"mb_per_sec\": %.1f }",
+	         len, best_mpa, len / best_mpa / 1e6 );
+	fprintf( stderr, "mpa_header_find:     %8.1f MB/s\n", len / best_mpa / 1e6 );
+
+	begin_result( "ts_scan_sync" );
+	fprintf( Results, ", \"bytes\": %zu, \"seconds\": %.6f, \"mb_per_sec\": %.1f, \"checksum\": %zu }",
+	         len, best_ts, len / best_ts / 1e6, found );
+	fprintf( stderr, "ts_scan_sync:        %8.1f MB/s\n", len / best_ts / 1e6 );
+}
+
+
+static int check_new_stream( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream )
+{
+	bench_check_t *check = ts2mpa->user;
+	
+	stream->user = ts_report_add_stream( check->report, stream->pid, stream->pes_stream_id );
+	return stream->user ? 0 : -1;
+}
+
+
+// Add up the duration of each frame, from the same header fields that
+// ts2mpa counts the duration of an output segment with, and report on it
+static int check_frame( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, size_t len )
+{
+	bench_check_t *check = ts2mpa->user;
+	
+	check->seconds += (double)stream->mpah.samples / stream->mpah.samplerate;
+	check->bytes += len;
+	ts_report_frame( stream->user, &stream->mpah, len, ts2mpa->packet_offset );
+	return 0;
+}
+
+
+// Is a duration too far from what was expected?
+static int duration_wrong( const bench_stream_t *bs, const char *what, double seconds, double expected )
+{
+	if (seconds >= expected * (1-BENCH_DURATION_ERROR) &&
+	    seconds <= expected * (1+BENCH_DURATION_ERROR))
+		return 0;
+	
+	fprintf( stderr, "ts2mpa_bench: %s has %.3f seconds of %s, rather than %.3f\n",
+	         bs->name, seconds, what, expected );
+	return 1;
+}
+
+
+// Check that the frames extracted from an undamaged stream last as long
+// as their bytes do at the bitrate, which padding only evens out, both
+// added up frame by frame and in a report on the streams
+// returns 0 on success, -1 if memory ran out, or 1 if they don't
+static int check_durations( const bench_stream_t *bs, const unsigned char *buf, size_t len )
+{
+	ts2mpa_t *ts2mpa = ts2mpa_new();
+	bench_check_t check = { 0, 0, NULL };
+	ts_report_stream_t *stream = NULL;
+	double expected, reported = 0;
+	int wrong = 0;
+	
+	check.report = ts_report_new();
+	if (ts2mpa==NULL || check.report==NULL) {
+		perror("Failed to allocate memory for duration check");
+		return -1;
+	}
+	ts2mpa->demux_all = bs->demux_all;
+	ts2mpa->new_stream = check_new_stream;
+	ts2mpa->frame_start = check_frame;
+	ts2mpa->user = &check;
+	
+	if (ts2mpa_feed( ts2mpa, buf, len ) || ts2mpa_finish( ts2mpa )) {
+		perror("Failed to allocate memory for duration check");
+		return -1;
+	}
+	ts2mpa_free( ts2mpa );
+	
+	// As the report works out the duration of each stream
+	for (stream = check.report->streams; stream; stream = stream->next) {
+		if (stream->mpah.samplerate)
+			reported += (double)stream->samples / stream->mpah.samplerate;
+	}
+	ts_report_free( check.report );
+	
+	expected = check.bytes * 8.0 / (bs->bitrate * 1000);
+	wrong |= duration_wrong( bs, "frames", check.seconds, expected );
+	wrong |= duration_wrong( bs, "reported streams", reported, expected );
+	
+	return wrong;
+}
+
+
+static int count_es_data( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, const unsigned char *data, size_t len )
+{
+	// Touch the data, as writing it out would
+	unsigned long *sum = ts2mpa->user;
+	*sum += data[0] + data[len-1];
+	return 0;
+}
+
+
+// Benchmark extraction of a whole stream, end to end
+// returns 0 on success, -1 if memory ran out, or 1 if a stream without
+// any damage lost sync, or didn't last as long as it should
+static int bench_feed( const bench_stream_t *bs, unsigned char *buf, size_t len, int iterations )
+{
+	unsigned long packets = 0, bytes = 0, skipped = 0, sync_losses = 0, sum = 0;
+	double best = 0;
+	size_t stream_len, pos;
+	int run;
+
+	stream_len = make_stream( bs, buf, len );
+
+	for (run=0; run<iterations; run++) {
+		ts2mpa_t *ts2mpa = ts2mpa_new();
+		double start, elapsed;
+
+		if (ts2mpa==NULL) {
+			perror("Failed to allocate memory for ts2mpa_t");
+			return -1;
+		}
+		ts2mpa->demux_all = bs->demux_all;
+		ts2mpa->es_data = count_es_data;
+		ts2mpa->user = &sum;
+
+		start = now();
+		for (pos=0; pos<stream_len; pos+=BENCH_FEED_SIZE) {
+			size_t piece = stream_len-pos < BENCH_FEED_SIZE ? stream_len-pos : BENCH_FEED_SIZE;
+			if (ts2mpa_feed( ts2mpa, buf+pos, piece )) break;
+		}
+		ts2mpa_finish( ts2mpa );
+		elapsed = now() - start;
+
+		if (run==0 || elapsed < best) best = elapsed;
+		packets = ts2mpa->total_packets;
+		bytes = ts2mpa->total_bytes;
+		skipped = ts2mpa->total_skipped;
+		sync_losses = ts2mpa->counters.sync_losses + ts2mpa->counters.hunt_skipped;
+		ts2mpa_free( ts2mpa );
+	}
+
+	begin_result( bs->name );
+	fprintf( Results, ", \"bytes\": %zu, \"packets\": %lu, \"es_bytes\": %lu, \"skipped\": %lu,"
+	         " \"seconds\": %.6f, \"mb_per_sec\": %.1f, \"packets_per_sec\": %.0f }",
+	         stream_len, packets, bytes, skipped,
+	         best, stream_len / best / 1e6, packets / best );
+	fprintf( stderr, "%-20s %8.1f MB/s %12.0f packets/s\n", bs->name,
+	         stream_len / best / 1e6, packets / best );
+
+	// Every frame of an undamaged stream should follow on from the last
+	if (bs->cc_errors || bs->trans_errors || bs->corruption || bs->length_errors) return 0;
+	if (sync_losses || bytes == 0) {
+		fprintf( stderr, "ts2mpa_bench: %s lost MPEG audio sync without any damage\n", bs->name );
+		return 1;
+	}
+
+	return check_durations( bs, buf, stream_len );
+}
+
+
+static void usage()
+{
+	fprintf( stderr, "Usage: ts2mpa_bench [options]\n" );
+	fprintf( stderr, "    -h             Help - this message.\n" );
+	fprintf( stderr, "    -o <file>      Write the results to a JSON file (default stdout).\n" );
+	fprintf( stderr, "    -m <mbytes>    Size of each generated stream (default 128).\n" );
+	fprintf( stderr, "    -n <runs>      Number of runs of each benchmark, taking the best (default 3).\n" );
+	exit(-1);
+}
+
+
+int main( int argc, char** argv )
+{
+	size_t len = 128*1024*1024;
+	int iterations = 3;
+	unsigned char *buf = NULL;
+	int failed = 0;
+	int ch, i, result;
+
+	Results = stdout;
+	while ((ch = getopt(argc, argv, "o:m:n:h?")) != -1)
+	switch (ch) {
+		case 'o':
+			Results = fopen( optarg, "w" );
+			if (Results==NULL) {
+				perror("ts2mpa_bench: Failed to open output file");
+				return -2;
+			}
+		break;
+		case 'm': len = (size_t)atoi( optarg ) * 1024 * 1024; break;
+		case 'n': iterations = atoi( optarg ); break;
+		case '?':
+		case 'h':
+		default:
+			usage();
+	}
+	if (len < 1024*1024 || iterations < 1) usage();
+
+	buf = malloc( len );
+	if (buf==NULL) {
+		perror("Failed to allocate memory for streams");
+		return -3;
+	}
+
+	fprintf( Results, "{\n  \"version\": \"%s\",\n  \"stream_bytes\": %zu,\n  \"runs\": %d,\n  \"results\": [",
+	         TOSTRING(VERSION), len, iterations );
+
+	bench_header_parse( iterations );
+	bench_sync_hunt( buf, len, iterations );
+	for (i=0; bench_streams[i].name; i++) {
+		result = bench_feed( &bench_streams[i], buf, len, iterations );
+		if (result < 0) return -3;
+		if (result) failed++;
+	}
+
+	fprintf( Results, "\n  ]\n}\n" );
+	free( buf );
+
+	if (fclose( Results )) {
+		perror("ts2mpa_bench: Failed to write results");
+		return -2;
+	}
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,998 @@
+/*
+
+	ts2mpad.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+
+#include "ts2mpa.h"
+#include "udp_input.h"
+#include "es_output.h"
+#include "mpa_header.h"
+
+int Quiet = 0;
+
+
+// Bytes read from an input in one go
+#define TS2MPAD_READ_SIZE		(64*1024)
+
+// Reads from one input before moving on to the next, to be fair
+#define TS2MPAD_READ_BUDGET		4
+
+// Events handled by each epoll_wait() call
+#define TS2MPAD_MAX_EVENTS		64
+
+// Longest line in the config file or from the control socket
+#define TS2MPAD_MAX_LINE		1024
+
+// Most control socket connections at once
+#define TS2MPAD_MAX_CLIENTS		16
+
+
+struct ts2mpad_worker_s;
+
+// A source of Transport Stream, and where its audio goes
+typedef struct ts2mpad_stream_s {
+
+	char* line;					// Definition, as it was given
+	char* words;				// Copy of it, split up into the fields below
+	char* name;
+	char* input_path;
+	char* output_path;			// File, or template with -a
+	int pid;
+	int pes_stream_id;
+	int demux_all;
+	int from_config;			// Added by the config file, not the control socket
+
+	struct ts2mpad_worker_s* worker;
+	int fd;
+	int fifo_fd;				// Held open for writing, so that a FIFO never ends
+	int is_file;				// Regular file, which epoll can't wait on
+	udp_input_t* udp;
+	ts2mpa_t* ts2mpa;
+	es_output_t* output;
+	unsigned char* buf;
+	size_t feed_len;			// Bytes of buf being fed in
+
+	int done;					// Input has ended, and outputs are closed
+	unsigned long written;		// Copy of total_bytes that the main thread can read
+
+	struct ts2mpad_stream_s* next;			// In the list of all streams
+	struct ts2mpad_stream_s* worker_next;	// In the worker's list
+
+} ts2mpad_stream_t;
+
+
+// Instructions for a worker, from the main thread
+enum { CMD_ADD, CMD_REMOVE, CMD_STOP };
+
+typedef struct ts2mpad_command_s {
+	int type;
+	ts2mpad_stream_t* stream;
+	struct ts2mpad_command_s* next;
+} ts2mpad_command_t;
+
+
+// A thread serving a shard of the streams, with an epoll set of its own
+typedef struct ts2mpad_worker_s {
+
+	int index;
+	pthread_t thread;
+	int epfd;
+	int wakeup;					// eventfd, to notice new commands
+
+	pthread_mutex_t lock;		// Protects the commands
+	ts2mpad_command_t* commands;
+	ts2mpad_command_t** commands_tail;
+
+	ts2mpad_stream_t* streams;	// Only touched by the worker itself
+	int stop;
+
+} ts2mpad_worker_t;
+
+
+// A connection to the control socket
+typedef struct ts2mpad_client_s {
+	int fd;
+	char buf[TS2MPAD_MAX_LINE];
+	size_t len;
+} ts2mpad_client_t;
+
+
+static ts2mpad_worker_t* Workers = NULL;
+static int WorkerCount = 0;
+static ts2mpad_stream_t* Streams = NULL;
+static char* ConfigPath = NULL;
+
+
+
+static void log_stream( ts2mpad_stream_t *stream, int level, const char *fmt, ... )
+{
+	char text[256];
+	va_list args;
+
+	if (Quiet && level != TS2MPA_ERROR) return;
+
+	va_start( args, fmt );
+	vsnprintf( text, sizeof(text), fmt, args );
+	va_end( args );
+	fprintf(stderr, "ts2mpad: %s: %s\n", stream->name, text);
+}
+
+
+// Callback for a new stream: choose where it is written to
+static int stream_new_stream( ts2mpa_t *ts2mpa, ts2mpa_stream_t *ts_stream )
+{
+	ts2mpad_stream_t *stream = ts2mpa->user;
+
+	if (stream->demux_all) {
+		char filename[FILENAME_MAX];
+
+		es_output_expand_template( stream->output_path, ts_stream->pid, ts_stream->pes_stream_id,
+		                           filename, sizeof(filename) );
+		ts_stream->user = es_output_open( filename, ES_OUTPUT_BATCH_SIZE, 0 );
+		if (ts_stream->user==NULL) {
+			log_stream( stream, TS2MPA_ERROR, "Failed to open output file %s: %s", filename, strerror(errno) );
+			return -1;
+		}
+		log_stream( stream, TS2MPA_INFO, "Writing pid %d, stream id 0x%x to %s",
+		            ts_stream->pid, ts_stream->pes_stream_id, filename );
+	} else {
+		ts_stream->user = stream->output;
+	}
+
+	return 0;
+}
+
+
+// Callback for ES data: queue it up, until the end of the read
+static int stream_es_data( ts2mpa_t *ts2mpa, ts2mpa_stream_t *ts_stream, const unsigned char *data, size_t len )
+{
+	ts2mpad_stream_t *stream = ts2mpa->user;
+
+	// Data from anywhere but the read buffer is gone once we return
+	if (data >= stream->buf && data+len <= stream->buf+stream->feed_len)
+		return es_output_write( ts_stream->user, data, len );
+	else
+		return es_output_write_copy( ts_stream->user, data, len );
+}
+
+
+static void stream_frame_header( ts2mpa_t *ts2mpa, ts2mpa_stream_t *ts_stream, const mpa_header_t *mpah )
+{
+	ts2mpad_stream_t *stream = ts2mpa->user;
+
+	if (ts_stream->never_synced) {
+		log_stream( stream, TS2MPA_INFO, "pid %d, stream id 0x%x: MPEG Audio Layer %d, %d kbps, %d Hz",
+		            ts_stream->pid, ts_stream->pes_stream_id, mpah->layer, mpah->bitrate, mpah->samplerate );
+	} else {
+		log_stream( stream, TS2MPA_INFO, "Regained sync at 0x%llx", ts2mpa->packet_offset );
+	}
+}
+
+
+static void stream_message( ts2mpa_t *ts2mpa, int level, const char *text )
+{
+	log_stream( ts2mpa->user, level, "%s", text );
+}
+
+
+// Write out everything queued for a stream's outputs
+// returns 0 on success or -1 on failure
+static int flush_stream( ts2mpad_stream_t *stream )
+{
+	ts2mpa_stream_t *ts_stream = NULL;
+	int result = 0;
+
+	for (ts_stream = stream->ts2mpa->stream_list; ts_stream; ts_stream = ts_stream->list_next) {
+		if (es_output_flush( ts_stream->user )) result = -1;
+	}
+
+	return result;
+}
+
+
+// Close a stream's input and outputs, once its input has ended
+static void finish_stream( ts2mpad_stream_t *stream )
+{
+	ts2mpa_stream_t *ts_stream = NULL;
+	int failed = 0;
+
+	if (stream->done) return;
+
+	if (ts2mpa_finish( stream->ts2mpa )) failed = 1;
+	for (ts_stream = stream->ts2mpa->stream_list; ts_stream; ts_stream = ts_stream->list_next) {
+		if (ts_stream->user != stream->output && es_output_close( ts_stream->user ))
+			failed = 1;
+	}
+	if (stream->output && es_output_close( stream->output ))
+		failed = 1;
+	stream->output = NULL;
+
+	if (!stream->is_file)
+		epoll_ctl( stream->worker->epfd, EPOLL_CTL_DEL, stream->fd, NULL );
+	if (stream->udp) udp_input_close( stream->udp );
+	else close( stream->fd );
+	if (stream->fifo_fd >= 0) close( stream->fifo_fd );
+	stream->udp = NULL;
+	stream->fd = stream->fifo_fd = -1;
+
+	if (failed) log_stream( stream, TS2MPA_ERROR, "Failed to write stream out" );
+	log_stream( stream, TS2MPA_INFO, "Finished: %lu TS packets, %lu bytes written",
+	            stream->ts2mpa->total_packets, stream->ts2mpa->total_bytes );
+	__atomic_store_n( &stream->written, stream->ts2mpa->total_bytes, __ATOMIC_RELAXED );
+	__atomic_store_n( &stream->done, 1, __ATOMIC_RELEASE );
+}
+
+
+// Read whatever an input has for us, and extract from it
+static void service_stream( ts2mpad_stream_t *stream )
+{
+	int i;
+
+	for (i=0; i<TS2MPAD_READ_BUDGET && !stream->done; i++) {
+		ssize_t len;
+
+		if (stream->udp) {
+			len = udp_input_recv( stream->udp, stream->buf, TS2MPAD_READ_SIZE );
+			if (len == 0) break;
+		} else {
+			len = read( stream->fd, stream->buf, TS2MPAD_READ_SIZE );
+		}
+
+		if (len < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			log_stream( stream, TS2MPA_ERROR, "Failed to read from input: %s", strerror(errno) );
+			finish_stream( stream );
+		} else if (len == 0) {
+			finish_stream( stream );
+		} else {
+			// Queued output points into the read buffer, so is
+			// written out before the buffer is read into again
+			stream->feed_len = len;
+			if (ts2mpa_feed( stream->ts2mpa, stream->buf, len ) || flush_stream( stream )) {
+				if (stream->ts2mpa->error) errno = stream->ts2mpa->error;
+				log_stream( stream, TS2MPA_ERROR, "Failed to extract audio: %s", strerror(errno) );
+				finish_stream( stream );
+			}
+			stream->feed_len = 0;
+			__atomic_store_n( &stream->written, stream->ts2mpa->total_bytes, __ATOMIC_RELAXED );
+		}
+	}
+}
+
+
+static void free_stream( ts2mpad_stream_t *stream )
+{
+	if (stream->ts2mpa) ts2mpa_free( stream->ts2mpa );
+	free( stream->buf );
+	free( stream->words );
+	free( stream->line );
+	free( stream );
+}
+
+
+// Start serving a stream on a worker
+static void worker_add( ts2mpad_worker_t *worker, ts2mpad_stream_t *stream )
+{
+	struct epoll_event ev;
+
+	stream->worker = worker;
+	stream->worker_next = worker->streams;
+	worker->streams = stream;
+
+	// Regular files are always readable, so are read between events
+	if (stream->is_file) return;
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = stream;
+	if (epoll_ctl( worker->epfd, EPOLL_CTL_ADD, stream->fd, &ev )) {
+		log_stream( stream, TS2MPA_ERROR, "Failed to wait on input: %s", strerror(errno) );
+		finish_stream( stream );
+	}
+}
+
+
+static void worker_remove( ts2mpad_worker_t *worker, ts2mpad_stream_t *stream )
+{
+	ts2mpad_stream_t **ptr = &worker->streams;
+
+	while (*ptr && *ptr != stream) ptr = &(*ptr)->worker_next;
+	if (*ptr) *ptr = stream->worker_next;
+
+	finish_stream( stream );
+	free_stream( stream );
+}
+
+
+// Carry out the commands sent by the main thread
+static void worker_commands( ts2mpad_worker_t *worker )
+{
+	ts2mpad_command_t *cmd = NULL, *next = NULL;
+	uint64_t count;
+
+	if (read( worker->wakeup, &count, sizeof(count) ) < 0 && errno != EAGAIN) return;
+
+	pthread_mutex_lock( &worker->lock );
+	cmd = worker->commands;
+	worker->commands = NULL;
+	worker->commands_tail = &worker->commands;
+	pthread_mutex_unlock( &worker->lock );
+
+	for (; cmd; cmd = next) {
+		next = cmd->next;
+		switch (cmd->type) {
+			case CMD_ADD: worker_add( worker, cmd->stream ); break;
+			case CMD_REMOVE: worker_remove( worker, cmd->stream ); break;
+			case CMD_STOP: worker->stop = 1; break;
+		}
+		free( cmd );
+	}
+}
+
+
+static void* worker_thread( void* arg )
+{
+	ts2mpad_worker_t *worker = arg;
+	struct epoll_event events[TS2MPAD_MAX_EVENTS];
+
+	while (!worker->stop) {
+		ts2mpad_stream_t *stream = NULL;
+		int files = 0;
+		int count, i;
+
+		for (stream = worker->streams; stream; stream = stream->worker_next) {
+			if (stream->is_file && !stream->done) files++;
+		}
+
+		// Don't wait if there are files to be getting on with
+		count = epoll_wait( worker->epfd, events, TS2MPAD_MAX_EVENTS, files ? 0 : -1 );
+		if (count < 0 && errno != EINTR) {
+			perror("ts2mpad: Failed to wait for input");
+			break;
+		}
+
+		for (i=0; i<count; i++) {
+			if (events[i].data.ptr == NULL)
+				worker_commands( worker );
+			else
+				service_stream( events[i].data.ptr );
+		}
+
+		for (stream = worker->streams; stream && files; stream = stream->worker_next) {
+			if (stream->is_file && !stream->done) service_stream( stream );
+		}
+	}
+
+	return NULL;
+}
+
+
+// Pass a command to a worker thread
+static void send_command( ts2mpad_worker_t *worker, int type, ts2mpad_stream_t *stream )
+{
+	ts2mpad_command_t *cmd = calloc( 1, sizeof(ts2mpad_command_t) );
+	uint64_t one = 1;
+
+	if (cmd==NULL) {
+		perror("Failed to allocate memory for ts2mpad_command_t");
+		exit(-3);
+	}
+	cmd->type = type;
+	cmd->stream = stream;
+
+	pthread_mutex_lock( &worker->lock );
+	*worker->commands_tail = cmd;
+	worker->commands_tail = &cmd->next;
+	pthread_mutex_unlock( &worker->lock );
+
+	if (write( worker->wakeup, &one, sizeof(one) ) < 0)
+		perror("ts2mpad: Failed to wake up worker");
+}
+
+
+static void start_workers( int count )
+{
+	struct epoll_event ev;
+	int i;
+
+	Workers = calloc( count, sizeof(ts2mpad_worker_t) );
+	if (Workers==NULL) {
+		perror("Failed to allocate memory for workers");
+		exit(-3);
+	}
+	WorkerCount = count;
+
+	for (i=0; i<count; i++) {
+		ts2mpad_worker_t *worker = &Workers[i];
+
+		worker->index = i;
+		worker->commands_tail = &worker->commands;
+		pthread_mutex_init( &worker->lock, NULL );
+		worker->epfd = epoll_create1( EPOLL_CLOEXEC );
+		worker->wakeup = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+		if (worker->epfd < 0 || worker->wakeup < 0) {
+			perror("ts2mpad: Failed to create epoll set");
+			exit(-2);
+		}
+
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (epoll_ctl( worker->epfd, EPOLL_CTL_ADD, worker->wakeup, &ev ) ||
+		    pthread_create( &worker->thread, NULL, worker_thread, worker ))
+		{
+			perror("ts2mpad: Failed to start worker thread");
+			exit(-2);
+		}
+	}
+}
+
+
+static void stop_workers()
+{
+	int i;
+
+	for (i=0; i<WorkerCount; i++)
+		send_command( &Workers[i], CMD_STOP, NULL );
+	for (i=0; i<WorkerCount; i++) {
+		pthread_join( Workers[i].thread, NULL );
+		close( Workers[i].epfd );
+		close( Workers[i].wakeup );
+	}
+	free( Workers );
+}
+
+
+// Pick a worker for a stream by its name, so that it always
+// goes to the same one
+static ts2mpad_worker_t* shard_for( const char *name )
+{
+	unsigned int hash = 5381;
+
+	while (*name) hash = hash * 33 + (unsigned char)*name++;
+	return &Workers[hash % WorkerCount];
+}
+
+
+static ts2mpad_stream_t* find_stream( const char *name )
+{
+	ts2mpad_stream_t *stream = NULL;
+
+	for (stream = Streams; stream; stream = stream->next) {
+		if (strcmp( stream->name, name ) == 0) return stream;
+	}
+
+	return NULL;
+}
+
+
+// Parse a stream definition: <name> <input> <output> [pid=N] [sid=N] [all]
+// returns NULL, with a reason in err, if it isn't valid
+static ts2mpad_stream_t* parse_stream( const char *line, char *err, size_t err_len )
+{
+	ts2mpad_stream_t *stream = calloc( 1, sizeof(ts2mpad_stream_t) );
+	char *fields[3];
+	char *token = NULL, *save = NULL;
+	int count = 0;
+
+	if (stream==NULL) {
+		snprintf( err, err_len, "out of memory" );
+		return NULL;
+	}
+	stream->fd = stream->fifo_fd = -1;
+	stream->pid = stream->pes_stream_id = -1;
+
+	// Split up a copy, and keep the line as given for comparing on reload
+	stream->line = strdup( line );
+	stream->words = strdup( line );
+	if (stream->line==NULL || stream->words==NULL) {
+		snprintf( err, err_len, "out of memory" );
+		free_stream( stream );
+		return NULL;
+	}
+
+	for (token = strtok_r( stream->words, " \t\r\n", &save ); token;
+	     token = strtok_r( NULL, " \t\r\n", &save ))
+	{
+		if (count < 3) {
+			fields[count++] = token;
+		} else if (strncmp( token, "pid=", 4 ) == 0) {
+			stream->pid = strtol( token+4, NULL, 0 );
+		} else if (strncmp( token, "sid=", 4 ) == 0) {
+			stream->pes_stream_id = strtol( token+4, NULL, 0 );
+		} else if (strcmp( token, "all" ) == 0) {
+			stream->demux_all = 1;
+		} else {
+			snprintf( err, err_len, "unknown option: %s", token );
+			goto fail;
+		}
+	}
+
+	if (count < 3) {
+		snprintf( err, err_len, "expected: <name> <input> <output> [pid=N] [sid=N] [all]" );
+		goto fail;
+	}
+	if (stream->pid == 0 || stream->pid < -1 || stream->pid >= TS_PID_COUNT ||
+	    stream->pes_stream_id == 0 || stream->pes_stream_id < -1)
+	{
+		snprintf( err, err_len, "invalid PID or stream ID" );
+		goto fail;
+	}
+	if (stream->demux_all && strstr( fields[2], "%pid" ) == NULL && strstr( fields[2], "%sid" ) == NULL) {
+		snprintf( err, err_len, "output must contain %%pid or %%sid with all" );
+		goto fail;
+	}
+	if (strcmp( fields[1], "-" ) == 0 || strcmp( fields[2], "-" ) == 0) {
+		snprintf( err, err_len, "stdin and stdout can't be used" );
+		goto fail;
+	}
+
+	stream->name = fields[0];
+	stream->input_path = fields[1];
+	stream->output_path = fields[2];
+	return stream;
+
+fail:
+	free_stream( stream );
+	return NULL;
+}
+
+
+// Open a stream's input and output, ready to hand to a worker
+// returns 0 on success, or -1 with a reason in err
+static int open_stream( ts2mpad_stream_t *stream, char *err, size_t err_len )
+{
+	struct stat st;
+
+	stream->buf = malloc( TS2MPAD_READ_SIZE );
+	stream->ts2mpa = ts2mpa_new();
+	if (stream->buf==NULL || stream->ts2mpa==NULL) {
+		snprintf( err, err_len, "out of memory" );
+		return -1;
+	}
+	stream->ts2mpa->pid = stream->pid;
+	stream->ts2mpa->pes_stream_id = stream->pes_stream_id;
+	stream->ts2mpa->demux_all = stream->demux_all;
+	stream->ts2mpa->user = stream;
+	stream->ts2mpa->new_stream = stream_new_stream;
+	stream->ts2mpa->es_data = stream_es_data;
+	stream->ts2mpa->frame_header = stream_frame_header;
+	stream->ts2mpa->message = stream_message;
+
+	if (udp_input_is_url( stream->input_path )) {
+		stream->udp = udp_input_open( stream->input_path );
+		if (stream->udp == NULL) goto fail;
+		stream->fd = stream->udp->fd;
+	} else {
+		// Don't block waiting for a writer to turn up
+		stream->fd = open( stream->input_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC );
+		if (stream->fd < 0) goto fail;
+		if (fstat( stream->fd, &st )) goto fail;
+		stream->is_file = S_ISREG( st.st_mode );
+
+		// Keep a FIFO open for writing too, so that it doesn't end
+		// when one writer goes away and before the next one comes along
+		if (S_ISFIFO( st.st_mode ))
+			stream->fifo_fd = open( stream->input_path, O_WRONLY | O_NONBLOCK | O_CLOEXEC );
+	}
+	if (fcntl( stream->fd, F_SETFL, fcntl( stream->fd, F_GETFL ) | O_NONBLOCK ))
+		goto fail;
+
+	if (!stream->demux_all) {
+		stream->output = es_output_open( stream->output_path, ES_OUTPUT_BATCH_SIZE, 0 );
+		if (stream->output == NULL) {
+			snprintf( err, err_len, "failed to open output file: %s", strerror(errno) );
+			return -1;
+		}
+	}
+
+	return 0;
+
+fail:
+	snprintf( err, err_len, "failed to open input: %s", strerror(errno) );
+	return -1;
+}
+
+
+// Undo open_stream(), for a stream that never made it to a worker
+static void close_stream( ts2mpad_stream_t *stream )
+{
+	if (stream->udp) udp_input_close( stream->udp );
+	else if (stream->fd >= 0) close( stream->fd );
+	if (stream->fifo_fd >= 0) close( stream->fifo_fd );
+	if (stream->output) es_output_close( stream->output );
+	free_stream( stream );
+}
+
+
+// Add a stream from its definition
+// returns 0 on success, or -1 with a reason in err
+static int add_stream( const char *line, int from_config, char *err, size_t err_len )
+{
+	ts2mpad_stream_t *stream = parse_stream( line, err, err_len );
+
+	if (stream == NULL) return -1;
+	if (find_stream( stream->name )) {
+		snprintf( err, err_len, "there is already a stream called %s", stream->name );
+		close_stream( stream );
+		return -1;
+	}
+	if (open_stream( stream, err, err_len )) {
+		close_stream( stream );
+		return -1;
+	}
+
+	stream->from_config = from_config;
+	stream->next = Streams;
+	Streams = stream;
+	send_command( shard_for( stream->name ), CMD_ADD, stream );
+
+	if (!Quiet) fprintf(stderr, "ts2mpad: Added %s\n", stream->name);
+	return 0;
+}
+
+
+// The worker finishes the stream off and frees it
+static void remove_stream( ts2mpad_stream_t *stream )
+{
+	ts2mpad_stream_t **ptr = &Streams;
+
+	while (*ptr && *ptr != stream) ptr = &(*ptr)->next;
+	if (*ptr) *ptr = stream->next;
+
+	if (!Quiet) fprintf(stderr, "ts2mpad: Removing %s\n", stream->name);
+	send_command( stream->worker ? stream->worker : shard_for( stream->name ), CMD_REMOVE, stream );
+}
+
+
+// Does a config file line define a stream?
+static int is_definition( const char *line )
+{
+	line += strspn( line, " \t\r\n" );
+	return *line && *line != '#';
+}
+
+
+// (Re)load the config file: streams that have gone or changed are
+// removed, and new ones added, leaving the rest running
+static void load_config()
+{
+	char line[TS2MPAD_MAX_LINE], err[256];
+	ts2mpad_stream_t *stream = NULL, *next = NULL;
+	FILE *file = fopen( ConfigPath, "r" );
+	char **lines = NULL;
+	int count = 0, i;
+
+	if (file==NULL) {
+		perror("ts2mpad: Failed to open config file");
+		return;
+	}
+	while (fgets( line, sizeof(line), file )) {
+		char **more = NULL;
+		line[strcspn( line, "\r\n" )] = '\0';
+		if (!is_definition( line )) continue;
+
+		more = realloc( lines, (count+1) * sizeof(char*) );
+		if (more==NULL || (more[count] = strdup( line )) == NULL) {
+			perror("Failed to allocate memory for config file");
+			exit(-3);
+		}
+		lines = more;
+		count++;
+	}
+	fclose( file );
+
+	for (stream = Streams; stream; stream = next) {
+		int found = 0;
+		next = stream->next;
+		if (!stream->from_config) continue;
+		for (i=0; i<count && !found; i++)
+			found = strcmp( stream->line, lines[i] ) == 0;
+		if (!found) remove_stream( stream );
+	}
+
+	for (i=0; i<count; i++) {
+		for (stream = Streams; stream; stream = stream->next) {
+			if (stream->from_config && strcmp( stream->line, lines[i] ) == 0) break;
+		}
+		if (stream == NULL && add_stream( lines[i], 1, err, sizeof(err) ))
+			fprintf(stderr, "ts2mpad: %s: %s\n", lines[i], err);
+		free( lines[i] );
+	}
+	free( lines );
+}
+
+
+static void reply( ts2mpad_client_t *client, const char *fmt, ... )
+{
+	char text[TS2MPAD_MAX_LINE];
+	va_list args;
+	int len;
+
+	va_start( args, fmt );
+	len = vsnprintf( text, sizeof(text), fmt, args );
+	va_end( args );
+	if (len >= (int)sizeof(text)) len = sizeof(text)-1;
+
+	// Replies are small, and a client that doesn't read them loses out
+	if (send( client->fd, text, len, MSG_NOSIGNAL | MSG_DONTWAIT ) < 0 && !Quiet)
+		perror("ts2mpad: Failed to reply to control connection");
+}
+
+
+// Carry out a command from the control socket
+static void control_command( ts2mpad_client_t *client, char *line )
+{
+	ts2mpad_stream_t *stream = NULL;
+	char err[256];
+
+	line[strcspn( line, "\r\n" )] = '\0';
+
+	if (strncmp( line, "add ", 4 ) == 0) {
+		if (add_stream( line+4, 0, err, sizeof(err) )) reply( client, "ERROR %s\n", err );
+		else reply( client, "OK\n" );
+	} else if (strncmp( line, "remove ", 7 ) == 0) {
+		stream = find_stream( line+7 );
+		if (stream) {
+			remove_stream( stream );
+			reply( client, "OK\n" );
+		} else {
+			reply( client, "ERROR no stream called %s\n", line+7 );
+		}
+	} else if (strcmp( line, "list" ) == 0) {
+		for (stream = Streams; stream; stream = stream->next) {
+			reply( client, "%s %s %s %s %lu\n", stream->name, stream->input_path, stream->output_path,
+			       __atomic_load_n( &stream->done, __ATOMIC_ACQUIRE ) ? "done" : "running",
+			       __atomic_load_n( &stream->written, __ATOMIC_RELAXED ) );
+		}
+		reply( client, "OK\n" );
+	} else if (strcmp( line, "reload" ) == 0) {
+		if (ConfigPath) {
+			load_config();
+			reply( client, "OK\n" );
+		} else {
+			reply( client, "ERROR no config file\n" );
+		}
+	} else {
+		reply( client, "ERROR commands are: add <definition>, remove <name>, list, reload\n" );
+	}
+}
+
+
+// Read from a control connection
+// returns 0 if it is still open, or -1 if it has closed
+static int control_read( ts2mpad_client_t *client )
+{
+	char *end = NULL;
+	ssize_t len = read( client->fd, client->buf + client->len, sizeof(client->buf) - client->len - 1 );
+
+	if (len < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+	if (len <= 0) return -1;
+	client->len += len;
+	client->buf[client->len] = '\0';
+
+	while ((end = strchr( client->buf, '\n' ))) {
+		*end = '\0';
+		control_command( client, client->buf );
+		client->len -= end+1 - client->buf;
+		memmove( client->buf, end+1, client->len + 1 );
+	}
+
+	// A line that is too long is dropped
+	if (client->len == sizeof(client->buf) - 1) {
+		reply( client, "ERROR line too long\n" );
+		client->len = 0;
+	}
+
+	return 0;
+}
+
+
+static int open_control( const char *path )
+{
+	struct sockaddr_un addr;
+	int fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+
+	if (fd < 0) return -1;
+	if (strlen( path ) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		close( fd );
+		return -1;
+	}
+	memset( &addr, 0, sizeof(addr) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path );
+
+	// Take over from a daemon that didn't tidy up after itself
+	unlink( path );
+	if (bind( fd, (struct sockaddr*)&addr, sizeof(addr) ) || listen( fd, TS2MPAD_MAX_CLIENTS )) {
+		close( fd );
+		return -1;
+	}
+
+	return fd;
+}
+
+
+static void usage()
+{
+	fprintf( stderr, "Usage: ts2mpad [options]\n" );
+	fprintf( stderr, "    -h             Help - this message.\n" );
+	fprintf( stderr, "    -q             Quiet - don't print messages to stderr.\n" );
+	fprintf( stderr, "    -c <file>      Config file of streams, re-read on SIGHUP.\n" );
+	fprintf( stderr, "    -s <socket>    Control socket, to add and remove streams.\n" );
+	fprintf( stderr, "    -w <workers>   Number of worker threads (default: one per CPU).\n" );
+	fprintf( stderr, "Each stream is defined on a line of its own:\n" );
+	fprintf( stderr, "    <name> <input> <output> [pid=N] [sid=N] [all]\n" );
+	fprintf( stderr, "<input> is a file, FIFO, or udp:// or rtp:// URL. With 'all', <output>\n" );
+	fprintf( stderr, "is a template containing %%pid and/or %%sid.\n" );
+	exit(-1);
+}
+
+
+int main( int argc, char** argv )
+{
+	ts2mpad_client_t *clients[TS2MPAD_MAX_CLIENTS];
+	struct epoll_event ev, events[TS2MPAD_MAX_EVENTS];
+	struct signalfd_siginfo info;
+	char *control_path = NULL;
+	sigset_t signals;
+	int workers = sysconf( _SC_NPROCESSORS_ONLN );
+	int epfd, sigfd, control = -1;
+	int running = 1;
+	int ch, i;
+
+	while ((ch = getopt(argc, argv, "c:s:w:qh?")) != -1)
+	switch (ch) {
+		case 'q': Quiet = 1; break;
+		case 'c': ConfigPath = optarg; break;
+		case 's': control_path = optarg; break;
+		case 'w':
+			workers = atoi( optarg );
+			if (workers <= 0) {
+				fprintf(stderr, "ts2mpad: Invalid number of workers: %s\n", optarg);
+				exit(-1);
+			}
+		break;
+		case '?':
+		case 'h':
+		default:
+			usage();
+	}
+	if (ConfigPath == NULL && control_path == NULL) {
+		fprintf(stderr, "ts2mpad: a config file or control socket is needed.\n");
+		usage();
+	}
+	if (workers <= 0) workers = 1;
+
+	// Signals are read from a signalfd by the main loop, and never
+	// delivered to the workers
+	sigemptyset( &signals );
+	sigaddset( &signals, SIGINT );
+	sigaddset( &signals, SIGTERM );
+	sigaddset( &signals, SIGHUP );
+	pthread_sigmask( SIG_BLOCK, &signals, NULL );
+	signal( SIGPIPE, SIG_IGN );
+	sigfd = signalfd( -1, &signals, SFD_NONBLOCK | SFD_CLOEXEC );
+	epfd = epoll_create1( EPOLL_CLOEXEC );
+	if (sigfd < 0 || epfd < 0) {
+		perror("ts2mpad: Failed to set up the main loop");
+		exit(-2);
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = &sigfd;
+	epoll_ctl( epfd, EPOLL_CTL_ADD, sigfd, &ev );
+
+	if (control_path) {
+		control = open_control( control_path );
+		if (control < 0) {
+			perror("ts2mpad: Failed to open control socket");
+			exit(-2);
+		}
+		ev.data.ptr = &control;
+		epoll_ctl( epfd, EPOLL_CTL_ADD, control, &ev );
+	}
+	memset( clients, 0, sizeof(clients) );
+
+	start_workers( workers );
+	if (ConfigPath) load_config();
+	if (!Quiet) fprintf(stderr, "ts2mpad: Running with %d worker thread(s).\n", workers);
+
+	while (running) {
+		int count = epoll_wait( epfd, events, TS2MPAD_MAX_EVENTS, -1 );
+		if (count < 0 && errno != EINTR) {
+			perror("ts2mpad: Failed to wait for events");
+			break;
+		}
+
+		for (i=0; i<count; i++) {
+			if (events[i].data.ptr == &sigfd) {
+				while (read( sigfd, &info, sizeof(info) ) == sizeof(info)) {
+					if (info.ssi_signo == SIGHUP) {
+						if (!Quiet) fprintf(stderr, "ts2mpad: Recieved SIGHUP, reloading config.\n");
+						if (ConfigPath) load_config();
+					} else {
+						if (!Quiet) fprintf(stderr, "ts2mpad: Recieved %s, stopping.\n",
+						                    info.ssi_signo == SIGINT ? "SIGINT" : "SIGTERM");
+						running = 0;
+					}
+				}
+			} else if (events[i].data.ptr == &control) {
+				int fd, slot;
+				while ((fd = accept4( control, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC )) >= 0) {
+					for (slot=0; slot<TS2MPAD_MAX_CLIENTS && clients[slot]; slot++);
+					if (slot == TS2MPAD_MAX_CLIENTS || (clients[slot] = calloc( 1, sizeof(ts2mpad_client_t) )) == NULL) {
+						close( fd );
+						continue;
+					}
+					clients[slot]->fd = fd;
+					ev.data.ptr = clients[slot];
+					epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &ev );
+				}
+			} else {
+				ts2mpad_client_t *client = events[i].data.ptr;
+				if (control_read( client )) {
+					close( client->fd );
+					for (ch=0; ch<TS2MPAD_MAX_CLIENTS; ch++)
+						if (clients[ch] == client) clients[ch] = NULL;
+					free( client );
+				}
+			}
+		}
+	}
+
+	// Finish every stream off, then let the workers go
+	while (Streams) remove_stream( Streams );
+	stop_workers();
+
+	for (i=0; i<TS2MPAD_MAX_CLIENTS; i++) {
+		if (clients[i] == NULL) continue;
+		close( clients[i]->fd );
+		free( clients[i] );
+	}
+	if (control >= 0) {
+		close( control );
+		unlink( control_path );
+	}
+	close( sigfd );
+	close( epfd );
+
+	return 0;
+}
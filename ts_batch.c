@@ -0,0 +1,642 @@
+/*
+
+	ts_batch.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <glob.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "ts_batch.h"
+#include "ts_report.h"
+#include "es_output.h"
+#include "ts_decompress.h"
+
+
+// A job being extracted, for the callbacks
+typedef struct ts_batch_run_s {
+	ts_batch_t* batch;
+	ts_batch_job_t* job;
+	unsigned char* buf;			// Read buffer of the thread
+	size_t feed_len;			// Bytes of buf being fed in
+	ts_decompress_t* decompress;	// Decompressing the input, or NULL
+} ts_batch_run_t;
+
+
+
+static double now()
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void log_job( ts_batch_run_t *run, int level, const char *fmt, ... )
+{
+	char text[256];
+	va_list args;
+
+	if (run->batch->quiet && level != TS2MPA_ERROR) return;
+
+	va_start( args, fmt );
+	vsnprintf( text, sizeof(text), fmt, args );
+	va_end( args );
+	fprintf(stderr, "ts2mpa: %s: %s\n", run->job->input_path, text);
+}
+
+
+// Record why a job failed, if it hasn't already
+static void job_failed( ts_batch_run_t *run, const char *fmt, ... )
+{
+	ts_batch_job_t *job = run->job;
+	va_list args;
+
+	if (job->failed) return;
+	job->failed = 1;
+
+	va_start( args, fmt );
+	vsnprintf( job->error, sizeof(job->error), fmt, args );
+	va_end( args );
+}
+
+
+// Expand %name in the output template, leaving anything else in it
+// for es_output_expand_template()
+static void expand_name( const char *tmpl, const char *name, char *buf, size_t buf_len )
+{
+	size_t len = 0;
+	const char *c = NULL;
+
+	while (*tmpl && len+2 < buf_len) {
+		if (strncmp( tmpl, TS_BATCH_NAME, strlen(TS_BATCH_NAME) ) == 0) {
+			// Any % in the name is kept as it is
+			for (c = name; *c && len+2 < buf_len; c++) {
+				if (*c == '%') buf[len++] = '%';
+				buf[len++] = *c;
+			}
+			tmpl += strlen(TS_BATCH_NAME);
+		} else if (strncmp( tmpl, "%%", 2 ) == 0) {
+			buf[len++] = *tmpl++;
+			buf[len++] = *tmpl++;
+		} else {
+			buf[len++] = *tmpl++;
+		}
+	}
+
+	buf[len] = '\0';
+}
+
+
+// Callback for a new stream: open the file it is written to
+static int job_new_stream( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream )
+{
+	ts_batch_run_t *run = ts2mpa->user;
+	char tmpl[FILENAME_MAX], filename[FILENAME_MAX];
+
+	expand_name( run->batch->output_template, run->job->name, tmpl, sizeof(tmpl) );
+	es_output_expand_template( tmpl, stream->pid, stream->pes_stream_id, filename, sizeof(filename) );
+	stream->user = es_output_open( filename, run->batch->batch_size, 0 );
+	if (stream->user==NULL) {
+		job_failed( run, "Failed to open output file %s: %s", filename, strerror(errno) );
+		return -1;
+	}
+	log_job( run, TS2MPA_INFO, "Writing pid %d, stream id 0x%x to %s",
+	         stream->pid, stream->pes_stream_id, filename );
+
+	return 0;
+}
+
+
+// Callback for ES data: queue it up, until the end of the read
+static int job_es_data( ts2mpa_t *ts2mpa, ts2mpa_stream_t *stream, const unsigned char *data, size_t len )
+{
+	ts_batch_run_t *run = ts2mpa->user;
+
+	// Data from anywhere but the read buffer is gone once we return
+	if (data >= run->buf && data+len <= run->buf+run->feed_len)
+		return es_output_write( stream->user, data, len );
+	else
+		return es_output_write_copy( stream->user, data, len );
+}
+
+
+static void job_message( ts2mpa_t *ts2mpa, int level, const char *text )
+{
+	log_job( ts2mpa->user, level, "%s", text );
+}
+
+
+// Write out everything queued for a job's outputs
+// returns 0 on success or -1 on failure
+static int flush_job( ts2mpa_t *ts2mpa )
+{
+	ts2mpa_stream_t *stream = NULL;
+	int result = 0;
+
+	for (stream = ts2mpa->stream_list; stream; stream = stream->list_next) {
+		if (stream->user && es_output_flush( stream->user )) result = -1;
+	}
+
+	return result;
+}
+
+
+// Read an input file through, extracting from it as it goes
+static void extract_job( ts_batch_run_t *run, ts2mpa_t *ts2mpa, int fd )
+{
+	const int *interrupted = run->batch->interrupted;
+	ssize_t len;
+
+	while (interrupted==NULL || !__atomic_load_n( interrupted, __ATOMIC_RELAXED )) {
+		if (run->decompress)
+			len = ts_decompress_read( run->decompress, run->buf, TS_BATCH_READ_SIZE );
+		else
+			len = read( fd, run->buf, TS_BATCH_READ_SIZE );
+		if (len < 0 && errno == EINTR) continue;
+		if (len < 0) {
+			job_failed( run, "Failed to read input: %s", strerror(errno) );
+			return;
+		}
+		if (len == 0) {
+			if (ts2mpa_finish( ts2mpa ) || flush_job( ts2mpa )) break;
+			return;
+		}
+
+		// Queued output points into the read buffer, so is
+		// written out before the buffer is read into again
+		run->feed_len = len;
+		if (ts2mpa_feed( ts2mpa, run->buf, len ) || flush_job( ts2mpa )) break;
+		run->feed_len = 0;
+	}
+
+	if (interrupted && __atomic_load_n( interrupted, __ATOMIC_RELAXED )) {
+		job_failed( run, "Interrupted" );
+	} else {
+		if (ts2mpa->error) errno = ts2mpa->error;
+		job_failed( run, "Failed to extract audio: %s", strerror(errno) );
+	}
+}
+
+
+// Extract one input, and record how it went
+static void run_job( ts_batch_t *batch, ts_batch_job_t *job, unsigned char *buf )
+{
+	ts_batch_run_t run = { batch, job, buf, 0, NULL };
+	ts2mpa_t *ts2mpa = NULL;
+	ts2mpa_stream_t *stream = NULL;
+	double start = now();
+	struct stat st;
+	int fd, format = TS_DECOMPRESS_NONE;
+
+	fd = open( job->input_path, O_RDONLY );
+	if (fd < 0) {
+		job_failed( &run, "Failed to open input: %s", strerror(errno) );
+	} else if (fstat( fd, &st ) == 0 && S_ISDIR( st.st_mode )) {
+		job_failed( &run, "Failed to open input: %s", strerror(EISDIR) );
+	} else if ((format = ts_decompress_probe( fd )) != TS_DECOMPRESS_NONE &&
+	           (run.decompress = ts_decompress_open( fd, format )) == NULL) {
+		if (errno == ENOTSUP)
+			job_failed( &run, "Compressed with %s, which this ts2mpa was built without", ts_decompress_name( format ) );
+		else
+			job_failed( &run, "Failed to open input: %s", strerror(errno) );
+	} else if ((ts2mpa = ts2mpa_new()) == NULL) {
+		job_failed( &run, "Failed to allocate memory for ts2mpa_t" );
+	} else {
+		posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+		ts2mpa->pid = batch->pid;
+		ts2mpa->pes_stream_id = batch->pes_stream_id;
+		ts2mpa->demux_all = batch->demux_all;
+		ts2mpa->user = &run;
+		ts2mpa->new_stream = job_new_stream;
+		ts2mpa->es_data = job_es_data;
+		ts2mpa->message = job_message;
+
+		extract_job( &run, ts2mpa, fd );
+
+		for (stream = ts2mpa->stream_list; stream; stream = stream->list_next) {
+			if (stream->user && es_output_close( stream->user ))
+				job_failed( &run, "Failed to write stream out: %s", strerror(errno) );
+		}
+		if (ts2mpa->stream_count == 0)
+			job_failed( &run, "No MPEG Audio streams found" );
+
+		job->input_bytes = ts2mpa->offset;
+		job->packets = ts2mpa->total_packets;
+		job->bytes = ts2mpa->total_bytes;
+		job->skipped = ts2mpa->total_skipped;
+		job->ts_sync_losses = ts2mpa->ts_sync_losses;
+		job->streams = ts2mpa->stream_count;
+		job->counters = ts2mpa->counters;
+		ts2mpa_free( ts2mpa );
+	}
+	if (run.decompress) ts_decompress_close( run.decompress );
+	if (fd >= 0) close( fd );
+
+	job->seconds = now() - start;
+}
+
+
+static void not_started( ts_batch_job_t *job )
+{
+	job->failed = 1;
+	snprintf( job->error, sizeof(job->error), "Not started" );
+}
+
+
+static void* pool_thread( void* arg )
+{
+	ts_batch_t *batch = arg;
+	unsigned char *buf = NULL;
+	int i, finished;
+
+	// One read buffer, for every job this thread does
+	buf = malloc( TS_BATCH_READ_SIZE );
+	if (buf==NULL) return NULL;
+
+	while ((i = __atomic_fetch_add( &batch->next, 1, __ATOMIC_RELAXED )) < batch->job_count) {
+		ts_batch_job_t *job = batch->order[i];
+
+		if (batch->interrupted && __atomic_load_n( batch->interrupted, __ATOMIC_RELAXED )) {
+			not_started( job );
+			break;
+		}
+		run_job( batch, job, buf );
+
+		finished = __atomic_add_fetch( &batch->finished, 1, __ATOMIC_RELAXED );
+		if (job->failed) {
+			fprintf(stderr, "ts2mpa: [%d/%d] %s: %s\n", finished, batch->job_count,
+			        job->input_path, job->error);
+		} else if (!batch->quiet) {
+			fprintf(stderr, "ts2mpa: [%d/%d] %s: %lu bytes from %d stream(s) in %.1fs\n",
+			        finished, batch->job_count, job->input_path, job->bytes, job->streams, job->seconds);
+		}
+	}
+
+	free( buf );
+	return NULL;
+}
+
+
+ts_batch_t* ts_batch_new( const char* output_template )
+{
+	ts_batch_t *batch = calloc( 1, sizeof(ts_batch_t) );
+	if (batch==NULL) return NULL;
+
+	batch->output_template = strdup( output_template );
+	if (batch->output_template==NULL) {
+		free( batch );
+		return NULL;
+	}
+	batch->batch_size = ES_OUTPUT_BATCH_SIZE;
+
+	return batch;
+}
+
+
+static int add_job( ts_batch_t *batch, const char *path )
+{
+	ts_batch_job_t *job = NULL;
+	const char *base = NULL, *dot = NULL;
+	struct stat st;
+
+	if (batch->job_count == batch->jobs_size) {
+		int size = batch->jobs_size ? batch->jobs_size*2 : 64;
+		ts_batch_job_t *jobs = realloc( batch->jobs, size * sizeof(ts_batch_job_t) );
+		if (jobs==NULL) return -1;
+		batch->jobs = jobs;
+		batch->jobs_size = size;
+	}
+
+	job = &batch->jobs[batch->job_count];
+	memset( job, 0, sizeof(ts_batch_job_t) );
+	job->input_path = strdup( path );
+	if (job->input_path==NULL) return -1;
+
+	// The name is what is left of the file name without its extension,
+	// or without both extensions of a compressed file
+	base = strrchr( path, '/' );
+	base = base ? base+1 : path;
+	dot = strrchr( base, '.' );
+	if (dot==NULL || dot==base) dot = base + strlen( base );
+	if (strcmp( dot, ".gz" ) == 0 || strcmp( dot, ".zst" ) == 0) {
+		const char *inner = memrchr( base, '.', dot - base );
+		if (inner && inner != base) dot = inner;
+	}
+	job->name = strndup( base, dot - base );
+	if (job->name==NULL) {
+		free( job->input_path );
+		return -1;
+	}
+
+	if (stat( path, &st ) == 0) job->size = st.st_size;
+	batch->job_count++;
+
+	return 1;
+}
+
+
+static int compare_paths( const void *a, const void *b )
+{
+	return strcmp( *(char * const *)a, *(char * const *)b );
+}
+
+
+// Is it the name of a Transport Stream file, compressed or not?
+static int is_ts_name( const char *name )
+{
+	static const char *suffixes[] = { ".ts", ".ts.gz", ".ts.zst" };
+	size_t len = strlen( name ), i;
+
+	for (i=0; i<sizeof(suffixes)/sizeof(suffixes[0]); i++) {
+		size_t suffix_len = strlen( suffixes[i] );
+		if (len > suffix_len && strcmp( name + len - suffix_len, suffixes[i] ) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+
+// Add every .ts file in a directory, in order of their names
+static int add_directory( ts_batch_t *batch, const char *path )
+{
+	DIR *dir = NULL;
+	struct dirent *entry = NULL;
+	char **paths = NULL;
+	int count = 0, size = 0, added = 0, i;
+
+	dir = opendir( path );
+	if (dir==NULL) return -1;
+
+	while ((entry = readdir( dir ))) {
+		if (!is_ts_name( entry->d_name )) continue;
+
+		if (count == size) {
+			char **more = NULL;
+			size = size ? size*2 : 64;
+			more = realloc( paths, size * sizeof(char*) );
+			if (more==NULL) goto fail;
+			paths = more;
+		}
+		if (asprintf( &paths[count], "%s/%s", path, entry->d_name ) < 0) goto fail;
+		count++;
+	}
+	closedir( dir );
+	dir = NULL;
+
+	qsort( paths, count, sizeof(char*), compare_paths );
+	for (i=0; i<count; i++) {
+		if (add_job( batch, paths[i] ) < 0) goto fail;
+		added++;
+	}
+
+	for (i=0; i<count; i++) free( paths[i] );
+	free( paths );
+	return added;
+
+fail:
+	{
+		int err = errno;
+		if (dir) closedir( dir );
+		for (i=0; i<count; i++) free( paths[i] );
+		free( paths );
+		errno = err;
+	}
+	return -1;
+}
+
+
+// Add a file, or every .ts file in a directory
+static int add_path( ts_batch_t *batch, const char *path )
+{
+	struct stat st;
+
+	if (stat( path, &st ) == 0 && S_ISDIR( st.st_mode ))
+		return add_directory( batch, path );
+
+	return add_job( batch, path );
+}
+
+
+int ts_batch_add( ts_batch_t* batch, const char* path )
+{
+	glob_t matches;
+	int added = 0, result;
+	size_t i;
+
+	if (strpbrk( path, "*?[" ) == NULL)
+		return add_path( batch, path );
+
+	result = glob( path, 0, NULL, &matches );
+	if (result == GLOB_NOMATCH) return add_job( batch, path );
+	if (result != 0) {
+		errno = (result == GLOB_NOSPACE) ? ENOMEM : EIO;
+		return -1;
+	}
+
+	for (i=0; i<matches.gl_pathc; i++) {
+		result = add_path( batch, matches.gl_pathv[i] );
+		if (result < 0) break;
+		added += result;
+	}
+	globfree( &matches );
+
+	return result < 0 ? -1 : added;
+}
+
+
+int ts_batch_add_list( ts_batch_t* batch, FILE* list )
+{
+	char line[FILENAME_MAX];
+	int added = 0, result;
+
+	while (fgets( line, sizeof(line), list )) {
+		size_t len = strlen( line );
+		while (len && (line[len-1] == '\n' || line[len-1] == '\r')) line[--len] = '\0';
+		if (len == 0 || line[0] == '#') continue;
+
+		result = ts_batch_add( batch, line );
+		if (result < 0) return -1;
+		added += result;
+	}
+	if (ferror( list )) return -1;
+
+	return added;
+}
+
+
+static int compare_names( const void *a, const void *b )
+{
+	return strcmp( (*(ts_batch_job_t * const *)a)->name, (*(ts_batch_job_t * const *)b)->name );
+}
+
+
+static int compare_sizes( const void *a, const void *b )
+{
+	const ts_batch_job_t *job_a = *(ts_batch_job_t * const *)a;
+	const ts_batch_job_t *job_b = *(ts_batch_job_t * const *)b;
+
+	// Biggest first, and otherwise in the order they were added
+	if (job_a->size != job_b->size) return job_a->size < job_b->size ? 1 : -1;
+	return job_a < job_b ? -1 : job_a > job_b;
+}
+
+
+// Point the order at each of the jobs
+static int order_jobs( ts_batch_t *batch )
+{
+	int i;
+
+	free( batch->order );
+	batch->order = malloc( (batch->job_count ? batch->job_count : 1) * sizeof(ts_batch_job_t*) );
+	if (batch->order==NULL) return -1;
+
+	for (i=0; i<batch->job_count; i++)
+		batch->order[i] = &batch->jobs[i];
+
+	return 0;
+}
+
+
+const char* ts_batch_clash( ts_batch_t* batch )
+{
+	int i;
+
+	if (order_jobs( batch )) return NULL;
+
+	qsort( batch->order, batch->job_count, sizeof(ts_batch_job_t*), compare_names );
+	for (i=1; i<batch->job_count; i++) {
+		if (strcmp( batch->order[i-1]->name, batch->order[i]->name ) == 0)
+			return batch->order[i]->name;
+	}
+
+	return NULL;
+}
+
+
+int ts_batch_run( ts_batch_t* batch, int threads )
+{
+	pthread_t *pool = NULL;
+	sigset_t all, old;
+	double start = now();
+	int started = 0, i;
+
+	if (order_jobs( batch )) return -1;
+	qsort( batch->order, batch->job_count, sizeof(ts_batch_job_t*), compare_sizes );
+	batch->next = 0;
+	batch->finished = 0;
+
+	if (threads > batch->job_count) threads = batch->job_count;
+	pool = calloc( threads ? threads : 1, sizeof(pthread_t) );
+	if (pool==NULL) return -1;
+
+	// Signals are left for the thread that started the batch
+	sigfillset( &all );
+	pthread_sigmask( SIG_SETMASK, &all, &old );
+	for (started=0; started<threads; started++) {
+		if (pthread_create( &pool[started], NULL, pool_thread, batch )) break;
+	}
+	pthread_sigmask( SIG_SETMASK, &old, NULL );
+	if (started == 0) pool_thread( batch );
+	for (i=0; i<started; i++)
+		pthread_join( pool[i], NULL );
+	free( pool );
+
+	// Any that weren't started, because of an interruption, failed too
+	for (i=batch->next; i<batch->job_count; i++)
+		not_started( batch->order[i] );
+	batch->failed = 0;
+	for (i=0; i<batch->job_count; i++) {
+		if (batch->jobs[i].failed) batch->failed++;
+	}
+	batch->seconds = now() - start;
+
+	return batch->failed;
+}
+
+
+int ts_batch_write_summary( ts_batch_t* batch, FILE* file )
+{
+	unsigned long long input_bytes = 0, bytes = 0;
+	int i;
+
+	for (i=0; i<batch->job_count; i++) {
+		input_bytes += batch->jobs[i].input_bytes;
+		bytes += batch->jobs[i].bytes;
+	}
+
+	fprintf( file, "{\n  \"inputs\": %d, \"ok\": %d, \"failed\": %d, \"seconds\": %.3f,\n",
+	         batch->job_count, batch->job_count - batch->failed, batch->failed, batch->seconds );
+	fprintf( file, "  \"input_bytes\": %llu, \"bytes\": %llu,\n", input_bytes, bytes );
+	fprintf( file, "  \"files\": [" );
+
+	for (i=0; i<batch->job_count; i++) {
+		const ts_batch_job_t *job = &batch->jobs[i];
+		const ts2mpa_counters_t *c = &job->counters;
+
+		fprintf( file, "%s\n    { \"input\": ", i ? "," : "" );
+		ts_report_put_string( file, job->input_path );
+		fprintf( file, ", \"status\": \"%s\"", job->failed ? "failed" : "ok" );
+		if (job->failed) {
+			fprintf( file, ", \"error\": " );
+			ts_report_put_string( file, job->error );
+		}
+		fprintf( file, ",\n      \"seconds\": %.3f, \"input_bytes\": %llu, \"packets\": %lu, \"streams\": %d, \"bytes\": %lu,\n",
+		         job->seconds, job->input_bytes, job->packets, job->streams, job->bytes );
+		fprintf( file, "      \"ts_sync_losses\": %lu, \"ts_skipped\": %lu, \"cc_errors\": %lu, \"trans_errors\": %lu, "
+		         "\"sync_losses\": %lu, \"frames\": %lu, \"frames_dropped\": %lu }",
+		         job->ts_sync_losses, job->skipped, c->cc_errors, c->trans_errors,
+		         c->sync_losses, c->frames, c->frames_dropped );
+	}
+	fprintf( file, "%s]\n}\n", batch->job_count ? "\n  " : "" );
+
+	return ferror( file ) ? -1 : 0;
+}
+
+
+void ts_batch_free( ts_batch_t* batch )
+{
+	int i;
+
+	for (i=0; i<batch->job_count; i++) {
+		free( batch->jobs[i].input_path );
+		free( batch->jobs[i].name );
+	}
+	free( batch->jobs );
+	free( batch->order );
+	free( batch->output_template );
+	free( batch );
+}
@@ -0,0 +1,124 @@
+/*
+
+	ts_batch.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _TS_BATCH_H
+#define _TS_BATCH_H
+
+#include <stdio.h>
+
+#include "ts2mpa.h"
+
+
+// Placeholder in the output template for the name of each input
+#define TS_BATCH_NAME			"%name"
+
+// Bytes read from an input in one go, into a buffer that each
+// thread keeps for all of its jobs
+#define TS_BATCH_READ_SIZE		(4096*TS_PACKET_SIZE)
+
+
+// Extraction of one input file, and how it went
+typedef struct ts_batch_job_s {
+
+	char* input_path;
+	char* name;						// File name, without the directory or extension
+	unsigned long long size;		// Of the file, when it was added
+
+	int failed;
+	char error[256];				// What went wrong, if it failed
+	double seconds;					// Taken to extract it
+
+	unsigned long long input_bytes;	// Totals from its ts2mpa_t
+	unsigned long packets;
+	unsigned long bytes;
+	unsigned long skipped;
+	unsigned long ts_sync_losses;
+	int streams;
+	ts2mpa_counters_t counters;
+
+} ts_batch_job_t;
+
+
+/*
+	Extraction of many input files, on a pool of threads
+
+	Each file is a job of its own, with its own ts2mpa_t, and writes
+	to outputs named from a template. A thread takes the next job
+	when it has finished one, biggest files first so that a big one
+	isn't left until last. A file that fails is recorded as failed,
+	and doesn't stop the others.
+*/
+typedef struct ts_batch_s {
+
+	char* output_template;			// Containing %name, and %pid or %sid with demux_all
+	int pid;						// Options for each ts2mpa_t
+	int pes_stream_id;
+	int demux_all;
+	size_t batch_size;				// Of each output
+	int quiet;						// Only print failures
+	const int* interrupted;			// Start no more jobs once this is set, or NULL
+
+	ts_batch_job_t* jobs;			// In the order they were added
+	int job_count;
+	int jobs_size;
+	ts_batch_job_t** order;			// In the order they are started
+	int next;						// Next of them to start, taken atomically
+	int finished;
+
+	int failed;						// Totals, once they have run
+	double seconds;
+
+} ts_batch_t;
+
+
+// returns NULL if there isn't enough memory
+ts_batch_t* ts_batch_new( const char* output_template );
+
+// Add a file, every .ts, .ts.gz and .ts.zst file in a directory, or
+// every file matching a glob pattern. A pattern that matches nothing
+// is added as a file, which then fails.
+// returns the number of jobs added, or -1 on failure
+int ts_batch_add( ts_batch_t* batch, const char* path );
+
+// Add the inputs listed in a file, one to a line. Blank lines, and
+// lines starting with #, are skipped.
+// returns the number of jobs added, or -1 on failure
+int ts_batch_add_list( ts_batch_t* batch, FILE* list );
+
+// Find two inputs that would be written to the same outputs
+// returns the name they share, or NULL if there are none
+const char* ts_batch_clash( ts_batch_t* batch );
+
+// Extract every input, on up to threads threads
+// returns the number of inputs that failed
+int ts_batch_run( ts_batch_t* batch, int threads );
+
+// Write a summary of each input as JSON
+// returns 0 on success, or -1 on failure
+int ts_batch_write_summary( ts_batch_t* batch, FILE* file );
+
+void ts_batch_free( ts_batch_t* batch );
+
+
+
+#endif
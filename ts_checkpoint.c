@@ -0,0 +1,247 @@
+/*
+
+	ts_checkpoint.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ts_checkpoint.h"
+
+
+// Longest line in a checkpoint file
+#define TS_CHECKPOINT_LINE		(FILENAME_MAX + TS_PID_MAP_WORDS*8 + 64)
+
+
+
+static void put_counters( FILE *file, const ts2mpa_counters_t *c )
+{
+	fprintf( file, " %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
+	         c->packets, c->cc_errors, c->trans_errors, c->scrambled,
+	         c->sync_losses, c->sync_gains, c->hunt_skipped, c->frames,
+	         c->frames_dropped, c->sync_predicted, c->bytes );
+}
+
+
+// returns 0 on success, or -1 if they aren't all there
+static int get_counters( const char *str, ts2mpa_counters_t *c )
+{
+	int count = sscanf( str, " %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu %lu",
+	                    &c->packets, &c->cc_errors, &c->trans_errors, &c->scrambled,
+	                    &c->sync_losses, &c->sync_gains, &c->hunt_skipped, &c->frames,
+	                    &c->frames_dropped, &c->sync_predicted, &c->bytes );
+	return count == 11 ? 0 : -1;
+}
+
+
+// Three bytes as hex, unused ones as zero
+static void put_bytes( FILE *file, const unsigned char *buf, size_t len )
+{
+	size_t i;
+
+	fputc( ' ', file );
+	for (i=0; i<3; i++)
+		fprintf( file, "%02x", i < len ? buf[i] : 0 );
+}
+
+
+static int get_bytes( const char *hex, unsigned char *buf )
+{
+	unsigned int byte;
+	int i;
+
+	for (i=0; i<3; i++) {
+		if (sscanf( hex + i*2, "%2x", &byte ) != 1) return -1;
+		buf[i] = byte;
+	}
+
+	return 0;
+}
+
+
+// Read a line, without the newline on the end, and check it starts with key
+// returns the rest of the line, or NULL if it is missing or different
+static char* get_line( FILE *file, char *line, const char *key )
+{
+	size_t key_len = strlen( key );
+	size_t len;
+
+	if (fgets( line, TS_CHECKPOINT_LINE, file ) == NULL) return NULL;
+	len = strlen( line );
+	if (len && line[len-1] == '\n') line[--len] = '\0';
+
+	if (strncmp( line, key, key_len ) != 0 || line[key_len] != ' ') return NULL;
+	return line + key_len + 1;
+}
+
+
+int ts_checkpoint_write( const char* path, const ts_checkpoint_t* checkpoint )
+{
+	char tmp_path[FILENAME_MAX];
+	FILE *file = NULL;
+	int i, err;
+
+	snprintf( tmp_path, sizeof(tmp_path), "%s.tmp", path );
+	file = fopen( tmp_path, "w" );
+	if (file==NULL) return -1;
+
+	fprintf( file, "%s %d\n", TS_CHECKPOINT_MAGIC, TS_CHECKPOINT_VERSION );
+	fprintf( file, "input %s\n", checkpoint->input_path );
+	fprintf( file, "output %s\n", checkpoint->output_path );
+	fprintf( file, "options %d %d %d\n", checkpoint->pid, checkpoint->pes_stream_id, checkpoint->demux_all );
+	fprintf( file, "offset %llu\n", checkpoint->offset );
+
+	fprintf( file, "totals %lu %lu %lu %lu", checkpoint->total_packets, checkpoint->total_bytes,
+	         checkpoint->total_skipped, checkpoint->ts_sync_losses );
+	put_counters( file, &checkpoint->counters );
+	fputc( '\n', file );
+
+	fprintf( file, "watch " );
+	for (i=0; i<TS_PID_MAP_WORDS; i++)
+		fprintf( file, "%08x", checkpoint->watch_map[i] );
+	fputc( '\n', file );
+
+	for (i=0; i<checkpoint->mark_count; i++) {
+		const ts2mpa_mark_t *mark = &checkpoint->marks[i];
+
+		fprintf( file, "stream %d %d %d %d %d %d %zu",
+		         mark->pid, mark->pes_stream_id, mark->continuity_count, mark->current_stream_id,
+		         mark->synced, mark->pes_remaining, mark->carry_len );
+		put_bytes( file, mark->carry, mark->carry_len );
+		fprintf( file, " %u %zu", mark->frame_left, mark->frame_header_len );
+		put_bytes( file, mark->frame_header, mark->frame_header_len );
+		fprintf( file, " %zu %d %d %lu %lu", mark->frame_len, mark->confirming,
+		         mark->predicted, mark->resume_skip, mark->total_bytes );
+		put_counters( file, &mark->counters );
+		fputc( '\n', file );
+	}
+
+	if (ferror( file ) | fclose( file ) || rename( tmp_path, path )) {
+		err = errno;
+		unlink( tmp_path );
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+
+ts_checkpoint_t* ts_checkpoint_read( const char* path )
+{
+	ts_checkpoint_t *checkpoint = NULL;
+	char *line = NULL, *rest = NULL;
+	FILE *file = NULL;
+	int version = 0, used = 0, i;
+
+	file = fopen( path, "r" );
+	if (file==NULL) return NULL;
+
+	line = malloc( TS_CHECKPOINT_LINE );
+	checkpoint = calloc( 1, sizeof(ts_checkpoint_t) );
+	if (line==NULL || checkpoint==NULL) goto fail;
+
+	if ((rest = get_line( file, line, TS_CHECKPOINT_MAGIC )) == NULL ||
+	    sscanf( rest, "%d", &version ) != 1 || version != TS_CHECKPOINT_VERSION)
+		goto invalid;
+
+	if ((rest = get_line( file, line, "input" )) == NULL) goto invalid;
+	if ((checkpoint->input_path = strdup( rest )) == NULL) goto fail;
+	if ((rest = get_line( file, line, "output" )) == NULL) goto invalid;
+	if ((checkpoint->output_path = strdup( rest )) == NULL) goto fail;
+
+	if ((rest = get_line( file, line, "options" )) == NULL ||
+	    sscanf( rest, "%d %d %d", &checkpoint->pid, &checkpoint->pes_stream_id, &checkpoint->demux_all ) != 3)
+		goto invalid;
+	if ((rest = get_line( file, line, "offset" )) == NULL ||
+	    sscanf( rest, "%llu", &checkpoint->offset ) != 1)
+		goto invalid;
+
+	if ((rest = get_line( file, line, "totals" )) == NULL ||
+	    sscanf( rest, "%lu %lu %lu %lu%n", &checkpoint->total_packets, &checkpoint->total_bytes,
+	            &checkpoint->total_skipped, &checkpoint->ts_sync_losses, &used ) != 4 ||
+	    get_counters( rest + used, &checkpoint->counters ))
+		goto invalid;
+
+	if ((rest = get_line( file, line, "watch" )) == NULL ||
+	    strlen( rest ) != TS_PID_MAP_WORDS*8)
+		goto invalid;
+	for (i=0; i<TS_PID_MAP_WORDS; i++) {
+		if (sscanf( rest + i*8, "%8x", &checkpoint->watch_map[i] ) != 1) goto invalid;
+	}
+
+	// Then the marks, up to the end of the file
+	while ((rest = get_line( file, line, "stream" ))) {
+		ts2mpa_mark_t *marks = realloc( checkpoint->marks, (checkpoint->mark_count+1) * sizeof(ts2mpa_mark_t) );
+		ts2mpa_mark_t *mark = NULL;
+		char carry[7], header[7];
+		int more = 0;
+
+		if (marks==NULL) goto fail;
+		checkpoint->marks = marks;
+		mark = &marks[checkpoint->mark_count];
+		bzero( mark, sizeof(ts2mpa_mark_t) );
+
+		if (sscanf( rest, "%d %d %d %d %d %d %zu %6s %u %zu %6s %zu %d %d %lu %lu%n",
+		            &mark->pid, &mark->pes_stream_id, &mark->continuity_count, &mark->current_stream_id,
+		            &mark->synced, &mark->pes_remaining, &mark->carry_len, carry,
+		            &mark->frame_left, &mark->frame_header_len, header,
+		            &mark->frame_len, &mark->confirming, &mark->predicted,
+		            &mark->resume_skip, &mark->total_bytes, &more ) != 16 ||
+		    mark->carry_len > sizeof(mark->carry) ||
+		    mark->frame_header_len > sizeof(mark->frame_header) ||
+		    get_bytes( carry, mark->carry ) || get_bytes( header, mark->frame_header ) ||
+		    get_counters( rest + more, &mark->counters ))
+			goto invalid;
+
+		checkpoint->mark_count++;
+	}
+	if (!feof( file )) goto invalid;
+
+	fclose( file );
+	free( line );
+	return checkpoint;
+
+invalid:
+	errno = EINVAL;
+fail:
+	{
+		int err = errno;
+		fclose( file );
+		free( line );
+		if (checkpoint) ts_checkpoint_free( checkpoint );
+		errno = err;
+	}
+	return NULL;
+}
+
+
+void ts_checkpoint_free( ts_checkpoint_t* checkpoint )
+{
+	free( checkpoint->input_path );
+	free( checkpoint->output_path );
+	free( checkpoint->marks );
+	free( checkpoint );
+}
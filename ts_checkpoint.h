@@ -0,0 +1,112 @@
+/*
+
+	ts_checkpoint.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _TS_CHECKPOINT_H
+#define _TS_CHECKPOINT_H
+
+#include <stdint.h>
+
+#include "ts2mpa.h"
+
+
+// First line of a checkpoint file, and the version of its layout
+#define TS_CHECKPOINT_MAGIC		"ts2mpa-checkpoint"
+#define TS_CHECKPOINT_VERSION	1
+
+
+// State of a stream at a point in the input, that extraction can be
+// picked up from: where a parallel chunk starts, or a checkpoint
+typedef struct ts2mpa_mark_s {
+
+	int pid;
+	int pes_stream_id;
+	int continuity_count;
+	int current_stream_id;			// Stream of the PES packet in progress, or -1
+	int synced;
+	int pes_remaining;
+	unsigned char carry[3];
+	size_t carry_len;
+	unsigned int frame_left;
+	unsigned char frame_header[3];
+	size_t frame_header_len;
+	size_t frame_len;				// Of the frame held back, not yet written
+	int confirming;
+	int predicted;
+	unsigned long resume_skip;
+	unsigned long total_bytes;		// Written before this point
+	ts2mpa_counters_t counters;		// Of the PID, before this point
+
+} ts2mpa_mark_t;
+
+
+/*
+	Checkpoint of an extraction, so that it can be carried on with
+	later instead of starting again
+
+	It is taken between two packets, once everything before them has
+	been written out. The outputs are as long as the total_bytes of
+	their streams, and the frames in progress are extracted again
+	when carrying on.
+
+	The file is text, a line for each of: the magic and version,
+	the input and output paths, the options, the offset, the totals,
+	the PIDs that streams could still turn up on, then a line for each
+	stream's mark.
+*/
+typedef struct ts_checkpoint_s {
+
+	char* input_path;
+	char* output_path;				// Or the template, with -a
+	int pid;						// Options that it was made with
+	int pes_stream_id;
+	int demux_all;
+
+	unsigned long long offset;		// Of the packet to carry on from
+
+	unsigned long total_packets;	// Totals from the ts2mpa_t
+	unsigned long total_bytes;
+	unsigned long total_skipped;
+	unsigned long ts_sync_losses;
+	ts2mpa_counters_t counters;
+
+	uint32_t watch_map[TS_PID_MAP_WORDS];
+	ts2mpa_mark_t* marks;
+	int mark_count;
+
+} ts_checkpoint_t;
+
+
+// Write a checkpoint, replacing the file atomically
+// returns 0 on success, or -1 on failure
+int ts_checkpoint_write( const char* path, const ts_checkpoint_t* checkpoint );
+
+// Read a checkpoint
+// returns NULL on failure, with errno set (ENOENT if there isn't one,
+// or EINVAL if the file isn't a checkpoint this can read)
+ts_checkpoint_t* ts_checkpoint_read( const char* path );
+
+void ts_checkpoint_free( ts_checkpoint_t* checkpoint );
+
+
+
+#endif
@@ -0,0 +1,265 @@
+/*
+
+	ts_decompress.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ts_decompress.h"
+
+
+static const unsigned char gzip_magic[] = { 0x1f, 0x8b };
+static const unsigned char zstd_magic[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+
+
+int ts_decompress_probe( int fd )
+{
+	unsigned char magic[4];
+	ssize_t len;
+
+	len = pread( fd, magic, sizeof(magic), 0 );
+	if (len >= sizeof(gzip_magic) && memcmp( magic, gzip_magic, sizeof(gzip_magic) ) == 0)
+		return TS_DECOMPRESS_GZIP;
+	if (len >= sizeof(zstd_magic) && memcmp( magic, zstd_magic, sizeof(zstd_magic) ) == 0)
+		return TS_DECOMPRESS_ZSTD;
+
+	return TS_DECOMPRESS_NONE;
+}
+
+
+const char* ts_decompress_name( int format )
+{
+	switch (format) {
+		case TS_DECOMPRESS_GZIP: return "gzip";
+		case TS_DECOMPRESS_ZSTD: return "zstd";
+	}
+
+	return "none";
+}
+
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+// Read more compressed input, once what there was has been used
+// returns 0 on success, or -1 on failure
+static int fill_input( ts_decompress_t *dec )
+{
+	ssize_t len;
+
+	if (dec->in_pos < dec->in_len || dec->in_eof) return 0;
+
+	do {
+		len = read( dec->fd, dec->in, TS_DECOMPRESS_READ_SIZE );
+	} while (len < 0 && errno == EINTR);
+	if (len < 0) return -1;
+
+	dec->in_len = len;
+	dec->in_pos = 0;
+	if (len == 0) dec->in_eof = 1;
+
+	return 0;
+}
+#endif
+
+
+#ifdef HAVE_ZLIB
+// returns 0 on success, or -1 on failure
+static int read_gzip( ts_decompress_t *dec, unsigned char *buf, size_t len, size_t *done )
+{
+	z_stream *z = &dec->zlib;
+	int result;
+
+	while (*done < len) {
+		if (fill_input( dec )) return -1;
+		if (dec->in_pos == dec->in_len) {
+			if (dec->finished) break;
+			errno = EBADMSG;
+			return -1;
+		}
+
+		// Another member straight after the last one
+		if (dec->finished) {
+			inflateReset( z );
+			dec->finished = 0;
+		}
+
+		z->next_in = dec->in + dec->in_pos;
+		z->avail_in = dec->in_len - dec->in_pos;
+		z->next_out = buf + *done;
+		z->avail_out = len - *done;
+		result = inflate( z, Z_NO_FLUSH );
+		dec->in_pos = dec->in_len - z->avail_in;
+		*done = len - z->avail_out;
+
+		if (result == Z_STREAM_END) {
+			dec->finished = 1;
+		} else if (result != Z_OK && result != Z_BUF_ERROR) {
+			errno = (result == Z_MEM_ERROR) ? ENOMEM : EBADMSG;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+#endif
+
+
+#ifdef HAVE_ZSTD
+// returns 0 on success, or -1 on failure
+static int read_zstd( ts_decompress_t *dec, unsigned char *buf, size_t len, size_t *done )
+{
+	ZSTD_outBuffer out = { buf, len, *done };
+	ZSTD_inBuffer in;
+	size_t result;
+
+	while (out.pos < out.size) {
+		if (fill_input( dec )) return -1;
+		if (dec->in_pos == dec->in_len) {
+			if (dec->finished) break;
+			errno = EBADMSG;
+			return -1;
+		}
+
+		// Frames one after another are carried on with by itself
+		in.src = dec->in;
+		in.size = dec->in_len;
+		in.pos = dec->in_pos;
+		result = ZSTD_decompressStream( dec->zstd, &out, &in );
+		dec->in_pos = in.pos;
+		*done = out.pos;
+
+		if (ZSTD_isError( result )) {
+			errno = EBADMSG;
+			return -1;
+		}
+		dec->finished = (result == 0);
+	}
+
+	return 0;
+}
+#endif
+
+
+ts_decompress_t* ts_decompress_open( int fd, int format )
+{
+	ts_decompress_t *dec = NULL;
+
+#ifndef HAVE_ZLIB
+	if (format == TS_DECOMPRESS_GZIP) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+#endif
+#ifndef HAVE_ZSTD
+	if (format == TS_DECOMPRESS_ZSTD) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+#endif
+	if (format != TS_DECOMPRESS_GZIP && format != TS_DECOMPRESS_ZSTD) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	dec = calloc( 1, sizeof(ts_decompress_t) );
+	if (dec==NULL) return NULL;
+	dec->fd = fd;
+	dec->format = format;
+
+	dec->in = malloc( TS_DECOMPRESS_READ_SIZE );
+	if (dec->in==NULL) goto fail;
+
+#ifdef HAVE_ZLIB
+	if (format == TS_DECOMPRESS_GZIP) {
+		// Only gzip headers, not raw zlib streams
+		if (inflateInit2( &dec->zlib, 15+16 ) != Z_OK) {
+			errno = ENOMEM;
+			goto fail;
+		}
+	}
+#endif
+#ifdef HAVE_ZSTD
+	if (format == TS_DECOMPRESS_ZSTD) {
+		dec->zstd = ZSTD_createDStream();
+		if (dec->zstd==NULL) {
+			errno = ENOMEM;
+			goto fail;
+		}
+	}
+#endif
+
+	return dec;
+
+fail:
+	free( dec->in );
+	free( dec );
+	return NULL;
+}
+
+
+ssize_t ts_decompress_read( ts_decompress_t* dec, unsigned char* buf, size_t len )
+{
+	size_t done = 0;
+	int result = -1;
+
+	if (dec->error) {
+		errno = dec->error;
+		return -1;
+	}
+
+#ifdef HAVE_ZLIB
+	if (dec->format == TS_DECOMPRESS_GZIP)
+		result = read_gzip( dec, buf, len, &done );
+#endif
+#ifdef HAVE_ZSTD
+	if (dec->format == TS_DECOMPRESS_ZSTD)
+		result = read_zstd( dec, buf, len, &done );
+#endif
+
+	// Hand over what there is, and the failure next time
+	if (result < 0) {
+		if (done == 0) return -1;
+		dec->error = errno;
+	}
+
+	return done;
+}
+
+
+void ts_decompress_close( ts_decompress_t* dec )
+{
+#ifdef HAVE_ZLIB
+	if (dec->format == TS_DECOMPRESS_GZIP)
+		inflateEnd( &dec->zlib );
+#endif
+#ifdef HAVE_ZSTD
+	if (dec->zstd)
+		ZSTD_freeDStream( dec->zstd );
+#endif
+
+	free( dec->in );
+	free( dec );
+}
@@ -0,0 +1,101 @@
+/*
+
+	ts_decompress.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _TS_DECOMPRESS_H
+#define _TS_DECOMPRESS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+
+// Formats that an input can be compressed in
+#define TS_DECOMPRESS_NONE		0
+#define TS_DECOMPRESS_GZIP		1
+#define TS_DECOMPRESS_ZSTD		2
+
+// Bytes of compressed input read in one go
+#define TS_DECOMPRESS_READ_SIZE	(256*1024)
+
+
+/*
+	Decompression of a gzip or zstd compressed file
+
+	The format is found from the magic bytes at the start of the file.
+	Support for each format is only built in with the library for it:
+	make ZLIB=1 for gzip, and make ZSTD=1 for zstd.
+
+	Several gzip members or zstd frames one after another are
+	decompressed as one stream, as zcat and zstdcat do.
+*/
+typedef struct ts_decompress_s {
+
+	int fd;
+	int format;					// TS_DECOMPRESS_*
+
+	unsigned char* in;			// Compressed input, read from fd
+	size_t in_len;
+	size_t in_pos;
+	int in_eof;
+	int finished;				// At the end of a member or frame
+	int error;					// errno of a failure, for after what came before it
+
+#ifdef HAVE_ZLIB
+	z_stream zlib;
+#endif
+#ifdef HAVE_ZSTD
+	ZSTD_DStream* zstd;
+#endif
+
+} ts_decompress_t;
+
+
+// Find out what a file is compressed with, from the start of it
+// returns TS_DECOMPRESS_NONE if it isn't, or can't be read at an offset
+int ts_decompress_probe( int fd );
+
+// returns the name of a format
+const char* ts_decompress_name( int format );
+
+// Start decompressing a file, from its current position
+// returns NULL on failure, with errno set (ENOTSUP if support for the
+// format wasn't built in)
+ts_decompress_t* ts_decompress_open( int fd, int format );
+
+// Decompress into buf, filling it unless the input ends first
+// returns the number of bytes, 0 at the end, or -1 on failure with
+// errno set (EBADMSG if the input is corrupt or cut short)
+ssize_t ts_decompress_read( ts_decompress_t* dec, unsigned char* buf, size_t len );
+
+// Free the decompressor, leaving the file open
+void ts_decompress_close( ts_decompress_t* dec );
+
+
+
+#endif
@@ -0,0 +1,558 @@
+/*
+
+	ts_gen.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "ts2mpa.h"
+#include "ts_gen.h"
+#include "mpa_header.h"
+
+
+
+void ts_gen_init( ts_gen_t* gen )
+{
+	bzero( gen, sizeof(ts_gen_t) );
+
+	// A typical DVB radio multiplex
+	gen->audio_pids = 8;
+	gen->other_pids = 2;
+	gen->layer = 2;
+	gen->bitrate = 192;
+	gen->samplerate = 48000;
+	gen->padding = 0;
+	gen->adaptation = 10;
+	gen->null_packets = 5;
+	gen->cc_errors = 0;
+	gen->trans_errors = 0;
+	gen->corruption = 0;
+	gen->length_errors = 0;
+	gen->duplicates = 0;
+	gen->psi_interval = 0;
+	gen->seed = 1;
+}
+
+
+// xorshift32 - cheap, and the same everywhere
+static uint32_t gen_random( ts_gen_t *gen )
+{
+	uint32_t x = gen->random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return gen->random = x;
+}
+
+
+// Should something that happens one in this many times happen now?
+static int gen_chance( ts_gen_t *gen, int one_in )
+{
+	return one_in > 0 && gen_random( gen ) % one_in == 0;
+}
+
+
+// Find the header for the layer, bitrate and samplerate asked for
+// returns 0 on success, or -1 if there isn't one
+static int find_header( ts_gen_t *gen )
+{
+	// Version bits of MPEG-1, MPEG-2 and MPEG-2.5; no CRC is used
+	static const int versions[3] = { 0x18, 0x10, 0x00 };
+	int version, bitrate_index, samplerate_index;
+
+	if (gen->layer < 1 || gen->layer > 3) return -1;
+
+	for (version=0; version<3; version++) {
+		for (samplerate_index=0; samplerate_index<3; samplerate_index++) {
+			for (bitrate_index=1; bitrate_index<15; bitrate_index++) {
+				mpa_header_t mh;
+
+				gen->header[0] = 0xFF;
+				gen->header[1] = 0xE1 | versions[version] | ((4-gen->layer) << 1);
+				gen->header[2] = (bitrate_index << 4) | (samplerate_index << 2);
+				gen->header[3] = 0x04;		// Stereo, original
+
+				if (!mpa_header_parse( gen->header, &mh ) ||
+				    mh.bitrate != gen->bitrate || mh.samplerate != gen->samplerate)
+					continue;
+
+				// Frame sizes are worked out here, rather than taken from
+				// the header parser, so that the extractor is checked
+				// against the standard rather than against itself
+				if (gen->layer == 1) {
+					gen->samples = 384;
+					gen->slot = 4;
+					gen->framesize = 12 * gen->bitrate * 1000 / gen->samplerate * 4;
+					gen->pad_step = (12UL * gen->bitrate * 1000) % gen->samplerate;
+				} else {
+					gen->samples = (version == 0 || gen->layer == 2) ? 1152 : 576;
+					gen->slot = 1;
+					gen->framesize = gen->samples / 8 * gen->bitrate * 1000 / gen->samplerate;
+					gen->pad_step = ((unsigned long)gen->samples / 8 * gen->bitrate * 1000) % gen->samplerate;
+				}
+				return 0;
+			}
+		}
+	}
+
+	return -1;
+}
+
+
+// Fill in the rest of a long section header, and the CRC after len bytes
+// returns the length of the section
+static size_t finish_section( unsigned char *section, int table_id, int table_id_ext, size_t len )
+{
+	size_t section_length = len + TS_PSI_CRC_SIZE - 3;
+	uint32_t crc;
+
+	section[0] = table_id;
+	section[1] = 0xB0 | ((section_length >> 8) & 0x0F);
+	section[2] = section_length & 0xFF;
+	section[3] = table_id_ext >> 8;
+	section[4] = table_id_ext & 0xFF;
+	section[5] = 0xC1;			// Version 0, current
+	section[6] = 0;
+	section[7] = 0;
+
+	crc = ts_psi_crc32( section, len );
+	section[len] = crc >> 24;
+	section[len+1] = (crc >> 16) & 0xFF;
+	section[len+2] = (crc >> 8) & 0xFF;
+	section[len+3] = crc & 0xFF;
+
+	return len + TS_PSI_CRC_SIZE;
+}
+
+
+// Split a section up into packets, after the ones made already
+static void section_packets( ts_gen_t *gen, int pid, const unsigned char *section, size_t len )
+{
+	size_t pos = 0;
+
+	while (pos < len) {
+		unsigned char *buf = gen->psi + gen->psi_packets*TS_PACKET_SIZE;
+		size_t header_len = pos ? 4 : 5;
+		size_t take = len - pos;
+		if (take > TS_PACKET_SIZE - header_len) take = TS_PACKET_SIZE - header_len;
+
+		buf[0] = 0x47;
+		buf[1] = (pos ? 0x00 : 0x40) | ((pid >> 8) & 0x1F);
+		buf[2] = pid & 0xFF;
+		buf[3] = 0x10;
+		buf[4] = 0;				// Pointer field, when the section starts here
+		memcpy( buf+header_len, section+pos, take );
+		memset( buf+header_len+take, 0xFF, TS_PACKET_SIZE-header_len-take );
+
+		pos += take;
+		gen->psi_packets++;
+	}
+}
+
+
+// Make the PAT and PMT packets, for a single program with every PID in it
+// returns 0 on success, or -1 if memory ran out
+static int make_psi( ts_gen_t *gen )
+{
+	unsigned char section[TS_PSI_MAX_SECTION];
+	size_t len = TS_PSI_HEADER_SIZE;
+	int i;
+
+	gen->psi = malloc( TS_GEN_MAX_PSI_PACKETS * TS_PACKET_SIZE );
+	if (gen->psi==NULL) return -1;
+
+	section[len++] = TS_GEN_PROGRAM >> 8;
+	section[len++] = TS_GEN_PROGRAM & 0xFF;
+	section[len++] = 0xE0 | (TS_GEN_PMT_PID >> 8);
+	section[len++] = TS_GEN_PMT_PID & 0xFF;
+	len = finish_section( section, TS_PSI_TABLE_PAT, 1, len );
+	section_packets( gen, TS_PSI_PAT_PID, section, len );
+
+	// The first PID carries the PCR, and there are no descriptors
+	len = TS_PSI_HEADER_SIZE;
+	section[len++] = 0xE0 | (gen->pids[0].pid >> 8);
+	section[len++] = gen->pids[0].pid & 0xFF;
+	section[len++] = 0xF0;
+	section[len++] = 0x00;
+	for (i=0; i<gen->pid_count; i++) {
+		ts_gen_pid_t *p = &gen->pids[i];
+		section[len++] = i < gen->audio_pids ? TS_PSI_STREAM_MPEG1_AUDIO : 0x02;
+		section[len++] = 0xE0 | (p->pid >> 8);
+		section[len++] = p->pid & 0xFF;
+		section[len++] = 0xF0;
+		section[len++] = 0x00;
+	}
+	len = finish_section( section, TS_PSI_TABLE_PMT, TS_GEN_PROGRAM, len );
+	section_packets( gen, TS_GEN_PMT_PID, section, len );
+
+	return 0;
+}
+
+
+// Check the options and set up each PID
+// returns 0 on success, or -1 if the options are invalid
+static int gen_start( ts_gen_t *gen )
+{
+	int i;
+
+	if (gen->audio_pids < 0 || gen->audio_pids > TS_GEN_MAX_PIDS ||
+	    gen->other_pids < 0 || gen->other_pids > TS_GEN_MAX_PIDS ||
+	    gen->audio_pids + gen->other_pids == 0 ||
+	    gen->adaptation < 0 || gen->adaptation > 100 ||
+	    gen->null_packets < 0 || gen->null_packets >= 100 ||
+	    gen->psi_interval < 0 || (gen->psi_interval > 0 && gen->psi_interval <= TS_GEN_MAX_PSI_PACKETS))
+		return -1;
+
+	if (find_header( gen )) return -1;
+
+	gen->pid_count = gen->audio_pids + gen->other_pids;
+	gen->pids = calloc( gen->pid_count, sizeof(ts_gen_pid_t) );
+	if (gen->pids==NULL) return -1;
+
+	for (i=0; i<gen->pid_count; i++) {
+		ts_gen_pid_t *p = &gen->pids[i];
+		if (i < gen->audio_pids) {
+			p->pid = TS_GEN_AUDIO_PID + i;
+			p->stream_id = 0xC0 + (i % 32);
+		} else {
+			p->pid = TS_GEN_OTHER_PID + i - gen->audio_pids;
+			p->stream_id = 0xE0 + ((i - gen->audio_pids) % 16);
+		}
+	}
+
+	if (gen->psi_interval && make_psi( gen )) return -1;
+
+	gen->random = gen->seed ? gen->seed : 1;
+	return 0;
+}
+
+
+// Fill in random bytes, that never look like an MPEG audio sync word
+static void random_bytes( ts_gen_t *gen, unsigned char *buf, size_t len )
+{
+	size_t i;
+
+	for (i=0; i<len; i++) {
+		buf[i] = gen_random( gen ) >> 24;
+		if (buf[i] == 0xFF) buf[i] = 0xFE;
+	}
+}
+
+
+// Start the next PES packet on a PID
+static void make_pes( ts_gen_t *gen, ts_gen_pid_t *p )
+{
+	unsigned char *pes = p->pes;
+	size_t payload_len, i;
+	unsigned long long pts = p->pts & 0x1FFFFFFFFULL;
+
+	if (p->stream_id >= 0xC0 && p->stream_id <= 0xDF) {
+		// A few frames of audio
+		size_t frames = (TS_GEN_MAX_PES - 14) / (gen->framesize + gen->slot);
+		if (frames > 4) frames = 4;
+
+		payload_len = 0;
+		for (i=0; i<frames; i++) {
+			unsigned char *frame = pes + 14 + payload_len;
+			size_t framesize = gen->framesize;
+
+			memcpy( frame, gen->header, 4 );
+
+			// Padded whenever a whole slot has been left over
+			if (gen->padding) {
+				gen->pad_total += gen->pad_step;
+				if (gen->pad_total >= (unsigned long)gen->samplerate) {
+					gen->pad_total -= gen->samplerate;
+					frame[2] |= 0x02;
+					framesize += gen->slot;
+				}
+			}
+
+			random_bytes( gen, frame+4, framesize-4 );
+			payload_len += framesize;
+		}
+		gen->audio_bytes += payload_len;
+		p->pts += frames * gen->samples * 90000ULL / gen->samplerate;
+	} else {
+		// Something bigger, that isn't audio
+		payload_len = 1024 + gen_random( gen ) % (TS_GEN_MAX_PES - 14 - 1024);
+		random_bytes( gen, pes+14, payload_len );
+		p->pts += 3600;
+	}
+
+	pes[0] = 0x00;
+	pes[1] = 0x00;
+	pes[2] = 0x01;
+	pes[3] = p->stream_id;
+	pes[4] = (payload_len + 8) >> 8;
+	pes[5] = (payload_len + 8) & 0xFF;
+	pes[6] = 0x80;				// Sync code, not scrambled
+	pes[7] = 0x80;				// PTS only
+	pes[8] = 5;
+	pes[9] = 0x21 | ((pts >> 29) & 0x0E);
+	pes[10] = (pts >> 22) & 0xFF;
+	pes[11] = ((pts >> 14) & 0xFE) | 0x01;
+	pes[12] = (pts >> 7) & 0xFF;
+	pes[13] = ((pts << 1) & 0xFE) | 0x01;
+
+	p->pes_len = 14 + payload_len;
+	p->pes_pos = 0;
+}
+
+
+// Write a null packet
+static void null_packet( unsigned char *buf )
+{
+	buf[0] = 0x47;
+	buf[1] = 0x1F;
+	buf[2] = 0xFF;
+	buf[3] = 0x10;
+	memset( buf+4, 0xFF, TS_PACKET_SIZE-4 );
+}
+
+
+// Write the next of the PAT and PMT packets
+static void psi_packet( ts_gen_t *gen, unsigned char *buf, int index )
+{
+	int *cc = index ? &gen->pmt_cc : &gen->pat_cc;
+
+	memcpy( buf, gen->psi + index*TS_PACKET_SIZE, TS_PACKET_SIZE );
+	buf[3] |= *cc;
+	*cc = (*cc + 1) & 0x0F;
+}
+
+
+// Write the next packet of the next PID in turn
+static void next_packet( ts_gen_t *gen, unsigned char *buf )
+{
+	ts_gen_pid_t *p = &gen->pids[gen->next_pid];
+	int start = 0;
+	size_t remaining, payload_len, header_len = 4;
+
+	gen->next_pid = (gen->next_pid + 1) % gen->pid_count;
+
+	if (p->pes_pos == p->pes_len) {
+		make_pes( gen, p );
+		start = 1;
+	}
+
+	// Use an adaptation field to pad out the end of a PES packet,
+	// and on some others, as a PCR would be
+	remaining = p->pes_len - p->pes_pos;
+	payload_len = TS_PACKET_SIZE - 4;
+	if ((int)(gen_random( gen ) % 100) < gen->adaptation)
+		payload_len -= 2;
+	if (payload_len > remaining)
+		payload_len = remaining;
+
+	if (payload_len < TS_PACKET_SIZE - 4) {
+		size_t adapt_len = TS_PACKET_SIZE - 5 - payload_len;
+		buf[4] = adapt_len;
+		if (adapt_len > 0) {
+			buf[5] = 0x00;
+			memset( buf+6, 0xFF, adapt_len-1 );
+		}
+		header_len += adapt_len + 1;
+	}
+
+	// Skip a continuity count
+	if (gen_chance( gen, gen->cc_errors ))
+		p->continuity_count = (p->continuity_count + 1) & 0x0F;
+
+	buf[0] = 0x47;
+	buf[1] = (start ? 0x40 : 0x00) | ((p->pid >> 8) & 0x1F);
+	buf[2] = p->pid & 0xFF;
+	buf[3] = (header_len > 4 ? 0x30 : 0x10) | p->continuity_count;
+	memcpy( buf+header_len, p->pes+p->pes_pos, payload_len );
+
+	if (gen_chance( gen, gen->trans_errors ))
+		buf[1] |= 0x80;
+
+	// A length running past the end of the packet: of the adaptation
+	// field if there is one, otherwise of the PES header starting here
+	if (gen_chance( gen, gen->length_errors )) {
+		if (header_len > 4) buf[4] = 0xFF;
+		else if (start) buf[4+8] = 0xFF;
+	}
+
+	p->pes_pos += payload_len;
+	p->continuity_count = (p->continuity_count + 1) & 0x0F;
+}
+
+
+size_t ts_gen_fill( ts_gen_t* gen, unsigned char* buf, size_t len )
+{
+	size_t used = 0;
+
+	if (gen->pids==NULL && gen_start( gen )) return 0;
+
+	// Room for a packet, the junk that might come before it, and a repeat
+	while (used + 3*TS_PACKET_SIZE <= len) {
+		unsigned char *pkt = buf + used;
+		int corrupt = gen_chance( gen, gen->corruption );
+		int repeat = 0;
+
+		// Junk that throws the packet boundaries out
+		if (corrupt && gen_random( gen ) % 2) {
+			size_t junk = 1 + gen_random( gen ) % (TS_PACKET_SIZE-1);
+			random_bytes( gen, pkt, junk );
+			pkt += junk;
+			used += junk;
+			corrupt = 0;
+		}
+
+		if (gen->psi_interval && gen->packets % gen->psi_interval < gen->psi_packets)
+			psi_packet( gen, pkt, gen->packets % gen->psi_interval );
+		else if ((int)(gen_random( gen ) % 100) < gen->null_packets)
+			null_packet( pkt );
+		else {
+			next_packet( gen, pkt );
+			repeat = gen_chance( gen, gen->duplicates );
+		}
+
+		// A damaged sync byte
+		if (corrupt) pkt[0] ^= 0xFF;
+
+		used += TS_PACKET_SIZE;
+		gen->packets++;
+
+		// The same packet again, with the same continuity count
+		if (repeat) {
+			memcpy( buf + used, pkt, TS_PACKET_SIZE );
+			used += TS_PACKET_SIZE;
+			gen->packets++;
+		}
+	}
+
+	return used;
+}
+
+
+void ts_gen_free( ts_gen_t* gen )
+{
+	free( gen->pids );
+	gen->pids = NULL;
+	free( gen->psi );
+	gen->psi = NULL;
+}
+
+
+#ifdef TS_GEN_MAIN
+
+static void usage()
+{
+	fprintf( stderr, "Usage: ts_gen [options] <outfile>\n" );
+	fprintf( stderr, "    -h             Help - this message.\n" );
+	fprintf( stderr, "    -m <mbytes>    Size of the stream to make (default 64).\n" );
+	fprintf( stderr, "    -a <count>     Number of MPEG audio PIDs (default 8).\n" );
+	fprintf( stderr, "    -o <count>     Number of other PIDs (default 2).\n" );
+	fprintf( stderr, "    -l <layer>     MPEG audio layer (default 2).\n" );
+	fprintf( stderr, "    -b <kbps>      Audio bitrate (default 192).\n" );
+	fprintf( stderr, "    -r <hz>        Audio samplerate, which chooses the MPEG version (default 48000).\n" );
+	fprintf( stderr, "    -P             Pad frames to keep to the bitrate, as encoders do.\n" );
+	fprintf( stderr, "    -f <percent>   Packets with an adaptation field (default 10).\n" );
+	fprintf( stderr, "    -n <percent>   Null packets (default 5).\n" );
+	fprintf( stderr, "    -c <n>         Continuity error in one of every n packets.\n" );
+	fprintf( stderr, "    -e <n>         Transport error in one of every n packets.\n" );
+	fprintf( stderr, "    -x <n>         Corrupt one of every n packets.\n" );
+	fprintf( stderr, "    -d <n>         Bad adaptation field or PES header length in one of every n packets.\n" );
+	fprintf( stderr, "    -D <n>         Send one of every n PES packets twice.\n" );
+	fprintf( stderr, "    -p <n>         Send a PAT and PMT every n packets.\n" );
+	fprintf( stderr, "    -s <seed>      Random number seed (default 1).\n" );
+	exit(-1);
+}
+
+
+int main( int argc, char** argv )
+{
+	ts_gen_t gen;
+	unsigned long long size = 64ULL*1024*1024;
+	unsigned long long written = 0;
+	unsigned char buf[1024*TS_PACKET_SIZE];
+	FILE *file = stdout;
+	int ch;
+
+	ts_gen_init( &gen );
+
+	while ((ch = getopt(argc, argv, "m:a:o:l:b:r:Pf:n:c:e:x:d:D:p:s:h?")) != -1)
+	switch (ch) {
+		case 'm': size = strtoull( optarg, NULL, 0 ) * 1024 * 1024; break;
+		case 'a': gen.audio_pids = atoi( optarg ); break;
+		case 'o': gen.other_pids = atoi( optarg ); break;
+		case 'l': gen.layer = atoi( optarg ); break;
+		case 'b': gen.bitrate = atoi( optarg ); break;
+		case 'r': gen.samplerate = atoi( optarg ); break;
+		case 'P': gen.padding = 1; break;
+		case 'f': gen.adaptation = atoi( optarg ); break;
+		case 'n': gen.null_packets = atoi( optarg ); break;
+		case 'c': gen.cc_errors = atoi( optarg ); break;
+		case 'e': gen.trans_errors = atoi( optarg ); break;
+		case 'x': gen.corruption = atoi( optarg ); break;
+		case 'd': gen.length_errors = atoi( optarg ); break;
+		case 'D': gen.duplicates = atoi( optarg ); break;
+		case 'p': gen.psi_interval = atoi( optarg ); break;
+		case 's': gen.seed = strtoul( optarg, NULL, 0 ); break;
+		case '?':
+		case 'h':
+		default:
+			usage();
+	}
+
+	if (argc-optind != 1) usage();
+	if (strcmp( argv[optind], "-" ) != 0) {
+		file = fopen( argv[optind], "wb" );
+		if (file==NULL) {
+			perror("ts_gen: Failed to open output file");
+			return -2;
+		}
+	}
+
+	while (written < size) {
+		size_t len = ts_gen_fill( &gen, buf, sizeof(buf) );
+		if (len == 0) {
+			fprintf(stderr, "ts_gen: Invalid options (no layer II header for %d kbps at %d Hz?)\n",
+			        gen.bitrate, gen.samplerate);
+			return -1;
+		}
+		if (len > size - written) len = size - written;
+		if (fwrite( buf, 1, len, file ) != len) {
+			perror("ts_gen: Failed to write output");
+			return -2;
+		}
+		written += len;
+	}
+
+	ts_gen_free( &gen );
+	if (fclose( file )) {
+		perror("ts_gen: Failed to write output");
+		return -2;
+	}
+
+	return 0;
+}
+
+#endif
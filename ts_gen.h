@@ -0,0 +1,128 @@
+/*
+
+	ts_gen.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _TS_GEN_H
+#define _TS_GEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Most PIDs of each kind in a generated multiplex
+#define TS_GEN_MAX_PIDS			64
+
+// First PID used for audio, and for everything else
+#define TS_GEN_AUDIO_PID		0x100
+#define TS_GEN_OTHER_PID		0x200
+
+// Largest PES packet generated
+#define TS_GEN_MAX_PES			8192
+
+// The program, and its PMT PID, when PSI is sent
+#define TS_GEN_PROGRAM			1
+#define TS_GEN_PMT_PID			0x1000
+
+// Most packets taken up by the PAT and PMT
+#define TS_GEN_MAX_PSI_PACKETS	8
+
+
+// A PID in the generated multiplex, and the PES packet being sent on it
+typedef struct ts_gen_pid_s {
+	int pid;
+	int stream_id;
+	int continuity_count;
+	unsigned char pes[TS_GEN_MAX_PES];
+	size_t pes_len;
+	size_t pes_pos;
+	unsigned long long pts;
+} ts_gen_pid_t;
+
+
+/*
+	Synthetic Transport Stream generator
+
+	Makes a deterministic multiplex of MPEG audio PIDs and PIDs
+	carrying other (video-like) PES packets, sent in turn, with null
+	packets mixed in, and optionally a PAT and PMT describing them.
+	The audio is any layer, and MPEG-1, MPEG-2 or MPEG-2.5 going by the
+	samplerate. The same options and seed always give the same stream,
+	so benchmarks can be compared between builds.
+
+	Damage can be added on purpose: continuity counter jumps, transport
+	error flags, corruption that throws the packet boundaries out, and
+	adaptation field or PES header lengths longer than the packet.
+	Packets sent twice, as is allowed, can be added too.
+*/
+typedef struct ts_gen_s {
+
+	// Options - set these before the first call to ts_gen_fill()
+	int audio_pids;				// Number of MPEG audio PIDs
+	int other_pids;				// Number of PIDs carrying other PES packets
+	int layer;					// MPEG audio layer, 1 to 3
+	int bitrate;				// Audio bitrate in kbps, from the table for the layer
+	int samplerate;				// Audio samplerate in Hz
+	int padding;				// Pad frames as encoders do, to keep to the bitrate
+	int adaptation;				// Percentage of packets with an adaptation field
+	int null_packets;			// Percentage of null packets
+	int cc_errors;				// One in this many packets has a continuity error, or 0
+	int trans_errors;			// One in this many packets has a transport error, or 0
+	int corruption;				// One in this many packets is corrupted, or 0
+	int length_errors;			// One in this many packets has a length that runs past its end, or 0
+	int duplicates;				// One in this many PES packets is sent twice, or 0
+	int psi_interval;			// Send the PAT and PMT every this many packets, or 0
+	uint32_t seed;
+
+	// State
+	unsigned char header[4];	// MPEG audio frame header used, without padding
+	unsigned int framesize;
+	unsigned int samples;		// In each frame
+	unsigned int slot;			// Bytes added by padding
+	unsigned long pad_step;		// Fraction of a slot left over by each frame,
+	unsigned long pad_total;	// out of the samplerate, and its running total
+	uint32_t random;
+	int next_pid;
+	ts_gen_pid_t* pids;
+	int pid_count;
+	unsigned char* psi;			// PAT and PMT packets, ready to send
+	int psi_packets;
+	int pat_cc;
+	int pmt_cc;
+	unsigned long long packets;
+	unsigned long long audio_bytes;		// ES bytes sent in audio PES packets
+
+} ts_gen_t;
+
+
+// Set the default options
+void ts_gen_init( ts_gen_t* gen );
+
+// Generate the next part of the stream, filling as much of buf as
+// whole packets (and any corruption before them) will go into.
+// returns the number of bytes written, or 0 if the options are invalid
+size_t ts_gen_fill( ts_gen_t* gen, unsigned char* buf, size_t len );
+
+void ts_gen_free( ts_gen_t* gen );
+
+
+
+#endif
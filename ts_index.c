@@ -0,0 +1,330 @@
+/*
+
+	ts_index.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "ts_index.h"
+#include "ts_scan.h"
+
+
+// PTS are stored in 40 bits, which lasts for over 100 days
+#define TS_INDEX_PTS_MASK		((1LL<<40)-1)
+
+
+
+static void put_u32( unsigned char *buf, uint32_t value )
+{
+	int i;
+	for (i=0; i<4; i++) buf[i] = (value >> (i*8)) & 0xFF;
+}
+
+
+static void put_u64( unsigned char *buf, uint64_t value )
+{
+	int i;
+	for (i=0; i<8; i++) buf[i] = (value >> (i*8)) & 0xFF;
+}
+
+
+static uint32_t get_u32( const unsigned char *buf )
+{
+	uint32_t value = 0;
+	int i;
+	for (i=3; i>=0; i--) value = (value << 8) | buf[i];
+	return value;
+}
+
+
+static uint64_t get_u64( const unsigned char *buf )
+{
+	uint64_t value = 0;
+	int i;
+	for (i=7; i>=0; i--) value = (value << 8) | buf[i];
+	return value;
+}
+
+
+// Read the next entry
+// returns 0 on success, or -1 at the end or on failure
+static int read_entry( FILE *file, ts_index_entry_t *entry )
+{
+	unsigned char buf[TS_INDEX_ENTRY_SIZE];
+	uint64_t packed;
+
+	if (fread( buf, TS_INDEX_ENTRY_SIZE, 1, file ) != 1) return -1;
+
+	packed = get_u64( buf+8 );
+	entry->offset = get_u64( buf );
+	entry->pts = packed & TS_INDEX_PTS_MASK;
+	entry->pid = (packed >> 40) & 0x1FFF;
+	entry->stream_id = (packed >> 53) & 0xFF;
+
+	return 0;
+}
+
+
+ts_index_t* ts_index_create( const char* path )
+{
+	unsigned char header[TS_INDEX_HEADER_SIZE];
+	ts_index_t *index = NULL;
+	char tmp_path[FILENAME_MAX];
+	int pid, err;
+
+	index = calloc( 1, sizeof(ts_index_t) );
+	if (index==NULL) return NULL;
+	index->path = strdup( path );
+	index->last_pts = malloc( TS_PID_COUNT * sizeof(long long) );
+	if (index->path==NULL || index->last_pts==NULL) goto fail;
+	for (pid=0; pid<TS_PID_COUNT; pid++)
+		index->last_pts[pid] = -1;
+
+	// The header is filled in at the end
+	snprintf( tmp_path, sizeof(tmp_path), "%s.tmp", path );
+	index->file = fopen( tmp_path, "wb" );
+	if (index->file==NULL) goto fail;
+	index->writing = 1;
+
+	memset( header, 0, sizeof(header) );
+	if (fwrite( header, sizeof(header), 1, index->file ) != 1) {
+		fclose( index->file );
+		unlink( tmp_path );
+		goto fail;
+	}
+
+	return index;
+
+fail:
+	err = errno;
+	free( index->last_pts );
+	free( index->path );
+	free( index );
+	errno = err;
+	return NULL;
+}
+
+
+int ts_index_add( ts_index_t* index, int pid, int stream_id, long long pts, unsigned long long offset )
+{
+	unsigned char buf[TS_INDEX_ENTRY_SIZE];
+	long long last = index->last_pts[pid];
+
+	// Carry on counting from the last PTS, past any wraparound
+	if (last != -1) pts = ts2mpa_pts_unwrap( pts, last );
+	if (pts < 0 || pts > TS_INDEX_PTS_MASK) return 0;
+	index->last_pts[pid] = pts;
+
+	put_u64( buf, offset );
+	put_u64( buf+8, (uint64_t)pts | ((uint64_t)pid << 40) | ((uint64_t)(stream_id & 0xFF) << 53) );
+	if (fwrite( buf, sizeof(buf), 1, index->file ) != 1) return -1;
+
+	index->entries++;
+	return 0;
+}
+
+
+ts_index_t* ts_index_open( const char* path )
+{
+	unsigned char header[TS_INDEX_HEADER_SIZE];
+	ts_index_t *index = NULL;
+
+	index = calloc( 1, sizeof(ts_index_t) );
+	if (index==NULL) return NULL;
+
+	index->file = fopen( path, "rb" );
+	if (index->file==NULL) {
+		free( index );
+		return NULL;
+	}
+
+	if (fread( header, sizeof(header), 1, index->file ) != 1 ||
+	    memcmp( header, TS_INDEX_MAGIC, 8 ) != 0 ||
+	    get_u32( header+8 ) != TS_INDEX_VERSION ||
+	    get_u32( header+12 ) != TS_INDEX_ENTRY_SIZE)
+	{
+		fclose( index->file );
+		free( index );
+		errno = EINVAL;
+		return NULL;
+	}
+
+	index->input_size = get_u64( header+16 );
+	index->entries = get_u64( header+24 );
+	index->first.pid = -1;
+	if (index->entries) read_entry( index->file, &index->first );
+
+	return index;
+}
+
+
+int ts_index_find( ts_index_t* index, int pid, long long start,
+                   unsigned long long* offset, long long* origins )
+{
+	unsigned long long *best = NULL;
+	uint32_t alive[TS_PID_MAP_WORDS];
+	ts_index_entry_t entry;
+	unsigned long long i;
+	int p;
+
+	best = calloc( TS_PID_COUNT, sizeof(unsigned long long) );
+	if (best==NULL) return -1;
+	memset( alive, 0, sizeof(alive) );
+	for (p=0; p<TS_PID_COUNT; p++)
+		origins[p] = -1;
+
+	if (fseek( index->file, TS_INDEX_HEADER_SIZE, SEEK_SET )) {
+		free( best );
+		return -1;
+	}
+
+	// The last packet on each PID starting no later than the start,
+	// for the PIDs that are still going by then
+	for (i=0; i<index->entries; i++) {
+		if (read_entry( index->file, &entry )) {
+			free( best );
+			return -1;
+		}
+		if (pid != -1 && entry.pid != pid) continue;
+
+		if (origins[entry.pid] == -1) origins[entry.pid] = entry.pts;
+		if (entry.pts - origins[entry.pid] <= start)
+			best[entry.pid] = entry.offset;
+		if (entry.pts - origins[entry.pid] >= start)
+			TS_PID_MAP_SET( alive, entry.pid );
+	}
+
+	*offset = index->input_size;
+	for (p=0; p<TS_PID_COUNT; p++) {
+		if (TS_PID_MAP_TEST( alive, p ) && best[p] < *offset)
+			*offset = best[p];
+	}
+
+	free( best );
+	return 0;
+}
+
+
+int ts_index_close( ts_index_t* index, unsigned long long input_size )
+{
+	unsigned char header[TS_INDEX_HEADER_SIZE];
+	char tmp_path[FILENAME_MAX];
+	int result = 0;
+
+	if (index->writing) {
+		memcpy( header, TS_INDEX_MAGIC, 8 );
+		put_u32( header+8, TS_INDEX_VERSION );
+		put_u32( header+12, TS_INDEX_ENTRY_SIZE );
+		put_u64( header+16, input_size );
+		put_u64( header+24, index->entries );
+
+		// Only replace an old index with a complete new one
+		snprintf( tmp_path, sizeof(tmp_path), "%s.tmp", index->path );
+		if (fseek( index->file, 0, SEEK_SET ) ||
+		    fwrite( header, sizeof(header), 1, index->file ) != 1)
+			result = -1;
+		if (fclose( index->file )) result = -1;
+		if (result == 0 && rename( tmp_path, index->path )) result = -1;
+		if (result) unlink( tmp_path );
+	} else {
+		fclose( index->file );
+	}
+
+	free( index->last_pts );
+	free( index->path );
+	free( index );
+	return result;
+}
+
+
+// Find the next PES packet with a PTS on a PID, from pos onwards
+// returns 0 on success, or -1 if there wasn't one close enough
+static int next_pts( const unsigned char *buf, size_t len, size_t pos, int pid,
+                     size_t *found, long long *pts )
+{
+	size_t limit = len - pos > TS_INDEX_SCAN_LIMIT ? pos + TS_INDEX_SCAN_LIMIT : len;
+	int synced = 0;
+
+	while (pos + TS_PACKET_SIZE <= limit) {
+		const unsigned char *pkt = buf + pos;
+		size_t header_len = 4;
+
+		// Find where the packets start, here or after any damage
+		if (!synced || pkt[0] != 0x47) {
+			size_t skip = ts_scan_sync( buf+pos, len-pos, TS_RESYNC_PACKETS );
+			if (skip >= len-pos) return -1;
+			pos += skip;
+			synced = 1;
+			continue;
+		}
+
+		if (TS_PACKET_PID(pkt) == pid && TS_PACKET_PAYLOAD_START(pkt) &&
+		    !TS_PACKET_TRANS_ERROR(pkt) && (TS_PACKET_ADAPTATION(pkt) & 0x1))
+		{
+			if (TS_PACKET_ADAPTATION(pkt) == 0x3)
+				header_len += TS_PACKET_ADAPT_LEN(pkt) + 1;
+			if (header_len < TS_PACKET_SIZE) {
+				*pts = ts2mpa_pes_pts( pkt+header_len, TS_PACKET_SIZE-header_len );
+				if (*pts >= 0) {
+					*found = pos;
+					return 0;
+				}
+			}
+		}
+
+		pos += TS_PACKET_SIZE;
+	}
+
+	return -1;
+}
+
+
+unsigned long long ts_index_bisect( const unsigned char* buf, size_t len, int pid,
+                                    long long origin, long long start )
+{
+	size_t lo = 0, hi = len, mid, found;
+	unsigned long long best = 0;
+	long long pts;
+
+	while (hi - lo > TS_INDEX_BISECT_MIN) {
+		mid = lo + (hi - lo) / 2;
+
+		// Nothing between here and the top of the range?
+		if (next_pts( buf, len, mid, pid, &found, &pts ) || found >= hi) {
+			hi = mid;
+			continue;
+		}
+
+		if (((pts - origin) & (TS2MPA_PTS_WRAP-1)) <= start) {
+			lo = found;
+			best = found;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return best;
+}
@@ -0,0 +1,128 @@
+/*
+
+	ts_index.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _TS_INDEX_H
+#define _TS_INDEX_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ts2mpa.h"
+
+
+// Added to the name of a recording, for the name of its index
+#define TS_INDEX_SUFFIX			".idx"
+
+// Start of the index file, and the version of its layout
+#define TS_INDEX_MAGIC			"TS2MPAIX"
+#define TS_INDEX_VERSION		1
+
+// Sizes of the header and of each entry, in the file
+#define TS_INDEX_HEADER_SIZE	32
+#define TS_INDEX_ENTRY_SIZE		16
+
+// Bisection stops once the range is this small
+#define TS_INDEX_BISECT_MIN		(256*1024)
+
+// Furthest to look for the next PES packet on a PID while bisecting
+#define TS_INDEX_SCAN_LIMIT		(8*1024*1024)
+
+
+/*
+	Seek index of a recording
+
+	Each PES packet with a PTS, on the audio PIDs, gets an entry with
+	its PTS, the offset of the packet it starts in, its PID and stream
+	ID. PTS are unwrapped for each PID as they are added, so they keep
+	going up past the 33 bit wraparound, however long the recording.
+
+	The file is a header:
+	  magic (8 bytes), version, entry size (32 bits each),
+	  size of the recording indexed, number of entries (64 bits each)
+	followed by the entries, in the order of the recording:
+	  offset (64 bits), then PTS (40 bits) | PID << 40 | stream ID << 53
+	all little endian.
+*/
+typedef struct ts_index_entry_s {
+	unsigned long long offset;
+	long long pts;				// Unwrapped for the PID
+	int pid;
+	int stream_id;
+} ts_index_entry_t;
+
+
+typedef struct ts_index_s {
+
+	FILE* file;
+	char* path;					// Written to path.tmp, then renamed into place
+	int writing;
+
+	unsigned long long input_size;	// Of the recording indexed
+	unsigned long long entries;
+	ts_index_entry_t first;			// First entry, when reading
+
+	long long* last_pts;		// Last PTS unwrapped for each PID, when writing
+
+} ts_index_t;
+
+
+// Start writing an index
+// returns NULL on failure, with errno set
+ts_index_t* ts_index_create( const char* path );
+
+// Add an entry for a PES packet, with its PTS as found in it
+// returns 0 on success, or -1 on failure
+int ts_index_add( ts_index_t* index, int pid, int stream_id, long long pts, unsigned long long offset );
+
+// Open an index for reading
+// returns NULL if it is missing or isn't an index, with errno set
+ts_index_t* ts_index_open( const char* path );
+
+// Find where to start reading, to get start ticks into the recording
+// on every PID (or only on pid, unless it is -1). Time is counted on
+// each PID from the first PTS on it, which is stored in origins[pid]
+// (which are -1 for PIDs with no entries).
+// *offset is the start of a PES packet, or input_size if every PID
+// ended before then.
+// returns 0 on success, or -1 if reading failed
+int ts_index_find( ts_index_t* index, int pid, long long start,
+                   unsigned long long* offset, long long* origins );
+
+// Close an index; one being written is finished off first, for a
+// recording of input_size bytes
+// returns 0 on success, or -1 on failure
+int ts_index_close( ts_index_t* index, unsigned long long input_size );
+
+
+// Without an index, find the start of the last PES packet on pid that
+// starts no more than start ticks after origin, by bisecting the
+// recording in buf. The time between origin and the packets looked at
+// must be less than one PTS wraparound (26.5 hours).
+// returns the offset, or 0 if there is no such packet
+unsigned long long ts_index_bisect( const unsigned char* buf, size_t len, int pid,
+                                    long long origin, long long start );
+
+
+
+#endif
@@ -0,0 +1,644 @@
+/*
+
+	ts_input.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "ts2mpa.h"
+#include "ts_input.h"
+
+
+
+// Try and map a regular file into memory
+static int map_input( ts_input_t* input )
+{
+	struct stat st;
+	void *map = NULL;
+
+	if (fstat( input->fd, &st ) < 0) return 0;
+	if (!S_ISREG( st.st_mode ) || st.st_size < TS_PACKET_SIZE) return 0;
+	if ((unsigned long long)st.st_size > (size_t)-1) return 0;
+
+	map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, input->fd, 0 );
+	if (map == MAP_FAILED) return 0;
+
+	// We only ever walk forwards through the file
+	madvise( map, st.st_size, MADV_SEQUENTIAL );
+#ifdef MADV_HUGEPAGE
+	madvise( map, st.st_size, MADV_HUGEPAGE );
+#endif
+
+	input->map = map;
+	input->map_size = st.st_size;
+	input->pos = 0;
+
+	return 1;
+}
+
+
+// Watch a followed file for being written to
+static void start_follow( ts_input_t* input, const char* path )
+{
+	input->follow = 1;
+	input->last_growth = time( NULL );
+	
+	// Without inotify (or on a filesystem where it doesn't see the
+	// writes), the file is checked every so often anyway
+	input->watch_fd = inotify_init1( IN_NONBLOCK|IN_CLOEXEC );
+	if (input->watch_fd >= 0 &&
+	    inotify_add_watch( input->watch_fd, path, IN_MODIFY|IN_CLOSE_WRITE ) < 0)
+	{
+		close( input->watch_fd );
+		input->watch_fd = -1;
+	}
+}
+
+
+// At the end of a followed file: wait a while for it to grow
+// returns 0 to try reading again, or -1 if it has stopped growing
+static int wait_for_growth( ts_input_t* input )
+{
+	char events[4096];
+	
+	if (input->follow_timeout && time( NULL ) - input->last_growth >= input->follow_timeout)
+		return -1;
+	
+	if (input->watch_fd >= 0) {
+		struct pollfd pfd = { input->watch_fd, POLLIN, 0 };
+		if (poll( &pfd, 1, TS_INPUT_FOLLOW_WAIT ) > 0) {
+			// Only the wakeup matters, not what it was for
+			while (read( input->watch_fd, events, sizeof(events) ) > 0);
+		}
+	} else {
+		poll( NULL, 0, TS_INPUT_FOLLOW_WAIT );
+	}
+	
+	return 0;
+}
+
+
+// Map some fresh pages for the read buffer
+static unsigned char* alloc_buffer( ts_input_t* input )
+{
+	void *buf = mmap( NULL, input->buf_size, PROT_READ|PROT_WRITE,
+	                  MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+	if (buf == MAP_FAILED) return NULL;
+	
+	return buf;
+}
+
+
+// Start reading the next block into one of the io_uring buffers
+// returns 0 on success, or -1 on failure
+static int submit_read( ts_input_t* input, int index )
+{
+	// Don't touch pages that may have been handed out
+	if (input->no_reuse) {
+		unsigned char *buf = alloc_buffer( input );
+		if (buf == NULL) return -1;
+		munmap( input->ubuf[index], input->buf_size );
+		input->ubuf[index] = buf;
+	}
+
+	if (uring_read( input->uring, input->fd, input->ubuf[index] + input->headroom,
+	                input->buf_size - input->headroom, input->read_offset, index ))
+		return -1;
+	if (uring_submit( input->uring ))
+		return -1;
+	
+	input->upending[index] = 1;
+	if (input->read_offset != -1)
+		input->read_offset += input->buf_size - input->headroom;
+	
+	return 0;
+}
+
+
+// Wait for the read into a buffer to finish
+// returns 0 on success, or -1 on failure
+static int wait_read( ts_input_t* input, int index )
+{
+	while (input->upending[index]) {
+		unsigned long long done;
+		int result;
+		
+		if (uring_complete( input->uring, 1, &done, &result ) < 0)
+			return -1;
+		input->upending[done] = 0;
+		input->uresult[done] = result;
+	}
+	
+	return 0;
+}
+
+
+// Switch to using io_uring to read the input
+// returns 1 on success, or 0 if it is not available
+static int start_uring( ts_input_t* input, int seekable )
+{
+	int i;
+	
+	input->uring = uring_open( TS_INPUT_URING_DEPTH*2 );
+	if (input->uring == NULL) return 0;
+	
+	// Files can have reads in flight at several offsets at once,
+	// but a pipe only has one position to read from
+	input->ubuf_count = seekable ? TS_INPUT_URING_DEPTH : 2;
+	input->read_offset = seekable ? 0 : -1;
+	input->ubuf[0] = input->buf;
+	for (i=1; i<input->ubuf_count; i++) {
+		input->ubuf[i] = alloc_buffer( input );
+		if (input->ubuf[i] == NULL) goto fail;
+	}
+	
+	for (i=0; i<input->ubuf_count; i++) {
+		if (!seekable && i > 0) break;
+		if (submit_read( input, i )) goto fail;
+	}
+	input->ucurrent = input->ubuf_count-1;
+	
+	return 1;
+
+fail:
+	for (i=0; i<input->ubuf_count; i++)
+		wait_read( input, i );
+	for (i=1; i<input->ubuf_count; i++) {
+		if (input->ubuf[i]) munmap( input->ubuf[i], input->buf_size );
+		input->ubuf[i] = NULL;
+	}
+	input->buf = input->ubuf[0];
+	uring_close( input->uring );
+	input->uring = NULL;
+	return 0;
+}
+
+
+// Move on to the next io_uring buffer, once its read has finished
+static size_t peek_uring( ts_input_t* input, unsigned char** ptr, size_t min_len )
+{
+	while (input->fill - input->pos < min_len && !input->eof) {
+		size_t remaining = input->fill - input->pos;
+		int old = input->ucurrent;
+		int next = (old + 1) % input->ubuf_count;
+		unsigned char *buf = NULL;
+		int result;
+		
+		if (wait_read( input, next )) {
+			input->error = errno;
+			perror("ts2mpa: Failed to read from input");
+			input->eof = 1;
+			break;
+		}
+		
+		result = input->uresult[next];
+		if (result <= 0) {
+			if (result < 0) {
+				errno = -result;
+				input->error = errno;
+				perror("ts2mpa: Failed to read from input");
+			}
+			input->eof = 1;
+			break;
+		}
+		
+		// Carry the partial data over to just before the new data
+		buf = input->ubuf[next];
+		memcpy( buf + input->headroom - remaining, input->buf + input->pos, remaining );
+		input->buf = buf;
+		input->pos = input->headroom - remaining;
+		input->fill = input->headroom + result;
+		input->ucurrent = next;
+		
+		// The old buffer can now be read into again
+		if (!input->upending[old] && submit_read( input, old )) {
+			input->error = errno;
+			perror("ts2mpa: Failed to read from input");
+			input->eof = 1;
+		}
+	}
+
+	*ptr = input->buf + input->pos;
+	return input->fill - input->pos;
+}
+
+
+// Keep the empty blocks filled, until told to stop or the input ends
+static void* reader_thread( void* arg )
+{
+	ts_input_t *input = arg;
+	ts_input_block_t *block = NULL;
+	
+	do {
+		block = spsc_ring_pop_wait( input->empty );
+		if (__atomic_load_n( &input->stop, __ATOMIC_ACQUIRE )) break;
+		
+		// Hand over whatever arrives straight away, for live streams,
+		// but fill the whole block when decompressing
+		if (input->decompress) {
+			block->len = ts_decompress_read( input->decompress, block->buf + input->headroom,
+			                                 input->buf_size - input->headroom );
+		} else {
+			do {
+				block->len = read( input->fd, block->buf + input->headroom,
+				                   input->buf_size - input->headroom );
+			} while (block->len < 0 && errno == EINTR);
+		}
+		if (block->len < 0) block->len = -errno;
+		
+		spsc_ring_push_wait( input->full, block );
+	} while (block->len > 0);
+	
+	return NULL;
+}
+
+
+// Start a thread to do the reading
+// returns 1 on success, or 0 if it could not be started
+static int start_thread( ts_input_t* input )
+{
+	sigset_t all, old;
+	int i;
+	
+	input->full = spsc_ring_new( TS_INPUT_THREAD_DEPTH );
+	input->empty = spsc_ring_new( TS_INPUT_THREAD_DEPTH );
+	if (input->full == NULL || input->empty == NULL) goto fail;
+	
+	input->blocks[0].buf = input->buf;
+	for (i=1; i<TS_INPUT_THREAD_DEPTH; i++) {
+		input->blocks[i].buf = alloc_buffer( input );
+		if (input->blocks[i].buf == NULL) goto fail;
+	}
+	for (i=0; i<TS_INPUT_THREAD_DEPTH; i++)
+		spsc_ring_push( input->empty, &input->blocks[i] );
+	
+	// Signals are left for the main thread to handle
+	sigfillset( &all );
+	pthread_sigmask( SIG_SETMASK, &all, &old );
+	i = pthread_create( &input->reader, NULL, reader_thread, input );
+	pthread_sigmask( SIG_SETMASK, &old, NULL );
+	if (i) goto fail;
+	
+	input->threaded = 1;
+	input->current = NULL;
+	return 1;
+
+fail:
+	for (i=1; i<TS_INPUT_THREAD_DEPTH; i++) {
+		if (input->blocks[i].buf) munmap( input->blocks[i].buf, input->buf_size );
+		input->blocks[i].buf = NULL;
+	}
+	if (input->full) spsc_ring_free( input->full );
+	if (input->empty) spsc_ring_free( input->empty );
+	input->full = input->empty = NULL;
+	return 0;
+}
+
+
+// Move on to the next block from the reader thread
+static size_t peek_thread( ts_input_t* input, unsigned char** ptr, size_t min_len )
+{
+	while (input->fill - input->pos < min_len && !input->eof) {
+		size_t remaining = input->fill - input->pos;
+		ts_input_block_t *old = input->current;
+		ts_input_block_t *block = spsc_ring_pop_wait( input->full );
+		
+		if (block->len <= 0) {
+			if (block->len < 0) {
+				errno = -block->len;
+				input->error = errno;
+				perror("ts2mpa: Failed to read from input");
+			}
+			spsc_ring_push( input->empty, block );
+			input->eof = 1;
+			break;
+		}
+		
+		// Don't touch pages that may have been handed out
+		if (input->no_reuse && old) {
+			unsigned char *buf = alloc_buffer( input );
+			if (buf) {
+				munmap( old->buf, input->buf_size );
+				old->buf = buf;
+			}
+		}
+		
+		// Carry the partial data over to just before the new data
+		memcpy( block->buf + input->headroom - remaining, input->buf + input->pos, remaining );
+		input->buf = block->buf;
+		input->pos = input->headroom - remaining;
+		input->fill = input->headroom + block->len;
+		input->current = block;
+		
+		if (old) spsc_ring_push( input->empty, old );
+	}
+
+	*ptr = input->buf + input->pos;
+	return input->fill - input->pos;
+}
+
+
+// Stop the reader thread and free its blocks
+static void stop_thread( ts_input_t* input )
+{
+	ts_input_block_t *block = NULL;
+	int i;
+	
+	// The reader is either blocked in read(), which is a cancellation
+	// point, or waiting for an empty block, which it will get below
+	__atomic_store_n( &input->stop, 1, __ATOMIC_RELEASE );
+	pthread_cancel( input->reader );
+	while ((block = spsc_ring_pop( input->full )))
+		spsc_ring_push( input->empty, block );
+	if (input->current) {
+		spsc_ring_push( input->empty, input->current );
+		input->current = NULL;
+	}
+	pthread_join( input->reader, NULL );
+	
+	for (i=0; i<TS_INPUT_THREAD_DEPTH; i++)
+		munmap( input->blocks[i].buf, input->buf_size );
+	spsc_ring_free( input->full );
+	spsc_ring_free( input->empty );
+	input->buf = NULL;
+}
+
+
+ts_input_t* ts_input_open( const char* path, int flags )
+{
+	struct stat st;
+	ts_input_t *input = NULL;
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	unsigned char *buf = NULL;
+	udp_input_t *udp = NULL;
+	ts_decompress_t *decompress = NULL;
+	int fd = -1;
+
+	if (strncmp( path, "-", 1 ) == 0) {
+		// Use STDIN
+		fd = STDIN_FILENO;
+	} else if (udp_input_is_url( path )) {
+		udp = udp_input_open( path );
+		if (udp == NULL) return NULL;
+		fd = udp->fd;
+		
+		// Datagrams are received by hand, not by a thread or io_uring
+		flags &= ~(TS_INPUT_URING|TS_INPUT_THREAD);
+	} else {
+		int format;
+		
+		fd = open( path, O_RDONLY );
+		if (fd < 0) return NULL;
+		
+		// Compressed files are decompressed on the reader thread
+		format = ts_decompress_probe( fd );
+		if (format != TS_DECOMPRESS_NONE) {
+			decompress = ts_decompress_open( fd, format );
+			if (decompress == NULL) {
+				int err = errno;
+				close( fd );
+				errno = err;
+				return NULL;
+			}
+			posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+			flags = TS_INPUT_THREAD;
+		}
+	}
+
+	input = malloc( sizeof(ts_input_t) );
+	if (input==NULL) {
+		if (decompress) ts_decompress_close( decompress );
+		if (udp) udp_input_close( udp );
+		else if (fd != STDIN_FILENO) close(fd);
+		return NULL;
+	}
+	bzero( input, sizeof(ts_input_t) );
+	input->fd = fd;
+	input->udp = udp;
+	input->decompress = decompress;
+	input->eof = 0;
+	input->watch_fd = -1;
+	
+	// A file that is still being written has to be read as it grows
+	if ((flags & TS_INPUT_FOLLOW) && fd != STDIN_FILENO && !udp &&
+	    fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ))
+	{
+		start_follow( input, path );
+		flags &= ~(TS_INPUT_URING|TS_INPUT_THREAD);
+	}
+
+	// No need for a buffer if we can map the file
+	if (fd != STDIN_FILENO && !udp && !decompress && !input->follow &&
+	    !(flags & (TS_INPUT_URING|TS_INPUT_THREAD)) && map_input( input ))
+		return input;
+
+	// Read area is a whole number of both pages and TS packets,
+	// with a page in front of it for bytes carried between blocks
+	input->headroom = page_size;
+	input->buf_size = page_size + (TS_PACKET_SIZE * page_size / (decompress ? 1 : 4));
+	buf = alloc_buffer( input );
+	if (buf == NULL) {
+		if (decompress) ts_decompress_close( decompress );
+		if (udp) udp_input_close( udp );
+		else if (fd != STDIN_FILENO) close(fd);
+		free( input );
+		return NULL;
+	}
+
+	input->buf = buf;
+	input->pos = input->headroom;
+	input->fill = input->headroom;
+
+	// Without a thread, compressed files are decompressed as they are read
+	if (flags & TS_INPUT_THREAD) {
+		if (!start_thread( input ) && fd != STDIN_FILENO && !decompress)
+			map_input( input );
+	}
+
+	// Fall back to normal reads if io_uring isn't available
+	else if (flags & TS_INPUT_URING) {
+		int seekable = (fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ));
+		if (!start_uring( input, seekable ) && fd != STDIN_FILENO && seekable)
+			map_input( input );
+	}
+
+	return input;
+}
+
+
+size_t ts_input_peek( ts_input_t* input, unsigned char** ptr, size_t min_len )
+{
+	size_t remaining = input->fill - input->pos;
+
+	// The rest of a mapped file is always available
+	if (input->map) {
+		*ptr = input->map + input->pos;
+		return input->map_size - input->pos;
+	}
+	
+	if (input->uring)
+		return peek_uring( input, ptr, min_len );
+	if (input->threaded)
+		return peek_thread( input, ptr, min_len );
+
+	if (remaining < min_len && !input->eof) {
+
+		// Don't touch pages that may have been handed out
+		if (input->no_reuse) {
+			unsigned char *buf = alloc_buffer( input );
+			if (buf == NULL) {
+				input->error = errno;
+				perror("ts2mpa: Failed to allocate input buffer");
+				input->eof = 1;
+				*ptr = input->buf + input->pos;
+				return remaining;
+			}
+			memcpy( buf + input->headroom - remaining,
+			        input->buf + input->pos, remaining );
+			munmap( input->buf, input->buf_size );
+			input->buf = buf;
+		}
+		
+		// Move the partial data to just before the read area,
+		// so that the next read lands on a page boundary
+		else if (remaining) {
+			memmove( input->buf + input->headroom - remaining,
+			         input->buf + input->pos, remaining );
+		}
+		input->pos = input->headroom - remaining;
+		input->fill = input->headroom;
+
+		// Pipes may return less than we asked for, so keep going
+		// until there is enough for the caller
+		while (input->fill - input->pos < min_len) {
+			ssize_t len;
+			
+			if (input->udp) {
+				len = udp_input_recv( input->udp, input->buf + input->fill,
+				                      input->buf_size - input->fill );
+				
+				// Nothing arrived for a while, so let the caller decide
+				// whether to wait any longer
+				if (len == 0) break;
+			} else if (input->decompress) {
+				len = ts_decompress_read( input->decompress, input->buf + input->fill,
+				                          input->buf_size - input->fill );
+			} else {
+				len = read( input->fd, input->buf + input->fill,
+				            input->buf_size - input->fill );
+			}
+			if (len < 0) {
+				if (errno == EINTR) continue;
+				input->error = errno;
+				perror("ts2mpa: Failed to read from input");
+				input->eof = 1;
+				break;
+			} else if (len == 0) {
+				// Give the caller what there is, while waiting for more
+				if (input->follow && wait_for_growth( input ) == 0) break;
+				input->eof = 1;
+				break;
+			}
+			input->fill += len;
+			if (input->follow) input->last_growth = time( NULL );
+		}
+	}
+
+	*ptr = input->buf + input->pos;
+	return input->fill - input->pos;
+}
+
+
+void ts_input_consume( ts_input_t* input, size_t len )
+{
+	size_t end = input->map ? input->map_size : input->fill;
+
+	if (input->pos + len > end)
+		len = end - input->pos;
+	input->pos += len;
+	input->offset += len;
+}
+
+
+int ts_input_seek( ts_input_t* input, unsigned long long offset )
+{
+	// Start reading again from there, with nothing carried over
+	if (input->map == NULL) {
+		if (input->uring || input->threaded || input->udp || input->decompress) return -1;
+		if (lseek( input->fd, offset, SEEK_SET ) == (off_t)-1) return -1;
+		input->pos = input->headroom;
+		input->fill = input->headroom;
+		input->offset = offset;
+		input->eof = 0;
+		return 0;
+	}
+	
+	if (offset > input->map_size) offset = input->map_size;
+	input->pos = offset;
+	input->offset = offset;
+	
+	return 0;
+}
+
+
+void ts_input_close( ts_input_t* input )
+{
+	int i;
+
+	// Let any reads still in flight finish, before freeing their buffers
+	if (input->uring) {
+		for (i=0; i<input->ubuf_count; i++) {
+			wait_read( input, i );
+			munmap( input->ubuf[i], input->buf_size );
+		}
+		uring_close( input->uring );
+		input->buf = NULL;
+	}
+	if (input->threaded)
+		stop_thread( input );
+	if (input->decompress)
+		ts_decompress_close( input->decompress );
+
+	if (input->watch_fd >= 0)
+		close( input->watch_fd );
+	if (input->udp)
+		udp_input_close( input->udp );
+	else if (input->fd != STDIN_FILENO)
+		close( input->fd );
+	if (input->map)
+		munmap( input->map, input->map_size );
+	if (input->buf)
+		munmap( input->buf, input->buf_size );
+	free( input );
+}
@@ -0,0 +1,168 @@
+/*
+
+	ts_input.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _TS_INPUT_H
+#define _TS_INPUT_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "uring.h"
+#include "spsc_ring.h"
+#include "udp_input.h"
+#include "ts_decompress.h"
+
+
+// Flags for ts_input_open()
+#define TS_INPUT_URING			0x01	// Use io_uring, if available
+#define TS_INPUT_THREAD			0x02	// Read on a separate thread
+#define TS_INPUT_FOLLOW			0x04	// Wait for a file that is still being written to grow
+
+// Number of buffers with reads in flight when using io_uring
+#define TS_INPUT_URING_DEPTH	4
+
+// Number of buffers passed between the reader thread and the parser
+#define TS_INPUT_THREAD_DEPTH	8
+
+// Longest wait for a followed file to grow before returning (in ms),
+// which is also how often it is checked without inotify
+#define TS_INPUT_FOLLOW_WAIT	500
+
+
+// A buffer passed to and from the reader thread
+typedef struct ts_input_block_s {
+	unsigned char* buf;
+	ssize_t len;							// Bytes read, 0 at end of file or -errno
+} ts_input_block_t;
+
+
+/*
+	Block-buffered Transport Stream reader
+
+	Data is read in large page-aligned blocks and handed out in place,
+	so callers walk the packets directly in the input buffer.
+	A window returned by ts_input_peek() stays valid until the next
+	call to ts_input_peek().
+
+	Seekable regular files are memory mapped instead, and the whole
+	of the rest of the file is returned as a single window.
+
+	If no_reuse is set, each block is read into freshly mapped pages
+	and the old ones are unmapped, so that data handed out can be
+	spliced into a pipe and never changes afterwards.
+
+	With io_uring, reads into the next few buffers are kept in flight
+	while the current one is being parsed. Regular files are read at
+	known offsets several blocks ahead, rather than being mapped; pipes
+	only ever have one read in flight, so the data stays in order.
+
+	With a reader thread, blocks are read on that thread and handed
+	over through a lock-free ring, then handed back through another
+	once parsed, so the parser never waits on a slow read().
+
+	udp:// and rtp:// inputs are received in batches of datagrams,
+	straight into the read area. They never end, and ts_input_peek()
+	returns nothing (without setting eof) if no datagrams arrived for
+	a while, so that the caller gets a chance to stop.
+
+	A file that is followed is read rather than mapped, and reaching
+	the end of it is the same: ts_input_peek() waits for it to grow
+	(woken by inotify if it can be, otherwise checking every so often)
+	and returns what it has so far, which can be part of a packet.
+	It only ends once the file hasn't grown for follow_timeout seconds.
+
+	A file compressed with gzip or zstd is decompressed on the reader
+	thread, straight into blocks four times the usual size, so that
+	decompression goes on while the blocks before are parsed. It can't
+	be mapped, seeked or followed.
+*/
+typedef struct ts_input_s {
+
+	int fd;
+
+	unsigned char* map;			// Memory mapped file, or NULL
+	size_t map_size;
+
+	unsigned char* buf;			// Page aligned allocation
+	size_t headroom;			// Space before the read area for carried bytes
+	size_t buf_size;			// Total size of the allocation
+	size_t pos;					// Offset of the first unconsumed byte
+	size_t fill;				// Offset after the last byte read
+	unsigned long long offset;	// Position in the input of the first unconsumed byte
+	int eof;
+	int error;					// errno of a read that failed, ending the input early
+	int no_reuse;
+	
+	uring_t* uring;
+	unsigned char* ubuf[TS_INPUT_URING_DEPTH];
+	int upending[TS_INPUT_URING_DEPTH];		// Read in flight into this buffer
+	int uresult[TS_INPUT_URING_DEPTH];
+	int ubuf_count;
+	int ucurrent;							// Buffer currently being parsed
+	long long read_offset;					// Offset of the next read, or -1 for pipes
+	
+	pthread_t reader;
+	int threaded;
+	int stop;								// Tell the reader thread to finish
+	ts_input_block_t blocks[TS_INPUT_THREAD_DEPTH];
+	ts_input_block_t* current;				// Block being parsed, or NULL
+	spsc_ring_t* full;						// Blocks read, waiting to be parsed
+	spsc_ring_t* empty;						// Blocks waiting to be read into
+	
+	udp_input_t* udp;						// Receiving datagrams, or NULL
+	ts_decompress_t* decompress;			// Decompressing the file, or NULL
+	
+	int follow;								// Waiting for the file to grow at the end
+	int follow_timeout;						// Seconds without growing to end after, or 0
+	int watch_fd;							// inotify watching the file, or -1
+	time_t last_growth;
+
+} ts_input_t;
+
+
+// Open a file for reading, STDIN if path is "-",
+// or a socket if it is a udp:// or rtp:// URL
+// returns NULL on failure, with errno set (ENOTSUP for a compressed
+// file, if support for its format wasn't built in)
+ts_input_t* ts_input_open( const char* path, int flags );
+
+// Get at least min_len contiguous bytes, unless at end of file
+// returns the number of bytes available at *ptr; if a read fails, eof
+// is set along with error, so that the input isn't taken as complete
+size_t ts_input_peek( ts_input_t* input, unsigned char** ptr, size_t min_len );
+
+// Mark bytes returned by ts_input_peek() as used
+void ts_input_consume( ts_input_t* input, size_t len );
+
+// Move to another position in a memory mapped file, or a file that
+// is read without io_uring or a thread
+// returns 0 on success, or -1 if the input can't seek
+int ts_input_seek( ts_input_t* input, unsigned long long offset );
+
+void ts_input_close( ts_input_t* input );
+
+
+
+#endif
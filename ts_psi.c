@@ -0,0 +1,152 @@
+/*
+
+	ts_psi.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+
+#include "ts_psi.h"
+
+
+
+// Tables only come round a few times a second, so this doesn't
+// need a lookup table (which would be global state)
+uint32_t ts_psi_crc32( const unsigned char* data, size_t len )
+{
+	uint32_t crc = 0xFFFFFFFF;
+	size_t i;
+	int bit;
+
+	for (i=0; i<len; i++) {
+		crc ^= (uint32_t)data[i] << 24;
+		for (bit=0; bit<8; bit++)
+			crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+	}
+
+	return crc;
+}
+
+
+void ts_psi_init( ts_psi_section_t* section )
+{
+	section->len = 0;
+	section->collecting = 0;
+	section->continuity_count = -1;
+}
+
+
+// Add some of a packet to the sections being collected
+// returns the number of bad sections
+static int add_bytes( ts_psi_section_t* section, const unsigned char* buf, size_t len,
+                      ts_psi_callback callback, void* user )
+{
+	int bad = 0;
+
+	while (len > 0 && section->collecting) {
+		size_t need, take;
+
+		// Stuffing fills the rest of the packet
+		if (section->len == 0 && buf[0] == 0xFF) {
+			section->collecting = 0;
+			break;
+		}
+
+		// The length is in the first three bytes
+		need = 3;
+		if (section->len >= 3) {
+			need += PSI_SECTION_LENGTH(section->data);
+			if (need > TS_PSI_MAX_SECTION) {
+				section->collecting = 0;
+				break;
+			}
+		}
+
+		take = need - section->len;
+		if (take > len) take = len;
+		memcpy( section->data + section->len, buf, take );
+		section->len += take;
+		buf += take;
+		len -= take;
+
+		if (section->len < 3 || section->len < 3 + PSI_SECTION_LENGTH(section->data)) continue;
+
+		// Got a whole section; another one can follow straight on
+		if (PSI_SECTION_SYNTAX(section->data) == 0 || section->len < TS_PSI_HEADER_SIZE+TS_PSI_CRC_SIZE) {
+			// Not a long section, so not a PAT or PMT
+		} else if (ts_psi_crc32( section->data, section->len ) != 0) {
+			bad++;
+		} else {
+			callback( user, section->data, section->len );
+		}
+		section->len = 0;
+	}
+
+	// A new section only starts in a packet with a pointer field
+	if (section->len == 0)
+		section->collecting = 0;
+
+	return bad;
+}
+
+
+int ts_psi_collect( ts_psi_section_t* section, const unsigned char* payload, size_t len,
+                    int unit_start, int continuity_count, ts_psi_callback callback, void* user )
+{
+	int bad = 0;
+	size_t pointer;
+
+	// Repeated packets are sent as they are, so only look at one
+	if (continuity_count == (section->continuity_count + 15) % 16 && section->continuity_count != -1)
+		return 0;
+
+	// A missing packet spoils whatever it was part of
+	if (continuity_count != section->continuity_count) {
+		section->collecting = 0;
+		section->len = 0;
+	}
+	section->continuity_count = (continuity_count + 1) % 16;
+
+	if (len == 0) return 0;
+	if (!unit_start)
+		return add_bytes( section, payload, len, callback, user );
+
+	// The pointer field says where the next section starts,
+	// after the end of the one in progress
+	pointer = payload[0];
+	payload++;
+	len--;
+	if (pointer > len) {
+		section->collecting = 0;
+		section->len = 0;
+		return 0;
+	}
+
+	if (section->collecting)
+		bad += add_bytes( section, payload, pointer, callback, user );
+
+	section->collecting = 1;
+	section->len = 0;
+	bad += add_bytes( section, payload+pointer, len-pointer, callback, user );
+
+	return bad;
+}
@@ -0,0 +1,113 @@
+/*
+
+	ts_psi.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _TS_PSI_H
+#define _TS_PSI_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Largest PAT or PMT section, including its header and CRC
+#define TS_PSI_MAX_SECTION		1024
+
+// Size of the long section header, up to last_section_number
+#define TS_PSI_HEADER_SIZE		8
+
+// Size of the CRC at the end of a long section
+#define TS_PSI_CRC_SIZE			4
+
+// PID that the Program Association Table is sent on
+#define TS_PSI_PAT_PID			0x0000
+
+// Table IDs
+#define TS_PSI_TABLE_PAT		0x00
+#define TS_PSI_TABLE_PMT		0x02
+
+// Stream types in a PMT that carry MPEG audio
+#define TS_PSI_STREAM_MPEG1_AUDIO	0x03
+#define TS_PSI_STREAM_MPEG2_AUDIO	0x04
+
+// Most elementary streams that fit in a PMT section
+#define TS_PSI_MAX_ES			((TS_PSI_MAX_SECTION-16)/5)
+
+
+/*
+	A PSI section being put back together from the packets of a PID.
+	Sections can start part way through a packet, as given by the
+	pointer field, and carry on over as many packets as they need.
+*/
+typedef struct ts_psi_section_s {
+	unsigned char data[TS_PSI_MAX_SECTION];
+	size_t len;
+	int collecting;					// In the middle of a section
+	int continuity_count;			// Expected next, or -1
+} ts_psi_section_t;
+
+
+// Called with each complete section that has a good CRC
+typedef void (*ts_psi_callback)( void* user, const unsigned char* section, size_t len );
+
+
+// Get ready to collect sections from a PID
+void ts_psi_init( ts_psi_section_t* section );
+
+// Collect the sections in the payload of a TS packet, passing each
+// complete one with a good CRC to callback
+// returns the number of sections thrown away because of a bad CRC
+int ts_psi_collect( ts_psi_section_t* section, const unsigned char* payload, size_t len,
+                    int unit_start, int continuity_count, ts_psi_callback callback, void* user );
+
+// MPEG-2 CRC32 of some data; a section with a good CRC on the end gives 0
+uint32_t ts_psi_crc32( const unsigned char* data, size_t len );
+
+
+
+/*
+	Macros for accessing long PSI section headers
+*/
+#define PSI_TABLE_ID(b)				(b[0])
+#define PSI_SECTION_SYNTAX(b)		((b[1]&0x80)>>7)
+#define PSI_SECTION_LENGTH(b)		(((b[1]&0x0F)<<8) | b[2])
+#define PSI_TABLE_ID_EXT(b)			((b[3]<<8) | b[4])
+#define PSI_VERSION(b)				((b[5]&0x3E)>>1)
+#define PSI_CURRENT_NEXT(b)			((b[5]&0x01)>>0)
+#define PSI_SECTION_NUMBER(b)		(b[6])
+#define PSI_LAST_SECTION_NUMBER(b)	(b[7])
+
+/*
+	Macros for accessing PAT entries and PMT fields
+*/
+#define PAT_PROGRAM_NUMBER(e)		((e[0]<<8) | e[1])
+#define PAT_PID(e)					(((e[2]&0x1F)<<8) | e[3])
+
+#define PMT_PCR_PID(b)				(((b[8]&0x1F)<<8) | b[9])
+#define PMT_PROGRAM_INFO_LEN(b)		(((b[10]&0x0F)<<8) | b[11])
+
+#define PMT_ES_STREAM_TYPE(e)		(e[0])
+#define PMT_ES_PID(e)				(((e[1]&0x1F)<<8) | e[2])
+#define PMT_ES_INFO_LEN(e)			(((e[3]&0x0F)<<8) | e[4])
+
+
+
+#endif
@@ -0,0 +1,220 @@
+/*
+
+	ts_report.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ts_report.h"
+
+
+static const char* event_names[] = { "lost", "regained", "unconfirmed" };
+
+
+
+ts_report_t* ts_report_new( void )
+{
+	ts_report_t *report = calloc( 1, sizeof(ts_report_t) );
+	if (report==NULL) return NULL;
+
+	report->last = &report->streams;
+
+	return report;
+}
+
+
+ts_report_stream_t* ts_report_add_stream( ts_report_t* report, int pid, int stream_id )
+{
+	ts_report_stream_t *stream = calloc( 1, sizeof(ts_report_stream_t) );
+	if (stream==NULL) return NULL;
+
+	stream->pid = pid;
+	stream->stream_id = stream_id;
+	stream->first_pts = -1;
+	stream->last_pts = -1;
+
+	*report->last = stream;
+	report->last = &stream->next;
+
+	return stream;
+}
+
+
+void ts_report_frame( ts_report_stream_t* stream, const mpa_header_t* mpah, size_t len,
+                      unsigned long long offset )
+{
+	if (stream->frames == 0) {
+		stream->mpah = *mpah;
+		stream->first_frame = offset;
+	}
+
+	stream->frames++;
+	stream->bytes += len;
+	stream->samples += mpah->samples;
+}
+
+
+void ts_report_pts( ts_report_stream_t* stream, long long pts )
+{
+	// Unwrapped near the last one, so it keeps going up
+	if (stream->first_pts == -1) {
+		stream->first_pts = pts;
+		stream->last_pts = pts;
+	} else {
+		stream->last_pts = ts2mpa_pts_unwrap( pts, stream->last_pts );
+	}
+}
+
+
+void ts_report_event( ts_report_stream_t* stream, int type, unsigned long long offset )
+{
+	if (stream->event_count < TS_REPORT_MAX_EVENTS) {
+		stream->events[stream->event_count].offset = offset;
+		stream->events[stream->event_count].type = type;
+	}
+	stream->event_count++;
+}
+
+
+void ts_report_put_string( FILE* file, const char* str )
+{
+	fputc( '"', file );
+	for (; *str; str++) {
+		if (*str == '"' || *str == '\\') fprintf( file, "\\%c", *str );
+		else if ((unsigned char)*str < 0x20) fprintf( file, "\\u%04x", *str );
+		else fputc( *str, file );
+	}
+	fputc( '"', file );
+}
+
+
+static void write_counters( FILE *file, const ts2mpa_counters_t *c )
+{
+	fprintf( file, "\"packets\": %lu, \"cc_errors\": %lu, \"trans_errors\": %lu, \"scrambled\": %lu, "
+	         "\"sync_losses\": %lu, \"sync_gains\": %lu, \"sync_predicted\": %lu, \"hunt_skipped\": %lu, "
+	         "\"frames\": %lu, \"frames_dropped\": %lu, \"bytes\": %lu",
+	         c->packets, c->cc_errors, c->trans_errors, c->scrambled,
+	         c->sync_losses, c->sync_gains, c->sync_predicted, c->hunt_skipped,
+	         c->frames, c->frames_dropped, c->bytes );
+}
+
+
+static void write_stream( FILE *file, const ts_report_stream_t *stream )
+{
+	const mpa_header_t *mpah = &stream->mpah;
+	unsigned long i, listed;
+
+	fprintf( file, "        { \"stream_id\": %d, \"frames\": %lu, \"bytes\": %llu",
+	         stream->stream_id, stream->frames, stream->bytes );
+
+	// Its format, from the first frame
+	if (stream->frames && mpah->samplerate) {
+		double duration = (double)stream->samples / mpah->samplerate;
+
+		fprintf( file, ",\n          \"format\": \"%s\", \"layer\": %u, \"bitrate\": %u, \"samplerate\": %u, "
+		         "\"mode\": \"%s\", \"channels\": %u, \"framesize\": %u,\n",
+		         mpa_header_version_name( mpah ), mpah->layer, mpah->bitrate, mpah->samplerate,
+		         mpa_header_mode_name( mpah ), mpah->channels, mpah->framesize );
+		fprintf( file, "          \"first_frame\": %llu, \"duration\": %.3f, \"average_bitrate\": %.1f",
+		         stream->first_frame, duration, duration ? stream->bytes * 8 / duration / 1000 : 0 );
+	}
+
+	if (stream->first_pts != -1) {
+		fprintf( file, ",\n          \"first_pts\": %lld, \"last_pts\": %lld, \"pts_duration\": %.3f",
+		         stream->first_pts, stream->last_pts,
+		         (double)(stream->last_pts - stream->first_pts) / TS2MPA_PTS_CLOCK );
+	}
+
+	// Where sync was lost and found again
+	listed = stream->event_count < TS_REPORT_MAX_EVENTS ? stream->event_count : TS_REPORT_MAX_EVENTS;
+	fprintf( file, ",\n          \"sync_events\": [" );
+	for (i=0; i<listed; i++) {
+		fprintf( file, "%s{ \"%s\": %llu }", i ? ", " : " ",
+		         event_names[ stream->events[i].type ], stream->events[i].offset );
+	}
+	fprintf( file, "%s], \"sync_events_not_listed\": %lu }",
+	         listed ? " " : "", stream->event_count - listed );
+}
+
+
+int ts_report_write( ts_report_t* report, ts2mpa_t* ts2mpa, const char* input_path, FILE* file )
+{
+	ts2mpa_program_t *program = NULL;
+	int pid, i, first = 1;
+
+	fprintf( file, "{\n  \"input\": " );
+	ts_report_put_string( file, input_path );
+	fprintf( file, ", \"bytes\": %llu, \"packets\": %lu,\n", ts2mpa->offset, ts2mpa->total_packets );
+	fprintf( file, "  \"ts_sync_losses\": %lu, \"ts_skipped\": %lu, \"psi_crc_errors\": %lu,\n",
+	         ts2mpa->ts_sync_losses, ts2mpa->total_skipped, ts2mpa->psi_crc_errors );
+
+	// What the PAT and PMTs said was there
+	fprintf( file, "  \"programs\": [" );
+	for (program = ts2mpa->programs; program; program = program->next) {
+		fprintf( file, "%s\n    { \"program\": %d, \"pmt_pid\": %d, \"streams\": [",
+		         program==ts2mpa->programs ? "" : ",", program->program_number, program->pmt_pid );
+		for (i=0; i<program->es_count; i++) {
+			fprintf( file, "%s{ \"pid\": %d, \"stream_type\": %d }", i ? ", " : " ",
+			         program->es_pids[i], program->es_types[i] );
+		}
+		fprintf( file, "%s] }", program->es_count ? " " : "" );
+	}
+	fprintf( file, "%s],\n", ts2mpa->programs ? "\n  " : "" );
+
+	// Then what was found on each PID
+	fprintf( file, "  \"pids\": [" );
+	for (pid=0; pid<TS_PID_COUNT; pid++) {
+		ts2mpa_pid_t *ts_pid = ts2mpa->pids[pid];
+		ts_report_stream_t *stream = NULL;
+		int first_stream = 1;
+		if (ts_pid==NULL || ts_pid->streams==NULL) continue;
+
+		fprintf( file, "%s\n    { \"pid\": %d, ", first ? "" : ",", pid );
+		write_counters( file, &ts_pid->counters );
+		fprintf( file, ",\n      \"streams\": [" );
+		for (stream = report->streams; stream; stream = stream->next) {
+			if (stream->pid != pid) continue;
+			fprintf( file, "%s\n", first_stream ? "" : "," );
+			write_stream( file, stream );
+			first_stream = 0;
+		}
+		fprintf( file, "%s] }", first_stream ? "" : "\n      " );
+		first = 0;
+	}
+	fprintf( file, "%s]\n}\n", first ? "" : "\n  " );
+
+	return ferror( file ) ? -1 : 0;
+}
+
+
+void ts_report_free( ts_report_t* report )
+{
+	while (report->streams) {
+		ts_report_stream_t *stream = report->streams;
+		report->streams = stream->next;
+		free( stream );
+	}
+
+	free( report );
+}
@@ -0,0 +1,116 @@
+/*
+
+	ts_report.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _TS_REPORT_H
+#define _TS_REPORT_H
+
+#include <stdio.h>
+
+#include "ts2mpa.h"
+#include "mpa_header.h"
+
+
+// Most sync events listed for each stream; any more are only counted
+#define TS_REPORT_MAX_EVENTS	100
+
+// Kinds of sync event
+#define TS_REPORT_LOST			0		// Sync was lost
+#define TS_REPORT_REGAINED		1		// Sync was found again
+#define TS_REPORT_UNCONFIRMED	2		// Sync found by hunting wasn't real
+
+
+typedef struct ts_report_event_s {
+	unsigned long long offset;		// Of the packet it happened in
+	int type;						// TS_REPORT_*
+} ts_report_event_t;
+
+
+// What was found in a stream
+typedef struct ts_report_stream_s {
+
+	int pid;
+	int stream_id;
+
+	mpa_header_t mpah;				// Header of the first frame
+	unsigned long long first_frame;	// Offset of the packet it ended in
+	unsigned long frames;
+	unsigned long long bytes;
+	unsigned long long samples;		// Of audio, in all the frames
+
+	long long first_pts;			// Unwrapped, or -1 if there were none
+	long long last_pts;
+
+	ts_report_event_t events[TS_REPORT_MAX_EVENTS];
+	unsigned long event_count;		// Including those not listed
+
+	struct ts_report_stream_s* next;
+
+} ts_report_stream_t;
+
+
+/*
+	Report on the audio streams in a Transport Stream
+
+	The streams are filled in from the libts2mpa callbacks as the
+	input is analysed, then written out as JSON with the counters for
+	their PIDs and the programs found in the PAT and PMTs.
+*/
+typedef struct ts_report_s {
+
+	ts_report_stream_t* streams;		// In the order they were found
+	ts_report_stream_t** last;
+
+} ts_report_t;
+
+
+// returns NULL if there isn't enough memory
+ts_report_t* ts_report_new( void );
+
+// Start reporting on a new stream
+// returns NULL if there isn't enough memory
+ts_report_stream_t* ts_report_add_stream( ts_report_t* report, int pid, int stream_id );
+
+// A whole frame of len bytes, of the stream synced on mpah, ending in
+// the packet at offset
+void ts_report_frame( ts_report_stream_t* stream, const mpa_header_t* mpah, size_t len,
+                      unsigned long long offset );
+
+// A PES packet with a PTS
+void ts_report_pts( ts_report_stream_t* stream, long long pts );
+
+// Sync was lost or found again, in the packet at offset
+void ts_report_event( ts_report_stream_t* stream, int type, unsigned long long offset );
+
+// Write the report as JSON, with what ts2mpa found when it analysed
+// input_path
+// returns 0 on success, or -1 on failure
+int ts_report_write( ts_report_t* report, ts2mpa_t* ts2mpa, const char* input_path, FILE* file );
+
+// Write str as a quoted JSON string, escaping what has to be
+void ts_report_put_string( FILE* file, const char* str );
+
+void ts_report_free( ts_report_t* report );
+
+
+
+#endif
@@ -0,0 +1,226 @@
+/*
+
+	ts_scan.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_AVX2_DISPATCH
+#endif
+
+#include "ts2mpa.h"
+#include "ts_scan.h"
+
+
+
+// Check for sync bytes at the start of count packets from buf
+static int check_sync( const unsigned char* buf, int count )
+{
+	int i;
+	
+	for (i=0; i<count; i++) {
+		if (buf[i*TS_PACKET_SIZE] != 0x47) return 0;
+	}
+	
+	return 1;
+}
+
+
+size_t ts_scan_sync( const unsigned char* buf, size_t len, int count )
+{
+	size_t span = (count-1)*TS_PACKET_SIZE;
+	size_t pos = 0;
+	
+	if (count < 1 || len <= span) return len;
+	
+#ifdef __SSE2__
+	{
+		const __m128i sync = _mm_set1_epi8( 0x47 );
+		
+		// Test 16 candidate offsets at once: a bit survives only
+		// if every packet in the span has a sync byte at that offset
+		while (pos+span+16 <= len) {
+			unsigned int mask = 0xFFFF;
+			int i;
+			
+			for (i=0; i<count && mask; i++) {
+				__m128i v = _mm_loadu_si128( (const __m128i*)(buf + pos + i*TS_PACKET_SIZE) );
+				mask &= _mm_movemask_epi8( _mm_cmpeq_epi8( v, sync ) );
+			}
+			
+			if (mask) return pos + __builtin_ctz( mask );
+			pos += 16;
+		}
+	}
+#endif
+
+	// Let memchr() find the candidates in whatever is left
+	while (pos+span < len) {
+		const unsigned char* ptr = memchr( buf+pos, 0x47, len-span-pos );
+		if (ptr==NULL) break;
+		
+		pos = ptr - buf;
+		if (check_sync( ptr, count )) return pos;
+		pos++;
+	}
+	
+	return len;
+}
+
+
+// Classify packets one at a time, without branching on the PID
+static size_t scan_packets_scalar( const unsigned char* buf, size_t start, size_t count,
+                                   const uint32_t* pid_map, unsigned int* wanted,
+                                   size_t found, size_t* valid )
+{
+	size_t i;
+	
+	for (i=start; i<count; i++) {
+		const unsigned char* pkt = buf + i*TS_PACKET_SIZE;
+		int pid = TS_PACKET_PID(pkt);
+		
+		if (TS_PACKET_SYNC_BYTE(pkt) != 0x47) break;
+		
+		wanted[found] = i;
+		found += TS_PID_MAP_TEST( pid_map, pid );
+	}
+	
+	*valid = i;
+	return found;
+}
+
+
+#ifdef __SSE2__
+// Check sync bytes and extract the PIDs of four packets at a time
+static size_t scan_packets_sse2( const unsigned char* buf, size_t count, const uint32_t* pid_map,
+                                 unsigned int* wanted, size_t* valid )
+{
+	const __m128i sync_mask = _mm_set1_epi32( 0xFF );
+	const __m128i sync = _mm_set1_epi32( 0x47 );
+	const __m128i pid_hi = _mm_set1_epi32( 0x1F00 );
+	const __m128i pid_lo = _mm_set1_epi32( 0xFF );
+	uint32_t pids[4];
+	size_t found = 0;
+	size_t i;
+	
+	for (i=0; i+4<=count; i+=4) {
+		const unsigned char* pkt = buf + i*TS_PACKET_SIZE;
+		uint32_t head[4];
+		__m128i h, pid;
+		int j;
+		
+		// Packet headers as little-endian words: sync byte in the bottom byte
+		memcpy( &head[0], pkt, 4 );
+		memcpy( &head[1], pkt+TS_PACKET_SIZE, 4 );
+		memcpy( &head[2], pkt+TS_PACKET_SIZE*2, 4 );
+		memcpy( &head[3], pkt+TS_PACKET_SIZE*3, 4 );
+		h = _mm_loadu_si128( (const __m128i*)head );
+		
+		if (_mm_movemask_epi8( _mm_cmpeq_epi32( _mm_and_si128( h, sync_mask ), sync ) ) != 0xFFFF)
+			break;
+		
+		pid = _mm_or_si128( _mm_and_si128( h, pid_hi ),
+		                    _mm_and_si128( _mm_srli_epi32( h, 16 ), pid_lo ) );
+		_mm_storeu_si128( (__m128i*)pids, pid );
+		
+		for (j=0; j<4; j++) {
+			wanted[found] = i+j;
+			found += TS_PID_MAP_TEST( pid_map, pids[j] );
+		}
+	}
+	
+	// Finish off, or find exactly which packet was bad
+	return scan_packets_scalar( buf, i, count, pid_map, wanted, found, valid );
+}
+#endif
+
+
+#ifdef HAVE_AVX2_DISPATCH
+// Gather the headers of eight packets at a time, and look their PIDs
+// up in the bitmap without leaving the vector registers
+__attribute__((target("avx2")))
+static size_t scan_packets_avx2( const unsigned char* buf, size_t count, const uint32_t* pid_map,
+                                 unsigned int* wanted, size_t* valid )
+{
+	const __m256i stride = _mm256_setr_epi32( 0, TS_PACKET_SIZE, TS_PACKET_SIZE*2, TS_PACKET_SIZE*3,
+	                                          TS_PACKET_SIZE*4, TS_PACKET_SIZE*5, TS_PACKET_SIZE*6, TS_PACKET_SIZE*7 );
+	const __m256i sync_mask = _mm256_set1_epi32( 0xFF );
+	const __m256i sync = _mm256_set1_epi32( 0x47 );
+	const __m256i pid_hi = _mm256_set1_epi32( 0x1F00 );
+	const __m256i pid_lo = _mm256_set1_epi32( 0xFF );
+	const __m256i one = _mm256_set1_epi32( 1 );
+	const __m256i low5 = _mm256_set1_epi32( 31 );
+	size_t found = 0;
+	size_t i;
+	
+	for (i=0; i+8<=count; i+=8) {
+		__m256i offsets = _mm256_add_epi32( stride, _mm256_set1_epi32( i*TS_PACKET_SIZE ) );
+		__m256i h = _mm256_i32gather_epi32( (const int*)buf, offsets, 1 );
+		__m256i pid, word, bit;
+		unsigned int mask;
+		
+		if (_mm256_movemask_epi8( _mm256_cmpeq_epi32( _mm256_and_si256( h, sync_mask ), sync ) ) != -1)
+			break;
+		
+		pid = _mm256_or_si256( _mm256_and_si256( h, pid_hi ),
+		                       _mm256_and_si256( _mm256_srli_epi32( h, 16 ), pid_lo ) );
+		word = _mm256_i32gather_epi32( (const int*)pid_map, _mm256_srli_epi32( pid, 5 ), 4 );
+		bit = _mm256_and_si256( _mm256_srlv_epi32( word, _mm256_and_si256( pid, low5 ) ), one );
+		mask = _mm256_movemask_ps( _mm256_castsi256_ps( _mm256_cmpeq_epi32( bit, one ) ) );
+		
+		while (mask) {
+			wanted[found++] = i + __builtin_ctz( mask );
+			mask &= mask-1;
+		}
+	}
+	
+	return scan_packets_scalar( buf, i, count, pid_map, wanted, found, valid );
+}
+#endif
+
+
+size_t ts_scan_packets( const unsigned char* buf, size_t count, const uint32_t* pid_map,
+                        unsigned int* wanted, size_t* valid )
+{
+	if (count > TS_SCAN_BATCH) count = TS_SCAN_BATCH;
+	
+#ifdef HAVE_AVX2_DISPATCH
+	{
+		static int have_avx2 = -1;
+		if (have_avx2 == -1) have_avx2 = __builtin_cpu_supports( "avx2" );
+		if (have_avx2) return scan_packets_avx2( buf, count, pid_map, wanted, valid );
+	}
+#endif
+
+#ifdef __SSE2__
+	return scan_packets_sse2( buf, count, pid_map, wanted, valid );
+#else
+	return scan_packets_scalar( buf, 0, count, pid_map, wanted, 0, valid );
+#endif
+}
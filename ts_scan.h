@@ -0,0 +1,65 @@
+/*
+
+	ts_scan.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _TS_SCAN_H
+#define _TS_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Number of consecutive packets that must start with a sync byte
+// before we believe that we have found the packet boundaries again
+#define TS_RESYNC_PACKETS		5
+
+
+// Maximum number of packets looked at by one call to ts_scan_packets()
+#define TS_SCAN_BATCH			256
+
+
+/*
+	Bitmap of PIDs that we are interested in
+*/
+#define TS_PID_MAP_WORDS			(8192/32)
+#define TS_PID_MAP_TEST(m,pid)		(((m)[(pid)>>5] >> ((pid)&31)) & 1)
+#define TS_PID_MAP_SET(m,pid)		((m)[(pid)>>5] |= (1u << ((pid)&31)))
+#define TS_PID_MAP_CLEAR(m,pid)		((m)[(pid)>>5] &= ~(1u << ((pid)&31)))
+
+
+// Check the sync bytes of up to TS_SCAN_BATCH packets, and pick out
+// the ones on PIDs that are set in pid_map.
+// The indexes of the wanted packets are stored in wanted[], and *valid
+// is set to the number of packets before the first bad sync byte.
+// returns the number of wanted packets
+size_t ts_scan_packets( const unsigned char* buf, size_t count, const uint32_t* pid_map,
+                        unsigned int* wanted, size_t* valid );
+
+// Find the first offset in buf where a sync byte appears at the start
+// of count consecutive packets.
+// returns the offset, or len if there is no such offset that
+// has count packets after it within the buffer
+size_t ts_scan_sync( const unsigned char* buf, size_t len, int count );
+
+
+
+#endif
@@ -0,0 +1,334 @@
+/*
+
+	udp_input.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+
+#include "udp_input.h"
+
+
+
+int udp_input_is_url( const char* path )
+{
+	return strncmp( path, "udp://", 6 ) == 0 || strncmp( path, "rtp://", 6 ) == 0;
+}
+
+
+static int is_multicast( const struct sockaddr *addr )
+{
+	if (addr->sa_family == AF_INET)
+		return IN_MULTICAST( ntohl( ((struct sockaddr_in*)addr)->sin_addr.s_addr ) );
+	if (addr->sa_family == AF_INET6)
+		return IN6_IS_ADDR_MULTICAST( &((struct sockaddr_in6*)addr)->sin6_addr );
+	return 0;
+}
+
+
+// Copy a host out of a URL, without the brackets around an IPv6 address
+// returns 0 on success, or -1 if it doesn't fit
+static int copy_host( char *host, size_t host_len, const char *start, const char *end )
+{
+	if (end > start && *start == '[' && end[-1] == ']') {
+		start++;
+		end--;
+	}
+	if ((size_t)(end - start) >= host_len) return -1;
+
+	memcpy( host, start, end - start );
+	host[end - start] = '\0';
+	return 0;
+}
+
+
+// Join a multicast group, only from one source if one is given
+// returns 0 on success, or -1 on failure
+static int join_group( int fd, const struct addrinfo *group, const char *source )
+{
+	int level = group->ai_family == AF_INET6 ? IPPROTO_IPV6 : IPPROTO_IP;
+
+	if (source[0]) {
+		struct group_source_req req;
+		struct addrinfo hints, *res = NULL;
+		int result;
+
+		memset( &hints, 0, sizeof(hints) );
+		hints.ai_family = group->ai_family;
+		hints.ai_socktype = SOCK_DGRAM;
+		if (getaddrinfo( source, NULL, &hints, &res )) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		memset( &req, 0, sizeof(req) );
+		memcpy( &req.gsr_group, group->ai_addr, group->ai_addrlen );
+		memcpy( &req.gsr_source, res->ai_addr, res->ai_addrlen );
+		freeaddrinfo( res );
+		result = setsockopt( fd, level, MCAST_JOIN_SOURCE_GROUP, &req, sizeof(req) );
+		return result;
+	} else {
+		struct group_req req;
+
+		memset( &req, 0, sizeof(req) );
+		memcpy( &req.gr_group, group->ai_addr, group->ai_addrlen );
+		return setsockopt( fd, level, MCAST_JOIN_GROUP, &req, sizeof(req) );
+	}
+}
+
+
+udp_input_t* udp_input_open( const char* url )
+{
+	char host[256] = "", source[256] = "", port[16];
+	const char *addr = url + 6;
+	const char *colon = NULL, *at = NULL;
+	struct addrinfo hints, *res = NULL;
+	struct timeval timeout;
+	udp_input_t *udp = NULL;
+	int size = UDP_INPUT_RCVBUF;
+	int one = 1;
+	int fd = -1;
+	int i;
+
+	// The port comes after the last colon, outside any brackets
+	colon = strrchr( addr, ':' );
+	if (colon == NULL || strchr( colon, ']' ) || strlen( colon+1 ) == 0 ||
+	    strlen( colon+1 ) >= sizeof(port) || strspn( colon+1, "0123456789" ) != strlen( colon+1 ))
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	strcpy( port, colon+1 );
+
+	// Either @group (as VLC has it), or source@group
+	at = memchr( addr, '@', colon - addr );
+	if (at) {
+		if (copy_host( source, sizeof(source), addr, at )) {
+			errno = EINVAL;
+			return NULL;
+		}
+		addr = at+1;
+	}
+	if (copy_host( host, sizeof(host), addr, colon )) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	memset( &hints, 0, sizeof(hints) );
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_PASSIVE | AI_NUMERICSERV;
+	if (getaddrinfo( host[0] ? host : NULL, port, &hints, &res )) {
+		errno = EADDRNOTAVAIL;
+		return NULL;
+	}
+
+	fd = socket( res->ai_family, SOCK_DGRAM, 0 );
+	if (fd < 0) goto fail;
+
+	// Several receivers may want the same group
+	setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one) );
+
+	// Soak up bursts while the output is busy; the kernel may give us less
+	setsockopt( fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size) );
+
+	// Come back now and again, so that an interruption is noticed
+	timeout.tv_sec = UDP_INPUT_TIMEOUT / 1000;
+	timeout.tv_usec = (UDP_INPUT_TIMEOUT % 1000) * 1000;
+	setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+
+	if (bind( fd, res->ai_addr, res->ai_addrlen ) < 0) goto fail;
+	if (is_multicast( res->ai_addr ) && join_group( fd, res, source )) goto fail;
+
+	udp = malloc( sizeof(udp_input_t) );
+	if (udp == NULL) goto fail;
+	bzero( udp, sizeof(udp_input_t) );
+	udp->msgs = calloc( UDP_INPUT_BATCH, sizeof(struct mmsghdr) );
+	if (udp->msgs == NULL) goto fail;
+
+	udp->fd = fd;
+	udp->rtp = strncmp( url, "rtp://", 6 ) == 0 ? 1 : -1;
+	for (i=0; i<UDP_INPUT_BATCH; i++) {
+		udp->iovs[i][0].iov_base = udp->headers[i];
+		udp->iovs[i][0].iov_len = RTP_HEADER_SIZE;
+		udp->iovs[i][2].iov_base = udp->extra[i];
+		udp->iovs[i][2].iov_len = UDP_INPUT_EXTRA;
+		udp->msgs[i].msg_hdr.msg_iov = udp->iovs[i];
+	}
+
+	freeaddrinfo( res );
+	return udp;
+
+fail:
+	i = errno;
+	if (udp) free( udp );
+	if (fd >= 0) close( fd );
+	freeaddrinfo( res );
+	errno = i;
+	return NULL;
+}
+
+
+// Does a datagram look like it starts with an RTP header?
+static int looks_like_rtp( const unsigned char *data, size_t len )
+{
+	// Version 2, and not a Transport Stream sync byte
+	return len >= RTP_HEADER_SIZE && data[0] != 0x47 && (data[0] >> 6) == 2;
+}
+
+
+// Work out where the payload starts, after the variable parts of the
+// RTP header, and check the sequence number
+// returns 0 on success, or -1 if the datagram should be dropped
+static int rtp_payload( udp_input_t* udp, int index, const unsigned char *slot,
+                        size_t *skip, size_t *len )
+{
+	const unsigned char *header = udp->headers[index];
+	uint16_t seq = (header[2] << 8) | header[3];
+	uint16_t gap;
+
+	if ((header[0] >> 6) != 2) {
+		udp->invalid++;
+		return -1;
+	}
+
+	// CSRC identifiers, then an extension header
+	*skip = (header[0] & 0x0F) * 4;
+	if ((header[0] & 0x10) && *skip + 4 <= *len)
+		*skip += 4 + ((slot[*skip+2] << 8) | slot[*skip+3]) * 4;
+
+	// Padding, with its length in the last byte
+	if ((header[0] & 0x20) && *len > 0) {
+		size_t last = *len-1;
+		size_t padding = last < UDP_INPUT_PAYLOAD ? slot[last] : udp->extra[index][last-UDP_INPUT_PAYLOAD];
+		*len -= padding < *len ? padding : *len;
+	}
+
+	if (*skip > *len) {
+		udp->invalid++;
+		return -1;
+	}
+	*len -= *skip;
+
+	if (udp->have_seq && seq != udp->next_seq) {
+		gap = seq - udp->next_seq;
+		if (gap >= 0x8000) {
+			// Behind where we are already
+			udp->late++;
+			return -1;
+		}
+		udp->lost += gap;
+	}
+	udp->have_seq = 1;
+	udp->next_seq = seq + 1;
+
+	return 0;
+}
+
+
+ssize_t udp_input_recv( udp_input_t* udp, unsigned char* buf, size_t len )
+{
+	size_t count = len / UDP_INPUT_PAYLOAD;
+	size_t used = 0;
+	int received, i;
+
+	if (count == 0) return 0;
+	if (count > UDP_INPUT_BATCH) count = UDP_INPUT_BATCH;
+
+	// Plain UDP, unless the first datagram turns out to be RTP
+	if (udp->rtp == -1) {
+		ssize_t peeked = recv( udp->fd, udp->headers[0], RTP_HEADER_SIZE, MSG_PEEK );
+		if (peeked < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+			return -1;
+		}
+		udp->rtp = looks_like_rtp( udp->headers[0], peeked );
+	}
+
+	// Each payload goes in a slot of its own, with RTP headers
+	// kept to one side
+	for (i=0; i<count; i++) {
+		struct msghdr *hdr = &udp->msgs[i].msg_hdr;
+		udp->iovs[i][1].iov_base = buf + i*UDP_INPUT_PAYLOAD;
+		udp->iovs[i][1].iov_len = UDP_INPUT_PAYLOAD;
+		hdr->msg_iov = udp->rtp ? &udp->iovs[i][0] : &udp->iovs[i][1];
+		hdr->msg_iovlen = udp->rtp ? 3 : 2;
+		hdr->msg_flags = 0;
+	}
+
+	// Wait for one, then take everything else that is waiting
+	received = recvmmsg( udp->fd, udp->msgs, count, MSG_WAITFORONE, NULL );
+	if (received < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return 0;
+		return -1;
+	}
+	udp->datagrams += received;
+
+	// Close up the gaps between the payloads
+	for (i=0; i<received; i++) {
+		unsigned char *slot = buf + i*UDP_INPUT_PAYLOAD;
+		size_t payload_len = udp->msgs[i].msg_len;
+		size_t skip = 0, in_slot;
+
+		if (udp->rtp) {
+			if (payload_len < RTP_HEADER_SIZE) {
+				udp->invalid++;
+				continue;
+			}
+			payload_len -= RTP_HEADER_SIZE;
+			if (rtp_payload( udp, i, slot, &skip, &payload_len ))
+				continue;
+		}
+
+		// Keep to the size of a slot, so as not to catch up with the next
+		if (payload_len > UDP_INPUT_PAYLOAD || (udp->msgs[i].msg_hdr.msg_flags & MSG_TRUNC)) {
+			if (payload_len > UDP_INPUT_PAYLOAD) payload_len = UDP_INPUT_PAYLOAD;
+			udp->truncated++;
+		}
+
+		in_slot = UDP_INPUT_PAYLOAD - skip;
+		if (in_slot > payload_len) in_slot = payload_len;
+		if (buf + used != slot + skip)
+			memmove( buf + used, slot + skip, in_slot );
+		memcpy( buf + used + in_slot, udp->extra[i], payload_len - in_slot );
+		used += payload_len;
+	}
+
+	return used;
+}
+
+
+void udp_input_close( udp_input_t* udp )
+{
+	close( udp->fd );
+	free( udp->msgs );
+	free( udp );
+}
@@ -0,0 +1,112 @@
+/*
+
+	udp_input.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _UDP_INPUT_H
+#define _UDP_INPUT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+// Transport Stream packets carried in each datagram
+#define UDP_INPUT_PACKETS		7
+
+// Space for the payload of each datagram
+#define UDP_INPUT_PAYLOAD		(UDP_INPUT_PACKETS*188)
+
+// Most datagrams received in a single recvmmsg() call
+#define UDP_INPUT_BATCH			64
+
+// Size of a fixed RTP header, without CSRCs or an extension
+#define RTP_HEADER_SIZE			12
+
+// Space for datagrams longer than usual, such as ones with a longer
+// RTP header, that would otherwise be cut short
+#define UDP_INPUT_EXTRA			256
+
+// How long to wait for a datagram before returning empty handed (ms)
+#define UDP_INPUT_TIMEOUT		500
+
+// Size of the socket receive buffer asked for
+#define UDP_INPUT_RCVBUF		(4*1024*1024)
+
+
+/*
+	UDP and RTP Transport Stream receiver
+
+	Datagrams are received in batches with recvmmsg(), straight into
+	consecutive slots of the caller's buffer. The fixed part of an RTP
+	header is scattered into a separate array, so the payloads of the
+	usual seven packet datagrams end up back to back without being
+	copied. Anything else (short datagrams, CSRCs, header extensions,
+	padding) is moved down to close the gaps, and anything that ran
+	over the end of a slot is copied in after it.
+
+	The RTP sequence number is checked, to count datagrams that were
+	lost; ones that arrive late are dropped, as their place in the
+	stream has already gone.
+*/
+typedef struct udp_input_s {
+
+	int fd;
+	int rtp;						// 1 for RTP, 0 for plain UDP, -1 to detect
+
+	struct mmsghdr* msgs;			// UDP_INPUT_BATCH of them
+	struct iovec iovs[UDP_INPUT_BATCH][3];
+	unsigned char headers[UDP_INPUT_BATCH][RTP_HEADER_SIZE];
+	unsigned char extra[UDP_INPUT_BATCH][UDP_INPUT_EXTRA];
+
+	int have_seq;
+	uint16_t next_seq;				// Expected RTP sequence number
+
+	unsigned long datagrams;		// Received
+	unsigned long lost;				// Gaps in the RTP sequence
+	unsigned long late;				// Arrived out of order, and dropped
+	unsigned long truncated;		// Payload larger than UDP_INPUT_PAYLOAD
+	unsigned long invalid;			// Not a valid RTP packet
+
+} udp_input_t;
+
+
+// Is path a udp:// or rtp:// URL?
+int udp_input_is_url( const char* path );
+
+// Start receiving from a URL in the form:
+//   udp://[[source@]address]:port or rtp://[[source@]address]:port
+// Multicast groups are joined, source specific if a source is given
+// returns NULL and sets errno on failure
+udp_input_t* udp_input_open( const char* url );
+
+// Receive as many datagrams as there are, and room for, into buf
+// returns the number of bytes of Transport Stream placed there,
+// 0 if nothing arrived in time, or -1 on error
+ssize_t udp_input_recv( udp_input_t* udp, unsigned char* buf, size_t len );
+
+void udp_input_close( udp_input_t* udp );
+
+
+
+#endif
@@ -0,0 +1,256 @@
+/*
+
+	uring.c
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "uring.h"
+
+
+#ifdef HAVE_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+
+struct uring_s {
+
+	int fd;
+	unsigned int to_submit;
+	
+	// Submission queue
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	struct io_uring_sqe *sqes;
+	
+	// Completion queue
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	size_t sqes_size;
+
+};
+
+
+uring_t* uring_open( unsigned int entries )
+{
+	struct io_uring_params params;
+	uring_t *ring = NULL;
+	
+	ring = malloc( sizeof(uring_t) );
+	if (ring==NULL) return NULL;
+	bzero( ring, sizeof(uring_t) );
+	bzero( &params, sizeof(params) );
+	
+	ring->fd = syscall( __NR_io_uring_setup, entries, &params );
+	if (ring->fd < 0) {
+		free( ring );
+		return NULL;
+	}
+	
+	// Map the rings into our memory
+	ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_ring_size > ring->sq_ring_size)
+			ring->sq_ring_size = ring->cq_ring_size;
+		ring->cq_ring_size = 0;
+	}
+	
+	ring->sq_ring = mmap( NULL, ring->sq_ring_size, PROT_READ|PROT_WRITE,
+	                      MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING );
+	if (ring->sq_ring == MAP_FAILED) goto fail;
+	
+	if (ring->cq_ring_size) {
+		ring->cq_ring = mmap( NULL, ring->cq_ring_size, PROT_READ|PROT_WRITE,
+		                      MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING );
+		if (ring->cq_ring == MAP_FAILED) goto fail;
+	} else {
+		ring->cq_ring = ring->sq_ring;
+	}
+	
+	ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap( NULL, ring->sqes_size, PROT_READ|PROT_WRITE,
+	                   MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES );
+	if (ring->sqes == MAP_FAILED) goto fail;
+	
+	ring->sq_head = (unsigned int*)((char*)ring->sq_ring + params.sq_off.head);
+	ring->sq_tail = (unsigned int*)((char*)ring->sq_ring + params.sq_off.tail);
+	ring->sq_mask = (unsigned int*)((char*)ring->sq_ring + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned int*)((char*)ring->sq_ring + params.sq_off.array);
+	
+	ring->cq_head = (unsigned int*)((char*)ring->cq_ring + params.cq_off.head);
+	ring->cq_tail = (unsigned int*)((char*)ring->cq_ring + params.cq_off.tail);
+	ring->cq_mask = (unsigned int*)((char*)ring->cq_ring + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe*)((char*)ring->cq_ring + params.cq_off.cqes);
+	
+	return ring;
+
+fail:
+	if (ring->sq_ring && ring->sq_ring != MAP_FAILED)
+		munmap( ring->sq_ring, ring->sq_ring_size );
+	if (ring->cq_ring_size && ring->cq_ring && ring->cq_ring != MAP_FAILED)
+		munmap( ring->cq_ring, ring->cq_ring_size );
+	close( ring->fd );
+	free( ring );
+	return NULL;
+}
+
+
+// Fill in the next submission queue entry
+static int queue_rw( uring_t* ring, int opcode, int fd, const void* buf, size_t len,
+                     long long offset, unsigned long long user_data )
+{
+	unsigned int head = __atomic_load_n( ring->sq_head, __ATOMIC_ACQUIRE );
+	unsigned int tail = *ring->sq_tail;
+	unsigned int index = tail & *ring->sq_mask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	
+	if (tail - head > *ring->sq_mask) return -1;
+	
+	bzero( sqe, sizeof(*sqe) );
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (unsigned long)buf;
+	sqe->len = len;
+	sqe->off = (unsigned long long)offset;
+	sqe->user_data = user_data;
+	
+	ring->sq_array[index] = index;
+	__atomic_store_n( ring->sq_tail, tail+1, __ATOMIC_RELEASE );
+	ring->to_submit++;
+	
+	return 0;
+}
+
+
+int uring_read( uring_t* ring, int fd, void* buf, size_t len, long long offset, unsigned long long user_data )
+{
+	return queue_rw( ring, IORING_OP_READ, fd, buf, len, offset, user_data );
+}
+
+
+int uring_write( uring_t* ring, int fd, const void* buf, size_t len, long long offset, unsigned long long user_data )
+{
+	return queue_rw( ring, IORING_OP_WRITE, fd, buf, len, offset, user_data );
+}
+
+
+int uring_submit( uring_t* ring )
+{
+	while (ring->to_submit) {
+		int count = syscall( __NR_io_uring_enter, ring->fd, ring->to_submit, 0, 0, NULL, 0 );
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		ring->to_submit -= count;
+	}
+	
+	return 0;
+}
+
+
+int uring_complete( uring_t* ring, int wait, unsigned long long* user_data, int* result )
+{
+	while (1) {
+		unsigned int head = *ring->cq_head;
+		unsigned int tail = __atomic_load_n( ring->cq_tail, __ATOMIC_ACQUIRE );
+		
+		if (head != tail) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+			*user_data = cqe->user_data;
+			*result = cqe->res;
+			__atomic_store_n( ring->cq_head, head+1, __ATOMIC_RELEASE );
+			return 1;
+		}
+		
+		if (!wait) return 0;
+		
+		if (syscall( __NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0 ) < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+	}
+}
+
+
+void uring_close( uring_t* ring )
+{
+	munmap( ring->sqes, ring->sqes_size );
+	if (ring->cq_ring_size)
+		munmap( ring->cq_ring, ring->cq_ring_size );
+	munmap( ring->sq_ring, ring->sq_ring_size );
+	close( ring->fd );
+	free( ring );
+}
+
+
+#else
+
+
+uring_t* uring_open( unsigned int entries )
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+int uring_read( uring_t* ring, int fd, void* buf, size_t len, long long offset, unsigned long long user_data )
+{
+	return -1;
+}
+
+int uring_write( uring_t* ring, int fd, const void* buf, size_t len, long long offset, unsigned long long user_data )
+{
+	return -1;
+}
+
+int uring_submit( uring_t* ring )
+{
+	return -1;
+}
+
+int uring_complete( uring_t* ring, int wait, unsigned long long* user_data, int* result )
+{
+	return -1;
+}
+
+void uring_close( uring_t* ring )
+{
+}
+
+
+#endif
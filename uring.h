@@ -0,0 +1,64 @@
+/*
+
+	uring.h
+	(C) Nicholas J Humfrey <njh@aelius.com> 2008
+
+	Copyright notice:
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+
+*/
+
+#ifndef _URING_H
+#define _URING_H
+
+#include <stddef.h>
+
+
+/*
+	Minimal wrapper around the Linux io_uring system calls,
+	just enough to keep reads and writes in flight.
+
+	Only built in when compiled with HAVE_IO_URING (make IO_URING=1),
+	otherwise uring_open() always fails and callers use normal I/O.
+*/
+typedef struct uring_s uring_t;
+
+
+// Set up a ring that can hold this many requests
+// returns NULL if io_uring is not available
+uring_t* uring_open( unsigned int entries );
+
+// Queue a read into buf, at offset (or the current position if -1)
+// returns 0 on success, or -1 if the ring is full
+int uring_read( uring_t* ring, int fd, void* buf, size_t len, long long offset, unsigned long long user_data );
+
+// Queue a write from buf, at offset (or the current position if -1)
+// returns 0 on success, or -1 if the ring is full
+int uring_write( uring_t* ring, int fd, const void* buf, size_t len, long long offset, unsigned long long user_data );
+
+// Send queued requests to the kernel
+// returns 0 on success, or -1 on failure
+int uring_submit( uring_t* ring );
+
+// Get the result of a completed request, waiting for one if wait is set
+// returns 1 if one was completed, 0 if none yet, or -1 on failure
+int uring_complete( uring_t* ring, int wait, unsigned long long* user_data, int* result );
+
+void uring_close( uring_t* ring );
+
+
+
+#endif